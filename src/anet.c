@@ -348,7 +348,26 @@ static int anetListen(char* err, int s, struct sockaddr* sa, socklen_t len)
     return ANET_OK;
 }
 
-int anetTcpServer(char* err, int port, char* bindaddr)
+/* Let other processes bind the same address and port, so that the kernel
+ * balances the incoming connections among all the listening sockets. */
+static int anetSetReusePort(char* err, int s)
+{
+#ifdef SO_REUSEPORT
+    int on = 1;
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+        close(s);
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    anetSetError(err, "SO_REUSEPORT is not supported on this platform");
+    close(s);
+    return ANET_ERR;
+#endif
+}
+
+static int _anetTcpServer(char* err, int port, char* bindaddr, int reuseport)
 {
     int s;
     struct sockaddr_in sa;
@@ -356,6 +375,9 @@ int anetTcpServer(char* err, int port, char* bindaddr)
     if ((s = anetCreateSocket(err, AF_INET)) == ANET_ERR) {
         return ANET_ERR;
     }
+    if (reuseport && anetSetReusePort(err, s) == ANET_ERR) {
+        return ANET_ERR;
+    }
 
     memset(&sa, 0, sizeof(sa));
     sa.sin_family = AF_INET;
@@ -372,6 +394,16 @@ int anetTcpServer(char* err, int port, char* bindaddr)
     return s;
 }
 
+int anetTcpServer(char* err, int port, char* bindaddr)
+{
+    return _anetTcpServer(err, port, bindaddr, 0);
+}
+
+int anetTcpReusePortServer(char* err, int port, char* bindaddr)
+{
+    return _anetTcpServer(err, port, bindaddr, 1);
+}
+
 int anetUnixServer(char* err, char* path, mode_t perm)
 {
     int s;
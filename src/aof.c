@@ -534,7 +534,7 @@ int loadAppendOnlyFile(char* filename)
         /* Serve the clients from time to time */
         if (!(loops++ % 1000)) {
             loadingProgress(ftello(fp));
-            aeProcessEvents(server.el, AE_FILE_EVENTS | AE_DONT_WAIT);
+            processEventsWhileBlocked();
         }
 
         if (fgets(buf, sizeof(buf), fp) == NULL) {
@@ -683,37 +683,45 @@ int rewriteListObject(rio* r, robj* key, robj* o)
             }
             items--;
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list* list = o->ptr;
-        listNode* ln;
-        listIter li;
-
-        listRewind(list, &li);
-        while ((ln = listNext(&li))) {
-            robj* eleobj = listNodeValue(ln);
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistIter* li = quicklistGetIterator(o->ptr, QUICKLIST_START_HEAD);
+        quicklistEntry entry;
 
+        while (quicklistNext(li, &entry)) {
             if (count == 0) {
                 int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
                                 REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
 
                 if (rioWriteBulkCount(r, '*', 2 + cmd_items) == 0) {
-                    return 0;
+                    goto werr;
                 }
                 if (rioWriteBulkString(r, "RPUSH", 5) == 0) {
-                    return 0;
+                    goto werr;
                 }
                 if (rioWriteBulkObject(r, key) == 0) {
-                    return 0;
+                    goto werr;
                 }
             }
-            if (rioWriteBulkObject(r, eleobj) == 0) {
-                return 0;
+            if (entry.value) {
+                if (rioWriteBulkString(r, (char*)entry.value, entry.sz) == 0) {
+                    goto werr;
+                }
+            } else {
+                if (rioWriteBulkLongLong(r, entry.longval) == 0) {
+                    goto werr;
+                }
             }
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) {
                 count = 0;
             }
             items--;
         }
+        quicklistReleaseIterator(li);
+        return 1;
+
+werr:
+        quicklistReleaseIterator(li);
+        return 0;
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -177,6 +177,14 @@ void* bioProcessBackgroundJobs(void* arg)
             close((long)job->arg1);
         } else if (type == REDIS_BIO_AOF_FSYNC) {
             aof_fsync((long)job->arg1);
+        } else if (type == REDIS_BIO_LAZY_FREE) {
+            /* arg1 is an object to free, arg2 and arg3 are the two
+             * dictionaries of an emptied database. */
+            if (job->arg1) {
+                lazyfreeFreeObjectFromBioThread(job->arg1);
+            } else {
+                lazyfreeFreeDatabaseFromBioThread(job->arg2, job->arg3);
+            }
         } else {
             redisPanic("Wrong job type in bioProcessBackgroundJobs().");
         }
@@ -30,6 +30,7 @@
 
 
 #include "redis.h"
+#include "persistence.h"
 #include <assert.h>
 
 /*-----------------------------------------------------------------------------
@@ -109,6 +110,23 @@ void loadServerConfigFromString(char* config)
                 err = "Invalid tcp-keepalive value";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0], "tcp-reuseport") && argc == 2) {
+            if ((server.tcp_reuseport = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "io-threads") && argc == 2) {
+            server.io_threads_num = atoi(argv[1]);
+            if (server.io_threads_num < 1 ||
+                server.io_threads_num > REDIS_IO_THREADS_MAX_NUM) {
+                err = "Invalid number of I/O threads";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "io-threads-do-reads") && argc == 2) {
+            if ((server.io_threads_do_reads = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0], "port") && argc == 2) {
             server.port = atoi(argv[1]);
             if (server.port < 0 || server.port > 65535) {
@@ -302,6 +320,21 @@ void loadServerConfigFromString(char* config)
                 err = "argument must be 'yes' or 'no'";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0], "keyspace-open-addressing") && argc == 2) {
+            if ((server.keyspace_open_addressing = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "lazyfree-lazy-eviction") && argc == 2) {
+            if ((server.lazyfree_lazy_eviction = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "lazyfree-lazy-server-del") && argc == 2) {
+            if ((server.lazyfree_lazy_server_del = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0], "daemonize") && argc == 2) {
             if ((server.daemonize = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'";
@@ -379,6 +412,18 @@ void loadServerConfigFromString(char* config)
             server.list_max_ziplist_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0], "list-max-ziplist-value") && argc == 2) {
             server.list_max_ziplist_value = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0], "list-max-ziplist-size") && argc == 2) {
+            server.list_max_ziplist_size = atoi(argv[1]);
+            if (server.list_max_ziplist_size < -5 || server.list_max_ziplist_size == 0) {
+                err = "Invalid list-max-ziplist-size value";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "list-compress-depth") && argc == 2) {
+            server.list_compress_depth = atoi(argv[1]);
+            if (server.list_compress_depth < 0) {
+                err = "Invalid list-compress-depth value";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0], "set-max-intset-entries") && argc == 2) {
             server.set_max_intset_entries = memtoll(argv[1], NULL);
         } else if (!strcasecmp(argv[0], "zset-max-ziplist-entries") && argc == 2) {
@@ -473,8 +518,118 @@ void loadServerConfigFromString(char* config)
             server.lockPersistenceMmapFile = strcat(zstrdup(argv[1]), "_lock");
         } else if (!strcasecmp(argv[0], "write_thread_num")) {
             server.writeThreadNum = atoi(argv[1]);
+            if (server.writeThreadNum < 1 || server.writeThreadNum > MAX_WRITE_THREAD_NUM) {
+                err = "Invalid number of write threads";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "write_thread_min") && argc == 2) {
+            server.writeThreadMin = atoi(argv[1]);
+            if (server.writeThreadMin < 1 || server.writeThreadMin > MAX_WRITE_THREAD_NUM) {
+                err = "Invalid minimum number of write threads";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "write_thread_max") && argc == 2) {
+            server.writeThreadMax = atoi(argv[1]);
+            if (server.writeThreadMax < 1 || server.writeThreadMax > MAX_WRITE_THREAD_NUM) {
+                err = "Invalid maximum number of write threads";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "write_thread_scale_depth") && argc == 2) {
+            server.writeThreadScaleDepth = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0], "write_thread_scale_age") && argc == 2) {
+            server.writeThreadScaleAge = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0], "write_thread_idle_time") && argc == 2) {
+            server.writeThreadIdleTime = atoi(argv[1]);
         } else if (!strcasecmp(argv[0], "persistence_tolerate_time")) {
             server.persistenceTolerateTime = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0], "persistence_backpressure") && argc == 2) {
+            server.persistenceBackpressure = persistenceBackpressureByName(argv[1]);
+            if (server.persistenceBackpressure == -1) {
+                err = "Invalid persistence_backpressure policy, must be alert, delay or reject";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "persistence_high_watermark") && argc == 2) {
+            server.persistenceHighWatermark = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0], "persistence_low_watermark") && argc == 2) {
+            server.persistenceLowWatermark = memtoll(argv[1], NULL);
+        } else if (!strcasecmp(argv[0], "persistence_retry_max_attempts") && argc == 2) {
+            server.persistenceRetryMaxAttempts = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0], "persistence_retry_max_jobs") && argc == 2) {
+            server.persistenceRetryMaxJobs = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0], "mysql_flush_rate") && argc == 2) {
+            server.mysqlFlushRate = atoi(argv[1]);
+            if (server.mysqlFlushRate < 0) {
+                err = "Invalid mysql_flush_rate, must be 0 or a positive number of rows per second";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "mysql_flush_max_hold") && argc == 2) {
+            server.mysqlFlushMaxHold = atoi(argv[1]);
+            if (server.mysqlFlushMaxHold < 0) {
+                err = "Invalid mysql_flush_max_hold, must be 0 or a positive number of seconds";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "binlog_invalidation") && argc == 2) {
+            if ((server.binlogInvalidation = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+#ifndef HAVE_MYSQL_BINLOG
+            if (server.binlogInvalidation) {
+                err = "binlog_invalidation requires the MySQL 5.7.5+ client library (MYSQL_RPL / mysql_binlog_open)";
+                goto loaderr;
+            }
+#endif
+        } else if (!strcasecmp(argv[0], "binlog_server_id") && argc == 2) {
+            server.binlogServerId = atoi(argv[1]);
+            if (server.binlogServerId < 0) {
+                err = "Invalid binlog_server_id";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "binlog_refresh") && argc == 2) {
+            if ((server.binlogRefresh = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "table_policy") && argc == 3) {
+            if (setTablePolicy(argv[1], argv[2]) != DB_RET_SUCCESS) {
+                err = "Invalid table_policy, must be write-behind, write-through, write-around or cache-only";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "table_quota") && argc == 4) {
+            int err1 = 0, err2 = 0;
+            long long soft = memtoll(argv[2], &err1);
+            long long hard = memtoll(argv[3], &err2);
+
+            if (err1 || err2 || soft < 0 || hard < 0 ||
+                setTableQuota(argv[1], soft, hard) == REDIS_ERR) {
+                err = "Invalid table_quota, soft quota must not exceed the hard one";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "mysql_shard") && argc == 7) {
+            int shard = atoi(argv[1]);
+
+            if (shard < 1 || setDBShard(shard, argv[2], atoi(argv[3]), argv[4], argv[5], argv[6]) != DB_RET_SUCCESS) {
+                err = "Invalid mysql_shard, shard must be between 1 and 63";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "shard_map") && argc >= 4) {
+            if (setShardMap(argv[1], argc - 2, argv + 2) != DB_RET_SUCCESS) {
+                err = "Invalid shard_map, must be 'range <min> <max> <shard> ...' or 'hash <shard> ...'";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "table_compress") && argc == 3) {
+            if (setTableCompress(argv[1], atoi(argv[2])) != DB_RET_SUCCESS) {
+                err = "Invalid table_compress table or threshold";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "read_prefetch") && argc == 3) {
+            if (setReadPrefetch(argv[1], atoi(argv[2])) != DB_RET_SUCCESS) {
+                err = "Invalid read_prefetch table or window";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0], "persistence_deadletter_file") && argc == 2) {
+            zfree(server.persistenceDeadLetterFile);
+            server.persistenceDeadLetterFile = zstrdup(argv[1]);
         } else if (!strcasecmp(argv[0], "dynamic_create_table")) {
             server.dynamicCreateTable = yesnotoi(argv[1]); 
         } else {
@@ -486,6 +641,19 @@ void loadServerConfigFromString(char* config)
     if (server.persistenceMmapFile != NULL && server.lockPersistenceMmapFile != NULL) {
         assert(strcmp(server.persistenceMmapFile, server.lockPersistenceMmapFile) != 0);
     }
+    /* write_thread_num alone keeps the pool fixed at that size. */
+    if (server.writeThreadMin == 0) {
+        server.writeThreadMin = server.writeThreadNum;
+    }
+    if (server.writeThreadMax == 0) {
+        server.writeThreadMax = server.writeThreadNum;
+    }
+    if (server.writeThreadMax < server.writeThreadMin) {
+        server.writeThreadMax = server.writeThreadMin;
+    }
+    if (server.persistenceLowWatermark > server.persistenceHighWatermark) {
+        server.persistenceLowWatermark = server.persistenceHighWatermark;
+    }
     sdsfreesplitres(lines, totlines);
     return;
 
@@ -742,6 +910,18 @@ void configSetCommand(redisClient* c)
             goto badfmt;
         }
         server.list_max_ziplist_value = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "list-max-ziplist-size")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR ||
+            ll < -5 || ll == 0 || ll > INT_MAX) {
+            goto badfmt;
+        }
+        server.list_max_ziplist_size = (int) ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "list-compress-depth")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR ||
+            ll < 0 || ll > INT_MAX) {
+            goto badfmt;
+        }
+        server.list_compress_depth = (int) ll;
     } else if (!strcasecmp(c->argv[2]->ptr, "set-max-intset-entries")) {
         if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll < 0) {
             goto badfmt;
@@ -863,6 +1043,27 @@ void configSetCommand(redisClient* c)
             goto badfmt;
         }
         server.rdb_compression = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr, "io-threads-do-reads")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) {
+            goto badfmt;
+        }
+        server.io_threads_do_reads = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr, "lazyfree-lazy-eviction")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) {
+            goto badfmt;
+        }
+        server.lazyfree_lazy_eviction = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr, "lazyfree-lazy-server-del")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) {
+            goto badfmt;
+        }
+        server.lazyfree_lazy_server_del = yn;
     } else if (!strcasecmp(c->argv[2]->ptr, "rdbchecksum")) {
         int yn = yesnotoi(o->ptr);
 
@@ -883,6 +1084,196 @@ void configSetCommand(redisClient* c)
             goto badfmt;
         }
         server.slave_priority = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "write_thread_min")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR ||
+            ll < 1 || ll > MAX_WRITE_THREAD_NUM) {
+            goto badfmt;
+        }
+        server.writeThreadMin = ll;
+        if (server.writeThreadMax < server.writeThreadMin) {
+            server.writeThreadMax = server.writeThreadMin;
+        }
+    } else if (!strcasecmp(c->argv[2]->ptr, "write_thread_max")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR ||
+            ll < 1 || ll > MAX_WRITE_THREAD_NUM) {
+            goto badfmt;
+        }
+        server.writeThreadMax = ll;
+        if (server.writeThreadMin > server.writeThreadMax) {
+            server.writeThreadMin = server.writeThreadMax;
+        }
+    } else if (!strcasecmp(c->argv[2]->ptr, "write_thread_scale_depth")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll <= 0) {
+            goto badfmt;
+        }
+        server.writeThreadScaleDepth = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "write_thread_scale_age")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll < 0) {
+            goto badfmt;
+        }
+        server.writeThreadScaleAge = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "persistence_backpressure")) {
+        int policy = persistenceBackpressureByName(o->ptr);
+
+        if (policy == -1) {
+            goto badfmt;
+        }
+        /* Writers delayed by the previous policy are resumed by
+         * persistenceBackpressureCron(). */
+        server.persistenceBackpressure = policy;
+    } else if (!strcasecmp(c->argv[2]->ptr, "persistence_high_watermark")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll <= 0 ||
+            ll < server.persistenceLowWatermark) {
+            goto badfmt;
+        }
+        server.persistenceHighWatermark = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "persistence_low_watermark")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll < 0 ||
+            ll > server.persistenceHighWatermark) {
+            goto badfmt;
+        }
+        server.persistenceLowWatermark = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "mysql_flush_rate")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll < 0 || ll > INT_MAX) {
+            goto badfmt;
+        }
+        /* Also applies to a BGMYSQLSAVE already in progress. */
+        setMysqlFlushRate(ll);
+    } else if (!strcasecmp(c->argv[2]->ptr, "mysql_flush_max_hold")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll < 0 || ll > INT_MAX) {
+            goto badfmt;
+        }
+        server.mysqlFlushMaxHold = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "binlog_refresh")) {
+        int yn = yesnotoi(o->ptr);
+
+        if (yn == -1) {
+            goto badfmt;
+        }
+        server.binlogRefresh = yn;
+    } else if (!strcasecmp(c->argv[2]->ptr, "persistence_retry_max_attempts")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll < 0) {
+            goto badfmt;
+        }
+        server.persistenceRetryMaxAttempts = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "table_policy")) {
+        int vlen, j;
+        sds* v = sdssplitlen(o->ptr, sdslen(o->ptr), " ", 1, &vlen);
+
+        /* Pairs of table and policy, replacing all the previous ones. */
+        if (vlen & 1) {
+            sdsfreesplitres(v, vlen);
+            goto badfmt;
+        }
+        dict* old = server.tablePolicies;
+        server.tablePolicies = dictCreate(&tablePolicyDictType, NULL);
+        for (j = 0; j < vlen; j += 2) {
+            if (setTablePolicy(v[j], v[j + 1]) != DB_RET_SUCCESS) {
+                dictRelease(server.tablePolicies);
+                server.tablePolicies = old;
+                sdsfreesplitres(v, vlen);
+                tablePoliciesChanged();
+                goto badfmt;
+            }
+        }
+        dictRelease(old);
+        sdsfreesplitres(v, vlen);
+        tablePoliciesChanged();
+    } else if (!strcasecmp(c->argv[2]->ptr, "table_quota")) {
+        int vlen, j, err1 = 0, err2 = 0;
+        sds* v = sdssplitlen(o->ptr, sdslen(o->ptr), " ", 1, &vlen);
+        dictIterator* di;
+        dictEntry* de;
+
+        /* Triples of table, soft and hard quota, replacing all the previous
+         * ones. Everything is validated before touching the old quotas. */
+        if (vlen % 3) {
+            sdsfreesplitres(v, vlen);
+            goto badfmt;
+        }
+        for (j = 0; j < vlen; j += 3) {
+            long long soft = memtoll(v[j + 1], &err1);
+            long long hard = memtoll(v[j + 2], &err2);
+
+            if (err1 || err2 || soft < 0 || hard < 0 || (hard && soft > hard) ||
+                sdslen(v[j]) > MAX_TABLE_LEN || strchr(v[j], '_') != NULL) {
+                sdsfreesplitres(v, vlen);
+                goto badfmt;
+            }
+        }
+        di = dictGetIterator(server.tableStats);
+        while ((de = dictNext(di)) != NULL) {
+            tableStats* ts = dictGetVal(de);
+
+            ts->softquota = ts->hardquota = 0;
+            updateTableQuota(ts);
+        }
+        dictReleaseIterator(di);
+        for (j = 0; j < vlen; j += 3) {
+            setTableQuota(v[j], memtoll(v[j + 1], NULL), memtoll(v[j + 2], NULL));
+        }
+        sdsfreesplitres(v, vlen);
+    } else if (!strcasecmp(c->argv[2]->ptr, "table_compress")) {
+        int vlen, j;
+        sds* v = sdssplitlen(o->ptr, sdslen(o->ptr), " ", 1, &vlen);
+
+        /* Pairs of table and threshold, tables not listed stop compressing
+         * new writes. Rows already compressed are still decompressed. */
+        if (vlen & 1) {
+            sdsfreesplitres(v, vlen);
+            goto badfmt;
+        }
+        for (j = 0; j < vlen; j += 2) {
+            long long threshold;
+
+            if (string2ll(v[j + 1], sdslen(v[j + 1]), &threshold) == 0 ||
+                threshold < 0 || threshold > INT_MAX ||
+                sdslen(v[j]) > MAX_TABLE_LEN || strchr(v[j], '_') != NULL) {
+                sdsfreesplitres(v, vlen);
+                goto badfmt;
+            }
+        }
+        resetTableCompress();
+        for (j = 0; j < vlen; j += 2) {
+            if (setTableCompress(v[j], atoi(v[j + 1])) != DB_RET_SUCCESS) {
+                sdsfreesplitres(v, vlen);
+                goto badfmt;
+            }
+        }
+        sdsfreesplitres(v, vlen);
+    } else if (!strcasecmp(c->argv[2]->ptr, "read_prefetch")) {
+        int vlen, j;
+        sds* v = sdssplitlen(o->ptr, sdslen(o->ptr), " ", 1, &vlen);
+
+        /* Pairs of table and window, the window between 0 and
+         * PREFETCH_MAX_WINDOW. Tables not listed stop prefetching. */
+        if (vlen & 1) {
+            sdsfreesplitres(v, vlen);
+            goto badfmt;
+        }
+        for (j = 0; j < vlen; j += 2) {
+            char* eptr;
+            long val = strtol(v[j + 1], &eptr, 10);
+            if (eptr[0] != '\0' || val < 0 || val > PREFETCH_MAX_WINDOW || sdslen(v[j]) > MAX_TABLE_LEN) {
+                sdsfreesplitres(v, vlen);
+                goto badfmt;
+            }
+        }
+        resetReadPrefetch();
+        for (j = 0; j < vlen; j += 2) {
+            setReadPrefetch(v[j], atoi(v[j + 1]));
+        }
+        sdsfreesplitres(v, vlen);
+    } else if (!strcasecmp(c->argv[2]->ptr, "persistence_retry_max_jobs")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll < 0) {
+            goto badfmt;
+        }
+        server.persistenceRetryMaxJobs = ll;
+    } else if (!strcasecmp(c->argv[2]->ptr, "write_thread_idle_time")) {
+        if (getLongLongFromObject(o, &ll) == REDIS_ERR || ll < 0) {
+            goto badfmt;
+        }
+        server.writeThreadIdleTime = ll;
     } else {
         addReplyErrorFormat(c, "Unsupported CONFIG parameter: %s",
                             (char*)c->argv[2]->ptr);
@@ -939,12 +1330,14 @@ void configGetCommand(redisClient* c)
     config_get_string_field("unixsocket", server.unixsocket);
     config_get_string_field("logfile", server.logfile);
     config_get_string_field("pidfile", server.pidfile);
+    config_get_string_field("persistence_deadletter_file", server.persistenceDeadLetterFile);
 
     /* Numerical values */
     config_get_numerical_field("maxmemory", server.maxmemory);
     config_get_numerical_field("maxmemory-samples", server.maxmemory_samples);
     config_get_numerical_field("timeout", server.maxidletime);
     config_get_numerical_field("tcp-keepalive", server.tcpkeepalive);
+    config_get_numerical_field("io-threads", server.io_threads_num);
     config_get_numerical_field("auto-aof-rewrite-percentage",
                                server.aof_rewrite_perc);
     config_get_numerical_field("auto-aof-rewrite-min-size",
@@ -957,6 +1350,10 @@ void configGetCommand(redisClient* c)
                                server.list_max_ziplist_entries);
     config_get_numerical_field("list-max-ziplist-value",
                                server.list_max_ziplist_value);
+    config_get_numerical_field("list-max-ziplist-size",
+                               server.list_max_ziplist_size);
+    config_get_numerical_field("list-compress-depth",
+                               server.list_compress_depth);
     config_get_numerical_field("set-max-intset-entries",
                                server.set_max_intset_entries);
     config_get_numerical_field("zset-max-ziplist-entries",
@@ -976,6 +1373,18 @@ void configGetCommand(redisClient* c)
     config_get_numerical_field("watchdog-period", server.watchdog_period);
     config_get_numerical_field("slave-priority", server.slave_priority);
     config_get_numerical_field("hz", server.hz);
+    config_get_numerical_field("write_thread_min", server.writeThreadMin);
+    config_get_numerical_field("write_thread_max", server.writeThreadMax);
+    config_get_numerical_field("write_thread_scale_depth", server.writeThreadScaleDepth);
+    config_get_numerical_field("write_thread_scale_age", server.writeThreadScaleAge);
+    config_get_numerical_field("write_thread_idle_time", server.writeThreadIdleTime);
+    config_get_numerical_field("persistence_high_watermark", server.persistenceHighWatermark);
+    config_get_numerical_field("persistence_low_watermark", server.persistenceLowWatermark);
+    config_get_numerical_field("persistence_retry_max_attempts", server.persistenceRetryMaxAttempts);
+    config_get_numerical_field("persistence_retry_max_jobs", server.persistenceRetryMaxJobs);
+    config_get_numerical_field("mysql_flush_rate", server.mysqlFlushRate);
+    config_get_numerical_field("mysql_flush_max_hold", server.mysqlFlushMaxHold);
+    config_get_numerical_field("binlog_server_id", server.binlogServerId);
 
     /* Bool (yes/no) values */
     config_get_bool_field("no-appendfsync-on-rewrite",
@@ -987,16 +1396,69 @@ void configGetCommand(redisClient* c)
     config_get_bool_field("stop-writes-on-bgsave-error",
                           server.stop_writes_on_bgsave_err);
     config_get_bool_field("daemonize", server.daemonize);
+    config_get_bool_field("tcp-reuseport", server.tcp_reuseport);
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
     config_get_bool_field("activerehashing", server.activerehashing);
+    config_get_bool_field("keyspace-open-addressing", server.keyspace_open_addressing);
+    config_get_bool_field("lazyfree-lazy-eviction", server.lazyfree_lazy_eviction);
+    config_get_bool_field("lazyfree-lazy-server-del", server.lazyfree_lazy_server_del);
+    config_get_bool_field("io-threads-do-reads", server.io_threads_do_reads);
     config_get_bool_field("repl-disable-tcp-nodelay",
                           server.repl_disable_tcp_nodelay);
     config_get_bool_field("aof-rewrite-incremental-fsync",
                           server.aof_rewrite_incremental_fsync);
+    config_get_bool_field("binlog_invalidation", server.binlogInvalidation);
+    config_get_bool_field("binlog_refresh", server.binlogRefresh);
 
     /* Everything we can't handle with macros follows. */
 
+    if (stringmatch(pattern, "table_policy", 0)) {
+        sds buf = catTablePolicyConfig(sdsempty());
+
+        addReplyBulkCString(c, "table_policy");
+        addReplyBulkCString(c, buf);
+        sdsfree(buf);
+        matches++;
+    }
+    if (stringmatch(pattern, "table_quota", 0)) {
+        sds buf = catTableQuotaConfig(sdsempty());
+
+        addReplyBulkCString(c, "table_quota");
+        addReplyBulkCString(c, buf);
+        sdsfree(buf);
+        matches++;
+    }
+    if (stringmatch(pattern, "shard_map", 0)) {
+        sds buf = catShardMapConfig(sdsempty());
+
+        addReplyBulkCString(c, "shard_map");
+        addReplyBulkCString(c, buf);
+        sdsfree(buf);
+        matches++;
+    }
+    if (stringmatch(pattern, "table_compress", 0)) {
+        sds buf = catTableCompressConfig(sdsempty());
+
+        addReplyBulkCString(c, "table_compress");
+        addReplyBulkCString(c, buf);
+        sdsfree(buf);
+        matches++;
+    }
+    if (stringmatch(pattern, "read_prefetch", 0)) {
+        sds buf = catReadPrefetchConfig(sdsempty());
+
+        addReplyBulkCString(c, "read_prefetch");
+        addReplyBulkCString(c, buf);
+        sdsfree(buf);
+        matches++;
+    }
+    if (stringmatch(pattern, "persistence_backpressure", 0)) {
+        addReplyBulkCString(c, "persistence_backpressure");
+        addReplyBulkCString(c, persistenceBackpressureName(server.persistenceBackpressure));
+        matches++;
+    }
+
     if (stringmatch(pattern, "appendonly", 0)) {
         addReplyBulkCString(c, "appendonly");
         addReplyBulkCString(c, server.aof_state == REDIS_AOF_OFF ? "no" : "yes");
@@ -1170,6 +1632,8 @@ void configCommand(redisClient* c)
         server.stat_expiredkeys = 0;
         server.stat_rejected_conn = 0;
         server.stat_fork_time = 0;
+        server.stat_io_reads_processed = 0;
+        server.stat_io_writes_processed = 0;
         server.aof_delayed_fsync = 0;
         resetCommandTableStats();
         addReply(c, shared.ok);
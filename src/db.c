@@ -52,6 +52,9 @@ robj* lookupKey(redisDb* db, robj* key)
         if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
             val->lru = server.lruclock;
         }
+        if (dictSize(server.readPrefetched) > 0) {
+            readPrefetchHit(db, key->ptr);
+        }
         return val;
     } else {
         return NULL;
@@ -66,8 +69,10 @@ robj* lookupKeyRead(redisDb* db, robj* key)
     val = lookupKey(db, key);
     if (val == NULL) {
         server.stat_keyspace_misses++;
+        lookupTableStats(key->ptr, 1)->misses++;
     } else {
         server.stat_keyspace_hits++;
+        lookupTableStats(key->ptr, 1)->hits++;
     }
     return val;
 }
@@ -118,7 +123,21 @@ void dbAdd(redisDb* db, robj* key, robj* val)
 {
     sds copy = sdsdup(key->ptr);
     int retval = dictAdd(db->dict, copy, val);
+    tableStats* ts;
+
     redisAssertWithInfo(NULL, key, retval == REDIS_OK);
+    ts = lookupTableStats(copy, 1);
+    ts->keys++;
+    /* Seed the average size with the first key of the table, otherwise
+     * the table is never over quota until tableStatsCron() samples it. */
+    if (ts->avgsize == 0) {
+        ts->avgsize = (server.keyspace_open_addressing ? sizeof(dictSlot) + 1 :
+                       sizeof(dictEntry)) + sdsAllocSize(copy) +
+                      estimateObjectMemory(val);
+        if (ts->softquota || ts->hardquota) {
+            updateTableQuota(ts);
+        }
+    }
 }
 
 /* Overwrite an existing key with a new value. Incrementing the reference
@@ -131,7 +150,14 @@ void dbOverwrite(redisDb* db, robj* key, robj* val)
     struct dictEntry* de = dictFind(db->dict, key->ptr);
 
     redisAssertWithInfo(NULL, key, de != NULL);
-    dictReplace(db->dict, key->ptr, val);
+    if (server.lazyfree_lazy_server_del) {
+        robj* old = dictGetVal(de);
+
+        dictSetVal(db->dict, de, val);
+        freeObjAsync(old);
+    } else {
+        dictReplace(db->dict, key->ptr, val);
+    }
 }
 
 /* High level Set operation. This function can be used in order to set
@@ -187,31 +213,50 @@ robj* dbRandomKey(redisDb* db)
 }
 
 /* Delete a key, value, and associated expiration entry if any, from the DB */
-int dbDelete(redisDb* db, robj* key)
+int dbSyncDelete(redisDb* db, robj* key)
 {
     /* Deleting an entry from the expires dict will not free the sds of
      * the key, because it is shared with the main dictionary. */
-    dictDelete(db->lastsaves, key->ptr);
+    if (dictSize(server.readPrefetched) > 0) {
+        readPrefetchForget(db, key->ptr);
+    }
     if (dictSize(db->expires) > 0) {
         dictDelete(db->expires, key->ptr);
     }
     if (dictDelete(db->dict, key->ptr) == DICT_OK) {
+        lookupTableStats(key->ptr, 1)->keys--;
         return 1;
     } else {
         return 0;
     }
 }
 
-long long emptyDb()
+/* This is a wrapper whose behavior depends on the Redis lazy free
+ * configuration. Deletes the key synchronously or asynchronously. */
+int dbDelete(redisDb* db, robj* key)
+{
+    return server.lazyfree_lazy_server_del ? dbAsyncDelete(db, key) :
+           dbSyncDelete(db, key);
+}
+
+/* Remove all keys from all the databases. With REDIS_EMPTYDB_ASYNC the
+ * values are freed by the lazyfree thread. */
+long long emptyDb(int flags)
 {
     int j;
     long long removed = 0;
 
     for (j = 0; j < server.dbnum; j++) {
         removed += dictSize(server.db[j].dict);
-        dictEmpty(server.db[j].dict);
-        dictEmpty(server.db[j].expires);
+        if (flags & REDIS_EMPTYDB_ASYNC) {
+            emptyDbAsync(&server.db[j]);
+        } else {
+            dictEmpty(server.db[j].dict);
+            dictEmpty(server.db[j].expires);
+        }
     }
+    dictEmpty(server.readPrefetched);
+    rebuildTableStats();
     return removed;
 }
 
@@ -247,19 +292,60 @@ void signalFlushedDb(int dbid)
  * Type agnostic commands operating on the key space
  *----------------------------------------------------------------------------*/
 
+/* Return the set of flags to use for the emptyDb() call for FLUSHALL
+ * and FLUSHDB commands.
+ *
+ * Currently the command just attempts to parse the "ASYNC" option. It
+ * also checks if the command arity is wrong.
+ *
+ * On success REDIS_OK is returned and the flags are stored in *flags, otherwise
+ * REDIS_ERR is returned and the function sends an error to the client. */
+int getFlushCommandFlags(redisClient* c, int* flags)
+{
+    /* Parse the optional ASYNC option. */
+    if (c->argc > 1) {
+        if (c->argc > 2 || strcasecmp(c->argv[1]->ptr, "async")) {
+            addReply(c, shared.syntaxerr);
+            return REDIS_ERR;
+        }
+        *flags = REDIS_EMPTYDB_ASYNC;
+    } else {
+        *flags = REDIS_EMPTYDB_NO_FLAGS;
+    }
+    return REDIS_OK;
+}
+
 void flushdbCommand(redisClient* c)
 {
+    int flags;
+
+    if (getFlushCommandFlags(c, &flags) == REDIS_ERR) {
+        return;
+    }
     server.dirty += dictSize(c->db->dict);
     signalFlushedDb(c->db->id);
-    dictEmpty(c->db->dict);
-    dictEmpty(c->db->expires);
+    if (flags & REDIS_EMPTYDB_ASYNC) {
+        emptyDbAsync(c->db);
+    } else {
+        dictEmpty(c->db->dict);
+        dictEmpty(c->db->expires);
+    }
+    if (dictSize(server.readPrefetched) > 0) {
+        readPrefetchForgetDb(c->db->id);
+    }
+    rebuildTableStats();
     addReply(c, shared.ok);
 }
 
 void flushallCommand(redisClient* c)
 {
+    int flags;
+
+    if (getFlushCommandFlags(c, &flags) == REDIS_ERR) {
+        return;
+    }
     signalFlushedDb(-1);
-    server.dirty += emptyDb();
+    server.dirty += emptyDb(flags);
     addReply(c, shared.ok);
     if (server.rdb_child_pid != -1) {
         kill(server.rdb_child_pid, SIGUSR1);
@@ -275,12 +361,15 @@ void flushallCommand(redisClient* c)
     server.dirty++;
 }
 
-void delCommand(redisClient* c)
+/* This command implements DEL and UNLINK. */
+void delGenericCommand(redisClient* c, int lazy)
 {
     int deleted = 0, j;
 
     for (j = 1; j < c->argc; j++) {
-        if (dbDelete(c->db, c->argv[j])) {
+        int retval = lazy ? dbAsyncDelete(c->db, c->argv[j]) :
+                     dbSyncDelete(c->db, c->argv[j]);
+        if (retval) {
             signalModifiedKey(c->db, c->argv[j]);
             server.dirty++;
             deleted++;
@@ -289,6 +378,17 @@ void delCommand(redisClient* c)
     addReplyLongLong(c, deleted);
 }
 
+void delCommand(redisClient* c)
+{
+    delGenericCommand(c, 0);
+}
+
+/* UNLINK is like DEL, but big values are freed in background. */
+void unlinkCommand(redisClient* c)
+{
+    delGenericCommand(c, 1);
+}
+
 void existsCommand(redisClient* c)
 {
     expireIfNeeded(c->db, c->argv[1]);
@@ -356,6 +456,249 @@ void keysCommand(redisClient* c)
     setDeferredMultiBulkLength(c, replylen, numkeys);
 }
 
+/* This callback is used by scanGenericCommand in order to collect elements
+ * returned by the dictionary iterator into a list. */
+static void scanCallback(void* privdata, const dictEntry* de)
+{
+    void** pd = (void**) privdata;
+    list* keys = pd[0];
+    robj* o = pd[1];
+    robj* key, *val = NULL;
+
+    if (o == NULL) {
+        sds sdskey = dictGetKey(de);
+        key = createStringObject(sdskey, sdslen(sdskey));
+    } else if (o->type == REDIS_SET) {
+        key = dictGetKey(de);
+        incrRefCount(key);
+    } else if (o->type == REDIS_HASH) {
+        key = dictGetKey(de);
+        incrRefCount(key);
+        val = dictGetVal(de);
+        incrRefCount(val);
+    } else if (o->type == REDIS_ZSET) {
+        key = dictGetKey(de);
+        incrRefCount(key);
+        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de));
+    } else {
+        redisPanic("Type not handled in SCAN callback.");
+    }
+
+    listAddNodeTail(keys, key);
+    if (val) {
+        listAddNodeTail(keys, val);
+    }
+}
+
+/* Try to parse a SCAN cursor stored at object 'o':
+ * if the cursor is valid, store it as unsigned integer into *cursor and
+ * returns REDIS_OK. Otherwise return REDIS_ERR and send an error to the
+ * client. */
+int parseScanCursorOrReply(redisClient* c, robj* o, unsigned long* cursor)
+{
+    char* eptr;
+
+    /* Use strtoul() because we need an *unsigned* long, so
+     * getLongLongFromObject() does not cover the whole cursor space. */
+    errno = 0;
+    *cursor = strtoul(o->ptr, &eptr, 10);
+    if (isspace(((char*)o->ptr)[0]) || eptr[0] != '\0' || errno == ERANGE) {
+        addReplyError(c, "invalid cursor");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* This command implements SCAN, HSCAN, SSCAN and ZSCAN.
+ *
+ * If object 'o' is passed, then it must be a Hash, Set or Zset object,
+ * otherwise if 'o' is NULL the command will operate on the dictionary
+ * associated with the current database.
+ *
+ * When 'o' is not NULL the function assumes that the first argument in
+ * the client arguments vector is a key so it skips it before iterating
+ * in order to parse options.
+ *
+ * In the case of a Hash object the function returns both the field and
+ * value of every element on the Hash. Small objects, encoded as ziplists
+ * or intsets, are returned whole with a cursor of 0. */
+void scanGenericCommand(redisClient* c, robj* o, unsigned long cursor)
+{
+    int i, j;
+    list* keys = listCreate();
+    listNode* node, *nextnode;
+    long count = 10;
+    sds pat = NULL;
+    int patlen = 0, use_pattern = 0;
+    dict* ht;
+
+    redisAssert(o == NULL || o->type == REDIS_SET || o->type == REDIS_HASH ||
+                o->type == REDIS_ZSET);
+
+    /* Set i to the first option argument. The previous one is the cursor. */
+    i = (o == NULL) ? 2 : 3; /* Skip the key argument if needed. */
+
+    /* Step 1: Parse options. */
+    while (i < c->argc) {
+        j = c->argc - i;
+        if (!strcasecmp(c->argv[i]->ptr, "count") && j >= 2) {
+            if (getLongFromObjectOrReply(c, c->argv[i + 1], &count, NULL)
+                != REDIS_OK) {
+                goto cleanup;
+            }
+            if (count < 1) {
+                addReply(c, shared.syntaxerr);
+                goto cleanup;
+            }
+            i += 2;
+        } else if (!strcasecmp(c->argv[i]->ptr, "match") && j >= 2) {
+            pat = c->argv[i + 1]->ptr;
+            patlen = sdslen(pat);
+
+            /* The pattern always matches if it is exactly "*", so it is
+             * equivalent to disabling it. */
+            use_pattern = !(pat[0] == '*' && patlen == 1);
+            i += 2;
+        } else {
+            addReply(c, shared.syntaxerr);
+            goto cleanup;
+        }
+    }
+
+    /* Step 2: Iterate the collection.
+     *
+     * Note that if the object is encoded with a ziplist or intset there is
+     * no cursor: the whole object is returned at once, as it is small. */
+    ht = NULL;
+    if (o == NULL) {
+        ht = c->db->dict;
+    } else if (o->type == REDIS_SET && o->encoding == REDIS_ENCODING_HT) {
+        ht = o->ptr;
+    } else if (o->type == REDIS_HASH && o->encoding == REDIS_ENCODING_HT) {
+        ht = o->ptr;
+        count *= 2; /* We return key / value for this type. */
+    } else if (o->type == REDIS_ZSET && o->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset* zs = o->ptr;
+        ht = zs->dict;
+        count *= 2; /* We return key / value for this type. */
+    }
+
+    if (ht) {
+        void* privdata[2];
+        /* Don't spend too much time on a sparse table: give up after
+         * visiting count*10 buckets even if fewer elements were found. */
+        long maxiterations = count * 10;
+
+        privdata[0] = keys;
+        privdata[1] = o;
+        do {
+            cursor = dictScan(ht, cursor, scanCallback, privdata);
+        } while (cursor && maxiterations-- && (long)listLength(keys) < count);
+    } else if (o->type == REDIS_SET) {
+        int pos = 0;
+        int64_t ll;
+
+        while (intsetGet(o->ptr, pos++, &ll)) {
+            listAddNodeTail(keys, createStringObjectFromLongLong(ll));
+        }
+        cursor = 0;
+    } else if (o->type == REDIS_HASH || o->type == REDIS_ZSET) {
+        unsigned char* p = ziplistIndex(o->ptr, 0);
+        unsigned char* vstr;
+        unsigned int vlen;
+        long long vll;
+
+        while (p) {
+            ziplistGet(p, &vstr, &vlen, &vll);
+            listAddNodeTail(keys,
+                            (vstr != NULL) ? createStringObject((char*)vstr, vlen) :
+                            createStringObjectFromLongLong(vll));
+            p = ziplistNext(o->ptr, p);
+        }
+        cursor = 0;
+    } else {
+        redisPanic("Not handled encoding in SCAN.");
+    }
+
+    /* Step 3: Filter elements. */
+    node = listFirst(keys);
+    while (node) {
+        robj* kobj = listNodeValue(node);
+        int filter = 0;
+
+        nextnode = listNextNode(node);
+
+        /* Filter element if it does not match the pattern. */
+        if (use_pattern) {
+            if (kobj->encoding == REDIS_ENCODING_INT) {
+                char buf[32];
+                int len = ll2string(buf, sizeof(buf), (long)kobj->ptr);
+
+                filter = !stringmatchlen(pat, patlen, buf, len, 0);
+            } else {
+                filter = !stringmatchlen(pat, patlen, kobj->ptr, sdslen(kobj->ptr), 0);
+            }
+        }
+
+        /* Filter element if it is an expired key. */
+        if (!filter && o == NULL && expireIfNeeded(c->db, kobj)) {
+            filter = 1;
+        }
+
+        /* Remove the element and its associted value if needed. */
+        if (filter) {
+            decrRefCount(kobj);
+            listDelNode(keys, node);
+        }
+
+        /* If this is a hash or a sorted set, we have a flat list of
+         * key-value elements, so if this element was filtered, remove the
+         * value, or skip it if it was not filtered: we only match keys. */
+        if (o && (o->type == REDIS_ZSET || o->type == REDIS_HASH)) {
+            node = nextnode;
+            nextnode = listNextNode(node);
+            if (filter) {
+                kobj = listNodeValue(node);
+                decrRefCount(kobj);
+                listDelNode(keys, node);
+            }
+        }
+        node = nextnode;
+    }
+
+    /* Step 4: Reply to the client. */
+    addReplyMultiBulkLen(c, 2);
+    do {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "%lu", cursor);
+
+        addReplyBulkCBuffer(c, buf, len);
+    } while (0);
+
+    addReplyMultiBulkLen(c, listLength(keys));
+    while ((node = listFirst(keys)) != NULL) {
+        robj* kobj = listNodeValue(node);
+        addReplyBulk(c, kobj);
+        decrRefCount(kobj);
+        listDelNode(keys, node);
+    }
+
+cleanup:
+    listSetFreeMethod(keys, decrRefCount);
+    listRelease(keys);
+}
+
+/* The SCAN command completely relies on scanGenericCommand. */
+void scanCommand(redisClient* c)
+{
+    unsigned long cursor;
+
+    if (parseScanCursorOrReply(c, c->argv[1], &cursor) == REDIS_ERR) {
+        return;
+    }
+    scanGenericCommand(c, NULL, cursor);
+}
+
 void dbsizeCommand(redisClient* c)
 {
     addReplyLongLong(c, dictSize(c->db->dict));
@@ -824,21 +1167,210 @@ int* zunionInterGetKeys(struct redisCommand* cmd, robj** argv, int argc, int* nu
     return keys;
 }
 
-long long getLastSaveTime(redisDb* db, sds key)
+/*-----------------------------------------------------------------------------
+ * Per table accounting and memory quotas
+ *
+ * Keys are named "table_ID" after the MySQL persistence convention. For every
+ * table we track the number of keys and the read hits / misses exactly, while
+ * the memory used is estimated as keys * average size, where the average is
+ * refreshed by tableStatsCron() sampling random keys. Tables over their soft
+ * quota are the first target of freeMemoryIfNeeded(), tables over their hard
+ * quota are evicted by evictOverQuotaTables() even below maxmemory.
+ *----------------------------------------------------------------------------*/
+
+/* Return the stats of the table the key belongs to. If create is true a
+ * missing entry is created, otherwise NULL is returned. */
+tableStats* lookupTableStats(const char* key, int create)
 {
+    char table[MAX_TABLE_LEN + 1];
+    int n = 0;
     dictEntry* de;
-    if (dictSize(db->lastsaves) == 0 ||
-        (de = dictFind(db->lastsaves, key)) == NULL) {
-        return -1;
+    tableStats* ts;
+
+    while (key[n] != '\0' && key[n] != '_' && n < MAX_TABLE_LEN) {
+        table[n] = key[n];
+        n++;
     }
-    return dictGetSignedIntegerVal(de);
+    table[n] = '\0';
+    if ((de = dictFind(server.tableStats, table)) != NULL) {
+        return dictGetVal(de);
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (dictSize(server.tableStats) >= REDIS_TABLE_STATS_MAX) {
+        if ((de = dictFind(server.tableStats, REDIS_TABLE_STATS_OTHER)) != NULL) {
+            return dictGetVal(de);
+        }
+        strcpy(table, REDIS_TABLE_STATS_OTHER);
+    }
+    ts = zcalloc(sizeof(*ts));
+    dictAdd(server.tableStats, sdsnew(table), ts);
+    return ts;
 }
 
-void setLastSaveTime(redisDb* db, sds key)
+/* Return the REDIS_TABLE_* quota state of the table the key belongs to. */
+int tableOverQuota(const char* key)
 {
-    long long now = (long long)time(NULL);
-    dictEntry* kde, *de;
-    kde = dictFind(db->dict, key);
-    de = dictReplaceRaw(db->lastsaves, dictGetKey(kde));
-    dictSetSignedIntegerVal(de, now);
+    tableStats* ts;
+
+    if (server.tablesOverSoft == 0 && server.tablesOverHard == 0) {
+        return REDIS_TABLE_UNDER_QUOTA;
+    }
+    ts = lookupTableStats(key, 0);
+    return ts ? ts->overquota : REDIS_TABLE_UNDER_QUOTA;
+}
+
+/* Recompute the quota state of a table, keeping the server wide counters
+ * of tables over quota in sync. */
+void updateTableQuota(tableStats* ts)
+{
+    unsigned long long mem = (unsigned long long)ts->keys * ts->avgsize;
+    int state = REDIS_TABLE_UNDER_QUOTA;
+
+    if (ts->keys > 0 && ts->hardquota && mem > ts->hardquota) {
+        state = REDIS_TABLE_OVER_HARD;
+    } else if (ts->keys > 0 && ts->softquota && mem > ts->softquota) {
+        state = REDIS_TABLE_OVER_SOFT;
+    }
+    if (state == ts->overquota) {
+        return;
+    }
+    if (ts->overquota != REDIS_TABLE_UNDER_QUOTA) {
+        server.tablesOverSoft--;
+    }
+    if (ts->overquota == REDIS_TABLE_OVER_HARD) {
+        server.tablesOverHard--;
+    }
+    if (state != REDIS_TABLE_UNDER_QUOTA) {
+        server.tablesOverSoft++;
+    }
+    if (state == REDIS_TABLE_OVER_HARD) {
+        server.tablesOverHard++;
+    }
+    ts->overquota = state;
+}
+
+/* Recount the keys of every table from scratch, used after the keyspace
+ * was emptied without passing from dbDelete(). */
+void rebuildTableStats(void)
+{
+    dictIterator* di;
+    dictEntry* de;
+    int j;
+
+    di = dictGetIterator(server.tableStats);
+    while ((de = dictNext(di)) != NULL) {
+        ((tableStats*)dictGetVal(de))->keys = 0;
+    }
+    dictReleaseIterator(di);
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (dictSize(server.db[j].dict) == 0) {
+            continue;
+        }
+        di = dictGetIterator(server.db[j].dict);
+        while ((de = dictNext(di)) != NULL) {
+            lookupTableStats(dictGetKey(de), 1)->keys++;
+        }
+        dictReleaseIterator(di);
+    }
+
+    di = dictGetIterator(server.tableStats);
+    while ((de = dictNext(di)) != NULL) {
+        updateTableQuota(dictGetVal(de));
+    }
+    dictReleaseIterator(di);
+}
+
+/* Refresh the average size of the keys of every table sampling a few
+ * random keys per DB, then update the quota state of the tables. */
+void tableStatsCron(void)
+{
+    dictIterator* di;
+    dictEntry* de;
+    int j, k;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb* db = server.db + j;
+
+        if (dictSize(db->dict) == 0) {
+            continue;
+        }
+        for (k = 0; k < REDIS_TABLE_STATS_SAMPLES; k++) {
+            sds key;
+            tableStats* ts;
+            size_t size;
+
+            de = dictGetRandomKey(db->dict);
+            key = dictGetKey(de);
+            ts = lookupTableStats(key, 1);
+            size = (server.keyspace_open_addressing ? sizeof(dictSlot) + 1 :
+                    sizeof(dictEntry)) + sdsAllocSize(key) +
+                   estimateObjectMemory(dictGetVal(de));
+            /* Exponential moving average, the first sample sets it. */
+            ts->avgsize = ts->avgsize ? (ts->avgsize * 7 + size) / 8 : size;
+        }
+    }
+
+    di = dictGetIterator(server.tableStats);
+    while ((de = dictNext(di)) != NULL) {
+        updateTableQuota(dictGetVal(de));
+    }
+    dictReleaseIterator(di);
+}
+
+int setTableQuota(const char* table, unsigned long long softquota, unsigned long long hardquota)
+{
+    tableStats* ts;
+
+    if (strlen(table) > MAX_TABLE_LEN || strchr(table, '_') != NULL ||
+        (hardquota && softquota > hardquota)) {
+        return REDIS_ERR;
+    }
+    ts = lookupTableStats(table, 1);
+    ts->softquota = softquota;
+    ts->hardquota = hardquota;
+    updateTableQuota(ts);
+    return REDIS_OK;
+}
+
+sds catTableQuotaConfig(sds s)
+{
+    dictIterator* di = dictGetIterator(server.tableStats);
+    dictEntry* de;
+
+    while ((de = dictNext(di)) != NULL) {
+        tableStats* ts = dictGetVal(de);
+
+        if (ts->softquota || ts->hardquota) {
+            s = sdscatprintf(s, "%s%s %llu %llu", sdslen(s) ? " " : "",
+                             (char*)dictGetKey(de), ts->softquota, ts->hardquota);
+        }
+    }
+    dictReleaseIterator(di);
+    return s;
+}
+
+sds catTableStatsInfo(sds info)
+{
+    dictIterator* di = dictGetIterator(server.tableStats);
+    dictEntry* de;
+    static char* states[] = {"no", "soft", "hard"};
+
+    while ((de = dictNext(di)) != NULL) {
+        tableStats* ts = dictGetVal(de);
+        long long lookups = ts->hits + ts->misses;
+
+        info = sdscatprintf(info,
+                            "%s:keys=%lld,memory=%llu,hits=%lld,misses=%lld,hit_ratio=%.2f,"
+                            "soft_quota=%llu,hard_quota=%llu,over_quota=%s\r\n",
+                            (char*)dictGetKey(de), ts->keys,
+                            (unsigned long long)ts->keys * ts->avgsize,
+                            ts->hits, ts->misses,
+                            lookups ? (double)ts->hits / lookups : 0,
+                            ts->softquota, ts->hardquota, states[ts->overquota]);
+    }
+    dictReleaseIterator(di);
+    return info;
 }
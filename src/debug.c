@@ -272,7 +272,7 @@ void debugCommand(redisClient* c)
             addReply(c, shared.err);
             return;
         }
-        emptyDb();
+        emptyDb(REDIS_EMPTYDB_NO_FLAGS);
         if (rdbLoad(server.rdb_filename) != REDIS_OK) {
             addReplyError(c, "Error trying to load the RDB dump");
             return;
@@ -280,7 +280,7 @@ void debugCommand(redisClient* c)
         redisLog(REDIS_WARNING, "DB reloaded by DEBUG RELOAD");
         addReply(c, shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr, "loadaof")) {
-        emptyDb();
+        emptyDb(REDIS_EMPTYDB_NO_FLAGS);
         if (loadAppendOnlyFile(server.aof_filename) != REDIS_OK) {
             addReply(c, shared.err);
             return;
@@ -292,6 +292,7 @@ void debugCommand(redisClient* c)
         dictEntry* de;
         robj* val;
         char* strenc;
+        char extra[128] = {0};
 
         if ((de = dictFind(c->db->dict, c->argv[2]->ptr)) == NULL) {
             addReply(c, shared.nokeyerr);
@@ -299,14 +300,19 @@ void debugCommand(redisClient* c)
         }
         val = dictGetVal(de);
         strenc = strEncoding(val->encoding);
+        if (val->type == REDIS_LIST && val->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist* ql = val->ptr;
+            snprintf(extra, sizeof(extra), " ql_nodes:%lu ql_fill:%d ql_compress:%u",
+                     ql->len, ql->fill, ql->compress);
+        }
 
         addReplyStatusFormat(c,
                              "Value at:%p refcount:%d "
                              "encoding:%s serializedlength:%lld "
-                             "lru:%d lru_seconds_idle:%lu",
+                             "lru:%d lru_seconds_idle:%lu%s",
                              (void*)val, val->refcount,
                              strenc, (long long) rdbSavedObjectLen(val),
-                             val->lru, estimateObjectIdleTime(val));
+                             val->lru, estimateObjectIdleTime(val), extra);
     } else if (!strcasecmp(c->argv[1]->ptr, "sdslen") && c->argc == 3) {
         dictEntry* de;
         robj* val;
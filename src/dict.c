@@ -42,6 +42,9 @@
 #include <limits.h>
 #include <sys/time.h>
 #include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "dict.h"
 #include "zmalloc.h"
@@ -64,6 +67,15 @@ static int _dictExpandIfNeeded(dict* ht);
 static unsigned long _dictNextPower(unsigned long size);
 static int _dictKeyIndex(dict* ht, const void* key);
 static int _dictInit(dict* ht, dictType* type, void* privDataPtr);
+static int _dictOpenExpand(dict* d, unsigned long size);
+static int _dictOpenRehash(dict* d, int n);
+static dictEntry* _dictOpenAddRaw(dict* d, void* key);
+static int _dictOpenDelete(dict* d, const void* key, int nofree);
+static void _dictOpenClear(dict* d, dictht* ht);
+static dictEntry* _dictOpenFind(dict* d, const void* key);
+static dictEntry* _dictOpenNext(dictIterator* iter);
+static dictEntry* _dictOpenGetRandomKey(dict* d);
+static int _dictOpenExpandIfNeeded(dict* d);
 
 /* -------------------------- hash functions -------------------------------- */
 
@@ -177,6 +189,8 @@ static void _dictReset(dictht* ht)
     ht->size = 0;
     ht->sizemask = 0;
     ht->used = 0;
+    ht->slots = NULL;
+    ht->deleted = 0;
 }
 
 /* Create a new hash table */
@@ -189,6 +203,22 @@ dict* dictCreate(dictType* type,
     return d;
 }
 
+/* Create a hash table using open addressing instead of chaining: entries
+ * are stored in the table itself, with a control byte per slot holding 7
+ * bits of the hash of the key, so that a lookup tests a whole group of
+ * slots at once and only compares the keys whose hash bits match.
+ *
+ * The API is the same, but a dictEntry returned by the table is only valid
+ * until the next call against the same table, as rehashing moves entries
+ * around. Deleting the entry returned by a safe iterator is still fine. */
+dict* dictCreateOpen(dictType* type, void* privDataPtr)
+{
+    dict* d = dictCreate(type, privDataPtr);
+
+    d->open = 1;
+    return d;
+}
+
 /* Initialize the hash table */
 int _dictInit(dict* d, dictType* type,
               void* privDataPtr)
@@ -199,6 +229,7 @@ int _dictInit(dict* d, dictType* type,
     d->privdata = privDataPtr;
     d->rehashidx = -1;
     d->iterators = 0;
+    d->open = 0;
     return DICT_OK;
 }
 
@@ -229,12 +260,17 @@ int dictExpand(dict* d, unsigned long size)
     if (dictIsRehashing(d) || d->ht[0].used > size) {
         return DICT_ERR;
     }
+    if (d->open) {
+        return _dictOpenExpand(d, size);
+    }
 
     /* Allocate the new hash table and initialize all pointers to NULL */
     n.size = realsize;
     n.sizemask = realsize - 1;
     n.table = zcalloc(realsize * sizeof(dictEntry*));
     n.used = 0;
+    n.slots = NULL;
+    n.deleted = 0;
 
     /* Is this the first initialization? If so it's not really a rehashing
      * we just set the first hash table so that it can accept keys. */
@@ -258,6 +294,9 @@ int dictRehash(dict* d, int n)
     if (!dictIsRehashing(d)) {
         return 0;
     }
+    if (d->open) {
+        return _dictOpenRehash(d, n);
+    }
 
     while (n--) {
         dictEntry* de, *nextde;
@@ -368,6 +407,9 @@ dictEntry* dictAddRaw(dict* d, void* key)
     dictEntry* entry;
     dictht* ht;
 
+    if (d->open) {
+        return _dictOpenAddRaw(d, key);
+    }
     if (dictIsRehashing(d)) {
         _dictRehashStep(d);
     }
@@ -439,6 +481,9 @@ static int dictGenericDelete(dict* d, const void* key, int nofree)
     if (d->ht[0].size == 0) {
         return DICT_ERR;    /* d->ht[0].table is NULL */
     }
+    if (d->open) {
+        return _dictOpenDelete(d, key, nofree);
+    }
     if (dictIsRehashing(d)) {
         _dictRehashStep(d);
     }
@@ -489,6 +534,11 @@ int _dictClear(dict* d, dictht* ht)
 {
     unsigned long i;
 
+    if (d->open) {
+        _dictOpenClear(d, ht);
+        return DICT_OK;
+    }
+
     /* Free all the elements */
     for (i = 0; i < ht->size && ht->used > 0; i++) {
         dictEntry* he, *nextHe;
@@ -528,6 +578,9 @@ dictEntry* dictFind(dict* d, const void* key)
     if (d->ht[0].size == 0) {
         return NULL;    /* We don't have a table at all */
     }
+    if (d->open) {
+        return _dictOpenFind(d, key);
+    }
     if (dictIsRehashing(d)) {
         _dictRehashStep(d);
     }
@@ -567,10 +620,10 @@ long long dictFingerprint(dict* d)
     long long integers[6], hash = 0;
     int j;
 
-    integers[0] = (long) d->ht[0].table;
+    integers[0] = d->open ? (long) d->ht[0].slots : (long) d->ht[0].table;
     integers[1] = d->ht[0].size;
     integers[2] = d->ht[0].used;
-    integers[3] = (long) d->ht[1].table;
+    integers[3] = d->open ? (long) d->ht[1].slots : (long) d->ht[1].table;
     integers[4] = d->ht[1].size;
     integers[5] = d->ht[1].used;
 
@@ -618,6 +671,9 @@ dictIterator* dictGetSafeIterator(dict* d)
 
 dictEntry* dictNext(dictIterator* iter)
 {
+    if (iter->d->open) {
+        return _dictOpenNext(iter);
+    }
     while (1) {
         if (iter->entry == NULL) {
             dictht* ht = &iter->d->ht[iter->table];
@@ -675,6 +731,9 @@ dictEntry* dictGetRandomKey(dict* d)
     if (dictSize(d) == 0) {
         return NULL;
     }
+    if (d->open) {
+        return _dictOpenGetRandomKey(d);
+    }
     if (dictIsRehashing(d)) {
         _dictRehashStep(d);
     }
@@ -709,6 +768,529 @@ dictEntry* dictGetRandomKey(dict* d)
     return he;
 }
 
+/* ------------------------ open addressing tables -------------------------- */
+
+/* Slots are grouped by DICT_GROUP_SIZE, and every slot has a control byte:
+ * the low 7 bits of the hash of the key for used slots, or one of the two
+ * values below, both with the high bit set. A key is looked for starting
+ * from the group selected by the rest of its hash, moving to further groups
+ * (triangular probing, so that every group is visited) until a group with
+ * an empty slot is found.
+ *
+ * A deleted slot can be marked empty only if its group already has an empty
+ * slot: no lookup ever went past that group. Otherwise it is marked deleted
+ * so that the lookups keep probing, and the deleted markers are cleaned up
+ * by rehashing when they make the table too full. */
+#define DICT_GROUP_SIZE 16
+#define DICT_CTRL_EMPTY 0x80
+#define DICT_CTRL_DELETED 0xfe
+#define DICT_OPEN_INITIAL_SIZE DICT_GROUP_SIZE
+
+#define _dictCtrl(ht) ((unsigned char*)((ht)->slots + (ht)->size))
+#define _dictSlotEntry(ht, idx) ((dictEntry*)((ht)->slots + (idx)))
+#define _dictCtrlIsFull(c) (((c) & 0x80) == 0)
+#define _dictHashTag(h) ((h) & 0x7f)
+#define _dictHashGroup(h) ((h) >> 7)
+
+#ifdef __SSE2__
+/* Bitmap of the slots of the group whose control byte is 'c'. */
+static inline unsigned int _dictGroupMatch(const unsigned char* group, unsigned char c)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+}
+
+/* Bitmap of the empty or deleted slots of the group. */
+static inline unsigned int _dictGroupMatchFree(const unsigned char* group)
+{
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+#else
+static inline unsigned int _dictGroupMatch(const unsigned char* group, unsigned char c)
+{
+    unsigned int mask = 0;
+    int j;
+
+    for (j = 0; j < DICT_GROUP_SIZE; j++) {
+        mask |= (unsigned int)(group[j] == c) << j;
+    }
+    return mask;
+}
+
+static inline unsigned int _dictGroupMatchFree(const unsigned char* group)
+{
+    unsigned int mask = 0;
+    int j;
+
+    for (j = 0; j < DICT_GROUP_SIZE; j++) {
+        mask |= (unsigned int)(group[j] >> 7) << j;
+    }
+    return mask;
+}
+#endif
+
+/* Index of the lowest bit set in a non zero bitmap. */
+static inline int _dictMaskFirst(unsigned int mask)
+{
+    return __builtin_ctz(mask);
+}
+
+/* Returns the slot of 'key' in 'ht', or -1 if it is not there. */
+static long _dictOpenLookup(dict* d, dictht* ht, const void* key, unsigned int h)
+{
+    unsigned long groupmask = ht->size / DICT_GROUP_SIZE - 1;
+    unsigned long g = _dictHashGroup(h) & groupmask, step;
+    unsigned char* ctrl = _dictCtrl(ht);
+
+    for (step = 1; step <= groupmask + 1; step++) {
+        unsigned char* group = ctrl + g * DICT_GROUP_SIZE;
+        unsigned int mask = _dictGroupMatch(group, _dictHashTag(h));
+
+        while (mask) {
+            long idx = g * DICT_GROUP_SIZE + _dictMaskFirst(mask);
+
+            if (dictCompareKeys(d, key, ht->slots[idx].key)) {
+                return idx;
+            }
+            mask &= mask - 1;
+        }
+        if (_dictGroupMatch(group, DICT_CTRL_EMPTY)) {
+            return -1;
+        }
+        g = (g + step) & groupmask;
+    }
+    return -1;
+}
+
+/* Returns the first empty or deleted slot for a key with hash 'h'. */
+static long _dictOpenFindSlot(dictht* ht, unsigned int h)
+{
+    unsigned long groupmask = ht->size / DICT_GROUP_SIZE - 1;
+    unsigned long g = _dictHashGroup(h) & groupmask, step;
+    unsigned char* ctrl = _dictCtrl(ht);
+
+    for (step = 1; step <= groupmask + 1; step++) {
+        unsigned int mask = _dictGroupMatchFree(ctrl + g * DICT_GROUP_SIZE);
+
+        if (mask) {
+            return g * DICT_GROUP_SIZE + _dictMaskFirst(mask);
+        }
+        g = (g + step) & groupmask;
+    }
+    /* Only possible if the table kept growing while rehashing was
+     * suspended by safe iterators. */
+    assert(0);
+    return -1;
+}
+
+static void _dictOpenFillSlot(dictht* ht, long idx, unsigned int h)
+{
+    unsigned char* ctrl = _dictCtrl(ht);
+
+    if (ctrl[idx] == DICT_CTRL_DELETED) {
+        ht->deleted--;
+    }
+    ctrl[idx] = _dictHashTag(h);
+    ht->used++;
+}
+
+static void _dictOpenClearSlot(dictht* ht, long idx)
+{
+    unsigned char* ctrl = _dictCtrl(ht);
+    unsigned char* group = ctrl + (idx & ~(long)(DICT_GROUP_SIZE - 1));
+
+    if (_dictGroupMatch(group, DICT_CTRL_EMPTY)) {
+        ctrl[idx] = DICT_CTRL_EMPTY;
+    } else {
+        ctrl[idx] = DICT_CTRL_DELETED;
+        ht->deleted++;
+    }
+    ht->used--;
+}
+
+static int _dictOpenExpand(dict* d, unsigned long size)
+{
+    dictht n;
+    /* Room for 'size' elements keeping the table at most 7/8 full. */
+    unsigned long realsize = _dictNextPower(size + size / 7 + 1);
+
+    if (realsize < DICT_OPEN_INITIAL_SIZE) {
+        realsize = DICT_OPEN_INITIAL_SIZE;
+    }
+    /* Rehashing to the same size is only useful to drop deleted markers. */
+    if (realsize == d->ht[0].size && d->ht[0].deleted == 0) {
+        return DICT_ERR;
+    }
+
+    n.table = NULL;
+    n.size = realsize;
+    n.sizemask = realsize - 1;
+    n.used = 0;
+    n.deleted = 0;
+    n.slots = zmalloc(realsize * (sizeof(dictSlot) + 1));
+    memset(_dictCtrl(&n), DICT_CTRL_EMPTY, realsize);
+
+    if (d->ht[0].size == 0) {
+        d->ht[0] = n;
+        return DICT_OK;
+    }
+    d->ht[1] = n;
+    d->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Same as dictRehash(), a step moves a single entry. */
+static int _dictOpenRehash(dict* d, int n)
+{
+    dictht* from = &d->ht[0], *to = &d->ht[1];
+    unsigned char* ctrl = _dictCtrl(from);
+
+    while (n--) {
+        dictSlot* de;
+        unsigned int h;
+        long idx;
+
+        if (from->used == 0) {
+            zfree(from->slots);
+            d->ht[0] = d->ht[1];
+            _dictReset(&d->ht[1]);
+            d->rehashidx = -1;
+            return 0;
+        }
+
+        assert(from->size > (unsigned)d->rehashidx);
+        while (!_dictCtrlIsFull(ctrl[d->rehashidx])) {
+            d->rehashidx++;
+        }
+        de = from->slots + d->rehashidx;
+        h = dictHashKey(d, de->key);
+        idx = _dictOpenFindSlot(to, h);
+        to->slots[idx] = *de;
+        _dictOpenFillSlot(to, idx, h);
+        _dictOpenClearSlot(from, d->rehashidx);
+        d->rehashidx++;
+    }
+    return 1;
+}
+
+static dictEntry* _dictOpenAddRaw(dict* d, void* key)
+{
+    dictEntry* entry;
+    dictht* ht;
+    unsigned int h;
+    long idx;
+
+    if (dictIsRehashing(d)) {
+        _dictRehashStep(d);
+    }
+    if (_dictExpandIfNeeded(d) == DICT_ERR) {
+        return NULL;
+    }
+    h = dictHashKey(d, key);
+    if (_dictOpenLookup(d, &d->ht[0], key, h) != -1 ||
+        (dictIsRehashing(d) && _dictOpenLookup(d, &d->ht[1], key, h) != -1)) {
+        return NULL;
+    }
+
+    /* While rehashing new entries go to the new table. */
+    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
+    idx = _dictOpenFindSlot(ht, h);
+    _dictOpenFillSlot(ht, idx, h);
+    entry = _dictSlotEntry(ht, idx);
+    dictSetKey(d, entry, key);
+    return entry;
+}
+
+static int _dictOpenDelete(dict* d, const void* key, int nofree)
+{
+    unsigned int h;
+    int table;
+
+    if (dictIsRehashing(d)) {
+        _dictRehashStep(d);
+    }
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        dictht* ht = &d->ht[table];
+        long idx = _dictOpenLookup(d, ht, key, h);
+
+        if (idx != -1) {
+            if (!nofree) {
+                dictFreeKey(d, ht->slots + idx);
+                dictFreeVal(d, ht->slots + idx);
+            }
+            _dictOpenClearSlot(ht, idx);
+            return DICT_OK;
+        }
+        if (!dictIsRehashing(d)) {
+            break;
+        }
+    }
+    return DICT_ERR; /* not found */
+}
+
+static void _dictOpenClear(dict* d, dictht* ht)
+{
+    unsigned char* ctrl = _dictCtrl(ht);
+    unsigned long i;
+
+    for (i = 0; i < ht->size && ht->used > 0; i++) {
+        if (_dictCtrlIsFull(ctrl[i])) {
+            dictFreeKey(d, ht->slots + i);
+            dictFreeVal(d, ht->slots + i);
+            ht->used--;
+        }
+    }
+    zfree(ht->slots);
+    _dictReset(ht);
+}
+
+static dictEntry* _dictOpenFind(dict* d, const void* key)
+{
+    unsigned int h;
+    int table;
+
+    if (dictIsRehashing(d)) {
+        _dictRehashStep(d);
+    }
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        long idx = _dictOpenLookup(d, &d->ht[table], key, h);
+
+        if (idx != -1) {
+            return _dictSlotEntry(&d->ht[table], idx);
+        }
+        if (!dictIsRehashing(d)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Entries don't move while iterating (rehashing is suspended by safe
+ * iterators and forbidden with the others), so there is no next entry to
+ * save: the iterator just walks the slots. */
+static dictEntry* _dictOpenNext(dictIterator* iter)
+{
+    while (1) {
+        dictht* ht = &iter->d->ht[iter->table];
+
+        if (iter->index == -1 && iter->table == 0) {
+            if (iter->safe) {
+                iter->d->iterators++;
+            } else {
+                iter->fingerprint = dictFingerprint(iter->d);
+            }
+        }
+        iter->index++;
+        if (iter->index >= (signed) ht->size) {
+            if (dictIsRehashing(iter->d) && iter->table == 0) {
+                iter->table++;
+                iter->index = -1;
+                continue;
+            }
+            break;
+        }
+        if (_dictCtrlIsFull(_dictCtrl(ht)[iter->index])) {
+            iter->entry = _dictSlotEntry(ht, iter->index);
+            return iter->entry;
+        }
+    }
+    return NULL;
+}
+
+static dictEntry* _dictOpenGetRandomKey(dict* d)
+{
+    dictht* ht;
+    unsigned long h;
+
+    if (dictIsRehashing(d)) {
+        _dictRehashStep(d);
+    }
+    do {
+        ht = &d->ht[0];
+        if (dictIsRehashing(d)) {
+            h = random() % (d->ht[0].size + d->ht[1].size);
+            if (h >= ht->size) {
+                h -= ht->size;
+                ht = &d->ht[1];
+            }
+        } else {
+            h = random() & ht->sizemask;
+        }
+    } while (!_dictCtrlIsFull(_dictCtrl(ht)[h]));
+    return _dictSlotEntry(ht, h);
+}
+
+/* Rehash when 7/8 of the slots are used or deleted, or 15/16 when resizing
+ * is disabled: unlike chains, slots can't be overcommitted. The new table is
+ * sized for the used slots only, so it doubles when there are few deleted
+ * markers, and keeps its size (or shrinks) when they are most of the fill. */
+static int _dictOpenExpandIfNeeded(dict* d)
+{
+    dictht* ht = &d->ht[0];
+    unsigned long fill;
+
+    if (ht->size == 0) {
+        return dictExpand(d, DICT_HT_INITIAL_SIZE);
+    }
+    fill = ht->used + ht->deleted + 1;
+    if (fill * 8 > ht->size * 7 &&
+        (dict_can_resize || fill * 16 > ht->size * 15)) {
+        return dictExpand(d, ht->used);
+    }
+    return DICT_OK;
+}
+
+/* Function to reverse bits. Algorithm from:
+ * http://graphics.stanford.edu/~seander/bithacks.html#ReverseParallel */
+static unsigned long rev(unsigned long v)
+{
+    unsigned long s = 8 * sizeof(v); // bit size; must be power of 2
+    unsigned long mask = ~0;
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/* Mask of the buckets dictScan() visits: the hash chains, or the groups of
+ * an open addressing table. */
+static unsigned long _dictScanMask(dict* d, dictht* ht)
+{
+    return d->open ? ht->size / DICT_GROUP_SIZE - 1 : ht->sizemask;
+}
+
+/* Call 'fn' for every element whose bucket is 'idx'. In open addressing
+ * tables these are the elements whose home group is 'idx': they are all on
+ * its probe sequence before the first group with an empty slot, where the
+ * lookups stop too. */
+static void _dictScanBucket(dict* d, dictht* ht, unsigned long idx,
+                            dictScanFunction* fn, void* privdata)
+{
+    if (d->open) {
+        unsigned long groupmask = ht->size / DICT_GROUP_SIZE - 1;
+        unsigned long g = idx, step;
+        unsigned char* ctrl = _dictCtrl(ht);
+
+        for (step = 1; step <= groupmask + 1; step++) {
+            unsigned char* group = ctrl + g * DICT_GROUP_SIZE;
+            int j;
+
+            for (j = 0; j < DICT_GROUP_SIZE; j++) {
+                dictEntry* de = _dictSlotEntry(ht, g * DICT_GROUP_SIZE + j);
+
+                if (_dictCtrlIsFull(group[j]) &&
+                    (_dictHashGroup(dictHashKey(d, de->key)) & groupmask) == idx) {
+                    fn(privdata, de);
+                }
+            }
+            if (_dictGroupMatch(group, DICT_CTRL_EMPTY)) {
+                break;
+            }
+            g = (g + step) & groupmask;
+        }
+    } else {
+        const dictEntry* de = ht->table[idx];
+
+        while (de) {
+            fn(privdata, de);
+            de = de->next;
+        }
+    }
+}
+
+/* dictScan() is used to iterate over the elements of a dictionary.
+ *
+ * Iterating works in the following way:
+ *
+ * 1) Initially you call the function using a cursor (v) value of 0.
+ * 2) The function performs one step of the iteration, and returns the
+ *    new cursor value that you must use in the next call.
+ * 3) When the returned cursor is 0, the iteration is complete.
+ *
+ * The function guarantees that all the elements that are present in the
+ * dictionary from the start to the end of the iteration are returned.
+ * However it is possible that some element is returned multiple times.
+ *
+ * For every element returned, the callback 'fn' is called, with 'privdata'
+ * as first argument and the dictionary entry 'de' as second argument.
+ *
+ * HOW IT WORKS.
+ *
+ * The cursor is the index of the next bucket to visit, but it is incremented
+ * starting from the higher order bits: the bits of the cursor are reversed,
+ * the reversed value incremented, and the bits reversed again.
+ *
+ * This way, as tables are always power of two sized and a bucket of a table
+ * holds the elements whose hash ends with the bits of its index, the buckets
+ * already visited are the same after the table grows or shrinks: when it
+ * grows, every visited bucket is split in buckets that are visited as well,
+ * as they only differ in the higher bits; when it shrinks, the buckets are
+ * merged into buckets that were all visited, or all not visited, except for
+ * the bucket at the cursor (this is why elements can be returned twice).
+ *
+ * While rehashing both tables are scanned: the bucket at the cursor in the
+ * smaller one, then all its expansions in the bigger one, so that again the
+ * cursor only depends on the smaller table. */
+unsigned long dictScan(dict* d, unsigned long v, dictScanFunction* fn, void* privdata)
+{
+    dictht* t0, *t1;
+    unsigned long m0, m1;
+
+    if (dictSize(d) == 0) {
+        return 0;
+    }
+
+    if (!dictIsRehashing(d)) {
+        t0 = &(d->ht[0]);
+        m0 = _dictScanMask(d, t0);
+
+        /* Emit entries at cursor */
+        _dictScanBucket(d, t0, v & m0, fn, privdata);
+    } else {
+        t0 = &d->ht[0];
+        t1 = &d->ht[1];
+
+        /* Make sure t0 is the smaller and t1 is the bigger table */
+        if (t0->size > t1->size) {
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+
+        m0 = _dictScanMask(d, t0);
+        m1 = _dictScanMask(d, t1);
+
+        /* Emit entries at cursor */
+        _dictScanBucket(d, t0, v & m0, fn, privdata);
+
+        /* Iterate over indices in larger table that are the expansion
+         * of the index pointed to by the cursor in the smaller table */
+        do {
+            /* Emit entries at cursor */
+            _dictScanBucket(d, t1, v & m1, fn, privdata);
+
+            /* Increment bits not covered by the smaller mask */
+            v = (((v | m0) + 1) & ~m0) | (v & m0);
+
+            /* Continue while bits covered by mask difference is non-zero */
+        } while (v & (m0 ^ m1));
+    }
+
+    /* Set unmasked bits so incrementing the reversed cursor
+     * operates on the masked bits of the smaller table */
+    v |= ~m0;
+
+    /* Increment the reverse cursor */
+    v = rev(v);
+    v++;
+    v = rev(v);
+
+    return v;
+}
+
 /* ------------------------- private functions ------------------------------ */
 
 /* Expand the hash table if needed */
@@ -718,6 +1300,9 @@ static int _dictExpandIfNeeded(dict* d)
     if (dictIsRehashing(d)) {
         return DICT_OK;
     }
+    if (d->open) {
+        return _dictOpenExpandIfNeeded(d);
+    }
 
     /* If the hash table is empty expand it to the initial size. */
     if (d->ht[0].size == 0) {
@@ -937,3 +1522,178 @@ dictType dictTypeHeapStringCopyKeyValue = {
     _dictStringDestructor,         /* val destructor */
 };
 #endif
+
+#ifdef DICT_BENCHMARK_MAIN
+/* Head to head benchmark of the chained and open addressing tables with the
+ * same sds keys the keyspace uses. Build with:
+ *
+ *   cc -O2 -DDICT_BENCHMARK_MAIN -o dict-benchmark dict.c sds.c zmalloc.c
+ *
+ * and run as: dict-benchmark [count] [chained|open] */
+#include "sds.h"
+
+void _redisAssert(char* estr, char* file, int line)
+{
+    fprintf(stderr, "ASSERTION FAILED: %s:%d '%s'\n", file, line, estr);
+}
+
+static unsigned int benchHashCallback(const void* key)
+{
+    return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
+}
+
+static int benchCompareCallback(void* privdata, const void* key1, const void* key2)
+{
+    DICT_NOTUSED(privdata);
+
+    return sdslen((sds)key1) == sdslen((sds)key2) &&
+           memcmp(key1, key2, sdslen((sds)key1)) == 0;
+}
+
+static void benchFreeCallback(void* privdata, void* val)
+{
+    DICT_NOTUSED(privdata);
+
+    sdsfree(val);
+}
+
+dictType benchDictType = {
+    benchHashCallback,      /* hash function */
+    NULL,                   /* key dup */
+    NULL,                   /* val dup */
+    benchCompareCallback,   /* key compare */
+    benchFreeCallback,      /* key destructor */
+    NULL                    /* val destructor */
+};
+
+static void benchScanCallback(void* privdata, const dictEntry* de)
+{
+    DICT_NOTUSED(de);
+
+    (*(long*)privdata)++;
+}
+
+static long long benchUstime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+#define start_benchmark() start = benchUstime()
+#define end_benchmark(msg) do { \
+    elapsed = benchUstime() - start; \
+    printf("%-8s %-24s %lld ms (%.1f ns/op)\n", mode, msg, elapsed / 1000, \
+           (double)elapsed * 1000 / count); \
+} while(0)
+
+static void benchmark(const char* mode, long count)
+{
+    dict* d = strcmp(mode, "open") ? dictCreate(&benchDictType, NULL) :
+              dictCreateOpen(&benchDictType, NULL);
+    size_t before = zmalloc_used_memory();
+    long long start, elapsed;
+    dictIterator* di;
+    dictEntry* de;
+    unsigned long cursor;
+    long j, seen = 0;
+
+    start_benchmark();
+    for (j = 0; j < count; j++) {
+        dictEntry* de = dictAddRaw(d, sdsfromlonglong(j));
+
+        assert(de != NULL);
+        dictSetSignedIntegerVal(de, j);
+    }
+    end_benchmark("insert");
+    assert((long)dictSize(d) == count);
+    while (dictIsRehashing(d)) {
+        dictRehashMilliseconds(d, 100);
+    }
+    printf("%-8s %-24s %.1f bytes/key\n", mode, "memory",
+           (double)(zmalloc_used_memory() - before) / count);
+
+    start_benchmark();
+    for (j = 0; j < count; j++) {
+        sds key = sdsfromlonglong(j);
+
+        de = dictFind(d, key);
+        assert(de != NULL && dictGetSignedIntegerVal(de) == j);
+        sdsfree(key);
+    }
+    end_benchmark("linear access");
+
+    start_benchmark();
+    for (j = 0; j < count; j++) {
+        sds key = sdsfromlonglong(rand() % count);
+
+        assert(dictFind(d, key) != NULL);
+        sdsfree(key);
+    }
+    end_benchmark("random access");
+
+    start_benchmark();
+    for (j = 0; j < count; j++) {
+        sds key = sdsfromlonglong(rand() % count);
+
+        key[0] = 'X';
+        assert(dictFind(d, key) == NULL);
+        sdsfree(key);
+    }
+    end_benchmark("missing keys");
+
+    start_benchmark();
+    for (j = 0; j < count; j++) {
+        assert(dictGetRandomKey(d) != NULL);
+    }
+    end_benchmark("random keys");
+
+    start_benchmark();
+    cursor = 0;
+    do {
+        cursor = dictScan(d, cursor, benchScanCallback, &seen);
+    } while (cursor);
+    assert(seen == count);
+    seen = 0;
+    end_benchmark("scan");
+
+    start_benchmark();
+    di = dictGetSafeIterator(d);
+    while ((de = dictNext(di)) != NULL) {
+        /* Deleting the current entry is allowed with safe iterators. */
+        if (dictGetSignedIntegerVal(de) % 2) {
+            assert(dictDelete(d, dictGetKey(de)) == DICT_OK);
+        }
+        seen++;
+    }
+    dictReleaseIterator(di);
+    assert(seen == count && (long)dictSize(d) == count - count / 2);
+    end_benchmark("iterate and delete odd");
+
+    start_benchmark();
+    for (j = 0; j < count; j++) {
+        sds key = sdsfromlonglong(j);
+        int retval = dictDelete(d, key);
+
+        assert(retval == (j % 2 ? DICT_ERR : DICT_OK));
+        sdsfree(key);
+    }
+    end_benchmark("delete");
+    assert(dictSize(d) == 0);
+    dictRelease(d);
+}
+
+int main(int argc, char** argv)
+{
+    long count = argc > 1 ? strtol(argv[1], NULL, 10) : 5000000;
+
+    if (argc > 2) {
+        benchmark(argv[2], count);
+    } else {
+        benchmark("chained", count);
+        benchmark("open", count);
+    }
+    return 0;
+}
+#endif
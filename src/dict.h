@@ -54,6 +54,18 @@ typedef struct dictEntry {
     struct dictEntry* next;
 } dictEntry;
 
+/* The slots of an open addressing table only hold the key and the value.
+ * They are returned as dictEntry pointers, so they must be accessed with
+ * the dictGet / dictSet macros and never through 'next'. */
+typedef struct dictSlot {
+    void* key;
+    union {
+        void* val;
+        uint64_t u64;
+        int64_t s64;
+    } v;
+} dictSlot;
+
 typedef struct dictType {
     unsigned int (*hashFunction)(const void* key);
     void* (*keyDup)(void* privdata, const void* key);
@@ -70,6 +82,9 @@ typedef struct dictht {
     unsigned long size;
     unsigned long sizemask;
     unsigned long used;
+    dictSlot* slots;        /* Open addressing: slots, then a control byte
+                             * per slot, in a single allocation */
+    unsigned long deleted;  /* Open addressing: deleted entries markers */
 } dictht;
 
 typedef struct dict {
@@ -78,6 +93,7 @@ typedef struct dict {
     dictht ht[2];
     int rehashidx; /* rehashing not in progress if rehashidx == -1 */
     int iterators; /* number of iterators currently running */
+    int open;      /* open addressing table, see dictCreateOpen() */
 } dict;
 
 /* If safe is set to 1 this is a safe iterator, that means, you can call
@@ -91,6 +107,8 @@ typedef struct dictIterator {
     long long fingerprint; /* unsafe iterator fingerprint for misuse detection */
 } dictIterator;
 
+typedef void (dictScanFunction)(void* privdata, const dictEntry* de);
+
 /* This is the initial size of every hash table */
 #define DICT_HT_INITIAL_SIZE     4
 
@@ -139,6 +157,7 @@ typedef struct dictIterator {
 
 /* API */
 dict* dictCreate(dictType* type, void* privDataPtr);
+dict* dictCreateOpen(dictType* type, void* privDataPtr);
 int dictExpand(dict* d, unsigned long size);
 int dictAdd(dict* d, void* key, void* val);
 dictEntry* dictAddRaw(dict* d, void* key);
@@ -155,6 +174,7 @@ dictIterator* dictGetSafeIterator(dict* d);
 dictEntry* dictNext(dictIterator* iter);
 void dictReleaseIterator(dictIterator* iter);
 dictEntry* dictGetRandomKey(dict* d);
+unsigned long dictScan(dict* d, unsigned long v, dictScanFunction* fn, void* privdata);
 void dictPrintStats(dict* d);
 unsigned int dictGenHashFunction(const void* key, int len);
 unsigned int dictGenCaseHashFunction(const unsigned char* buf, int len);
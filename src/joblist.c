@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 
 static int _resizeJobListStart(JobList* this);
@@ -119,8 +120,15 @@ static int _initJobBuff(JobList* this, int listsize)
     int buffsize = listsize + sizeof(JobBuff);
     if (this->mmapFile != NULL) { //mmap
         int existFile = access(this->mmapFile, F_OK) == 0; 
-        int mmapFd = open(this->mmapFile, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-        assert(mmapFd > 0);
+        if (this->mmapFd == -1) {
+            this->mmapFd = open(this->mmapFile, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+            assert(this->mmapFd > 0);
+            if (flock(this->mmapFd, LOCK_EX | LOCK_NB) == -1) {
+                redisLog(REDIS_WARNING, "mmap file %s is used by another process: %s", this->mmapFile, strerror(errno));
+                exit(1);
+            }
+        }
+        int mmapFd = this->mmapFd;
         if (existFile) {
             struct stat s;
             stat(this->mmapFile, &s);
@@ -134,7 +142,6 @@ static int _initJobBuff(JobList* this, int listsize)
         if (!existFile) {
             this->jobbuff->dirtysize = this->jobbuff->wSize = this->jobbuff->rSize = 0;
         }
-        close(mmapFd);
     
     } else { //malloc 
         if (this->jobbuff != NULL) {
@@ -154,6 +161,7 @@ JobList* initJoblist(int maxBufSize, int listsize, const char* mmapFile)
     this->maxBufSize = maxBufSize;
     this->resize = 0;
     this->mmapFile = mmapFile;
+    this->mmapFd = -1;
     this->jobbuff = NULL;
     this->listsize = 0;
     this->listsizeMask = 0;
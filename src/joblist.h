@@ -28,6 +28,7 @@ typedef struct _JobList {
     int listsizeMask;
     int resize;
     const char* mmapFile;
+    int mmapFd;      //持有mmap文件的排他锁, 同一个文件只能被一个进程使用
     JobBuff* jobbuff;
 } JobList;
 
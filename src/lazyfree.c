@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2009-2013, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Lazy freeing of big values.
+ *
+ * Freeing a list, set, sorted set or hash with millions of elements blocks
+ * the server for as long as it takes to release every element. The functions
+ * in this file unlink such values from the keyspace and hand them to the
+ * REDIS_BIO_LAZY_FREE thread of bio.c, which releases the memory while the
+ * main thread keeps serving clients. The memory is still accounted in
+ * used_memory until the background thread actually frees it.
+ *
+ * Reference counts are not atomic, and the elements of an aggregate value
+ * may be shared with the main thread: for instance with the reply list of
+ * a client, with another set after SUNIONSTORE, or with the pending MySQL
+ * writes. The background thread only frees objects it holds the only
+ * references of, every other object is handed back to the main thread that
+ * drops the reference in lazyfreeReleaseShared(). An object whose count is
+ * exactly the number of references held by the detached value can't be
+ * reached by the main thread anymore, so reading its count is safe. */
+
+#include "redis.h"
+#include "mysqlDB.h"
+#include "bio.h"
+
+/* Values with fewer allocations than this are freed synchronously, as
+ * creating the background job would cost more than freeing them. */
+#define LAZYFREE_THRESHOLD 64
+
+static pthread_mutex_t lazyfree_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t lazyfree_objects = 0;     /* Jobs waiting to be processed:
+                                           a value or a whole database. */
+static list* lazyfree_shared = NULL;    /* References to drop in main thread. */
+
+/* Used to release the dictionaries of a value once its elements were
+ * already taken care of one by one. */
+static dictType lazyfreeDictType = {
+    NULL,                       /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    NULL,                       /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/* Return the number of values and databases not yet freed by the background
+ * thread. */
+size_t lazyfreeGetPendingObjectsCount(void)
+{
+    size_t count;
+
+    pthread_mutex_lock(&lazyfree_mutex);
+    count = lazyfree_objects;
+    pthread_mutex_unlock(&lazyfree_mutex);
+    return count;
+}
+
+static void lazyfreeAddPendingObjects(long count)
+{
+    pthread_mutex_lock(&lazyfree_mutex);
+    lazyfree_objects += count;
+    pthread_mutex_unlock(&lazyfree_mutex);
+}
+
+/* Return the amount of work needed in order to free an object: the number
+ * of allocations of aggregate values, 1 for everything else. */
+static size_t lazyfreeGetFreeEffort(robj* o)
+{
+    if (o->type == REDIS_LIST && o->encoding == REDIS_ENCODING_QUICKLIST) {
+        return ((quicklist*)o->ptr)->len;
+    } else if (o->type == REDIS_SET && o->encoding == REDIS_ENCODING_HT) {
+        return dictSize((dict*)o->ptr);
+    } else if (o->type == REDIS_ZSET && o->encoding == REDIS_ENCODING_SKIPLIST) {
+        return ((zset*)o->ptr)->zsl->length;
+    } else if (o->type == REDIS_HASH && o->encoding == REDIS_ENCODING_HT) {
+        return dictSize((dict*)o->ptr);
+    } else {
+        return 1;
+    }
+}
+
+/* Delete a key, value, and associated expiration entry if any, from the DB.
+ * If the value is big enough it is freed by the lazyfree thread, otherwise
+ * this works exactly like dbSyncDelete(). */
+int dbAsyncDelete(redisDb* db, robj* key)
+{
+    dictEntry* de;
+
+    if (dictSize(server.readPrefetched) > 0) {
+        readPrefetchForget(db, key->ptr);
+    }
+    if (dictSize(db->expires) > 0) {
+        dictDelete(db->expires, key->ptr);
+    }
+
+    /* Replace the value with NULL, that the dictionary destructor skips,
+     * so that only the key is freed by dictDelete(). */
+    de = dictFind(db->dict, key->ptr);
+    if (de) {
+        robj* val = dictGetVal(de);
+
+        if (val->refcount == 1 && lazyfreeGetFreeEffort(val) > LAZYFREE_THRESHOLD) {
+            lazyfreeAddPendingObjects(1);
+            bioCreateBackgroundJob(REDIS_BIO_LAZY_FREE, val, NULL, NULL);
+            dictSetVal(db->dict, de, NULL);
+        }
+    }
+    if (dictDelete(db->dict, key->ptr) == DICT_OK) {
+        lookupTableStats(key->ptr, 1)->keys--;
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Drop a reference to an object no longer referenced by the keyspace,
+ * freeing it in the background when it is big. */
+void freeObjAsync(robj* o)
+{
+    if (o->refcount == 1 && lazyfreeGetFreeEffort(o) > LAZYFREE_THRESHOLD) {
+        lazyfreeAddPendingObjects(1);
+        bioCreateBackgroundJob(REDIS_BIO_LAZY_FREE, o, NULL, NULL);
+    } else {
+        decrRefCount(o);
+    }
+}
+
+/* Empty a Redis DB asynchronously: new empty dictionaries are installed
+ * and the old ones are freed by the lazyfree thread. */
+void emptyDbAsync(redisDb* db)
+{
+    dict* oldht1 = db->dict, *oldht2 = db->expires;
+
+    if (server.keyspace_open_addressing) {
+        db->dict = dictCreateOpen(&dbDictType, NULL);
+        db->expires = dictCreateOpen(&keyptrDictType, NULL);
+    } else {
+        db->dict = dictCreate(&dbDictType, NULL);
+        db->expires = dictCreate(&keyptrDictType, NULL);
+    }
+    lazyfreeAddPendingObjects(1);
+    bioCreateBackgroundJob(REDIS_BIO_LAZY_FREE, NULL, oldht1, oldht2);
+}
+
+/* Drop the references handed back by the lazyfree thread. Called by
+ * serverCron(). */
+void lazyfreeReleaseShared(void)
+{
+    list* shared;
+    listNode* ln;
+
+    pthread_mutex_lock(&lazyfree_mutex);
+    shared = lazyfree_shared;
+    lazyfree_shared = NULL;
+    pthread_mutex_unlock(&lazyfree_mutex);
+    if (shared == NULL) {
+        return;
+    }
+    while ((ln = listFirst(shared)) != NULL) {
+        decrRefCount(listNodeValue(ln));
+        listDelNode(shared, ln);
+    }
+    listRelease(shared);
+}
+
+/* ----------------------------- Lazyfree thread ---------------------------- */
+
+static void lazyfreeReleaseObject(robj* o, int refs);
+
+/* Hand 'refs' references of an object still shared with the main thread
+ * back to it. */
+static void lazyfreeDefer(robj* o, int refs)
+{
+    pthread_mutex_lock(&lazyfree_mutex);
+    if (lazyfree_shared == NULL) {
+        lazyfree_shared = listCreate();
+    }
+    while (refs--) {
+        listAddNodeTail(lazyfree_shared, o);
+    }
+    pthread_mutex_unlock(&lazyfree_mutex);
+}
+
+/* Release every element of a dictionary of objects and then the dictionary
+ * itself. */
+static void lazyfreeReleaseDict(dict* d, int keys, int vals)
+{
+    dictIterator* di = dictGetIterator(d);
+    dictEntry* de;
+
+    while ((de = dictNext(di)) != NULL) {
+        if (keys) {
+            lazyfreeReleaseObject(dictGetKey(de), 1);
+        }
+        if (vals) {
+            lazyfreeReleaseObject(dictGetVal(de), 1);
+        }
+    }
+    dictReleaseIterator(di);
+    d->type = &lazyfreeDictType;
+    dictRelease(d);
+}
+
+/* The background counterpart of decrRefCount() for 'refs' references held
+ * by a detached value. */
+static void lazyfreeReleaseObject(robj* o, int refs)
+{
+    if (o->refcount != refs) {
+        lazyfreeDefer(o, refs);
+        return;
+    }
+
+    switch (o->type) {
+        case REDIS_STRING:
+            freeStringObject(o);
+            break;
+        case REDIS_LIST:
+            /* List entries are stored by value, there are no shared objects
+             * to release. */
+            freeListObject(o);
+            break;
+        case REDIS_SET:
+            if (o->encoding == REDIS_ENCODING_HT) {
+                lazyfreeReleaseDict(o->ptr, 1, 0);
+            } else {
+                freeSetObject(o);
+            }
+            break;
+        case REDIS_ZSET:
+            if (o->encoding == REDIS_ENCODING_SKIPLIST) {
+                zset* zs = o->ptr;
+                zskiplistNode* node = zs->zsl->header->level[0].forward, *next;
+
+                /* Every element is referenced by both the dictionary and
+                 * the skiplist. */
+                zs->dict->type = &lazyfreeDictType;
+                dictRelease(zs->dict);
+                zfree(zs->zsl->header);
+                while (node) {
+                    next = node->level[0].forward;
+                    lazyfreeReleaseObject(node->obj, 2);
+                    zfree(node);
+                    node = next;
+                }
+                zfree(zs->zsl);
+                zfree(zs);
+            } else {
+                freeZsetObject(o);
+            }
+            break;
+        case REDIS_HASH:
+            if (o->encoding == REDIS_ENCODING_HT) {
+                lazyfreeReleaseDict(o->ptr, 1, 1);
+            } else {
+                freeHashObject(o);
+            }
+            break;
+        default:
+            redisPanic("Unknown object type");
+            break;
+    }
+    zfree(o);
+}
+
+/* Release objects from the lazyfree thread. It's just decrRefCount()
+ * updating the count of objects to release. */
+void lazyfreeFreeObjectFromBioThread(robj* o)
+{
+    lazyfreeReleaseObject(o, 1);
+    lazyfreeAddPendingObjects(-1);
+}
+
+/* Release a database from the lazyfree thread. The expires dictionary only
+ * references the keys of the main dictionary, so it is released first. */
+void lazyfreeFreeDatabaseFromBioThread(dict* ht1, dict* ht2)
+{
+    dictIterator* di;
+    dictEntry* de;
+
+    dictRelease(ht2);
+    di = dictGetIterator(ht1);
+    while ((de = dictNext(di)) != NULL) {
+        sdsfree(dictGetKey(de));
+        lazyfreeReleaseObject(dictGetVal(de), 1);
+    }
+    dictReleaseIterator(di);
+    ht1->type = &lazyfreeDictType;
+    dictRelease(ht1);
+    lazyfreeAddPendingObjects(-1);
+}
@@ -28,6 +28,7 @@
  */
 
 #include "redis.h"
+#include "persistence.h"
 
 /* ================================ MULTI/EXEC ============================== */
 
@@ -178,6 +179,9 @@ void execCommand(redisClient* c)
     c->argv = orig_argv;
     c->argc = orig_argc;
     c->cmd = orig_cmd;
+    if (pmgr != NULL) {
+        flushPersistenceMulti();
+    }
     discardTransaction(c);
     /* Make sure the EXEC command will be propagated as well if MULTI
      * was already propagated. */
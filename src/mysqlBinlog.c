@@ -0,0 +1,673 @@
+/* binlog失效: 每个MySQL分片一个线程, 以从库的身份读取row格式的binlog, 把其它服务
+ * (管理后台, 批处理任务等)修改的行转换成 "tablename_ID" 形式的key, 由主线程在serverCron中
+ * 分批删除, 下次访问时重新回源读取; 开启binlog_refresh时字符串立即重新读取.
+ *
+ * redisDB自己的连接在建立时登记thread_id, 事务开始的BEGIN事件中带有执行它的thread_id,
+ * 据此跳过redisDB自己写入的事务. 只识别redisDB建的表: 前两列为 `_PID`, `ID`,
+ * INCR_TAB的第二列为完整的key. 需要MySQL开启 binlog_format=ROW. */
+
+#include "redis.h"
+#include "mysqlDB.h"
+#include "persistence.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define BINLOG_MAX_TABLE_MAPS 256
+#define BINLOG_MAX_TXN_KEYS 10000     /* 超过后不再等待事务结束, 先提交已收集的key */
+#define BINLOG_BATCH_KEYS 1000        /* 主线程每次最多处理的key数 */
+#define BINLOG_RECONNECT_DELAY 1
+
+/* binlog v4事件 */
+#define BINLOG_HEADER_LEN 19
+#define BINLOG_CHECKSUM_LEN 4
+#define BINLOG_QUERY_EVENT 2
+#define BINLOG_ROTATE_EVENT 4
+#define BINLOG_XID_EVENT 16
+#define BINLOG_TABLE_MAP_EVENT 19
+#define BINLOG_WRITE_ROWS_EVENT_V1 23
+#define BINLOG_UPDATE_ROWS_EVENT_V1 24
+#define BINLOG_DELETE_ROWS_EVENT_V1 25
+#define BINLOG_WRITE_ROWS_EVENT 30
+#define BINLOG_UPDATE_ROWS_EVENT 31
+#define BINLOG_DELETE_ROWS_EVENT 32
+
+/* 列类型, 只需要能跳过redisDB建表用到的类型 */
+#define BINLOG_TYPE_TINY 1
+#define BINLOG_TYPE_SHORT 2
+#define BINLOG_TYPE_LONG 3
+#define BINLOG_TYPE_FLOAT 4
+#define BINLOG_TYPE_DOUBLE 5
+#define BINLOG_TYPE_LONGLONG 8
+#define BINLOG_TYPE_INT24 9
+#define BINLOG_TYPE_VARCHAR 15
+#define BINLOG_TYPE_BLOB 252
+#define BINLOG_TYPE_VAR_STRING 253
+#define BINLOG_TYPE_STRING 254
+
+typedef struct _BinlogTable {
+    unsigned long long tableId;
+    char table[MAX_TABLE_LEN + 1];
+    int incr;                     /* INCR_TAB, 第二列是完整的key */
+    int columnNum;
+    unsigned char* types;
+    unsigned int* meta;
+} BinlogTable;
+
+typedef struct _BinlogReader {
+    int shard;
+    MYSQL* conn;
+    char file[256];
+    unsigned long long pos;       /* 最近一个完整事务之后的位置, 重连时从这里开始 */
+    int checksum;                 /* 事件末尾带有CRC32 */
+    int own;                      /* 当前事务由redisDB自己写入 */
+    list* keys;                   /* 当前事务修改的key */
+    BinlogTable tables[BINLOG_MAX_TABLE_MAPS];
+    int tableNum;
+    volatile long long events;
+    volatile long long ownTxns;
+    volatile time_t lastEventTime;
+} BinlogReader;
+
+static BinlogReader* _readers[MAX_DB_SHARD_NUM];
+static int _readerNum = 0;
+/* binlog线程提交, 主线程取出的key */
+static list* _invalidKeys = NULL;
+static pthread_mutex_t _invalidLock = PTHREAD_MUTEX_INITIALIZER;
+static long long _queuedKeys = 0;
+static long long _invalidatedKeys = 0;
+static long long _refreshedKeys = 0;
+
+static void* _binlogMain(void* arg);
+static int _binlogConnect(BinlogReader* this);
+static int _binlogOpen(BinlogReader* this);
+static int _binlogFetch(BinlogReader* this, const unsigned char** buf, unsigned long* size);
+static void _binlogEvent(BinlogReader* this, const unsigned char* buf, unsigned long len);
+static void _tableMapEvent(BinlogReader* this, const unsigned char* p, const unsigned char* end);
+static void _rowsEvent(BinlogReader* this, int type, const unsigned char* p, const unsigned char* end);
+static const unsigned char* _rowImage(BinlogReader* this, BinlogTable* t, const unsigned char* present,
+                                      const unsigned char* p, const unsigned char* end);
+static int _columnLen(int type, unsigned int meta, const unsigned char* p, const unsigned char* end);
+static unsigned long long _packedInt(const unsigned char** p, const unsigned char* end);
+static unsigned long long _uint(const unsigned char* p, int n);
+static void _addKey(BinlogReader* this, const char* table, const char* ID, int IDLen);
+static void _commitTxn(BinlogReader* this);
+static void _clearTables(BinlogReader* this);
+static void _emptyKeys(BinlogReader* this);
+
+int initBinlogReaders(void)
+{
+#ifndef HAVE_MYSQL_BINLOG
+    redisLog(REDIS_WARNING, "binlog_invalidation requires the MySQL 5.7.5+ client library");
+    return DB_RET_NOT_SUPPORT;
+#endif
+    _invalidKeys = listCreate();
+    listSetFreeMethod(_invalidKeys, (void (*)(void*))sdsfree);
+    int i = 0;
+    for (; i < dbShardNum(); i++) {
+        BinlogReader* this = (BinlogReader*)zcalloc(sizeof(BinlogReader));
+        this->shard = i;
+        this->keys = listCreate();
+        listSetFreeMethod(this->keys, (void (*)(void*))sdsfree);
+        if (_binlogConnect(this) != DB_RET_SUCCESS) {
+            return DB_RET_CONNERROR;
+        }
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, _binlogMain, this) != 0) {
+            return DB_RET_DBINITERROR;
+        }
+        _readers[_readerNum++] = this;
+    }
+    return DB_RET_SUCCESS;
+}
+
+/* 第一次连接时从当前位置开始, 重连时从上次完整事务之后开始 */
+static int _binlogConnect(BinlogReader* this)
+{
+    DBShard* shard = dbShard(this->shard);
+    if (this->conn != NULL) {
+        mysql_close(this->conn);
+    }
+    this->conn = mysql_init(NULL);
+    if (this->conn == NULL || !mysql_real_connect(this->conn, shard->host, shard->user, shard->pwd, shard->dbName, shard->port, NULL, 0)) {
+        redisLog(REDIS_WARNING, "binlog connect shard %d error, %s", this->shard, this->conn ? mysql_error(this->conn) : "");
+        return DB_RET_CONNERROR;
+    }
+    MYSQL_RES* res;
+    MYSQL_ROW row;
+    if (this->file[0] == '\0') {
+        if (mysql_query(this->conn, "SHOW MASTER STATUS") != 0 || (res = mysql_store_result(this->conn)) == NULL) {
+            redisLog(REDIS_WARNING, "binlog SHOW MASTER STATUS on shard %d error, %s", this->shard, mysql_error(this->conn));
+            return DB_RET_CONNERROR;
+        }
+        if ((row = mysql_fetch_row(res)) == NULL) {
+            redisLog(REDIS_WARNING, "binlog is not enabled on shard %d", this->shard);
+            mysql_free_result(res);
+            return DB_RET_NOT_SUPPORT;
+        }
+        snprintf(this->file, sizeof(this->file), "%s", row[0]);
+        this->pos = strtoull(row[1], NULL, 10);
+        mysql_free_result(res);
+    }
+    /* 声明能处理校验和, 否则开启了binlog_checksum的MySQL会拒绝dump */
+    this->checksum = 0;
+    if (mysql_query(this->conn, "SET @master_binlog_checksum = @@global.binlog_checksum") == 0
+        && mysql_query(this->conn, "SELECT @@global.binlog_checksum") == 0
+        && (res = mysql_store_result(this->conn)) != NULL) {
+        if ((row = mysql_fetch_row(res)) != NULL && row[0] != NULL) {
+            this->checksum = strcasecmp(row[0], "NONE") != 0;
+        }
+        mysql_free_result(res);
+    }
+    if (_binlogOpen(this) != 0) {
+        redisLog(REDIS_WARNING, "binlog dump %s:%llu on shard %d error, %s", this->file, this->pos, this->shard, mysql_error(this->conn));
+        return DB_RET_CONNERROR;
+    }
+    _emptyKeys(this);
+    this->own = 0;
+    _clearTables(this);
+    redisLog(REDIS_NOTICE, "binlog of shard %d from %s:%llu", this->shard, this->file, this->pos);
+    return DB_RET_SUCCESS;
+}
+
+static void* _binlogMain(void* arg)
+{
+    BinlogReader* this = (BinlogReader*)arg;
+    mysql_thread_init();
+    while (1) {
+        const unsigned char* buf;
+        unsigned long size;
+        if (_binlogFetch(this, &buf, &size) != 0 || size == 0) {
+            redisLog(REDIS_WARNING, "binlog of shard %d interrupted, %s", this->shard, mysql_error(this->conn));
+            do {
+                sleep(BINLOG_RECONNECT_DELAY);
+            } while (_binlogConnect(this) != DB_RET_SUCCESS);
+            continue;
+        }
+        /* 第一个字节是OK包的标记 */
+        unsigned long len = size - 1;
+        if (len < BINLOG_HEADER_LEN) {
+            continue;
+        }
+        if (this->checksum && len >= BINLOG_HEADER_LEN + BINLOG_CHECKSUM_LEN) {
+            len -= BINLOG_CHECKSUM_LEN;
+        }
+        _binlogEvent(this, buf + 1, len);
+    }
+    return NULL;
+}
+
+/* 只有这两个函数直接使用客户端库的binlog接口, 没有时返回失败, initBinlogReaders会先拒绝启动 */
+static int _binlogOpen(BinlogReader* this)
+{
+#ifdef HAVE_MYSQL_BINLOG
+    MYSQL_RPL rpl;
+    memset(&rpl, 0, sizeof(rpl));
+    rpl.file_name_length = strlen(this->file);
+    rpl.file_name = this->file;
+    rpl.start_position = this->pos;
+    rpl.server_id = server.binlogServerId;
+    return mysql_binlog_open(this->conn, &rpl);
+#else
+    (void)this;
+    return -1;
+#endif
+}
+
+static int _binlogFetch(BinlogReader* this, const unsigned char** buf, unsigned long* size)
+{
+#ifdef HAVE_MYSQL_BINLOG
+    MYSQL_RPL rpl;
+    memset(&rpl, 0, sizeof(rpl));
+    if (mysql_binlog_fetch(this->conn, &rpl) != 0) {
+        return -1;
+    }
+    *buf = rpl.buffer;
+    *size = rpl.size;
+    return 0;
+#else
+    (void)this;
+    *buf = NULL;
+    *size = 0;
+    return -1;
+#endif
+}
+
+static void _binlogEvent(BinlogReader* this, const unsigned char* buf, unsigned long len)
+{
+    int type = buf[4];
+    const unsigned char* end = buf + len;
+    const unsigned char* p = buf + BINLOG_HEADER_LEN;
+    unsigned long long logPos = _uint(buf + 13, 4);
+    this->events++;
+    this->lastEventTime = (time_t)_uint(buf, 4);
+
+    switch (type) {
+        case BINLOG_ROTATE_EVENT:
+            if (end - p >= 8) {
+                int n = (int)(end - p - 8);
+                if (n >= (int)sizeof(this->file)) {
+                    n = sizeof(this->file) - 1;
+                }
+                memcpy(this->file, p + 8, n);
+                this->file[n] = '\0';
+                this->pos = _uint(p, 8);
+                _clearTables(this);
+            }
+            break;
+        case BINLOG_QUERY_EVENT:
+            /* 事务以BEGIN开始, 非事务表以COMMIT结束; post-header: thread_id, exec_time, db_len, error_code, status_vars_len */
+            if (end - p >= 13) {
+                unsigned long threadId = (unsigned long)_uint(p, 4);
+                int dbLen = p[8];
+                int statusLen = (int)_uint(p + 11, 2);
+                const unsigned char* query = p + 13 + statusLen + dbLen + 1;
+                int queryLen = query < end ? (int)(end - query) : 0;
+                if (queryLen == 5 && !strncasecmp((const char*)query, "BEGIN", 5)) {
+                    DBShard* shard = dbShard(this->shard);
+                    _emptyKeys(this);
+                    this->own = isOwnDBThread(shard->host, shard->port, threadId);
+                } else if (queryLen == 6 && !strncasecmp((const char*)query, "COMMIT", 6)) {
+                    _commitTxn(this);
+                    if (logPos) {
+                        this->pos = logPos;
+                    }
+                }
+            }
+            break;
+        case BINLOG_XID_EVENT:
+            _commitTxn(this);
+            if (logPos) {
+                this->pos = logPos;
+            }
+            break;
+        case BINLOG_TABLE_MAP_EVENT:
+            _tableMapEvent(this, p, end);
+            break;
+        case BINLOG_WRITE_ROWS_EVENT_V1:
+        case BINLOG_UPDATE_ROWS_EVENT_V1:
+        case BINLOG_DELETE_ROWS_EVENT_V1:
+        case BINLOG_WRITE_ROWS_EVENT:
+        case BINLOG_UPDATE_ROWS_EVENT:
+        case BINLOG_DELETE_ROWS_EVENT:
+            if (!this->own) {
+                _rowsEvent(this, type, p, end);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* post-header: table_id(6) flags(2); body: db, table, 列数, 列类型, 元数据 */
+static void _tableMapEvent(BinlogReader* this, const unsigned char* p, const unsigned char* end)
+{
+    if (end - p < 10) {
+        return;
+    }
+    unsigned long long tableId = _uint(p, 6);
+    p += 8;
+    int dbLen = *p++;
+    if (p + dbLen + 2 > end) {
+        return;
+    }
+    const char* db = (const char*)p;
+    p += dbLen + 1;
+    int tableLen = *p++;
+    if (p + tableLen + 1 > end || tableLen > MAX_TABLE_LEN || strchr(dbShard(this->shard)->dbName, '\0') - dbShard(this->shard)->dbName != dbLen
+        || strncmp(db, dbShard(this->shard)->dbName, dbLen) != 0) {
+        return;
+    }
+    const char* table = (const char*)p;
+    p += tableLen + 1;
+    int columnNum = (int)_packedInt(&p, end);
+    if (columnNum < 2 || p + columnNum > end) {
+        return;
+    }
+    const unsigned char* types = p;
+    p += columnNum;
+    _packedInt(&p, end);
+
+    BinlogTable* t = NULL;
+    int i = 0;
+    for (; i < this->tableNum; i++) {
+        if (this->tables[i].tableId == tableId) {
+            t = &this->tables[i];
+            break;
+        }
+    }
+    if (t == NULL) {
+        if (this->tableNum == BINLOG_MAX_TABLE_MAPS) {
+            _clearTables(this);
+        }
+        t = &this->tables[this->tableNum++];
+    } else {
+        zfree(t->types);
+        zfree(t->meta);
+    }
+    t->tableId = tableId;
+    memcpy(t->table, table, tableLen);
+    t->table[tableLen] = '\0';
+    t->incr = !strcmp(t->table, "INCR_TAB");
+    t->columnNum = columnNum;
+    t->types = (unsigned char*)zmalloc(columnNum);
+    memcpy(t->types, types, columnNum);
+    t->meta = (unsigned int*)zcalloc(sizeof(unsigned int) * columnNum);
+    for (i = 0; i < columnNum && p < end; i++) {
+        switch (types[i]) {
+            case BINLOG_TYPE_FLOAT:
+            case BINLOG_TYPE_DOUBLE:
+            case BINLOG_TYPE_BLOB:
+                t->meta[i] = *p++;
+                break;
+            case BINLOG_TYPE_VARCHAR:
+            case BINLOG_TYPE_VAR_STRING:
+                t->meta[i] = (unsigned int)_uint(p, 2);
+                p += 2;
+                break;
+            case BINLOG_TYPE_STRING:
+                t->meta[i] = (p[0] << 8) | p[1];
+                p += 2;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* post-header: table_id(6) flags(2) [v2: extra_len(2) extra]; body: 列数, 列位图, [UPDATE: 新值列位图], 行 */
+static void _rowsEvent(BinlogReader* this, int type, const unsigned char* p, const unsigned char* end)
+{
+    if (end - p < 8) {
+        return;
+    }
+    unsigned long long tableId = _uint(p, 6);
+    p += 8;
+    if (type >= BINLOG_WRITE_ROWS_EVENT) {
+        if (end - p < 2) {
+            return;
+        }
+        p += _uint(p, 2);
+    }
+    BinlogTable* t = NULL;
+    int i = 0;
+    for (; i < this->tableNum; i++) {
+        if (this->tables[i].tableId == tableId) {
+            t = &this->tables[i];
+            break;
+        }
+    }
+    if (t == NULL || p >= end) {
+        return;
+    }
+    int columnNum = (int)_packedInt(&p, end);
+    int bitmapLen = (columnNum + 7) / 8;
+    int update = type == BINLOG_UPDATE_ROWS_EVENT || type == BINLOG_UPDATE_ROWS_EVENT_V1;
+    if (columnNum != t->columnNum || p + bitmapLen * (update ? 2 : 1) > end) {
+        return;
+    }
+    const unsigned char* before = p;
+    p += bitmapLen;
+    const unsigned char* after = before;
+    if (update) {
+        after = p;
+        p += bitmapLen;
+    }
+    while (p != NULL && p < end) {
+        p = _rowImage(this, t, before, p, end);
+        if (update && p != NULL && p < end) {
+            p = _rowImage(this, t, after, p, end);
+        }
+    }
+}
+
+/* 解析一行, 取出第二列作为ID(INCR_TAB为key), 返回下一行的位置, 无法解析时返回NULL */
+static const unsigned char* _rowImage(BinlogReader* this, BinlogTable* t, const unsigned char* present,
+                                      const unsigned char* p, const unsigned char* end)
+{
+    int presentNum = 0;
+    int i = 0;
+    for (; i < t->columnNum; i++) {
+        presentNum += (present[i / 8] >> (i % 8)) & 1;
+    }
+    const unsigned char* nulls = p;
+    p += (presentNum + 7) / 8;
+    int n = 0;
+    for (i = 0; i < t->columnNum && p <= end; i++) {
+        if (!((present[i / 8] >> (i % 8)) & 1)) {
+            continue;
+        }
+        int isNull = (nulls[n / 8] >> (n % 8)) & 1;
+        n++;
+        if (isNull) {
+            continue;
+        }
+        int len = _columnLen(t->types[i], t->meta[i], p, end);
+        if (len < 0 || p + len > end) {
+            return NULL;
+        }
+        if (i == 1) {
+            if (t->types[i] == BINLOG_TYPE_STRING || t->types[i] == BINLOG_TYPE_VARCHAR) {
+                /* INCR_TAB的完整key, 或者字符串类型的ID */
+                int prefix = 1 + p[0] == len ? 1 : 2;
+                _addKey(this, t->incr ? NULL : t->table, (const char*)p + prefix, len - prefix);
+            } else if (!t->incr && t->types[i] == BINLOG_TYPE_LONG) {
+                char ID[16];
+                int IDLen = ll2string(ID, sizeof(ID), (long long)(int)_uint(p, 4));
+                _addKey(this, t->table, ID, IDLen);
+            }
+        }
+        p += len;
+    }
+    return p;
+}
+
+/* 列值占用的字节数, 包括长度前缀; 不支持的类型返回-1 */
+static int _columnLen(int type, unsigned int meta, const unsigned char* p, const unsigned char* end)
+{
+    switch (type) {
+        case BINLOG_TYPE_TINY:
+            return 1;
+        case BINLOG_TYPE_SHORT:
+            return 2;
+        case BINLOG_TYPE_INT24:
+            return 3;
+        case BINLOG_TYPE_LONG:
+        case BINLOG_TYPE_FLOAT:
+            return 4;
+        case BINLOG_TYPE_LONGLONG:
+        case BINLOG_TYPE_DOUBLE:
+            return 8;
+        case BINLOG_TYPE_BLOB:
+            if (meta < 1 || meta > 4 || p + meta > end) {
+                return -1;
+            }
+            return (int)(meta + _uint(p, meta));
+        case BINLOG_TYPE_VARCHAR:
+        case BINLOG_TYPE_VAR_STRING:
+            if (meta < 256) {
+                return p + 1 > end ? -1 : 1 + p[0];
+            }
+            return p + 2 > end ? -1 : (int)(2 + _uint(p, 2));
+        case BINLOG_TYPE_STRING: {
+            /* 元数据的高位字节是实际类型, 最大长度超过255时借用了其中两位 */
+            unsigned int realType = meta >> 8;
+            unsigned int maxLen = meta & 0xff;
+            if ((realType & 0x30) != 0x30) {
+                maxLen |= ((realType & 0x30) ^ 0x30) << 4;
+            }
+            if (maxLen < 256) {
+                return p + 1 > end ? -1 : 1 + p[0];
+            }
+            return p + 2 > end ? -1 : (int)(2 + _uint(p, 2));
+        }
+        default:
+            return -1;
+    }
+}
+
+static unsigned long long _packedInt(const unsigned char** pp, const unsigned char* end)
+{
+    const unsigned char* p = *pp;
+    if (p >= end) {
+        return 0;
+    }
+    unsigned long long v;
+    int n;
+    if (p[0] < 251) {
+        v = p[0];
+        n = 1;
+    } else if (p[0] == 252) {
+        v = _uint(p + 1, 2);
+        n = 3;
+    } else if (p[0] == 253) {
+        v = _uint(p + 1, 3);
+        n = 4;
+    } else {
+        v = _uint(p + 1, 8);
+        n = 9;
+    }
+    *pp = p + n;
+    return v;
+}
+
+/* 小端无符号整数 */
+static unsigned long long _uint(const unsigned char* p, int n)
+{
+    unsigned long long v = 0;
+    while (n-- > 0) {
+        v = (v << 8) | p[n];
+    }
+    return v;
+}
+
+/* table为NULL时ID是完整的key */
+static void _addKey(BinlogReader* this, const char* table, const char* ID, int IDLen)
+{
+    sds key = table == NULL ? sdsnewlen(ID, IDLen) : sdscatlen(sdscatprintf(sdsempty(), "%s_", table), ID, IDLen);
+    listAddNodeTail(this->keys, key);
+    /* ID为0的行也对应不带ID的key */
+    if (table != NULL && IDLen == 1 && ID[0] == '0') {
+        listAddNodeTail(this->keys, sdsnew(table));
+    }
+    if (listLength(this->keys) >= BINLOG_MAX_TXN_KEYS) {
+        _commitTxn(this);
+    }
+}
+
+static void _commitTxn(BinlogReader* this)
+{
+    if (this->own) {
+        this->ownTxns++;
+    }
+    if (listLength(this->keys) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&_invalidLock);
+    listNode* ln;
+    while ((ln = listFirst(this->keys)) != NULL) {
+        listAddNodeTail(_invalidKeys, listNodeValue(ln));
+        listNodeValue(ln) = NULL;
+        listDelNode(this->keys, ln);
+        _queuedKeys++;
+    }
+    pthread_mutex_unlock(&_invalidLock);
+}
+
+static void _emptyKeys(BinlogReader* this)
+{
+    listNode* ln;
+    while ((ln = listFirst(this->keys)) != NULL) {
+        listDelNode(this->keys, ln);
+    }
+}
+
+static void _clearTables(BinlogReader* this)
+{
+    int i = 0;
+    for (; i < this->tableNum; i++) {
+        zfree(this->tables[i].types);
+        zfree(this->tables[i].meta);
+    }
+    this->tableNum = 0;
+}
+
+/* 主线程: 每次最多处理BINLOG_BATCH_KEYS个key. 有未写入MySQL的修改的key以内存为准, 不失效 */
+void binlogInvalidateCron(void)
+{
+    if (_invalidKeys == NULL || listLength(_invalidKeys) == 0) {
+        return;
+    }
+    sds keys[BINLOG_BATCH_KEYS];
+    int num = 0;
+    pthread_mutex_lock(&_invalidLock);
+    listNode* ln;
+    while (num < BINLOG_BATCH_KEYS && (ln = listFirst(_invalidKeys)) != NULL) {
+        keys[num++] = listNodeValue(ln);
+        listNodeValue(ln) = NULL;
+        listDelNode(_invalidKeys, ln);
+    }
+    pthread_mutex_unlock(&_invalidLock);
+
+    robj* refresh[BINLOG_BATCH_KEYS];
+    int j = 0;
+    for (; j < server.dbnum; j++) {
+        redisDb* db = server.db + j;
+        int refreshNum = 0;
+        int i = 0;
+        for (; i < num; i++) {
+            robj* key = createObject(REDIS_STRING, sdsdup(keys[i]));
+            robj* val = lookupKey(db, key);
+            if (val == NULL || hasPendingWrite(key)) {
+                decrRefCount(key);
+                continue;
+            }
+            int str = val->type == REDIS_STRING;
+            dbDelete(db, key);
+            signalModifiedKey(db, key);
+            _invalidatedKeys++;
+            if (server.binlogRefresh && str) {
+                refresh[refreshNum++] = key;
+            } else {
+                decrRefCount(key);
+            }
+        }
+        if (refreshNum > 0) {
+            readStrKeysFromDB(db, refresh, refreshNum, 1);
+            _refreshedKeys += refreshNum;
+            for (i = 0; i < refreshNum; i++) {
+                decrRefCount(refresh[i]);
+            }
+        }
+    }
+    for (j = 0; j < num; j++) {
+        sdsfree(keys[j]);
+    }
+}
+
+sds catBinlogInfo(sds info)
+{
+    if (_invalidKeys == NULL) {
+        return info;
+    }
+    pthread_mutex_lock(&_invalidLock);
+    unsigned long queued = listLength(_invalidKeys);
+    pthread_mutex_unlock(&_invalidLock);
+    info = sdscatprintf(info,
+                        "binlog queued keys :%lld\r\n"
+                        "binlog pending keys :%lu\r\n"
+                        "binlog invalidated keys :%lld\r\n"
+                        "binlog refreshed keys :%lld\r\n",
+                        _queuedKeys, queued, _invalidatedKeys, _refreshedKeys);
+    int i = 0;
+    for (; i < _readerNum; i++) {
+        BinlogReader* this = _readers[i];
+        info = sdscatprintf(info, "binlog shard %d :file=%s,pos=%llu,events=%lld,own_txns=%lld,lag=%ld\r\n",
+                            this->shard, this->file, this->pos, this->events, this->ownTxns,
+                            this->lastEventTime ? (long)(time(NULL) - this->lastEventTime) : -1L);
+    }
+    return info;
+}
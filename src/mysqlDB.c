@@ -1,5 +1,7 @@
 #include "mysqlDB.h"
+#include "persistence.h"
 #include "dict.h"
+#include "lzf.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -8,11 +10,26 @@
 #define LOCK_TABLE_NUM 2048
 #define LOCK_TABLE_NUM_MASK 2047
 
-static DBConn* _readConn;
+static DBShard _shards[MAX_DB_SHARD_NUM];
+static int _shardNum = 1;
+/* 写线程只读, 主线程修改时先写表项再增加个数, 不删除表项 */
+static TableCompress _compressTables[MAX_COMPRESS_TABLES];
+static int _compressTableNum = 0;
+static long long _compressedValues = 0;
+static long long _compressedSaved = 0;
 static pthread_mutex_t _lockTableDict[LOCK_TABLE_NUM];
+/* redisDB自己的连接的thread_id, binlog线程据此跳过自己写入的事务 */
+static unsigned long long _ownDBThreads[MAX_OWN_DB_THREADS];
+static int _ownDBThreadIdx = 0;
+static pthread_mutex_t _ownDBThreadLock = PTHREAD_MUTEX_INITIALIZER;
+static char* _tablePolicyNames[] = {"write-behind", "write-through", "write-around", "cache-only"};
+/* 表名注册表, 只在主线程登记, 写线程只按编号读取 */
+static DBTable* _dbTables[MAX_DB_TABLES];
+static int _dbTableNum = 0;
+static dict* _dbTableIds = NULL;      /* 表名 -> 编号 */
+static int _policyVersion = 1;
 
 static int _query(const char* sql, MYSQL* conn);
-static int _parseKey(const char* key, const int keyLen, char* table, char* ID);
 static int _begin(DBConn* dbConn);
 static int _commit(DBConn* dbConn);
 static int _rollback(DBConn* dbConn);
@@ -20,20 +37,36 @@ static char* _strmov(char* dest, char* src);
 static int _connDB(MYSQL* conn, const char* host, const int port, const char* user, const char* pwd, const char* dbName);
 static int _pingDB(MYSQL* conn);
 static int _lockTable(const char* table);
+static int _lockIndex(const char* table);
 static int _unlockTable(const char* table);
 static int _cmdArgv2int(CmdArgv* argv);
+static int _shardOf(const char* table, const char* ID);
+static DBConn* _shardReadConn(const char* table, const char* ID);
+static DBConn* _keyReadConn(const char* key);
+static int _compressThreshold(const char* table);
+static int _compressVal(int threshold, CmdArgv* val, char* out);
+static int _compress(int threshold, const char* val, unsigned int len, char* out);
+static int _keyCompressThreshold(const DBKey* dbKey);
 
 /* 同步读 */
-static int _selectStrFromDB(redisClient* c);
-static int _loadListFromDB(redisClient* c);
-static int _loadZsetFromDB(redisClient* c);
+static int _loadFromDB(redisClient* c);
+static int _selectStrFromDB(redisClient* c, const DBKey* dbKey);
+static int _selectStrsFromDB(redisDb* db, robj** keys, DBKey* dbKeys, int* shards, int num);
+static ReadPrefetch* _readPrefetchPolicy(const char* table, const char* ID);
+static int _prefetchStrFromDB(redisClient* c, const char* table, const char* ID, ReadPrefetch* pf);
+static void _adjustReadPrefetch(ReadPrefetch* pf);
+static sds _prefetchedName(int dbid, const sds key);
+static int _writeMultiToDB(int argc, CmdArgv** cmdArgvs, DBConn* dbConn);
+static int _applyCmdToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, const JobKey* jobKey, DBConn* dbConn, int time);
+static int _loadListFromDB(redisClient* c, const DBKey* dbKey);
+static int _loadZsetFromDB(redisClient* c, const DBKey* dbKey);
 static int _loadIncrFromDB(redisClient* c);
 static int _clearExpireStrToDB(const char* table, const char* ID);
 
 /* 异步写 */
 static int _popListToDB(const char* table, const char* ID, int where, DBConn* dbConn);
 static int _pushListToDB(const char* table, const char* ID, CmdArgv* val, int where, int createNotExist, DBConn* dbConn);
-static int _writeStrToDB(const char* table, const char* ID, CmdArgv* val, int expireat, DBConn* dbConn);
+static int _writeStrToDB(const char* table, const char* ID, CmdArgv* val, int expireat, int compressThreshold, DBConn* dbConn);
 static int _expireat(const char* table, const char* ID, int expireat, DBConn* dbConn);
 static int _zaddToDB(const char* table, const char* ID, CmdArgv* score, CmdArgv* member, int incr, DBConn* dbConn);
 static int _incrToDB(CmdArgv* key, CmdArgv* incr, DBConn* dbConn);
@@ -43,11 +76,40 @@ static int _createStrTable(const char* table, DBConn* dbConn);
 static int _createListTable(const char* table, DBConn* dbConn);
 static int _createZsetTable(const char* table, DBConn* dbConn);
 static int _createIncrTable(DBConn* dbConn);
+static int _createBulkTable(const char* table, int type, DBConn* dbConn);
+static int _loadData(const char* sql, MYSQL* conn, long long* rows);
 
+/* 分片0使用mysql_host等配置, 其余分片由mysql_shard配置, 每个分片一个读连接 */
 int initReadDB(const char* host, const int port, const char* user, const char* pwd, const char* dbName)
 {
-    _readConn = initDB(host, port, user, pwd, dbName);
-    return _readConn != NULL ? DB_RET_SUCCESS : DB_RET_DBINITERROR;
+    int i = 0;
+    setDBShard(0, host, port, user, pwd, dbName);
+    for (; i < _shardNum; i++) {
+        DBShard* shard = &_shards[i];
+        if (shard->host == NULL) {
+            redisLog(REDIS_WARNING, "mysql_shard %d is not configured", i);
+            return DB_RET_DBINITERROR;
+        }
+        shard->readConn = initDB(shard->host, shard->port, shard->user, shard->pwd, shard->dbName);
+        if (shard->readConn == NULL) {
+            redisLog(REDIS_WARNING, "connect mysql_shard %d %s:%d error", i, shard->host, shard->port);
+            return DB_RET_DBINITERROR;
+        }
+    }
+    dictIterator* di = dictGetIterator(server.shardMaps);
+    dictEntry* de;
+    int ret = DB_RET_SUCCESS;
+    while ((de = dictNext(di)) != NULL) {
+        ShardMap* map = dictGetVal(de);
+        for (i = 0; i < map->num; i++) {
+            if (map->shards[i] >= _shardNum) {
+                redisLog(REDIS_WARNING, "shard_map %s uses shard %d which is not configured", (char*)dictGetKey(de), map->shards[i]);
+                ret = DB_RET_DBINITERROR;
+            }
+        }
+    }
+    dictReleaseIterator(di);
+    return ret;
 }
 
 DBConn* initDB(const char* host, const int port, const char* user, const char* pwd, const char* dbName)
@@ -62,6 +124,13 @@ DBConn* initDB(const char* host, const int port, const char* user, const char* p
     return dbConn;
 }
 
+void freeDB(DBConn* dbConn)
+{
+    mysql_close(dbConn->conn);
+    zfree(dbConn->sqlbuff);
+    zfree(dbConn);
+}
+
 static int _begin(DBConn* dbConn)
 {
     return _query("BEGIN", dbConn->conn);
@@ -95,50 +164,217 @@ static int _query(const char* sql, MYSQL* conn)
     return DB_RET_SUCCESS;
 }
 
-static int _parseKey(const char* key, int keyLen, char* table, char* ID)
+/* key不要求以'\0'结尾, 表名或ID超长时返回DB_RET_KEY_TOO_LONG */
+int parseDBKey(const char* key, int keyLen, DBKey* dbKey)
 {
-    int n = 0;
-    while (*(key + n) != '_' && n < keyLen) {
-        *(table + n) = *(key + n);
-        n++;
+    const char* sep = memchr(key, '_', keyLen);
+    int tableLen = sep != NULL ? (int)(sep - key) : keyLen;
+    int IDLen = sep != NULL ? keyLen - tableLen - 1 : 0;
+    if (tableLen > MAX_TABLE_LEN || IDLen > MAX_ID_LEN) {
+        return DB_RET_KEY_TOO_LONG;
     }
-    n++;
-    int j = 0;
-    while (*(key + n) != '_' && n < keyLen) {
-        *(ID + j++) = *(key + n);
-        n++;
+    memcpy(dbKey->table, key, tableLen);
+    dbKey->table[tableLen] = '\0';
+    if (IDLen == 0) {
+        dbKey->ID[0] = '0';
+        dbKey->ID[1] = '\0';
+    } else {
+        memcpy(dbKey->ID, sep + 1, IDLen);
+        dbKey->ID[IDLen] = '\0';
     }
-    if (j == 0) {
-        *ID = '0';
+    dbKey->tableId = -1;
+    dbKey->tableLen = tableLen;
+    dbKey->IDLen = IDLen;
+    dbKey->numeric = string2ll(dbKey->ID, IDLen == 0 ? 1 : IDLen, &dbKey->numID);
+    if (!dbKey->numeric) {
+        dbKey->numID = 0;
     }
-    return j;
+    return DB_RET_SUCCESS;
 }
 
-int writeToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, DBConn* dbConn, int time)
+/* 只在主线程调用, 注册表已满时tableId为-1, 按表名查找的功能不受影响 */
+int registerDBTable(DBKey* dbKey)
 {
-    _pingDB(dbConn->conn);
-    int ret = 0;
-    int i = 0;
+    if (_dbTableIds == NULL) {
+        _dbTableIds = dictCreate(&tablePolicyDictType, NULL);
+    }
+    dictEntry* de = dictFind(_dbTableIds, dbKey->table);
+    if (de != NULL) {
+        dbKey->tableId = (int)dictGetSignedIntegerVal(de);
+        return dbKey->tableId;
+    }
+    if (_dbTableNum == MAX_DB_TABLES) {
+        dbKey->tableId = -1;
+        return -1;
+    }
+    DBTable* t = (DBTable*)zcalloc(sizeof(DBTable));
+    strcpy(t->name, dbKey->table);
+    t->compressThreshold = _compressThreshold(t->name);
+    _dbTables[_dbTableNum] = t;
+    de = dictAddRaw(_dbTableIds, sdsnew(t->name));
+    dictSetSignedIntegerVal(de, _dbTableNum);
+    /* 编号随任务经队列交给写线程, 入队时的同步保证写线程看到完整的表项 */
+    dbKey->tableId = _dbTableNum++;
+    return dbKey->tableId;
+}
 
-    char table[16] = {'\0'};
-    char ID[16] = {'\0'};
-    _parseKey(cmdArgvs[0]->buf, cmdArgvs[0]->len, table, ID);
+DBTable* dbTable(int tableId)
+{
+    return tableId >= 0 && tableId < _dbTableNum ? _dbTables[tableId] : NULL;
+}
+
+/* 按表名查找已注册的表, 没有注册时返回NULL */
+DBTable* findDBTable(const char* table)
+{
+    dictEntry* de = _dbTableIds != NULL ? dictFind(_dbTableIds, table) : NULL;
+    return de != NULL ? _dbTables[dictGetSignedIntegerVal(de)] : NULL;
+}
+
+void packJobKey(const DBKey* dbKey, JobKey* jobKey)
+{
+    jobKey->tableId = dbKey->tableId;
+    jobKey->tableLen = dbKey->tableLen;
+    jobKey->IDLen = dbKey->IDLen;
+    jobKey->numeric = dbKey->numeric;
+    jobKey->reserved = 0;
+    jobKey->numID = dbKey->numID;
+}
+
+/* 按头部中的长度从key中取出表名和ID; 没有头部或长度与key不符时重新解析 */
+int unpackJobKey(const JobKey* jobKey, const CmdArgv* key, DBKey* dbKey)
+{
+    int tableLen = jobKey != NULL ? jobKey->tableLen : 0;
+    int IDLen = jobKey != NULL ? jobKey->IDLen : 0;
+    if (tableLen == 0 || tableLen > MAX_TABLE_LEN || IDLen > MAX_ID_LEN
+        || tableLen + (IDLen ? IDLen + 1 : 0) > key->len) {
+        return parseDBKey(key->buf, key->len, dbKey);
+    }
+    memcpy(dbKey->table, key->buf, tableLen);
+    dbKey->table[tableLen] = '\0';
+    if (IDLen == 0) {
+        dbKey->ID[0] = '0';
+        dbKey->ID[1] = '\0';
+    } else {
+        memcpy(dbKey->ID, key->buf + tableLen + 1, IDLen);
+        dbKey->ID[IDLen] = '\0';
+    }
+    dbKey->tableId = jobKey->tableId;
+    dbKey->tableLen = tableLen;
+    dbKey->IDLen = IDLen;
+    dbKey->numeric = jobKey->numeric;
+    dbKey->numID = jobKey->numID;
+    return DB_RET_SUCCESS;
+}
+
+/* jobKey为任务头部中解析好的第一个key, 可以为NULL */
+int writeToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, const JobKey* jobKey, DBConn* dbConn, int time)
+{
+    if (_pingDB(dbConn->conn) != DB_RET_SUCCESS) {
+        return DB_RET_CONNERROR;
+    }
+    if (proc == execCommand) {
+        return _writeMultiToDB(argc, cmdArgvs, dbConn);
+    }
+    DBKey dbKey;
+    if (needLockTable(proc)) {
+        if (unpackJobKey(jobKey, cmdArgvs[0], &dbKey) != DB_RET_SUCCESS) {
+            return DB_RET_KEY_TOO_LONG;
+        }
+        _lockTable(dbKey.table);
+    }
+    _begin(dbConn);
+    int ret = _applyCmdToDB(argc, cmdArgvs, proc, jobKey, dbConn, time);
+    if (ret != 0) {
+        _rollback(dbConn);
+        if (needLockTable(proc)) {
+            _unlockTable(dbKey.table);
+        }
+        return ret;
+    }
+    _commit(dbConn);
     if (needLockTable(proc)) {
-        _lockTable(table);
+        _unlockTable(dbKey.table);
+    }
+    return DB_RET_SUCCESS;
+}
+
+/* MULTI/EXEC合并的任务, 每个参数是一个完整的子任务, 在同一个事务中写入.
+ * 需要的表锁按下标顺序一次拿齐, 避免两个事务互相等待 */
+static int _writeMultiToDB(int argc, CmdArgv** cmdArgvs, DBConn* dbConn)
+{
+    CmdArgv* subArgvs[MAX_CMD_ARGV];
+    redisCommandProc* subProc;
+    int subTime;
+    long long seq;
+    JobKey subKey;
+    char locks[LOCK_TABLE_NUM] = {0};
+    int ret = DB_RET_SUCCESS;
+    int i = 0;
+    for (; i < argc; i++) {
+        unpackPersistenceJob(cmdArgvs[i]->buf, cmdArgvs[i]->len, subArgvs, &subProc, &subTime, &seq, &subKey);
+        if (needLockTable(subProc)) {
+            DBKey dbKey;
+            if (unpackJobKey(&subKey, subArgvs[0], &dbKey) != DB_RET_SUCCESS) {
+                return DB_RET_KEY_TOO_LONG;
+            }
+            locks[_lockIndex(dbKey.table)] = 1;
+        }
+    }
+    for (i = 0; i < LOCK_TABLE_NUM; i++) {
+        if (locks[i]) {
+            pthread_mutex_lock(&_lockTableDict[i]);
+        }
     }
     _begin(dbConn);
+    for (i = 0; i < argc; i++) {
+        int subArgc = unpackPersistenceJob(cmdArgvs[i]->buf, cmdArgvs[i]->len, subArgvs, &subProc, &subTime, &seq, &subKey);
+        ret = _applyCmdToDB(subArgc, subArgvs, subProc, &subKey, dbConn, subTime);
+        if (ret == DB_RET_NOTRESULT) {
+            ret = DB_RET_SUCCESS; /* 与单独写入时一样不算失败 */
+        } else if (ret != DB_RET_SUCCESS) {
+            break;
+        }
+    }
+    if (ret != DB_RET_SUCCESS) {
+        _rollback(dbConn);
+    } else {
+        _commit(dbConn);
+    }
+    for (i = LOCK_TABLE_NUM - 1; i >= 0; i--) {
+        if (locks[i]) {
+            pthread_mutex_unlock(&_lockTableDict[i]);
+        }
+    }
+    return ret;
+}
+
+/* 执行一条命令对应的SQL, 事务和表锁由调用者负责 */
+static int _applyCmdToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, const JobKey* jobKey, DBConn* dbConn, int time)
+{
+    int ret = 0;
+    int i = 0;
+
+    DBKey dbKey;
+    if (unpackJobKey(jobKey, cmdArgvs[0], &dbKey) != DB_RET_SUCCESS) {
+        return DB_RET_KEY_TOO_LONG;
+    }
+    const char* table = dbKey.table;
+    const char* ID = dbKey.ID;
     if ((proc == setCommand || proc == setnxCommand) && argc == 2) {
-        ret = _writeStrToDB(table, ID, cmdArgvs[1], 0, dbConn);
+        ret = _writeStrToDB(table, ID, cmdArgvs[1], 0, _keyCompressThreshold(&dbKey), dbConn);
     
     } else if ((proc == setexCommand || proc == psetexCommand) && argc == 3) {
-        ret = _writeStrToDB(table, ID, cmdArgvs[2], time + _cmdArgv2int(cmdArgvs[1]), dbConn);
+        ret = _writeStrToDB(table, ID, cmdArgvs[2], time + _cmdArgv2int(cmdArgvs[1]), _keyCompressThreshold(&dbKey), dbConn);
 
     } else if (proc == msetCommand) {
+        /* MSET的每个key单独解析 */
         for (i = 0; i < argc; i += 2) {
-            char table[16] = {'\0'};
-            char ID[16] = {'\0'};
-            _parseKey(cmdArgvs[i]->buf, cmdArgvs[i]->len, table, ID);
-            ret = _writeStrToDB(table, ID, cmdArgvs[i + 1], 0, dbConn);
+            DBKey k;
+            if (parseDBKey(cmdArgvs[i]->buf, cmdArgvs[i]->len, &k) != DB_RET_SUCCESS) {
+                ret = DB_RET_KEY_TOO_LONG;
+                break;
+            }
+            ret = _writeStrToDB(k.table, k.ID, cmdArgvs[i + 1], 0, _keyCompressThreshold(&k), dbConn);
             if (ret != 0) {
                 break;
             }
@@ -194,27 +430,174 @@ int writeToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, DBConn* dbCo
     } else {
         ret = -1;
     }
+    return ret;
+}
 
-    if (ret != 0) {
-        _rollback(dbConn);
-        if (needLockTable(proc)) {
-            _unlockTable(table);
+int readFromDB(redisClient* c)
+{
+    if (tablePolicy(c->argv[1]->ptr) == TABLE_POLICY_CACHE_ONLY) {
+        return DB_RET_NOTRESULT;
+    }
+    return readPendingWrite(c, _loadFromDB);
+}
+
+/* 主线程使用读连接同步写入, 用于write-through的表 */
+int writeSyncToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, const JobKey* jobKey, int time)
+{
+    if (proc != msetCommand || _shardNum == 1) {
+        int shard = dbShardOfKey(cmdArgvs[0]->buf, cmdArgvs[0]->len);
+        return writeToDB(argc, cmdArgvs, proc, jobKey, _shards[shard].readConn, time);
+    }
+    /* MSET的key分布在多个分片时按分片分别写入, 分片之间不保证原子性 */
+    CmdArgv* subArgvs[MAX_CMD_ARGV];
+    char done[MAX_DB_SHARD_NUM] = {0};
+    int i = 0;
+    for (; i < argc; i += 2) {
+        int shard = dbShardOfKey(cmdArgvs[i]->buf, cmdArgvs[i]->len);
+        if (done[shard]) {
+            continue;
         }
-        return ret;
+        int subArgc = 0;
+        int j = i;
+        for (; j < argc; j += 2) {
+            if (dbShardOfKey(cmdArgvs[j]->buf, cmdArgvs[j]->len) == shard) {
+                subArgvs[subArgc++] = cmdArgvs[j];
+                subArgvs[subArgc++] = cmdArgvs[j + 1];
+            }
+        }
+        int ret = writeToDB(subArgc, subArgvs, proc, NULL, _shards[shard].readConn, time);
+        if (ret != DB_RET_SUCCESS && ret != DB_RET_NOTRESULT) {
+            return ret;
+        }
+        done[shard] = 1;
     }
-    _commit(dbConn);
-    if (needLockTable(proc)) {
-        _unlockTable(table);
+    return DB_RET_SUCCESS;
+}
+
+/* 按key中的表名查找持久化策略, 没有配置的表为write-behind */
+int tablePolicy(const char* key)
+{
+    if (dictSize(server.tablePolicies) == 0) {
+        return TABLE_POLICY_WRITE_BEHIND;
+    }
+    char table[MAX_TABLE_LEN + 1] = {'\0'};
+    int n = 0;
+    while (key[n] != '\0' && key[n] != '_') {
+        if (n == MAX_TABLE_LEN) {
+            return TABLE_POLICY_WRITE_BEHIND;
+        }
+        table[n] = key[n];
+        n++;
     }
+    dictEntry* de = dictFind(server.tablePolicies, table);
+    return de != NULL ? (int)dictGetSignedIntegerVal(de) : TABLE_POLICY_WRITE_BEHIND;
+}
+
+/* 按注册表中的编号查找, table_policy变化后第一次查找时刷新缓存 */
+int dbTablePolicy(int tableId)
+{
+    DBTable* t = dbTable(tableId);
+    if (t == NULL) {
+        return TABLE_POLICY_WRITE_BEHIND;
+    }
+    if (t->policyVersion != _policyVersion) {
+        dictEntry* de = dictFind(server.tablePolicies, t->name);
+        t->policy = de != NULL ? (int)dictGetSignedIntegerVal(de) : TABLE_POLICY_WRITE_BEHIND;
+        t->policyVersion = _policyVersion;
+    }
+    return t->policy;
+}
+
+/* server.tablePolicies被整体替换后调用 */
+void tablePoliciesChanged(void)
+{
+    _policyVersion++;
+}
+
+int setTablePolicy(const char* table, const char* policy)
+{
+    int i = 0;
+    int n = sizeof(_tablePolicyNames) / sizeof(char*);
+    for (; i < n; i++) {
+        if (!strcasecmp(policy, _tablePolicyNames[i])) {
+            break;
+        }
+    }
+    if (i == n || strlen(table) > MAX_TABLE_LEN || strchr(table, '_') != NULL) {
+        return DB_RET_NOT_SUPPORT;
+    }
+    dictEntry* de = dictFind(server.tablePolicies, table);
+    if (de == NULL) {
+        de = dictAddRaw(server.tablePolicies, sdsnew(table));
+    }
+    dictSetSignedIntegerVal(de, i);
+    _policyVersion++;
     return DB_RET_SUCCESS;
 }
 
-int readFromDB(redisClient* c)
+const char* tablePolicyName(int policy)
 {
-    _pingDB(_readConn->conn);
-    int keylen = strlen(c->argv[1]->ptr);
-    if (keylen >= MAX_KEY_LEN) {
-        return DB_RET_KEY_TOO_MANY;
+    return _tablePolicyNames[policy];
+}
+
+sds catTablePolicyConfig(sds s)
+{
+    dictIterator* di = dictGetIterator(server.tablePolicies);
+    dictEntry* de;
+    while ((de = dictNext(di)) != NULL) {
+        s = sdscatprintf(s, "%s%s %s", sdslen(s) ? " " : "", (char*)dictGetKey(de),
+                         tablePolicyName((int)dictGetSignedIntegerVal(de)));
+    }
+    dictReleaseIterator(di);
+    return s;
+}
+
+/* 解析命令的key(argv[1]), 一条命令只解析并登记一次, 回源读取和打包任务共用结果.
+ * key过长或ID不是整数时返回NULL, 这样的key不对应MySQL中的行 */
+DBKey* clientDBKey(redisClient* c)
+{
+    if (c->dbkey_arg != c->argv[1]) {
+        int keylen = sdslen(c->argv[1]->ptr);
+        if (c->dbkey == NULL) {
+            c->dbkey = (DBKey*)zmalloc(sizeof(DBKey));
+        }
+        c->dbkey_valid = keylen < MAX_KEY_LEN && parseDBKey(c->argv[1]->ptr, keylen, c->dbkey) == DB_RET_SUCCESS
+                         && c->dbkey->numeric;
+        if (c->dbkey_valid) {
+            registerDBTable(c->dbkey);
+        }
+        c->dbkey_arg = c->argv[1];
+    }
+    return c->dbkey_valid ? c->dbkey : NULL;
+}
+
+/* 写入MySQL的命令中所有key都要是 "表名_整数ID" 的形式, cache-only的表除外 */
+int checkPersistenceKeys(redisClient* c)
+{
+    if (c->cmd->proc != msetCommand) {
+        return clientDBKey(c) != NULL || tablePolicy(c->argv[1]->ptr) == TABLE_POLICY_CACHE_ONLY;
+    }
+    int j = 1;
+    for (; j < c->argc; j += 2) {
+        sds key = c->argv[j]->ptr;
+        DBKey dbKey;
+        if ((sdslen(key) >= MAX_KEY_LEN || parseDBKey(key, sdslen(key), &dbKey) != DB_RET_SUCCESS || !dbKey.numeric)
+            && tablePolicy(key) != TABLE_POLICY_CACHE_ONLY) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int _loadFromDB(redisClient* c)
+{
+    DBKey* dbKeyPtr = clientDBKey(c);
+    if (dbKeyPtr == NULL) {
+        return DB_RET_NOTRESULT;
+    }
+    DBKey dbKey = *dbKeyPtr;
+    if (_pingDB(_shardReadConn(dbKey.table, dbKey.ID)->conn) != DB_RET_SUCCESS) {
+        return DB_RET_CONNERROR;
     }
     if (c->cmd->proc == getCommand 
         || c->cmd->proc == setCommand 
@@ -222,7 +605,7 @@ int readFromDB(redisClient* c)
         || c->cmd->proc == psetexCommand
         || c->cmd->proc == setexCommand
     ) {
-        return _selectStrFromDB(c);
+        return _selectStrFromDB(c, &dbKey);
 
     } else if (c->cmd->proc == lpopCommand
                || c->cmd->proc == rpopCommand
@@ -238,7 +621,7 @@ int readFromDB(redisClient* c)
                || c->cmd->proc == lremCommand
                || c->cmd->proc == lsetCommand
               ) {
-        return _loadListFromDB(c);
+        return _loadListFromDB(c, &dbKey);
 
     } else if (c->cmd->proc ==  zrangeCommand
                || c->cmd->proc == zrangebyscoreCommand
@@ -253,8 +636,9 @@ int readFromDB(redisClient* c)
                || c->cmd->proc == zrevrangeCommand
                || c->cmd->proc == zrevrankCommand
                || c->cmd->proc == zscoreCommand
+               || c->cmd->proc == zscanCommand
               ) {
-        return _loadZsetFromDB(c);
+        return _loadZsetFromDB(c, &dbKey);
 
     } else if (c->cmd->proc == incrCommand
                || c->cmd->proc == incrbyCommand
@@ -266,20 +650,86 @@ int readFromDB(redisClient* c)
     }
 }
 
+/* 批量回源读取字符串, keys中每隔step个取一个key, 已在内存中的跳过,
+ * 同一张表同一分片的key合并为一次 WHERE ID IN (...) 查询 */
+int readStrKeysFromDB(redisDb* db, robj** keys, int numkeys, int step)
+{
+    int n = (numkeys + step - 1) / step;
+    robj** misses = (robj**)zmalloc(sizeof(robj*) * n);
+    DBKey* dbKeys = (DBKey*)zmalloc(sizeof(DBKey) * n);
+    int* shards = (int*)zmalloc(sizeof(int) * n);
+    char pinged[MAX_DB_SHARD_NUM] = {0};
+    int num = 0;
+    int ret = DB_RET_SUCCESS;
+    int i = 0;
+    for (; i < numkeys; i += step) {
+        robj* key = keys[i];
+        if (sdslen(key->ptr) >= MAX_KEY_LEN || lookupKey(db, key) != NULL
+            || tablePolicy(key->ptr) == TABLE_POLICY_CACHE_ONLY) {
+            continue;
+        }
+        if (hasPendingWrite(key)) {
+            /* 需要叠加未写入的修改, 单独回源 */
+            redisClient fake;
+            robj* argv[2];
+            argv[0] = argv[1] = key;
+            fake.db = db;
+            fake.argc = 2;
+            fake.argv = argv;
+            fake.cmd = lookupCommandByProc(getCommand);
+            fake.dbkey = NULL;
+            fake.dbkey_arg = NULL;
+            readFromDB(&fake);
+            zfree(fake.dbkey);
+            continue;
+        }
+        misses[num] = key;
+        if (parseDBKey(key->ptr, sdslen(key->ptr), &dbKeys[num]) != DB_RET_SUCCESS || !dbKeys[num].numeric) {
+            continue;
+        }
+        shards[num] = _shardOf(dbKeys[num].table, dbKeys[num].ID);
+        num++;
+    }
+    for (i = 0; i < num; i++) {
+        if (dbKeys[i].table[0] == '\0') {
+            continue; /* 已随前面的同表同分片查询读取 */
+        }
+        if (!pinged[shards[i]]) {
+            if (_pingDB(_shards[shards[i]].readConn->conn) != DB_RET_SUCCESS) {
+                ret = DB_RET_CONNERROR;
+                break;
+            }
+            pinged[shards[i]] = 1;
+        }
+        int r = _selectStrsFromDB(db, misses + i, dbKeys + i, shards + i, num - i);
+        if (r != DB_RET_SUCCESS && r != DB_RET_TABLE_NOTEXIST) {
+            ret = r;
+            break;
+        }
+    }
+    zfree(misses);
+    zfree(dbKeys);
+    zfree(shards);
+    return ret;
+}
+
 static char* _strmov(char* dest, char* src)
 {
     while ((*dest++ = *src++));
     return dest - 1;
 }
 
-static int _selectStrFromDB(redisClient* c)
+static int _selectStrFromDB(redisClient* c, const DBKey* dbKey)
 {
-    MYSQL* conn = _readConn->conn;
-    char* key = c->argv[1]->ptr;
-    char table[16] = {'\0'};
-    char ID[16] = {'\0'};
-    _parseKey(key, strlen(key), table, ID);
-    char* sql = _readConn->sqlbuff;
+    const char* table = dbKey->table;
+    const char* ID = dbKey->ID;
+    ReadPrefetch* pf = _readPrefetchPolicy(table, ID);
+    if (pf != NULL) {
+        return _prefetchStrFromDB(c, table, ID, pf);
+    }
+    DBConn* readConn = _shardReadConn(table, ID);
+    MYSQL* conn = readConn->conn;
+    char* sql = readConn->sqlbuff;
     char* end = _strmov(sql, "SELECT `val`, `expireat` FROM `");
     end += mysql_real_escape_string(conn, end, table, strlen(table));
     end = _strmov(end, "` WHERE `ID` = '");
@@ -302,7 +752,7 @@ static int _selectStrFromDB(redisClient* c)
             mysql_free_result(res);
             return DB_RET_EXPIRE;
         }
-        robj* val = createStringObject(row[0], strlen(row[0]));
+        robj* val = createStrObjectFromDB(row[0], mysql_fetch_lengths(res)[0]);
         setKey(c->db, c->argv[1], val);
         if (expireat) {
             setExpire(c->db, c->argv[1], expireat * 1000);
@@ -314,8 +764,296 @@ static int _selectStrFromDB(redisClient* c)
     }
 }
 
-static int _writeStrToDB(const char* table, const char* ID, CmdArgv* val, int expireat, DBConn* dbConn)
+/* 读取与dbKeys[0]同表同分片的所有key, SQL超长时分多次查询, 读过的key把表名清空 */
+static int _selectStrsFromDB(redisDb* db, robj** keys, DBKey* dbKeys, int* shards, int num)
 {
+    int shard = shards[0];
+    DBConn* readConn = _shards[shard].readConn;
+    MYSQL* conn = readConn->conn;
+    char table[MAX_TABLE_LEN + 1];
+    memcpy(table, dbKeys[0].table, sizeof(table));
+    int i = 0;
+    while (i < num) {
+        int first = i;
+        int j = 0;
+        char* sql = readConn->sqlbuff;
+        char* end = _strmov(sql, "SELECT `ID`, `val`, `expireat` FROM `");
+        end += mysql_real_escape_string(conn, end, table, strlen(table));
+        end = _strmov(end, "` WHERE `ID` IN (");
+        for (; i < num && end - sql < MAX_SQL_BUF_SIZE * 2 - 64; i++) {
+            if (strcmp(dbKeys[i].table, table) != 0 || shards[i] != shard) {
+                continue;
+            }
+            if (j++ > 0) {
+                *end++ = ',';
+            }
+            *end++ = '\'';
+            end += mysql_real_escape_string(conn, end, dbKeys[i].ID, dbKeys[i].IDLen ? dbKeys[i].IDLen : 1);
+            *end++ = '\'';
+        }
+        if (j == 0) {
+            break;
+        }
+        end = _strmov(end, ")");
+        *end++ = '\0';
+
+        int ret = _query(sql, conn);
+        MYSQL_RES* res;
+        if (ret != DB_RET_SUCCESS || (res = mysql_store_result(conn)) == NULL) {
+            /* 表不存在时调用者继续读其它表, 同表同分片剩下的key也不再查询 */
+            for (j = 0; j < num; j++) {
+                if (strcmp(dbKeys[j].table, table) == 0 && shards[j] == shard) {
+                    dbKeys[j].table[0] = '\0';
+                }
+            }
+            return ret;
+        }
+        MYSQL_ROW row;
+        int now = (int)time(NULL);
+        while ((row = mysql_fetch_row(res)) != NULL) {
+            int expireat = atoi(row[2]);
+            if (expireat != 0 && now > expireat) {
+                _clearExpireStrToDB(table, row[0]);
+                continue;
+            }
+            for (j = first; j < i; j++) {
+                if (strcmp(dbKeys[j].table, table) != 0 || shards[j] != shard || strcmp(dbKeys[j].ID, row[0]) != 0
+                    || lookupKey(db, keys[j]) != NULL) {
+                    continue;
+                }
+                robj* val = createStrObjectFromDB(row[1], mysql_fetch_lengths(res)[1]);
+                setKey(db, keys[j], val);
+                decrRefCount(val);
+                if (expireat) {
+                    setExpire(db, keys[j], expireat * 1000LL);
+                }
+            }
+        }
+        mysql_free_result(res);
+        for (j = first; j < i; j++) {
+            if (strcmp(dbKeys[j].table, table) == 0 && shards[j] == shard) {
+                dbKeys[j].table[0] = '\0';
+            }
+        }
+    }
+    return DB_RET_SUCCESS;
+}
+
+/* 配置了预取且ID是数字时返回该表的预取策略 */
+static ReadPrefetch* _readPrefetchPolicy(const char* table, const char* ID)
+{
+    if (dictSize(server.readPrefetch) == 0) {
+        return NULL;
+    }
+    sds name = sdsnew(table);
+    ReadPrefetch* pf = dictFetchValue(server.readPrefetch, name);
+    sdsfree(name);
+    long long id;
+    if (pf == NULL || pf->maxWindow == 0 || !string2ll(ID, strlen(ID), &id) || id < 0) {
+        return NULL;
+    }
+    if (pf->window == 0) {
+        if (++pf->skipped < PREFETCH_PROBE_MISSES) {
+            return NULL;
+        }
+        pf->window = 1;
+        pf->skipped = 0;
+    }
+    return pf;
+}
+
+/* 一次范围查询读出ID..ID+window, 除了请求的key, 其余的以最久未访问的状态放入内存,
+ * 内存不足时最先被淘汰. 已在内存中或有未写入修改的key不覆盖 */
+static int _prefetchStrFromDB(redisClient* c, const char* table, const char* ID, ReadPrefetch* pf)
+{
+    /* 只查询ID所在的分片, 范围内其它分片的行不会返回, 也就不会被误放入内存 */
+    DBConn* readConn = _shardReadConn(table, ID);
+    MYSQL* conn = readConn->conn;
+    long long start = strtoll(ID, NULL, 10);
+    char range[64];
+    char* sql = readConn->sqlbuff;
+    char* end = _strmov(sql, "SELECT `ID`, `val`, `expireat` FROM `");
+    end += mysql_real_escape_string(conn, end, table, strlen(table));
+    snprintf(range, sizeof(range), "` WHERE `ID` >= %lld AND `ID` <= %lld", start, start + pf->window);
+    end = _strmov(end, range);
+    *end++ = '\0';
+
+    int ret = _query(sql, conn);
+    MYSQL_RES* res;
+    if (ret != DB_RET_SUCCESS || (res = mysql_store_result(conn)) == NULL) {
+        return ret;
+    }
+    ret = DB_RET_NOTRESULT;
+    int now = (int)time(NULL);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        int expireat = atoi(row[2]);
+        int expired = expireat != 0 && now > expireat;
+        if (strtoll(row[0], NULL, 10) == start) {
+            if (expired) {
+                _clearExpireStrToDB(table, ID);
+                ret = DB_RET_EXPIRE;
+                continue;
+            }
+            robj* val = createStrObjectFromDB(row[1], mysql_fetch_lengths(res)[1]);
+            setKey(c->db, c->argv[1], val);
+            decrRefCount(val);
+            if (expireat) {
+                setExpire(c->db, c->argv[1], expireat * 1000LL);
+            }
+            ret = DB_RET_SUCCESS;
+            continue;
+        }
+        if (expired) {
+            continue;
+        }
+        robj* key = createObject(REDIS_STRING, sdscatprintf(sdsempty(), "%s_%s", table, row[0]));
+        if (dictFind(c->db->dict, key->ptr) == NULL && !hasPendingWrite(key)) {
+            robj* val = createStrObjectFromDB(row[1], mysql_fetch_lengths(res)[1]);
+            val->lru = (server.lruclock + 1) & REDIS_LRU_CLOCK_MAX;
+            dbAdd(c->db, key, val);
+            if (expireat) {
+                setExpire(c->db, key, expireat * 1000LL);
+            }
+            sds name = _prefetchedName(c->db->id, key->ptr);
+            if (dictAdd(server.readPrefetched, name, pf) != DICT_OK) {
+                sdsfree(name);
+            }
+            pf->loaded++;
+        }
+        decrRefCount(key);
+    }
+    mysql_free_result(res);
+    _adjustReadPrefetch(pf);
+    return ret;
+}
+
+/* 按上一轮预取的命中率调整窗口 */
+static void _adjustReadPrefetch(ReadPrefetch* pf)
+{
+    long long loaded = pf->loaded - pf->lastLoaded;
+    if (loaded < PREFETCH_ADJUST_KEYS) {
+        return;
+    }
+    double ratio = (double)(pf->hits - pf->lastHits) / loaded;
+    if (ratio < PREFETCH_LOW_HIT_RATIO) {
+        pf->window /= 2;
+    } else if (ratio > PREFETCH_HIGH_HIT_RATIO && pf->window < pf->maxWindow) {
+        pf->window = pf->window * 2 > pf->maxWindow ? pf->maxWindow : pf->window * 2;
+    }
+    pf->lastLoaded = pf->loaded;
+    pf->lastHits = pf->hits;
+}
+
+int setReadPrefetch(const char* table, int window)
+{
+    if (window < 0 || window > PREFETCH_MAX_WINDOW || strlen(table) > MAX_TABLE_LEN) {
+        return DB_RET_NOT_SUPPORT;
+    }
+    sds name = sdsnew(table);
+    ReadPrefetch* pf = dictFetchValue(server.readPrefetch, name);
+    if (pf == NULL) {
+        pf = (ReadPrefetch*)zcalloc(sizeof(ReadPrefetch));
+        dictAdd(server.readPrefetch, name, pf);
+    } else {
+        sdsfree(name);
+    }
+    pf->maxWindow = window;
+    pf->window = window;
+    pf->skipped = 0;
+    pf->lastLoaded = pf->loaded;
+    pf->lastHits = pf->hits;
+    return DB_RET_SUCCESS;
+}
+
+/* 策略只关闭不释放, readPrefetched中可能还引用着 */
+void resetReadPrefetch(void)
+{
+    dictIterator* di = dictGetIterator(server.readPrefetch);
+    dictEntry* de;
+    while ((de = dictNext(di)) != NULL) {
+        ReadPrefetch* pf = dictGetVal(de);
+        pf->maxWindow = pf->window = 0;
+    }
+    dictReleaseIterator(di);
+}
+
+/* readPrefetched中的key为 "<db>:<key>", 不同db中的同名key分开统计 */
+static sds _prefetchedName(int dbid, const sds key)
+{
+    sds name = sdsfromlonglong(dbid);
+    name = sdscatlen(name, ":", 1);
+    return sdscatlen(name, key, sdslen(key));
+}
+
+void readPrefetchHit(redisDb* db, sds key)
+{
+    sds name = _prefetchedName(db->id, key);
+    dictEntry* de = dictFind(server.readPrefetched, name);
+    if (de != NULL) {
+        ((ReadPrefetch*)dictGetVal(de))->hits++;
+        dictDelete(server.readPrefetched, name);
+    }
+    sdsfree(name);
+}
+
+/* key被删除, 之后再写入的同名key不算预取命中 */
+void readPrefetchForget(redisDb* db, sds key)
+{
+    sds name = _prefetchedName(db->id, key);
+    dictDelete(server.readPrefetched, name);
+    sdsfree(name);
+}
+
+/* FLUSHDB时删除该db的全部预取记录 */
+void readPrefetchForgetDb(int dbid)
+{
+    sds prefix = sdscatlen(sdsfromlonglong(dbid), ":", 1);
+    dictIterator* di = dictGetSafeIterator(server.readPrefetched);
+    dictEntry* de;
+    while ((de = dictNext(di)) != NULL) {
+        sds name = dictGetKey(de);
+        if (sdslen(name) > sdslen(prefix) && memcmp(name, prefix, sdslen(prefix)) == 0) {
+            dictDelete(server.readPrefetched, name);
+        }
+    }
+    dictReleaseIterator(di);
+    sdsfree(prefix);
+}
+
+sds catReadPrefetchConfig(sds s)
+{
+    dictIterator* di = dictGetIterator(server.readPrefetch);
+    dictEntry* de;
+    while ((de = dictNext(di)) != NULL) {
+        ReadPrefetch* pf = dictGetVal(de);
+        if (pf->maxWindow > 0) {
+            s = sdscatprintf(s, "%s%s %d", sdslen(s) ? " " : "", (char*)dictGetKey(de), pf->maxWindow);
+        }
+    }
+    dictReleaseIterator(di);
+    return s;
+}
+
+sds catReadPrefetchInfo(sds info)
+{
+    dictIterator* di = dictGetIterator(server.readPrefetch);
+    dictEntry* de;
+    while ((de = dictNext(di)) != NULL) {
+        ReadPrefetch* pf = dictGetVal(de);
+        info = sdscatprintf(info, "persistence prefetch %s :window=%d,max_window=%d,loaded=%lld,hits=%lld\r\n",
+                            (char*)dictGetKey(de), pf->window, pf->maxWindow, pf->loaded, pf->hits);
+    }
+    dictReleaseIterator(di);
+    return info;
+}
+
+static int _writeStrToDB(const char* table, const char* ID, CmdArgv* val, int expireat, int compressThreshold, DBConn* dbConn)
+{
+    long long compressed[(sizeof(int) + MAX_PERSISTENCE_BUF_SIZE) / sizeof(long long) + 1];
+    if (_compressVal(compressThreshold, val, (char*)compressed)) {
+        val = (CmdArgv*)compressed;
+    }
     MYSQL* conn = dbConn->conn;
     char* sql = dbConn->sqlbuff;
     char* end = _strmov(sql, "INSERT INTO `");
@@ -341,7 +1079,7 @@ static int _writeStrToDB(const char* table, const char* ID, CmdArgv* val, int ex
     int ret = _query(sql, conn);
     if (ret == DB_RET_TABLE_NOTEXIST && server.dynamicCreateTable == 1) {
         _createStrTable(table, dbConn);
-        return _writeStrToDB(table, ID, val, expireat, dbConn);
+        return _writeStrToDB(table, ID, val, expireat, 0, dbConn);
     }
     return ret;
 }
@@ -369,8 +1107,9 @@ static int _expireat(const char* table, const char* ID, int expireat, DBConn* db
 
 static int _clearExpireStrToDB(const char* table, const char* ID)
 {
-    MYSQL* conn = _readConn->conn;
-    char* sql = _readConn->sqlbuff;
+    DBConn* readConn = _shardReadConn(table, ID);
+    MYSQL* conn = readConn->conn;
+    char* sql = readConn->sqlbuff;
     char* end = _strmov(sql, "DELETE FROM `");
     end += mysql_real_escape_string(conn, end, table, strlen(table));
     end = _strmov(end, "` WHERE `ID` = '");
@@ -461,14 +1200,13 @@ static int _popListToDB(const char* table, const char* ID, int where, DBConn* db
 }
 
 
-static int _loadListFromDB(redisClient* c)
+static int _loadListFromDB(redisClient* c, const DBKey* dbKey)
 {
-    MYSQL* conn = _readConn->conn;
-    char* key = c->argv[1]->ptr;
-    char table[16] = {'\0'};
-    char ID[16] = {'\0'};
-    _parseKey(key, strlen(key), table, ID);
-    char* sql = _readConn->sqlbuff;
+    const char* table = dbKey->table;
+    const char* ID = dbKey->ID;
+    DBConn* readConn = _shardReadConn(table, ID);
+    MYSQL* conn = readConn->conn;
+    char* sql = readConn->sqlbuff;
     char* end = _strmov(sql, "SELECT `val` FROM `");
     end += mysql_real_escape_string(conn, end, table, strlen(table));
     end = _strmov(end, "` WHERE `ID` = '");
@@ -499,14 +1237,13 @@ static int _loadListFromDB(redisClient* c)
     }
 }
 
-static int _loadZsetFromDB(redisClient* c)
+static int _loadZsetFromDB(redisClient* c, const DBKey* dbKey)
 {
-    MYSQL* conn = _readConn->conn;
-    char* key = c->argv[1]->ptr;
-    char table[16] = {'\0'};
-    char ID[16] = {'\0'};
-    _parseKey(key, strlen(key), table, ID);
-    char* sql = _readConn->sqlbuff;
+    const char* table = dbKey->table;
+    const char* ID = dbKey->ID;
+    DBConn* readConn = _shardReadConn(table, ID);
+    MYSQL* conn = readConn->conn;
+    char* sql = readConn->sqlbuff;
     char* end = _strmov(sql, "SELECT `member`, `score` FROM `");
     end += mysql_real_escape_string(conn, end, table, strlen(table));
     end = _strmov(end, "` WHERE `ID` = '");
@@ -585,9 +1322,10 @@ static int _zaddToDB(const char* table, const char* ID, CmdArgv* score, CmdArgv*
 
 static int _loadIncrFromDB(redisClient* c)
 {
-    MYSQL* conn = _readConn->conn;
     char* key = c->argv[1]->ptr;
-    char* sql = _readConn->sqlbuff;
+    DBConn* readConn = _keyReadConn(key);
+    MYSQL* conn = readConn->conn;
+    char* sql = readConn->sqlbuff;
     char* end = _strmov(sql, "SELECT `incr` FROM `INCR_TAB` WHERE `key` = '");
     end += mysql_real_escape_string(conn, end, key, strlen(key));
     end = _strmov(end, "' LIMIT 1");
@@ -615,11 +1353,11 @@ static int _loadIncrFromDB(redisClient* c)
 static int _incrToDB(CmdArgv* key, CmdArgv* incr, DBConn* dbConn)
 {
     MYSQL* conn = dbConn->conn;
-    char incrStr[16] = {'\0'};
+    char incrStr[32] = {'\0'};
     if (incr == NULL) {
         incrStr[0] = '1';
     } else {
-        memcpy(incrStr, incr->buf, incr->len);
+        memcpy(incrStr, incr->buf, incr->len < (int)sizeof(incrStr) - 1 ? incr->len : (int)sizeof(incrStr) - 1);
     }
     char* sql = dbConn->sqlbuff;
     char* end = _strmov(sql, "INSERT INTO INCR_TAB set `key` = '");
@@ -740,7 +1478,7 @@ static int _createZsetTable(const char* table, DBConn* dbConn)
 static int _createIncrTable(DBConn* dbConn)
 {
     MYSQL* conn = dbConn->conn;
-    return _query("CREATE TABLE `INCR_TAB` (`_PID` int(10) NOT NULL AUTO_INCREMENT, `key` char(32) NOT NULL DEFAULT '', `incr` int(10) NOT NULL DEFAULT 0, PRIMARY KEY (`_PID`), UNIQUE INDEX `keyidx` (`key`)) ENGINE=InnoDB DEFAULT CHARSET=utf8 ", conn);
+    return _query("CREATE TABLE `INCR_TAB` (`_PID` int(10) NOT NULL AUTO_INCREMENT, `key` varchar(128) NOT NULL DEFAULT '', `incr` int(10) NOT NULL DEFAULT 0, PRIMARY KEY (`_PID`), UNIQUE INDEX `keyidx` (`key`)) ENGINE=InnoDB DEFAULT CHARSET=utf8 ", conn);
 }
 
 static int _zremToDB(const char* table, const char* ID, CmdArgv* member, DBConn* dbConn)
@@ -762,21 +1500,71 @@ static int _zremToDB(const char* table, const char* ID, CmdArgv* member, DBConn*
 
 static int _connDB(MYSQL* conn, const char* host, const int port, const char* user, const char* pwd, const char* dbName)
 {
+    my_bool reconnect = 1; /* mysql_ping重连 */
+    mysql_options(conn, MYSQL_OPT_RECONNECT, &reconnect);
     if (!mysql_real_connect(conn, host, user, pwd, dbName, port, NULL, 0)) {
         redisLog(REDIS_WARNING, "mysql connect error  %d, %s", conn, mysql_error(conn));
         return DB_RET_CONNERROR;
     }
+    registerOwnDBThread(host, port, mysql_thread_id(conn));
     return DB_RET_SUCCESS;
 }
 
+/* 不同实例的thread_id可能相同, 按host和port区分 */
+static unsigned long long _ownDBThreadTag(const char* host, int port, unsigned long threadId)
+{
+    unsigned int h = dictGenHashFunction(host, strlen(host)) ^ (unsigned int)port;
+    return ((unsigned long long)h << 32) | (threadId & 0xffffffff);
+}
+
+/* 只保留最近的MAX_OWN_DB_THREADS个连接, 被挤掉的连接写入的行最多多一次失效 */
+void registerOwnDBThread(const char* host, int port, unsigned long threadId)
+{
+    unsigned long long tag = _ownDBThreadTag(host, port, threadId);
+    pthread_mutex_lock(&_ownDBThreadLock);
+    _ownDBThreads[_ownDBThreadIdx] = tag;
+    _ownDBThreadIdx = (_ownDBThreadIdx + 1) % MAX_OWN_DB_THREADS;
+    pthread_mutex_unlock(&_ownDBThreadLock);
+}
+
+int isOwnDBThread(const char* host, int port, unsigned long threadId)
+{
+    unsigned long long tag = _ownDBThreadTag(host, port, threadId);
+    int found = 0;
+    int i = 0;
+    pthread_mutex_lock(&_ownDBThreadLock);
+    for (; i < MAX_OWN_DB_THREADS && !found; i++) {
+        found = _ownDBThreads[i] == tag;
+    }
+    pthread_mutex_unlock(&_ownDBThreadLock);
+    return found;
+}
+
+/* 只尝试一次, 重连的退避由调用方负责, 不在这里阻塞 */
 static int _pingDB(MYSQL* conn)
 {
-    while (mysql_ping(conn)) {
-        redisLog(REDIS_WARNING, "mysql connect lost %d, %s", conn, mysql_error(conn));
+    if (mysql_ping(conn)) {
+        redisLog(REDIS_WARNING, "mysql connect lost %p, %s", (void*)conn, mysql_error(conn));
+        return DB_RET_CONNERROR;
     }
     return DB_RET_SUCCESS;
 }
 
+int pingDB(DBConn* dbConn)
+{
+    return _pingDB(dbConn->conn);
+}
+
+int isDBConnError(int ret)
+{
+    return ret == DB_RET_CONNERROR || ret == DB_RET_SERVER_GONE || ret == DB_RET_SERVER_LOST;
+}
+
+int isDBRetryable(int ret)
+{
+    return isDBConnError(ret) || ret == DB_RET_LOCK_WAIT_TIMEOUT || ret == DB_RET_DEADLOCK;
+}
+
 int isDBError(int ret)
 {
     if (ret == DB_RET_TABLE_NOTEXIST && server.dynamicCreateTable == 0) {
@@ -785,19 +1573,20 @@ int isDBError(int ret)
     return ret != DB_RET_SUCCESS && ret != DB_RET_NOTRESULT && ret != DB_RET_EXPIRE && ret != DB_RET_TABLE_NOTEXIST;
 }
 
+static int _lockIndex(const char* table)
+{
+    return dictGenHashFunction(table, strlen(table)) & LOCK_TABLE_NUM_MASK;
+}
+
 static int _lockTable(const char* table)
 {
-    int key = dictGenHashFunction(table, strlen(table));
-    key &= LOCK_TABLE_NUM_MASK;
-    pthread_mutex_lock(&_lockTableDict[key]);
+    pthread_mutex_lock(&_lockTableDict[_lockIndex(table)]);
     return DB_RET_SUCCESS;
 }
 
 static int _unlockTable(const char* table)
 {
-    int key = dictGenHashFunction(table, strlen(table));
-    key &= LOCK_TABLE_NUM_MASK;
-    pthread_mutex_unlock(&_lockTableDict[key]);
+    pthread_mutex_unlock(&_lockTableDict[_lockIndex(table)]);
     return DB_RET_SUCCESS;
 }
 
@@ -850,6 +1639,423 @@ int isPersistenceCmd(redisClient* c)
 static int _cmdArgv2int(CmdArgv* argv)
 {
     char tmp[16] = {'\0'};
-    memcpy(tmp, argv->buf, argv->len);
+    memcpy(tmp, argv->buf, argv->len < (int)sizeof(tmp) - 1 ? argv->len : (int)sizeof(tmp) - 1);
     return atoi(tmp);
 }
+
+int setDBShard(int shard, const char* host, const int port, const char* user, const char* pwd, const char* dbName)
+{
+    if (shard < 0 || shard >= MAX_DB_SHARD_NUM) {
+        return DB_RET_NOT_SUPPORT;
+    }
+    DBShard* this = &_shards[shard];
+    this->host = zstrdup(host);
+    this->port = port;
+    this->user = zstrdup(user);
+    this->pwd = zstrdup(pwd);
+    this->dbName = zstrdup(dbName);
+    this->readConn = NULL;
+    if (shard >= _shardNum) {
+        _shardNum = shard + 1;
+    }
+    return DB_RET_SUCCESS;
+}
+
+/* shard_map <table> range <minID> <maxID> <shard> ...
+ * shard_map <table> hash <shard> <shard> ...
+ * 范围之外和没有配置的表都属于分片0 */
+int setShardMap(const char* table, int argc, char** argv)
+{
+    if (argc < 2 || strlen(table) > MAX_TABLE_LEN || strchr(table, '_') != NULL) {
+        return DB_RET_NOT_SUPPORT;
+    }
+    ShardMap* map = (ShardMap*)zcalloc(sizeof(ShardMap));
+    int i = 1;
+    if (!strcasecmp(argv[0], "range") && (argc - 1) % 3 == 0 && (argc - 1) / 3 <= MAX_SHARD_MAP_ENTRIES) {
+        map->type = SHARD_MAP_RANGE;
+        for (; i < argc; i += 3) {
+            if (!string2ll(argv[i], strlen(argv[i]), &map->minIDs[map->num])
+                || !string2ll(argv[i + 1], strlen(argv[i + 1]), &map->maxIDs[map->num])
+                || map->minIDs[map->num] > map->maxIDs[map->num]) {
+                break;
+            }
+            map->shards[map->num++] = atoi(argv[i + 2]);
+        }
+    } else if (!strcasecmp(argv[0], "hash") && argc - 1 <= MAX_SHARD_MAP_ENTRIES) {
+        map->type = SHARD_MAP_HASH;
+        for (; i < argc; i++) {
+            map->shards[map->num++] = atoi(argv[i]);
+        }
+    }
+    int ok = i == argc;
+    for (i = 0; ok && i < map->num; i++) {
+        ok = map->shards[i] >= 0 && map->shards[i] < MAX_DB_SHARD_NUM;
+    }
+    if (!ok) {
+        zfree(map);
+        return DB_RET_NOT_SUPPORT;
+    }
+    dictEntry* de = dictFind(server.shardMaps, table);
+    if (de != NULL) {
+        zfree(dictGetVal(de));
+        dictSetVal(server.shardMaps, de, map);
+    } else {
+        dictAdd(server.shardMaps, sdsnew(table), map);
+    }
+    return DB_RET_SUCCESS;
+}
+
+sds catShardMapConfig(sds s)
+{
+    dictIterator* di = dictGetIterator(server.shardMaps);
+    dictEntry* de;
+    while ((de = dictNext(di)) != NULL) {
+        ShardMap* map = dictGetVal(de);
+        int i = 0;
+        s = sdscatprintf(s, "%s%s %s", sdslen(s) ? " " : "", (char*)dictGetKey(de),
+                         map->type == SHARD_MAP_RANGE ? "range" : "hash");
+        for (; i < map->num; i++) {
+            if (map->type == SHARD_MAP_RANGE) {
+                s = sdscatprintf(s, " %lld %lld", map->minIDs[i], map->maxIDs[i]);
+            }
+            s = sdscatprintf(s, " %d", map->shards[i]);
+        }
+    }
+    dictReleaseIterator(di);
+    return s;
+}
+
+int dbShardNum(void)
+{
+    return _shardNum;
+}
+
+DBShard* dbShard(int shard)
+{
+    return &_shards[shard];
+}
+
+static int _shardOf(const char* table, const char* ID)
+{
+    if (dictSize(server.shardMaps) == 0) {
+        return 0;
+    }
+    ShardMap* map = dictFetchValue(server.shardMaps, table);
+    if (map == NULL) {
+        return 0;
+    }
+    long long id;
+    int numeric = string2ll(ID, strlen(ID), &id);
+    int i = 0;
+    if (map->type == SHARD_MAP_HASH) {
+        if (!numeric) {
+            /* 用crc64而不是dict的哈希函数, 保证重启后映射不变 */
+            return map->shards[crc64(0, (unsigned char*)ID, strlen(ID)) % map->num];
+        }
+        return map->shards[((id % map->num) + map->num) % map->num];
+    }
+    for (; numeric && i < map->num; i++) {
+        if (id >= map->minIDs[i] && id <= map->maxIDs[i]) {
+            return map->shards[i];
+        }
+    }
+    return 0;
+}
+
+/* key不要求以'\0'结尾, 超长的key不会被持久化, 归入分片0 */
+int dbShardOfKey(const char* key, int keyLen)
+{
+    DBKey dbKey;
+    if (_shardNum == 1 || keyLen >= MAX_KEY_LEN || parseDBKey(key, keyLen, &dbKey) != DB_RET_SUCCESS) {
+        return 0;
+    }
+    return _shardOf(dbKey.table, dbKey.ID);
+}
+
+static DBConn* _shardReadConn(const char* table, const char* ID)
+{
+    return _shards[_shardNum == 1 ? 0 : _shardOf(table, ID)].readConn;
+}
+
+static DBConn* _keyReadConn(const char* key)
+{
+    return _shards[dbShardOfKey(key, strlen(key))].readConn;
+}
+
+int setTableCompress(const char* table, int threshold)
+{
+    if (strlen(table) > MAX_TABLE_LEN || strchr(table, '_') != NULL || threshold < 0) {
+        return DB_RET_NOT_SUPPORT;
+    }
+    if (threshold > 0 && threshold < COMPRESS_MIN_THRESHOLD) {
+        threshold = COMPRESS_MIN_THRESHOLD;
+    }
+    int i = 0;
+    for (; i < _compressTableNum; i++) {
+        if (!strcmp(_compressTables[i].table, table)) {
+            break;
+        }
+    }
+    if (i == _compressTableNum) {
+        if (_compressTableNum >= MAX_COMPRESS_TABLES) {
+            return DB_RET_NOT_SUPPORT;
+        }
+        strcpy(_compressTables[i].table, table);
+        _compressTables[i].threshold = threshold;
+        __sync_synchronize();
+        _compressTableNum++;
+    } else {
+        _compressTables[i].threshold = threshold;
+    }
+    DBTable* t = findDBTable(table);
+    if (t != NULL) {
+        t->compressThreshold = threshold;
+    }
+    return DB_RET_SUCCESS;
+}
+
+/* 关闭所有表的压缩, 已压缩的行仍可读取 */
+void resetTableCompress(void)
+{
+    int i = 0;
+    for (; i < _compressTableNum; i++) {
+        _compressTables[i].threshold = 0;
+    }
+    for (i = 0; i < _dbTableNum; i++) {
+        _dbTables[i]->compressThreshold = 0;
+    }
+}
+
+sds catTableCompressConfig(sds s)
+{
+    int i = 0;
+    for (; i < _compressTableNum; i++) {
+        if (_compressTables[i].threshold > 0) {
+            s = sdscatprintf(s, "%s%s %d", sdslen(s) ? " " : "", _compressTables[i].table, _compressTables[i].threshold);
+        }
+    }
+    return s;
+}
+
+sds catTableCompressInfo(sds info)
+{
+    return sdscatprintf(info,
+                        "persistence compressed values :%lld\r\n"
+                        "persistence compressed saved bytes :%lld\r\n",
+                        _compressedValues, _compressedSaved);
+}
+
+static int _compressThreshold(const char* table)
+{
+    int n = _compressTableNum;
+    int i = 0;
+    for (; i < n; i++) {
+        if (!strcmp(_compressTables[i].table, table)) {
+            return _compressTables[i].threshold;
+        }
+    }
+    return 0;
+}
+
+/* 写线程中本次运行打包的任务按编号取阈值, 其余按表名查找 */
+static int _keyCompressThreshold(const DBKey* dbKey)
+{
+    DBTable* t = dbTable(dbKey->tableId);
+    return t != NULL ? t->compressThreshold : _compressThreshold(dbKey->table);
+}
+
+/* 在写线程中压缩, 压缩后不比原值短时返回0, 按原值写入 */
+static int _compressVal(int threshold, CmdArgv* val, char* out)
+{
+    CmdArgv* compressed = (CmdArgv*)out;
+    int len = _compress(threshold, val->buf, val->len, compressed->buf);
+    if (len == 0) {
+        return 0;
+    }
+    compressed->len = len;
+    return 1;
+}
+
+/* 按表的压缩阈值把val压缩到out(至少len字节), 返回带头部的长度, 不压缩时返回0 */
+int compressStrValue(const char* table, const char* val, unsigned int len, char* out)
+{
+    return _compress(_compressThreshold(table), val, len, out);
+}
+
+static int _compress(int threshold, const char* val, unsigned int len, char* out)
+{
+    if (threshold == 0 || len < (unsigned int)threshold) {
+        return 0;
+    }
+    unsigned char* header = (unsigned char*)out;
+    unsigned int clen = lzf_compress(val, len, header + COMPRESS_HEADER_LEN, len - COMPRESS_HEADER_LEN - 1);
+    if (clen == 0) {
+        return 0;
+    }
+    header[0] = '\0';
+    header[1] = COMPRESS_MAGIC;
+    header[2] = (len >> 24) & 0xff;
+    header[3] = (len >> 16) & 0xff;
+    header[4] = (len >> 8) & 0xff;
+    header[5] = len & 0xff;
+    __sync_fetch_and_add(&_compressedValues, 1);
+    __sync_fetch_and_add(&_compressedSaved, len - COMPRESS_HEADER_LEN - clen);
+    return COMPRESS_HEADER_LEN + clen;
+}
+
+/* 回源读取字符串值, 带压缩头的值先解压 */
+robj* createStrObjectFromDB(const char* buf, unsigned long len)
+{
+    const unsigned char* header = (const unsigned char*)buf;
+    if (len <= COMPRESS_HEADER_LEN || header[0] != '\0' || header[1] != COMPRESS_MAGIC) {
+        return createStringObject((char*)buf, len);
+    }
+    unsigned int rawlen = ((unsigned int)header[2] << 24) | (header[3] << 16) | (header[4] << 8) | header[5];
+    sds raw = sdsnewlen(NULL, rawlen);
+    if (lzf_decompress(buf + COMPRESS_HEADER_LEN, len - COMPRESS_HEADER_LEN, raw, rawlen) != rawlen) {
+        redisLog(REDIS_WARNING, "decompress value error, expected %u bytes", rawlen);
+        sdsfree(raw);
+        return createStringObject((char*)buf, len);
+    }
+    return createObject(REDIS_STRING, raw);
+}
+
+/* BGMYSQLSAVE子进程使用的连接, 需要开启LOCAL INFILE */
+DBConn* initBulkDB(int shard)
+{
+    DBShard* this = &_shards[shard];
+    DBConn* dbConn = (DBConn*)zmalloc(sizeof(DBConn));
+    dbConn->conn = mysql_init(NULL);
+    unsigned int localInfile = 1;
+    if (dbConn->conn != NULL) {
+        mysql_options(dbConn->conn, MYSQL_OPT_LOCAL_INFILE, &localInfile);
+    }
+    if (!dbConn->conn || _connDB(dbConn->conn, this->host, this->port, this->user, this->pwd, this->dbName) != DB_RET_SUCCESS) {
+        zfree(dbConn);
+        return NULL;
+    }
+    dbConn->sqlbuff = (char*)zmalloc(MAX_SQL_BUF_SIZE * 2);
+    return dbConn;
+}
+
+/* LOAD DATA只把警告记录到日志, 被截断的行不算失败 */
+static int _loadData(const char* sql, MYSQL* conn, long long* rows)
+{
+    redisLog(REDIS_DEBUG, "%s", sql);
+    if (mysql_query(conn, sql) != 0) {
+        int err = mysql_errno(conn);
+        if (err != DB_RET_TABLE_NOTEXIST) {
+            redisLog(REDIS_WARNING, "%d, %s, %s", err, sql, mysql_error(conn));
+        }
+        return err;
+    }
+    if (mysql_warning_count(conn) > 0) {
+        redisLog(REDIS_WARNING, "sql warning count %d, %s", mysql_warning_count(conn), sql);
+    }
+    *rows = (long long)mysql_affected_rows(conn);
+    return DB_RET_SUCCESS;
+}
+
+static int _createBulkTable(const char* table, int type, DBConn* dbConn)
+{
+    if (server.dynamicCreateTable != 1) {
+        return DB_RET_TABLE_NOTEXIST;
+    }
+    switch (type) {
+        case BULK_TYPE_STR:
+            return _createStrTable(table, dbConn);
+        case BULK_TYPE_LIST:
+            return _createListTable(table, dbConn);
+        case BULK_TYPE_ZSET:
+            return _createZsetTable(table, dbConn);
+        default:
+            return DB_RET_NOTRESULT; /* 计数器只更新已存在的行, 不建表 */
+    }
+}
+
+/* 导入一个分块文件, 格式为LOAD DATA默认的 \t 分隔, \n 换行, \\ 转义.
+ * 字符串按唯一的ID直接REPLACE; 列表和有序集合先导入临时表, 在一个事务中删除这些ID
+ * 原有的行再整体插入; 计数器只更新INCR_TAB中已经存在的key */
+int bulkLoadToDB(DBConn* dbConn, const char* table, int type, const char* filename, long long* rows)
+{
+    static const char* columns[] = {"`ID`, `val`, `expireat`", "`ID`, `order`, `val`", "`ID`, `member`, `score`", "`key`, `incr`"};
+    MYSQL* conn = dbConn->conn;
+    char* sql = dbConn->sqlbuff;
+    char* end;
+    int ret;
+    *rows = 0;
+    if (type == BULK_TYPE_STR) {
+        end = _strmov(sql, "LOAD DATA LOCAL INFILE '");
+        end += mysql_real_escape_string(conn, end, filename, strlen(filename));
+        end = _strmov(end, "' REPLACE INTO TABLE `");
+        end += mysql_real_escape_string(conn, end, table, strlen(table));
+        end = _strmov(end, "` CHARACTER SET binary (");
+        end = _strmov(end, (char*)columns[type]);
+        *end++ = ')';
+        *end++ = '\0';
+        ret = _loadData(sql, conn, rows);
+        if (ret == DB_RET_TABLE_NOTEXIST && _createBulkTable(table, type, dbConn) == DB_RET_SUCCESS) {
+            return _loadData(sql, conn, rows);
+        }
+        return ret;
+    }
+
+    const char* target = type == BULK_TYPE_INCR ? "INCR_TAB" : table;
+    if ((ret = _query("DROP TEMPORARY TABLE IF EXISTS `_bulk_load`", conn)) != DB_RET_SUCCESS) {
+        return ret;
+    }
+    end = _strmov(sql, "CREATE TEMPORARY TABLE `_bulk_load` LIKE `");
+    end += mysql_real_escape_string(conn, end, target, strlen(target));
+    *end++ = '`';
+    *end++ = '\0';
+    ret = _query(sql, conn);
+    if (ret == DB_RET_TABLE_NOTEXIST) {
+        if (_createBulkTable(target, type, dbConn) != DB_RET_SUCCESS) {
+            return type == BULK_TYPE_INCR ? DB_RET_SUCCESS : ret;
+        }
+        return bulkLoadToDB(dbConn, table, type, filename, rows);
+    } else if (ret != DB_RET_SUCCESS) {
+        return ret;
+    }
+
+    long long loaded;
+    end = _strmov(sql, "LOAD DATA LOCAL INFILE '");
+    end += mysql_real_escape_string(conn, end, filename, strlen(filename));
+    end = _strmov(end, "' INTO TABLE `_bulk_load` CHARACTER SET binary (");
+    end = _strmov(end, (char*)columns[type]);
+    *end++ = ')';
+    *end++ = '\0';
+    if ((ret = _loadData(sql, conn, &loaded)) != DB_RET_SUCCESS || (ret = _begin(dbConn)) != DB_RET_SUCCESS) {
+        return ret;
+    }
+    if (type == BULK_TYPE_INCR) {
+        end = _strmov(sql, "UPDATE `INCR_TAB` t JOIN `_bulk_load` b ON t.`key` = b.`key` SET t.`incr` = b.`incr`");
+        *end++ = '\0';
+        ret = _query(sql, conn);
+    } else {
+        end = _strmov(sql, "DELETE t FROM `");
+        end += mysql_real_escape_string(conn, end, target, strlen(target));
+        end = _strmov(end, "` t JOIN (SELECT DISTINCT `ID` FROM `_bulk_load`) b ON t.`ID` = b.`ID`");
+        *end++ = '\0';
+        ret = _query(sql, conn);
+        if (ret == DB_RET_SUCCESS) {
+            end = _strmov(sql, "INSERT INTO `");
+            end += mysql_real_escape_string(conn, end, target, strlen(target));
+            end = _strmov(end, "` (");
+            end = _strmov(end, (char*)columns[type]);
+            end = _strmov(end, ") SELECT ");
+            end = _strmov(end, (char*)columns[type]);
+            end = _strmov(end, " FROM `_bulk_load`");
+            *end++ = '\0';
+            ret = _query(sql, conn);
+        }
+    }
+    if (ret != DB_RET_SUCCESS) {
+        _rollback(dbConn);
+        return ret;
+    }
+    if ((ret = _commit(dbConn)) == DB_RET_SUCCESS) {
+        *rows = loaded;
+    }
+    return ret;
+}
@@ -4,7 +4,16 @@
 #include "redis.h"
 #include <mysql/mysql.h>
 
-#define MAX_KEY_LEN 32
+/* binlog失效使用的 MYSQL_RPL / mysql_binlog_open 是 MySQL 5.7.5 客户端库加入的,
+ * 更早的版本和MariaDB的客户端库没有这组接口 */
+#if defined(MYSQL_VERSION_ID) && MYSQL_VERSION_ID >= 50705 \
+    && !defined(MARIADB_BASE_VERSION) && !defined(MARIADB_PACKAGE_VERSION_ID)
+#define HAVE_MYSQL_BINLOG 1
+#endif
+
+#define MAX_KEY_LEN 128
+#define MAX_TABLE_LEN 64      /* MySQL表名最长64个字符 */
+#define MAX_ID_LEN 63
 #define MAX_SQL_BUF_SIZE 5120 
 #define DB_RET_TABLE_NOTEXIST 1146
 #define DB_RET_NOTRESULT -1
@@ -16,6 +25,104 @@
 #define DB_RET_EXPIRE -6
 #define DB_RET_LIST_NOT_WHERE -7
 #define DB_RET_NOT_SUPPORT -8
+#define DB_RET_KEY_TOO_LONG -9
+#define DB_RET_PENDING_BUSY -10
+#define DB_RET_LOCK_WAIT_TIMEOUT 1205
+#define DB_RET_DEADLOCK 1213
+#define DB_RET_SERVER_GONE 2006
+#define DB_RET_SERVER_LOST 2013
+
+/* 按表配置的持久化策略 */
+#define TABLE_POLICY_WRITE_BEHIND 0   /* 异步写入, 默认 */
+#define TABLE_POLICY_WRITE_THROUGH 1  /* 执行后同步写入, 失败时撤销命令并返回错误 */
+#define TABLE_POLICY_WRITE_AROUND 2   /* 异步写入, 写后不保留在内存中 */
+#define TABLE_POLICY_CACHE_ONLY 3     /* 不读写MySQL */
+
+/* 按ID顺序预取: 未命中ID为N的key时, 一次读出N..N+window */
+#define PREFETCH_MAX_WINDOW 1024
+#define PREFETCH_ADJUST_KEYS 1024     /* 每预取这么多key按命中率调整一次窗口 */
+#define PREFETCH_LOW_HIT_RATIO 0.1    /* 低于该命中率窗口减半, 减到0即关闭 */
+#define PREFETCH_HIGH_HIT_RATIO 0.5   /* 高于该命中率窗口翻倍, 不超过配置值 */
+#define PREFETCH_PROBE_MISSES 10000   /* 关闭后每这么多次未命中以窗口1重新试探 */
+
+typedef struct _ReadPrefetch {
+    int maxWindow;        /* 配置的窗口, 0表示不预取 */
+    int window;           /* 当前窗口 */
+    int skipped;          /* 关闭期间的未命中次数 */
+    long long loaded;     /* 预取进内存的key数 */
+    long long hits;       /* 预取的key被访问的次数 */
+    long long lastLoaded;
+    long long lastHits;
+} ReadPrefetch;
+
+/* 水平分片: 按表的ID范围或ID取模把key映射到不同的MySQL实例, 分片0为mysql_host */
+#define MAX_DB_SHARD_NUM 64
+#define MAX_SHARD_MAP_ENTRIES 64
+#define SHARD_MAP_RANGE 0     /* ID在[minID, maxID]内的key属于对应分片 */
+#define SHARD_MAP_HASH 1      /* ID对分片数取模, 非数字ID按crc64取模 */
+
+typedef struct _ShardMap {
+    int type;
+    int num;
+    long long minIDs[MAX_SHARD_MAP_ENTRIES];
+    long long maxIDs[MAX_SHARD_MAP_ENTRIES];
+    int shards[MAX_SHARD_MAP_ENTRIES];
+} ShardMap;
+
+/* 按表压缩写入BLOB列的字符串值. 压缩后的值以头部开始: '\0' 'L' 4字节大端原始长度,
+ * 原来按strlen读取的值不可能以'\0'开始, 所以压缩与未压缩的行可以共存 */
+#define MAX_COMPRESS_TABLES 256
+#define COMPRESS_HEADER_LEN 6
+#define COMPRESS_MAGIC 'L'
+#define COMPRESS_MIN_THRESHOLD 20     /* 更短的值压缩后不会更小 */
+
+typedef struct _TableCompress {
+    char table[MAX_TABLE_LEN + 1];
+    int threshold;        /* 不小于该长度的值才压缩, 0表示不压缩 */
+} TableCompress;
+
+/* BGMYSQLSAVE分块文件的类型 */
+#define BULK_TYPE_STR 0
+#define BULK_TYPE_LIST 1
+#define BULK_TYPE_ZSET 2
+#define BULK_TYPE_INCR 3
+
+/* 读取MySQL的binlog, 使其它服务修改过的行对应的key失效 */
+#define MAX_OWN_DB_THREADS 4096       /* 记录的redisDB自己的连接数 */
+
+/* 表名注册表: 主线程第一次遇到某张表时分配编号, 只增不删, 写线程按编号只读 */
+#define MAX_DB_TABLES 65536
+
+typedef struct _DBTable {
+    char name[MAX_TABLE_LEN + 1];
+    int policy;           /* table_policy的缓存, policyVersion过期时重新查找 */
+    int policyVersion;
+    int compressThreshold;
+    int counter;          /* 表中的key被INCR/INCRBY写过, BGMYSQLSAVE把整数值写回INCR_TAB */
+} DBTable;
+
+/* 解析后的key "tablename_ID": 表名到第一个'_'为止, ID为其后的全部内容; 没有ID时ID为0.
+ * 建表的ID列为整数, 命令中ID不是整数的key (如 "order_12_3") 不读写MySQL, 写命令返回错误 */
+typedef struct _DBKey {
+    int tableId;          /* 注册表中的编号, 未登记时为-1 */
+    int tableLen;
+    int IDLen;            /* key中ID部分的长度, 0表示没有ID */
+    int numeric;          /* ID是否为整数 */
+    long long numID;
+    char table[MAX_TABLE_LEN + 1];
+    char ID[MAX_ID_LEN + 1];
+} DBKey;
+
+/* 任务头部中打包时解析好的key, 写线程按长度直接取出表名和ID, 不再解析.
+ * tableLen为0时(MSET, 上次运行留在mmap队列中的任务)由写线程自己解析 */
+typedef struct _JobKey {
+    int tableId;          /* 只在本次运行内有效 */
+    unsigned char tableLen;
+    unsigned char IDLen;
+    unsigned char numeric;
+    unsigned char reserved;
+    long long numID;
+} JobKey;
 
 typedef struct _CmdArgv
 {
@@ -28,13 +135,70 @@ typedef struct _DBConn {
     char* sqlbuff;
 } DBConn;
 
+typedef struct _DBShard {
+    char* host;
+    int port;
+    char* user;
+    char* pwd;
+    char* dbName;
+    DBConn* readConn;     /* 主线程回源读取和同步写入使用 */
+} DBShard;
+
 int readFromDB(redisClient* c);
-int writeToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, DBConn* dbConn, int time);
+int readStrKeysFromDB(redisDb* db, robj** keys, int numkeys, int step);
+int writeToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, const JobKey* jobKey, DBConn* dbConn, int time);
 DBConn* initDB(const char* host, const int port, const char* user, const char* pwd, const char* dbName);
+void freeDB(DBConn* dbConn);
 int isDBError(int ret);
+int isDBRetryable(int ret);
+int isDBConnError(int ret);
+int pingDB(DBConn* dbConn);
 int initReadDB(const char* host, const int port, const char* user, const char* pwd, const char* dbName);
 int initDBLockDict(void);
 int needLockTable(redisCommandProc* proc);
 int isPersistenceCmd(redisClient* c);
+int writeSyncToDB(int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, const JobKey* jobKey, int time);
+int tablePolicy(const char* key);
+int dbTablePolicy(int tableId);
+void tablePoliciesChanged(void);
+int setTablePolicy(const char* table, const char* policy);
+const char* tablePolicyName(int policy);
+sds catTablePolicyConfig(sds s);
+int setReadPrefetch(const char* table, int window);
+void resetReadPrefetch(void);
+void readPrefetchHit(redisDb* db, sds key);
+void readPrefetchForget(redisDb* db, sds key);
+void readPrefetchForgetDb(int dbid);
+sds catReadPrefetchConfig(sds s);
+sds catReadPrefetchInfo(sds info);
+int setTableCompress(const char* table, int threshold);
+void resetTableCompress(void);
+sds catTableCompressConfig(sds s);
+sds catTableCompressInfo(sds info);
+robj* createStrObjectFromDB(const char* buf, unsigned long len);
+int compressStrValue(const char* table, const char* val, unsigned int len, char* out);
+int parseDBKey(const char* key, int keyLen, DBKey* dbKey);
+int registerDBTable(DBKey* dbKey);
+DBTable* dbTable(int tableId);
+DBTable* findDBTable(const char* table);
+DBKey* clientDBKey(redisClient* c);
+int checkPersistenceKeys(redisClient* c);
+void packJobKey(const DBKey* dbKey, JobKey* jobKey);
+int unpackJobKey(const JobKey* jobKey, const CmdArgv* key, DBKey* dbKey);
+DBConn* initBulkDB(int shard);
+int bulkLoadToDB(DBConn* dbConn, const char* table, int type, const char* filename, long long* rows);
+void registerOwnDBThread(const char* host, int port, unsigned long threadId);
+int isOwnDBThread(const char* host, int port, unsigned long threadId);
+int initBinlogReaders(void);
+void binlogInvalidateCron(void);
+sds catBinlogInfo(sds info);
+int checkForMysqlDumpMode(int argc, char** argv);
+void mysqlDumpMain(int argc, char** argv);
+int setDBShard(int shard, const char* host, const int port, const char* user, const char* pwd, const char* dbName);
+int setShardMap(const char* table, int argc, char** argv);
+sds catShardMapConfig(sds s);
+int dbShardNum(void);
+DBShard* dbShard(int shard);
+int dbShardOfKey(const char* key, int keyLen);
 
 #endif
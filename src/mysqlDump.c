@@ -0,0 +1,509 @@
+/* redis-mysql-dump: 离线扫描MySQL中的表, 生成RDB文件, 冷启动时直接rdbLoad,
+ * 不必通过大量回源读取慢慢预热.
+ *
+ * 与redis-sentinel一样是redis-server的另一个名字, 这样可以直接使用rdb.c的编码函数
+ * 以及ziplist等对象编码. 每个(分片, 表)由一个子进程导出到单独的片段文件,
+ * 最多同时运行jobs个子进程, 全部完成后由父进程按顺序拼接并计算校验和. */
+
+#include "redis.h"
+#include "mysqlDB.h"
+#include "endianconv.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DUMP_TYPE_UNKNOWN -1
+#define DUMP_TYPE_STR 0
+#define DUMP_TYPE_LIST 1
+#define DUMP_TYPE_ZSET 2
+#define DUMP_TYPE_INCR 3
+#define DUMP_DEFAULT_JOBS 8
+#define DUMP_MAX_TASKS 65536
+
+typedef struct _DumpTask {
+    int shard;
+    int type;
+    char table[MAX_TABLE_LEN + 1];
+    pid_t pid;
+    int done;
+} DumpTask;
+
+static char* _dumpTypeNames[] = {"string", "list", "zset", "incr"};
+
+static int _tableType(MYSQL* conn, const char* table);
+static int _listTasks(DumpTask* tasks, int max);
+static int _runTasks(DumpTask* tasks, int num, int jobs);
+static int _dumpTask(DumpTask* task, const char* segfile);
+static int _dumpStrTable(MYSQL* conn, DumpTask* task, rio* rdb, long long now);
+static int _dumpListTable(MYSQL* conn, DumpTask* task, rio* rdb, long long now);
+static int _dumpZsetTable(MYSQL* conn, DumpTask* task, rio* rdb, long long now);
+static int _dumpIncrTable(MYSQL* conn, rio* rdb, long long now);
+static int _saveKey(rio* rdb, const char* table, const char* ID, robj* val, long long expire, long long now);
+static int _mergeSegments(DumpTask* tasks, int num, const char* filename);
+static void _segmentFile(char* buf, size_t len, int idx);
+
+int checkForMysqlDumpMode(int argc, char** argv)
+{
+    REDIS_NOTUSED(argc);
+    return strstr(argv[0], "redis-mysql-dump") != NULL;
+}
+
+/* redis-mysql-dump <redis.conf> <output.rdb> [jobs] */
+void mysqlDumpMain(int argc, char** argv)
+{
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s <redis.conf> <output.rdb> [jobs]\n", argv[0]);
+        exit(1);
+    }
+    int jobs = argc == 4 ? atoi(argv[3]) : DUMP_DEFAULT_JOBS;
+    if (jobs <= 0) {
+        jobs = DUMP_DEFAULT_JOBS;
+    }
+    resetServerSaveParams();
+    loadServerConfig(argv[1], NULL);
+    if (server.mysqlHost == NULL || server.mysqlUser == NULL || server.mysqlPwd == NULL
+        || server.mysqlDBName == NULL || server.mysqlPort == 0) {
+        fprintf(stderr, "MySQL is not configured in %s\n", argv[1]);
+        exit(1);
+    }
+    createSharedObjects();
+    if (initReadDB(server.mysqlHost, server.mysqlPort, server.mysqlUser, server.mysqlPwd, server.mysqlDBName) != DB_RET_SUCCESS) {
+        redisLog(REDIS_WARNING, "connect MySQL error");
+        exit(1);
+    }
+    long long start = ustime();
+    DumpTask* tasks = (DumpTask*)zcalloc(sizeof(DumpTask) * DUMP_MAX_TASKS);
+    int num = _listTasks(tasks, DUMP_MAX_TASKS);
+    if (num < 0) {
+        exit(1);
+    }
+    redisLog(REDIS_NOTICE, "dumping %d tables with %d jobs", num, jobs);
+    int ret = _runTasks(tasks, num, jobs);
+    if (ret == REDIS_OK) {
+        ret = _mergeSegments(tasks, num, argv[2]);
+    }
+    int i = 0;
+    for (; i < num; i++) {
+        char segfile[256];
+        _segmentFile(segfile, sizeof(segfile), i);
+        unlink(segfile);
+    }
+    zfree(tasks);
+    if (ret != REDIS_OK) {
+        redisLog(REDIS_WARNING, "dump MySQL to %s failed", argv[2]);
+        exit(1);
+    }
+    redisLog(REDIS_NOTICE, "MySQL dumped to %s in %.3f seconds", argv[2], (float)(ustime() - start) / 1000000);
+    exit(0);
+}
+
+/* 按列名识别表的类型, 与mysqlDB.c中建表语句一致 */
+static int _tableType(MYSQL* conn, const char* table)
+{
+    char sql[128];
+    snprintf(sql, sizeof(sql), "SELECT * FROM `%s` LIMIT 0", table);
+    if (mysql_query(conn, sql) != 0) {
+        redisLog(REDIS_WARNING, "%s, %s", sql, mysql_error(conn));
+        return DUMP_TYPE_UNKNOWN;
+    }
+    MYSQL_RES* res = mysql_store_result(conn);
+    if (res == NULL) {
+        return DUMP_TYPE_UNKNOWN;
+    }
+    int hasVal = 0, hasExpireat = 0, hasOrder = 0, hasMember = 0, hasKey = 0, hasIncr = 0;
+    MYSQL_FIELD* field;
+    while ((field = mysql_fetch_field(res)) != NULL) {
+        hasVal |= !strcmp(field->name, "val");
+        hasExpireat |= !strcmp(field->name, "expireat");
+        hasOrder |= !strcmp(field->name, "order");
+        hasMember |= !strcmp(field->name, "member");
+        hasKey |= !strcmp(field->name, "key");
+        hasIncr |= !strcmp(field->name, "incr");
+    }
+    mysql_free_result(res);
+    if (!strcmp(table, "INCR_TAB") && hasKey && hasIncr) {
+        return DUMP_TYPE_INCR;
+    } else if (hasOrder && hasVal) {
+        return DUMP_TYPE_LIST;
+    } else if (hasMember) {
+        return DUMP_TYPE_ZSET;
+    } else if (hasVal && hasExpireat) {
+        return DUMP_TYPE_STR;
+    }
+    return DUMP_TYPE_UNKNOWN;
+}
+
+/* 列出每个分片上的表, 跳过cache-only的表和无法识别的表 */
+static int _listTasks(DumpTask* tasks, int max)
+{
+    int num = 0;
+    int shard = 0;
+    for (; shard < dbShardNum(); shard++) {
+        MYSQL* conn = dbShard(shard)->readConn->conn;
+        if (mysql_query(conn, "SHOW TABLES") != 0) {
+            redisLog(REDIS_WARNING, "SHOW TABLES on shard %d, %s", shard, mysql_error(conn));
+            return -1;
+        }
+        MYSQL_RES* res = mysql_store_result(conn);
+        if (res == NULL) {
+            return -1;
+        }
+        MYSQL_ROW row;
+        while ((row = mysql_fetch_row(res)) != NULL) {
+            if (strlen(row[0]) >= sizeof(tasks[0].table) || strchr(row[0], '`') != NULL) {
+                continue;
+            }
+            if (strcmp(row[0], "INCR_TAB") != 0 && tablePolicy(row[0]) == TABLE_POLICY_CACHE_ONLY) {
+                continue;
+            }
+            if (num == max) {
+                redisLog(REDIS_WARNING, "too many tables, only the first %d are dumped", max);
+                break;
+            }
+            DumpTask* task = &tasks[num];
+            task->shard = shard;
+            strcpy(task->table, row[0]);
+            task->type = DUMP_TYPE_UNKNOWN;
+            num++;
+        }
+        mysql_free_result(res);
+    }
+    int i = 0, n = 0;
+    for (; i < num; i++) {
+        tasks[i].type = _tableType(dbShard(tasks[i].shard)->readConn->conn, tasks[i].table);
+        if (tasks[i].type == DUMP_TYPE_UNKNOWN) {
+            redisLog(REDIS_NOTICE, "skip table %s on shard %d, unknown layout", tasks[i].table, tasks[i].shard);
+            continue;
+        }
+        tasks[n++] = tasks[i];
+    }
+    return n;
+}
+
+static void _segmentFile(char* buf, size_t len, int idx)
+{
+    snprintf(buf, len, "temp-mysqldump-%d-%d.seg", (int)getpid(), idx);
+}
+
+/* 最多同时运行jobs个子进程, 任一子进程失败时等其余的结束后返回错误 */
+static int _runTasks(DumpTask* tasks, int num, int jobs)
+{
+    int next = 0, running = 0, failed = 0;
+    while (next < num || running > 0) {
+        if (next < num && running < jobs && !failed) {
+            DumpTask* task = &tasks[next];
+            char segfile[256];
+            _segmentFile(segfile, sizeof(segfile), next);
+            pid_t pid = fork();
+            if (pid == 0) {
+                exitFromChild(_dumpTask(task, segfile) == REDIS_OK ? 0 : 1);
+            } else if (pid == -1) {
+                redisLog(REDIS_WARNING, "fork error: %s", strerror(errno));
+                failed = 1;
+                continue;
+            }
+            task->pid = pid;
+            next++;
+            running++;
+            continue;
+        }
+        if (running == 0) {
+            break;
+        }
+        int statloc;
+        pid_t pid = wait(&statloc);
+        if (pid == -1) {
+            break;
+        }
+        int i = 0;
+        for (; i < next; i++) {
+            if (tasks[i].pid == pid) {
+                tasks[i].done = WIFEXITED(statloc) && WEXITSTATUS(statloc) == 0;
+                redisLog(tasks[i].done ? REDIS_NOTICE : REDIS_WARNING, "table %s (%s) on shard %d %s",
+                         tasks[i].table, _dumpTypeNames[tasks[i].type], tasks[i].shard,
+                         tasks[i].done ? "dumped" : "failed");
+                failed |= !tasks[i].done;
+                running--;
+                break;
+            }
+        }
+    }
+    return failed || next < num ? REDIS_ERR : REDIS_OK;
+}
+
+/* 子进程中执行, 片段文件只包含键值对, 没有文件头和校验和 */
+static int _dumpTask(DumpTask* task, const char* segfile)
+{
+    DBShard* shard = dbShard(task->shard);
+    DBConn* dbConn = initDB(shard->host, shard->port, shard->user, shard->pwd, shard->dbName);
+    if (dbConn == NULL) {
+        redisLog(REDIS_WARNING, "connect shard %d error", task->shard);
+        return REDIS_ERR;
+    }
+    FILE* fp = fopen(segfile, "w");
+    if (fp == NULL) {
+        redisLog(REDIS_WARNING, "open %s error: %s", segfile, strerror(errno));
+        freeDB(dbConn);
+        return REDIS_ERR;
+    }
+    rio rdb;
+    rioInitWithFile(&rdb, fp);
+    long long now = mstime();
+    int ret;
+    switch (task->type) {
+        case DUMP_TYPE_STR:
+            ret = _dumpStrTable(dbConn->conn, task, &rdb, now);
+            break;
+        case DUMP_TYPE_LIST:
+            ret = _dumpListTable(dbConn->conn, task, &rdb, now);
+            break;
+        case DUMP_TYPE_ZSET:
+            ret = _dumpZsetTable(dbConn->conn, task, &rdb, now);
+            break;
+        default:
+            ret = _dumpIncrTable(dbConn->conn, &rdb, now);
+            break;
+    }
+    if (fflush(fp) == EOF || fsync(fileno(fp)) == -1) {
+        ret = REDIS_ERR;
+    }
+    fclose(fp);
+    freeDB(dbConn);
+    return ret;
+}
+
+/* 查询结果逐行读取, 不把整张表放进内存 */
+static MYSQL_RES* _scan(MYSQL* conn, const char* sql)
+{
+    if (mysql_query(conn, sql) != 0) {
+        redisLog(REDIS_WARNING, "%s, %s", sql, mysql_error(conn));
+        return NULL;
+    }
+    return mysql_use_result(conn);
+}
+
+static int _saveKey(rio* rdb, const char* table, const char* ID, robj* val, long long expire, long long now)
+{
+    robj* key = createObject(REDIS_STRING, sdscatprintf(sdsempty(), "%s_%s", table, ID));
+    int ret = rdbSaveKeyValuePair(rdb, key, val, expire, now);
+    decrRefCount(key);
+    return ret == -1 ? REDIS_ERR : REDIS_OK;
+}
+
+static int _dumpStrTable(MYSQL* conn, DumpTask* task, rio* rdb, long long now)
+{
+    char sql[256];
+    snprintf(sql, sizeof(sql), "SELECT `ID`, `val`, `expireat` FROM `%s`", task->table);
+    MYSQL_RES* res = _scan(conn, sql);
+    if (res == NULL) {
+        return REDIS_ERR;
+    }
+    int ret = REDIS_OK;
+    MYSQL_ROW row;
+    while (ret == REDIS_OK && (row = mysql_fetch_row(res)) != NULL) {
+        long long expireat = atoll(row[2]);
+        robj* val = createStrObjectFromDB(row[1], mysql_fetch_lengths(res)[1]);
+        ret = _saveKey(rdb, task->table, row[0], val, expireat ? expireat * 1000 : -1, now);
+        decrRefCount(val);
+    }
+    if (mysql_errno(conn)) {
+        redisLog(REDIS_WARNING, "scan %s, %s", task->table, mysql_error(conn));
+        ret = REDIS_ERR;
+    }
+    mysql_free_result(res);
+    return ret;
+}
+
+/* 同一ID的行是连续的, ID变化时保存上一个key. listTypePush按list_max_ziplist_*
+ * 的配置决定是否转换为双端链表 */
+static int _dumpListTable(MYSQL* conn, DumpTask* task, rio* rdb, long long now)
+{
+    char sql[256];
+    snprintf(sql, sizeof(sql), "SELECT `ID`, `val` FROM `%s` ORDER BY `ID` ASC, `order` ASC", task->table);
+    MYSQL_RES* res = _scan(conn, sql);
+    if (res == NULL) {
+        return REDIS_ERR;
+    }
+    int ret = REDIS_OK;
+    char ID[64] = {'\0'};
+    robj* lobj = NULL;
+    MYSQL_ROW row;
+    while (ret == REDIS_OK && (row = mysql_fetch_row(res)) != NULL) {
+        if (lobj != NULL && strcmp(ID, row[0]) != 0) {
+            ret = _saveKey(rdb, task->table, ID, lobj, -1, now);
+            decrRefCount(lobj);
+            lobj = NULL;
+        }
+        if (lobj == NULL) {
+            snprintf(ID, sizeof(ID), "%s", row[0]);
+            lobj = createZiplistObject();
+        }
+        robj* val = createStringObject(row[1], mysql_fetch_lengths(res)[1]);
+        listTypePush(lobj, val, REDIS_TAIL);
+        decrRefCount(val);
+    }
+    if (ret == REDIS_OK && lobj != NULL) {
+        ret = _saveKey(rdb, task->table, ID, lobj, -1, now);
+    }
+    if (lobj != NULL) {
+        decrRefCount(lobj);
+    }
+    if (mysql_errno(conn)) {
+        redisLog(REDIS_WARNING, "scan %s, %s", task->table, mysql_error(conn));
+        ret = REDIS_ERR;
+    }
+    mysql_free_result(res);
+    return ret;
+}
+
+/* 先按ziplist编码插入, 超过zset_max_ziplist_*的配置时转换为跳表 */
+static int _dumpZsetTable(MYSQL* conn, DumpTask* task, rio* rdb, long long now)
+{
+    char sql[256];
+    snprintf(sql, sizeof(sql), "SELECT `ID`, `member`, `score` FROM `%s` ORDER BY `ID` ASC", task->table);
+    MYSQL_RES* res = _scan(conn, sql);
+    if (res == NULL) {
+        return REDIS_ERR;
+    }
+    int ret = REDIS_OK;
+    char ID[64] = {'\0'};
+    robj* zobj = NULL;
+    MYSQL_ROW row;
+    while (ret == REDIS_OK && (row = mysql_fetch_row(res)) != NULL) {
+        if (zobj != NULL && strcmp(ID, row[0]) != 0) {
+            ret = _saveKey(rdb, task->table, ID, zobj, -1, now);
+            decrRefCount(zobj);
+            zobj = NULL;
+        }
+        if (zobj == NULL) {
+            snprintf(ID, sizeof(ID), "%s", row[0]);
+            zobj = server.zset_max_ziplist_entries == 0 ? createZsetObject() : createZsetZiplistObject();
+        }
+        unsigned long len = mysql_fetch_lengths(res)[1];
+        robj* member = createStringObject(row[1], len);
+        double score = atoi(row[2]);
+        if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+            zobj->ptr = zzlInsert(zobj->ptr, member, score);
+            if (zsetLength(zobj) > server.zset_max_ziplist_entries || len > server.zset_max_ziplist_value) {
+                zsetConvert(zobj, REDIS_ENCODING_SKIPLIST);
+            }
+        } else {
+            zset* zs = zobj->ptr;
+            zskiplistNode* znode = zslInsert(zs->zsl, score, member);
+            incrRefCount(member);
+            if (dictAdd(zs->dict, member, &znode->score) == DICT_OK) {
+                incrRefCount(member);
+            }
+        }
+        decrRefCount(member);
+    }
+    if (ret == REDIS_OK && zobj != NULL) {
+        ret = _saveKey(rdb, task->table, ID, zobj, -1, now);
+    }
+    if (zobj != NULL) {
+        decrRefCount(zobj);
+    }
+    if (mysql_errno(conn)) {
+        redisLog(REDIS_WARNING, "scan %s, %s", task->table, mysql_error(conn));
+        ret = REDIS_ERR;
+    }
+    mysql_free_result(res);
+    return ret;
+}
+
+/* INCR_TAB中保存的是完整的key */
+static int _dumpIncrTable(MYSQL* conn, rio* rdb, long long now)
+{
+    MYSQL_RES* res = _scan(conn, "SELECT `key`, `incr` FROM `INCR_TAB`");
+    if (res == NULL) {
+        return REDIS_ERR;
+    }
+    int ret = REDIS_OK;
+    MYSQL_ROW row;
+    while (ret == REDIS_OK && (row = mysql_fetch_row(res)) != NULL) {
+        robj* key = createStringObject(row[0], strlen(row[0]));
+        robj* val = createStringObjectFromLongLong(atoll(row[1]));
+        if (rdbSaveKeyValuePair(rdb, key, val, -1, now) == -1) {
+            ret = REDIS_ERR;
+        }
+        decrRefCount(key);
+        decrRefCount(val);
+    }
+    if (mysql_errno(conn)) {
+        redisLog(REDIS_WARNING, "scan INCR_TAB, %s", mysql_error(conn));
+        ret = REDIS_ERR;
+    }
+    mysql_free_result(res);
+    return ret;
+}
+
+/* 写入文件头和SELECTDB 0, 依次拷贝片段文件, 最后写入EOF和CRC64校验和 */
+static int _mergeSegments(DumpTask* tasks, int num, const char* filename)
+{
+    char tmpfile[256];
+    char magic[10];
+    char buf[REDIS_IOBUF_LEN];
+    snprintf(tmpfile, sizeof(tmpfile), "temp-mysqldump-%d.rdb", (int)getpid());
+    FILE* fp = fopen(tmpfile, "w");
+    if (fp == NULL) {
+        redisLog(REDIS_WARNING, "open %s error: %s", tmpfile, strerror(errno));
+        return REDIS_ERR;
+    }
+    rio rdb;
+    rioInitWithFile(&rdb, fp);
+    if (server.rdb_checksum) {
+        rdb.update_cksum = rioGenericUpdateChecksum;
+    }
+    snprintf(magic, sizeof(magic), "REDIS%04d", REDIS_RDB_VERSION);
+    if (rioWrite(&rdb, magic, 9) == 0
+        || rdbSaveType(&rdb, REDIS_RDB_OPCODE_SELECTDB) == -1
+        || rdbSaveLen(&rdb, 0) == -1) {
+        goto werr;
+    }
+    int i = 0;
+    for (; i < num; i++) {
+        char segfile[256];
+        _segmentFile(segfile, sizeof(segfile), i);
+        FILE* seg = fopen(segfile, "r");
+        if (seg == NULL) {
+            redisLog(REDIS_WARNING, "open %s error: %s", segfile, strerror(errno));
+            goto werr;
+        }
+        size_t nread;
+        while ((nread = fread(buf, 1, sizeof(buf), seg)) > 0) {
+            if (rioWrite(&rdb, buf, nread) == 0) {
+                fclose(seg);
+                goto werr;
+            }
+        }
+        fclose(seg);
+    }
+    if (rdbSaveType(&rdb, REDIS_RDB_OPCODE_EOF) == -1) {
+        goto werr;
+    }
+    uint64_t cksum = rdb.cksum;
+    memrev64ifbe(&cksum);
+    if (rioWrite(&rdb, &cksum, 8) == 0) {
+        goto werr;
+    }
+    if (fflush(fp) == EOF || fsync(fileno(fp)) == -1 || fclose(fp) == EOF) {
+        fp = NULL;
+        goto werr;
+    }
+    if (rename(tmpfile, filename) == -1) {
+        redisLog(REDIS_WARNING, "rename %s to %s error: %s", tmpfile, filename, strerror(errno));
+        unlink(tmpfile);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+
+werr:
+    redisLog(REDIS_WARNING, "write %s error: %s", tmpfile, strerror(errno));
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    unlink(tmpfile);
+    return REDIS_ERR;
+}
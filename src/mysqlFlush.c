@@ -0,0 +1,508 @@
+/* BGMYSQLSAVE: fork出子进程把内存中的key整体写回MySQL, 用于MySQL故障恢复后的对账,
+ * 或者把已有的redis数据接入redisDB, 不必通过队列逐条重放命令.
+ *
+ * 子进程按(分片, 表, 类型)把行写入分块文件, 每个分块用LOAD DATA LOCAL INFILE导入.
+ * fork时以最后一个入队任务的序号为fence: fence之前的任务已经反映在快照中, 父进程等它们
+ * 写完后才通知子进程开始导入; fence之后的任务暂停分派, 子进程结束后再写入, 不会被快照覆盖. */
+
+#include "redis.h"
+#include "mysqlDB.h"
+#include "persistence.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define FLUSH_CHUNK_ROWS 10000    /* 每个分块文件的行数, 同一个key的行不会跨分块 */
+#define FLUSH_MAX_CHUNKS 4096     /* (分片, 表, 类型)组合的上限 */
+#define FLUSH_READY_WAIT 100000   /* 子进程等待fence的轮询间隔, 微秒 */
+
+/* 父子进程共享的匿名映射, 子进程更新进度, 父进程通知开始导入和调整速率 */
+typedef struct _FlushProgress {
+    volatile int ready;              /* fence之前的任务已全部写入 */
+    volatile int rate;               /* 每秒最多导入的行数, 0表示不限制 */
+    volatile long long totalKeys;
+    volatile long long keys;         /* 已扫描的key数 */
+    volatile long long rows;         /* 已导入的行数 */
+    volatile long long chunks;       /* 已导入的分块数 */
+    volatile long long failedChunks;
+    /* 子进程导入连接的thread_id, 父进程登记后binlog失效会跳过它们写入的事务 */
+    volatile unsigned long threadIds[MAX_DB_SHARD_NUM];
+    volatile unsigned long registered[MAX_DB_SHARD_NUM];
+} FlushProgress;
+
+typedef struct _FlushChunk {
+    int shard;
+    int type;
+    char table[MAX_TABLE_LEN + 1];
+    char filename[64];
+    FILE* fp;
+    long long rows;
+} FlushChunk;
+
+static FlushProgress* _progress = NULL;
+/* 以下只在子进程中使用 */
+static FlushChunk* _chunks = NULL;
+static int _chunkNum = 0;
+static int _fileSeq = 0;
+static DBConn* _bulkConns[MAX_DB_SHARD_NUM];
+static long long _lastLoad = 0;
+static sds _compressBuf = NULL;
+
+static int _mysqlFlushBackground(int rate);
+static int _mysqlFlush(void);
+static int _flushKey(redisDb* db, sds key, robj* o);
+static FlushChunk* _chunk(int shard, const char* table, int type);
+static int _endKey(FlushChunk* chunk);
+static int _loadChunk(FlushChunk* chunk);
+static void _throttle(long long rows);
+static void _writeField(FILE* fp, const char* buf, size_t len, int last);
+static void _writeLongLong(FILE* fp, long long value, int last);
+static void _writeObj(FILE* fp, robj* o, int last);
+
+/* BGMYSQLSAVE [rate] */
+void bgmysqlsaveCommand(redisClient* c)
+{
+    long long rate = server.mysqlFlushRate;
+    if (c->argc > 2) {
+        addReply(c, shared.syntaxerr);
+        return;
+    }
+    if (c->argc == 2 && getLongLongFromObjectOrReply(c, c->argv[1], &rate, NULL) != REDIS_OK) {
+        return;
+    }
+    if (rate < 0 || rate > INT_MAX) {
+        addReplyError(c, "rate must be 0 or a positive number of rows per second");
+    } else if (pmgr == NULL) {
+        addReplyError(c, "MySQL persistence is not configured");
+    } else if (server.mysqlFlushChildPid != -1) {
+        addReplyError(c, "Background MySQL flush already in progress");
+    } else if (server.rdb_child_pid != -1 || server.aof_child_pid != -1) {
+        addReplyError(c, "Can't BGMYSQLSAVE while saving the RDB or rewriting the AOF");
+    } else if (_mysqlFlushBackground(rate) == REDIS_OK) {
+        addReplyStatus(c, "Background MySQL flush started");
+    } else {
+        addReply(c, shared.err);
+    }
+}
+
+static int _mysqlFlushBackground(int rate)
+{
+    if (_progress == NULL) {
+        _progress = mmap(NULL, sizeof(FlushProgress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+        if (_progress == MAP_FAILED) {
+            _progress = NULL;
+            redisLog(REDIS_WARNING, "Can't flush to MySQL in background: mmap: %s", strerror(errno));
+            return REDIS_ERR;
+        }
+    }
+    memset((void*)_progress, 0, sizeof(FlushProgress));
+    _progress->rate = rate;
+    int j = 0;
+    for (; j < server.dbnum; j++) {
+        _progress->totalKeys += dictSize(server.db[j].dict);
+    }
+
+    long long start = ustime();
+    setPersistenceFence(1);
+    pid_t childpid = fork();
+    if (childpid == 0) {
+        if (server.ipfd > 0) {
+            close(server.ipfd);
+        }
+        if (server.sofd > 0) {
+            close(server.sofd);
+        }
+        exitFromChild(_mysqlFlush() == REDIS_OK ? 0 : 1);
+    }
+    server.stat_fork_time = ustime() - start;
+    if (childpid == -1) {
+        setPersistenceFence(0);
+        server.lastMysqlFlushStatus = REDIS_ERR;
+        redisLog(REDIS_WARNING, "Can't flush to MySQL in background: fork: %s", strerror(errno));
+        return REDIS_ERR;
+    }
+    redisLog(REDIS_NOTICE, "Background MySQL flush started by pid %d", childpid);
+    server.mysqlFlushTimeStart = time(NULL);
+    server.mysqlFlushChildPid = childpid;
+    updateDictResizePolicy();
+    return REDIS_OK;
+}
+
+void mysqlFlushDoneHandler(int exitcode, int bysignal)
+{
+    if (!bysignal && exitcode == 0) {
+        redisLog(REDIS_NOTICE, "Background MySQL flush terminated with success, %lld rows in %lld chunks",
+                 _progress->rows, _progress->chunks);
+        server.lastMysqlFlushStatus = REDIS_OK;
+    } else if (!bysignal && exitcode != 0) {
+        redisLog(REDIS_WARNING, "Background MySQL flush error, %lld of %lld chunks failed",
+                 _progress->failedChunks, _progress->chunks + _progress->failedChunks);
+        server.lastMysqlFlushStatus = REDIS_ERR;
+    } else {
+        redisLog(REDIS_WARNING, "Background MySQL flush terminated by signal %d", bysignal);
+        if (bysignal != SIGUSR1) {
+            server.lastMysqlFlushStatus = REDIS_ERR;
+        }
+    }
+    /* 暂停的任务比快照新, 现在可以写入了 */
+    setPersistenceFence(0);
+    server.mysqlFlushChildPid = -1;
+    server.mysqlFlushTimeLast = time(NULL) - server.mysqlFlushTimeStart;
+    server.mysqlFlushTimeStart = -1;
+}
+
+/* fence之前的任务写完后通知子进程开始导入. 导入期间fence之后的write-behind任务都在暂停,
+ * 超过mysql_flush_max_hold秒时终止导入, 已导入的部分保留, 暂停的任务随后写入 */
+void mysqlFlushCron(void)
+{
+    if (server.mysqlFlushChildPid != -1 && server.mysqlFlushMaxHold > 0
+        && time(NULL) - server.mysqlFlushTimeStart > server.mysqlFlushMaxHold) {
+        redisLog(REDIS_WARNING, "Background MySQL flush held persistence jobs for more than %d seconds, killing it",
+                 server.mysqlFlushMaxHold);
+        server.lastMysqlFlushStatus = REDIS_ERR;
+        kill(server.mysqlFlushChildPid, SIGUSR1);
+        return;
+    }
+    if (server.mysqlFlushChildPid != -1 && !_progress->ready && persistenceFenceReached()) {
+        redisLog(REDIS_NOTICE, "Persistence jobs queued before BGMYSQLSAVE are written, loading the snapshot");
+        _progress->ready = 1;
+    }
+    if (server.mysqlFlushChildPid != -1) {
+        int i = 0;
+        for (; i < dbShardNum(); i++) {
+            unsigned long id = _progress->threadIds[i];
+            if (id != 0 && _progress->registered[i] != id) {
+                registerOwnDBThread(dbShard(i)->host, dbShard(i)->port, id);
+                _progress->registered[i] = id;
+            }
+        }
+    }
+}
+
+void setMysqlFlushRate(int rate)
+{
+    server.mysqlFlushRate = rate;
+    if (server.mysqlFlushChildPid != -1) {
+        _progress->rate = rate;
+    }
+}
+
+sds catMysqlFlushInfo(sds info)
+{
+    int running = server.mysqlFlushChildPid != -1;
+    FlushProgress empty;
+    memset(&empty, 0, sizeof(empty));
+    FlushProgress* p = _progress != NULL ? _progress : &empty;
+    return sdscatprintf(info,
+                        "mysql flush in progress :%d\r\n"
+                        "mysql flush loading :%d\r\n"
+                        "mysql flush keys :%lld\r\n"
+                        "mysql flush total keys :%lld\r\n"
+                        "mysql flush rows :%lld\r\n"
+                        "mysql flush chunks :%lld\r\n"
+                        "mysql flush failed chunks :%lld\r\n"
+                        "mysql flush rate :%d\r\n"
+                        "mysql flush last status :%s\r\n"
+                        "mysql flush last time sec :%ld\r\n"
+                        "mysql flush current time sec :%ld\r\n",
+                        running,
+                        running && p->ready,
+                        p->keys,
+                        p->totalKeys,
+                        p->rows,
+                        p->chunks,
+                        p->failedChunks,
+                        running ? p->rate : server.mysqlFlushRate,
+                        server.lastMysqlFlushStatus == REDIS_OK ? "ok" : "err",
+                        (long)server.mysqlFlushTimeLast,
+                        running ? (long)(time(NULL) - server.mysqlFlushTimeStart) : -1L);
+}
+
+/* 子进程: 扫描所有db, 写满的分块立即导入, 最后导入剩余的分块 */
+static int _mysqlFlush(void)
+{
+    int ret = REDIS_OK;
+    int j = 0;
+    memset(_bulkConns, 0, sizeof(_bulkConns));
+    _chunks = (FlushChunk*)zcalloc(sizeof(FlushChunk) * FLUSH_MAX_CHUNKS);
+    _compressBuf = sdsempty();
+    for (; j < server.dbnum; j++) {
+        redisDb* db = server.db + j;
+        dictIterator* di = dictGetIterator(db->dict);
+        dictEntry* de;
+        while ((de = dictNext(di)) != NULL) {
+            if (_flushKey(db, dictGetKey(de), dictGetVal(de)) != REDIS_OK) {
+                ret = REDIS_ERR;
+            }
+            _progress->keys++;
+        }
+        dictReleaseIterator(di);
+    }
+    for (j = 0; j < _chunkNum; j++) {
+        if (_loadChunk(&_chunks[j]) != REDIS_OK) {
+            ret = REDIS_ERR;
+        }
+    }
+    for (j = 0; j < MAX_DB_SHARD_NUM; j++) {
+        if (_bulkConns[j] != NULL) {
+            freeDB(_bulkConns[j]);
+        }
+    }
+    return ret;
+}
+
+/* 集合和哈希不持久化, cache-only的表, 过长或ID不是整数的key跳过. write-through的表在导入期间仍同步写入,
+ * MySQL中的值可能比快照新, 也跳过 */
+static int _flushKey(redisDb* db, sds key, robj* o)
+{
+    int keyLen = sdslen(key);
+    DBKey dbKey;
+    int policy;
+    if (keyLen >= MAX_KEY_LEN || parseDBKey(key, keyLen, &dbKey) != DB_RET_SUCCESS || !dbKey.numeric
+        || (policy = tablePolicy(key)) == TABLE_POLICY_CACHE_ONLY || policy == TABLE_POLICY_WRITE_THROUGH) {
+        return REDIS_OK;
+    }
+    const char* table = dbKey.table;
+    const char* ID = dbKey.ID;
+    int shard = dbShardOfKey(key, keyLen);
+    FlushChunk* chunk;
+    DBTable* t;
+
+    if (o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_INT
+        && (t = findDBTable(table)) != NULL && t->counter) {
+        /* 与写线程一样, INCR/INCRBY写过的表的整数值只写回INCR_TAB中已有的key */
+        if ((chunk = _chunk(shard, "INCR_TAB", BULK_TYPE_INCR)) == NULL) {
+            return REDIS_ERR;
+        }
+        _writeField(chunk->fp, key, keyLen, 0);
+        _writeObj(chunk->fp, o, 1);
+        chunk->rows++;
+
+    } else if (o->type == REDIS_STRING) {
+        robj keyobj;
+        initStaticStringObject(keyobj, key);
+        long long expire = getExpire(db, &keyobj);
+        if ((chunk = _chunk(shard, table, BULK_TYPE_STR)) == NULL) {
+            return REDIS_ERR;
+        }
+        _writeField(chunk->fp, ID, strlen(ID), 0);
+        if (o->encoding == REDIS_ENCODING_INT) {
+            _writeObj(chunk->fp, o, 0);
+        } else {
+            size_t len = sdslen(o->ptr);
+            if (sdsavail(_compressBuf) < len) {
+                _compressBuf = sdsMakeRoomFor(_compressBuf, len);
+            }
+            int clen = compressStrValue(table, o->ptr, len, _compressBuf);
+            if (clen > 0) {
+                _writeField(chunk->fp, _compressBuf, clen, 0);
+            } else {
+                _writeField(chunk->fp, o->ptr, len, 0);
+            }
+        }
+        _writeLongLong(chunk->fp, expire == -1 ? 0 : expire / 1000, 1);
+        chunk->rows++;
+
+    } else if (o->type == REDIS_LIST) {
+        if ((chunk = _chunk(shard, table, BULK_TYPE_LIST)) == NULL) {
+            return REDIS_ERR;
+        }
+        listTypeIterator* li = listTypeInitIterator(o, 0, REDIS_TAIL);
+        listTypeEntry entry;
+        long long order = 0;
+        while (listTypeNext(li, &entry)) {
+            robj* val = listTypeGet(&entry);
+            _writeField(chunk->fp, ID, strlen(ID), 0);
+            _writeLongLong(chunk->fp, order++, 0);
+            _writeObj(chunk->fp, val, 1);
+            decrRefCount(val);
+            chunk->rows++;
+        }
+        listTypeReleaseIterator(li);
+
+    } else if (o->type == REDIS_ZSET) {
+        if ((chunk = _chunk(shard, table, BULK_TYPE_ZSET)) == NULL) {
+            return REDIS_ERR;
+        }
+        if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+            unsigned char* zl = o->ptr;
+            unsigned char* eptr = ziplistIndex(zl, 0);
+            unsigned char* sptr = eptr != NULL ? ziplistNext(zl, eptr) : NULL;
+            while (eptr != NULL) {
+                unsigned char* vstr;
+                unsigned int vlen;
+                long long vll;
+                ziplistGet(eptr, &vstr, &vlen, &vll);
+                _writeField(chunk->fp, ID, strlen(ID), 0);
+                if (vstr != NULL) {
+                    _writeField(chunk->fp, (char*)vstr, vlen, 0);
+                } else {
+                    _writeLongLong(chunk->fp, vll, 0);
+                }
+                _writeLongLong(chunk->fp, (long long)zzlGetScore(sptr), 1);
+                chunk->rows++;
+                zzlNext(zl, &eptr, &sptr);
+            }
+        } else {
+            zset* zs = o->ptr;
+            zskiplistNode* ln = zs->zsl->header->level[0].forward;
+            for (; ln != NULL; ln = ln->level[0].forward) {
+                _writeField(chunk->fp, ID, strlen(ID), 0);
+                _writeObj(chunk->fp, ln->obj, 0);
+                _writeLongLong(chunk->fp, (long long)ln->score, 1);
+                chunk->rows++;
+            }
+        }
+
+    } else {
+        return REDIS_OK;
+    }
+    return _endKey(chunk);
+}
+
+static FlushChunk* _chunk(int shard, const char* table, int type)
+{
+    FlushChunk* chunk = NULL;
+    int i = 0;
+    for (; i < _chunkNum; i++) {
+        if (_chunks[i].shard == shard && _chunks[i].type == type && !strcmp(_chunks[i].table, table)) {
+            chunk = &_chunks[i];
+            break;
+        }
+    }
+    if (chunk == NULL) {
+        if (_chunkNum == FLUSH_MAX_CHUNKS) {
+            redisLog(REDIS_WARNING, "too many tables to flush, %s on shard %d skipped", table, shard);
+            return NULL;
+        }
+        chunk = &_chunks[_chunkNum++];
+        chunk->shard = shard;
+        chunk->type = type;
+        snprintf(chunk->table, sizeof(chunk->table), "%s", table);
+    }
+    if (chunk->fp == NULL) {
+        snprintf(chunk->filename, sizeof(chunk->filename), "temp-mysqlflush-%d-%d.tsv", (int)getpid(), _fileSeq++);
+        if ((chunk->fp = fopen(chunk->filename, "w")) == NULL) {
+            redisLog(REDIS_WARNING, "open %s error: %s", chunk->filename, strerror(errno));
+            return NULL;
+        }
+    }
+    return chunk;
+}
+
+/* 一个key的行写完后检查分块是否已满 */
+static int _endKey(FlushChunk* chunk)
+{
+    return chunk->rows >= FLUSH_CHUNK_ROWS ? _loadChunk(chunk) : REDIS_OK;
+}
+
+static int _loadChunk(FlushChunk* chunk)
+{
+    if (chunk->fp == NULL) {
+        return REDIS_OK;
+    }
+    int ret = fflush(chunk->fp) == 0 && !ferror(chunk->fp) ? DB_RET_SUCCESS : DB_RET_NOTRESULT;
+    fclose(chunk->fp);
+    chunk->fp = NULL;
+    while (!_progress->ready) {
+        if (getppid() == 1) {
+            unlink(chunk->filename);
+            return REDIS_ERR;
+        }
+        usleep(FLUSH_READY_WAIT);
+    }
+    if (_lastLoad == 0) {
+        _lastLoad = ustime();
+    }
+    long long rows = chunk->rows;
+    long long affected = 0;
+    if (ret == DB_RET_SUCCESS) {
+        if (_bulkConns[chunk->shard] == NULL) {
+            _bulkConns[chunk->shard] = initBulkDB(chunk->shard);
+            if (_bulkConns[chunk->shard] != NULL && server.binlogInvalidation) {
+                unsigned long id = mysql_thread_id(_bulkConns[chunk->shard]->conn);
+                _progress->threadIds[chunk->shard] = id;
+                while (_progress->registered[chunk->shard] != id && getppid() != 1) {
+                    usleep(FLUSH_READY_WAIT);
+                }
+            }
+        }
+        ret = _bulkConns[chunk->shard] == NULL ? DB_RET_CONNERROR
+              : bulkLoadToDB(_bulkConns[chunk->shard], chunk->table, chunk->type, chunk->filename, &affected);
+    }
+    unlink(chunk->filename);
+    chunk->rows = 0;
+    if (ret != DB_RET_SUCCESS) {
+        redisLog(REDIS_WARNING, "flush %lld rows of %s to shard %d error %d", rows, chunk->table, chunk->shard, ret);
+        _progress->failedChunks++;
+        return REDIS_ERR;
+    }
+    _progress->rows += rows;
+    _progress->chunks++;
+    _throttle(rows);
+    return REDIS_OK;
+}
+
+/* 按rate折算本分块应占用的时间, 不足的部分sleep补齐 */
+static void _throttle(long long rows)
+{
+    int rate = _progress->rate;
+    long long now = ustime();
+    if (rate > 0) {
+        long long expected = rows * 1000000 / rate;
+        if (now - _lastLoad < expected) {
+            usleep(expected - (now - _lastLoad));
+            now = ustime();
+        }
+    }
+    _lastLoad = now;
+}
+
+/* LOAD DATA默认格式: 字段以\t分隔, 行以\n结束, \t \n \\ 和 \0 用 \\ 转义 */
+static void _writeField(FILE* fp, const char* buf, size_t len, int last)
+{
+    size_t start = 0;
+    size_t i = 0;
+    for (; i < len; i++) {
+        char esc;
+        switch (buf[i]) {
+            case '\t':
+                esc = 't';
+                break;
+            case '\n':
+                esc = 'n';
+                break;
+            case '\\':
+                esc = '\\';
+                break;
+            case '\0':
+                esc = '0';
+                break;
+            default:
+                continue;
+        }
+        fwrite(buf + start, 1, i - start, fp);
+        fputc('\\', fp);
+        fputc(esc, fp);
+        start = i + 1;
+    }
+    fwrite(buf + start, 1, len - start, fp);
+    fputc(last ? '\n' : '\t', fp);
+}
+
+static void _writeLongLong(FILE* fp, long long value, int last)
+{
+    char buf[32];
+    int len = ll2string(buf, sizeof(buf), value);
+    _writeField(fp, buf, len, last);
+}
+
+static void _writeObj(FILE* fp, robj* o, int last)
+{
+    if (o->encoding == REDIS_ENCODING_INT) {
+        _writeLongLong(fp, (long)o->ptr, last);
+    } else {
+        _writeField(fp, o->ptr, sdslen(o->ptr), last);
+    }
+}
@@ -28,9 +28,14 @@
  */
 
 #include "redis.h"
+#include "mysqlDB.h"
+#include "resp.h"
 #include <sys/uio.h>
 
-static void setProtocolError(redisClient* c, int pos);
+static void setProtocolError(redisClient* c, int pos, sds err);
+
+/* Set while processEventsWhileBlocked() serves the clients. */
+static int processing_events_while_blocked = 0;
 
 /* To evaluate the output buffer size of a client we need to get size of
  * allocated objects, however we can't used zmalloc_size() directly on sds
@@ -107,6 +112,16 @@ redisClient* createClient(int fd)
     c->pubsub_patterns = listCreate();
     listSetFreeMethod(c->pubsub_patterns, decrRefCount);
     listSetMatchMethod(c->pubsub_patterns, listMatchObjects);
+    c->pcmds = NULL;
+    c->pcmds_pos = c->pcmds_len = c->pcmds_size = 0;
+    c->protoerr = NULL;
+    c->io_nread = 0;
+    c->io_errno = 0;
+    c->io_sentobjs = 0;
+    c->argpool_len = 0;
+    c->dbkey = NULL;
+    c->dbkey_arg = NULL;
+    c->dbkey_valid = 0;
     if (fd != -1) {
         listAddNodeTail(server.clients, c);
     }
@@ -119,7 +134,9 @@ redisClient* createClient(int fd)
  *
  * If the client should receive new data (normal clients will) the function
  * returns REDIS_OK, and make sure to install the write handler in our event
- * loop so that when the socket is writable new data gets written.
+ * loop so that when the socket is writable new data gets written. With I/O
+ * threads the client is queued instead, the reply is then written by
+ * handleClientsWithPendingWrites() before to re-enter the event loop.
  *
  * If the client should not receive new data, because it is a fake client
  * or a slave, or because the setup of the write handler failed, the function
@@ -138,10 +155,17 @@ int prepareClientToWrite(redisClient* c)
     }
     if (c->bufpos == 0 && listLength(c->reply) == 0 &&
         (c->replstate == REDIS_REPL_NONE ||
-         c->replstate == REDIS_REPL_ONLINE) &&
-        aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
-                          sendReplyToClient, c) == AE_ERR) {
-        return REDIS_ERR;
+         c->replstate == REDIS_REPL_ONLINE)) {
+        if (server.io_threads_num > 1 &&
+            !(c->flags & (REDIS_SLAVE | REDIS_MASTER))) {
+            if (!(c->flags & REDIS_PENDING_WRITE)) {
+                c->flags |= REDIS_PENDING_WRITE;
+                listAddNodeTail(server.clients_pending_write, c);
+            }
+        } else if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                                     sendReplyToClient, c) == AE_ERR) {
+            return REDIS_ERR;
+        }
     }
     return REDIS_OK;
 }
@@ -167,6 +191,27 @@ robj* dupLastObjectIfNeeded(list* reply)
  * Low level functions to add more data to output buffers.
  * -------------------------------------------------------------------------- */
 
+/* Big objects go in the reply list by reference, writev() sends them from
+ * where they are, instead of being copied in the reply buffers. Not while a
+ * child is saving, as touching the refcount would copy the page on write,
+ * see addReply(). */
+static int replyObjectByReference(robj* o)
+{
+    return sdslen(o->ptr) >= REDIS_REPLY_SHARE_BYTES &&
+           server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+           server.mysqlFlushChildPid == -1;
+}
+
+/* Return 1 if 'len' bytes can be appended to the last object of the reply
+ * list. A big object shared with the keyspace is not duplicated just to
+ * append a few bytes to it. */
+static int canAppendToReplyTail(robj* tail, size_t len)
+{
+    return tail->ptr != NULL &&
+           sdslen(tail->ptr) + len <= REDIS_REPLY_CHUNK_BYTES &&
+           (tail->refcount == 1 || sdslen(tail->ptr) < REDIS_REPLY_SHARE_BYTES);
+}
+
 int _addReplyToBuffer(redisClient* c, char* s, size_t len)
 {
     size_t available = sizeof(c->buf) - c->bufpos;
@@ -207,8 +252,8 @@ void _addReplyObjectToList(redisClient* c, robj* o)
         tail = listNodeValue(listLast(c->reply));
 
         /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr) + sdslen(o->ptr) <= REDIS_REPLY_CHUNK_BYTES) {
+        if (!replyObjectByReference(o) &&
+            canAppendToReplyTail(tail, sdslen(o->ptr))) {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
             tail = dupLastObjectIfNeeded(c->reply);
             tail->ptr = sdscatlen(tail->ptr, o->ptr, sdslen(o->ptr));
@@ -240,8 +285,7 @@ void _addReplySdsToList(redisClient* c, sds s)
         tail = listNodeValue(listLast(c->reply));
 
         /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr) + sdslen(s) <= REDIS_REPLY_CHUNK_BYTES) {
+        if (canAppendToReplyTail(tail, sdslen(s))) {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
             tail = dupLastObjectIfNeeded(c->reply);
             tail->ptr = sdscatlen(tail->ptr, s, sdslen(s));
@@ -272,8 +316,7 @@ void _addReplyStringToList(redisClient* c, char* s, size_t len)
         tail = listNodeValue(listLast(c->reply));
 
         /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr) + len <= REDIS_REPLY_CHUNK_BYTES) {
+        if (canAppendToReplyTail(tail, len)) {
             c->reply_bytes -= zmalloc_size_sds(tail->ptr);
             tail = dupLastObjectIfNeeded(c->reply);
             tail->ptr = sdscatlen(tail->ptr, s, len);
@@ -305,9 +348,11 @@ void addReply(redisClient* c, robj* obj)
      *
      * If the encoding is RAW and there is room in the static buffer
      * we'll be able to send the object to the client without
-     * messing with its page. */
+     * messing with its page. Big objects are referenced instead when no
+     * child is saving, see replyObjectByReference(). */
     if (obj->encoding == REDIS_ENCODING_RAW) {
-        if (_addReplyToBuffer(c, obj->ptr, sdslen(obj->ptr)) != REDIS_OK) {
+        if (replyObjectByReference(obj) ||
+            _addReplyToBuffer(c, obj->ptr, sdslen(obj->ptr)) != REDIS_OK) {
             _addReplyObjectToList(c, obj);
         }
     } else if (obj->encoding == REDIS_ENCODING_INT) {
@@ -444,8 +489,10 @@ void setDeferredMultiBulkLength(redisClient* c, void* node, long length)
     if (ln->next != NULL) {
         next = listNodeValue(ln->next);
 
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next->ptr != NULL) {
+        /* Only glue when the next node is non-NULL (an sds in this case)
+         * and not a big object referenced by the reply. */
+        if (next->ptr != NULL &&
+            (next->refcount == 1 || sdslen(next->ptr) < REDIS_REPLY_SHARE_BYTES)) {
             c->reply_bytes -= zmalloc_size_sds(len->ptr);
             c->reply_bytes -= zmalloc_size_sds(next->ptr);
             len->ptr = sdscatlen(len->ptr, next->ptr, sdslen(next->ptr));
@@ -578,6 +625,49 @@ void copyClientOutputBuffer(redisClient* dst, redisClient* src)
     dst->reply_bytes = src->reply_bytes;
 }
 
+/* Remember the end of the output buffers of 'c', so that what a command
+ * is about to reply can be dropped with discardClientReply(). */
+void markClientReply(redisClient* c, replyMark* mark)
+{
+    mark->bufpos = c->bufpos;
+    mark->listlen = listLength(c->reply);
+    mark->taillen = 0;
+    if (mark->listlen > 0) {
+        robj* tail = listNodeValue(listLast(c->reply));
+        if (tail->ptr != NULL) {
+            mark->taillen = sdslen(tail->ptr);
+        }
+    }
+}
+
+/* Drop everything added to the output buffers of 'c' after 'mark'. Used
+ * when a command is undone and its reply replaced by an error. Nothing is
+ * written to the socket while the command runs, so the dropped part was
+ * never sent. */
+void discardClientReply(redisClient* c, replyMark* mark)
+{
+    robj* tail;
+
+    while (listLength(c->reply) > mark->listlen) {
+        listNode* ln = listLast(c->reply);
+        tail = listNodeValue(ln);
+        if (tail->ptr != NULL) {
+            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
+        }
+        listDelNode(c->reply, ln);
+    }
+    if (mark->listlen > 0) {
+        tail = listNodeValue(listLast(c->reply));
+        if (tail->ptr != NULL && sdslen(tail->ptr) > mark->taillen) {
+            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
+            tail = dupLastObjectIfNeeded(c->reply);
+            sdsrange(tail->ptr, 0, mark->taillen - 1);
+            c->reply_bytes += zmalloc_size_sds(tail->ptr);
+        }
+    }
+    c->bufpos = mark->bufpos;
+}
+
 static void acceptCommonHandler(int fd, int flags)
 {
     redisClient* c;
@@ -641,16 +731,71 @@ void acceptUnixHandler(aeEventLoop* el, int fd, void* privdata, int mask)
 }
 
 
+/* Create the object of a query argument, reusing one of the objects
+ * freeClientArgv() recycled when available. Called by the I/O threads too,
+ * that own the client while they parse its query buffer. */
+static robj* createArgObject(redisClient* c, char* ptr, size_t len)
+{
+    robj* o;
+
+    if (c->argpool_len == 0) {
+        return createStringObject(ptr, len);
+    }
+    o = c->argpool[--c->argpool_len];
+    o->ptr = sdscpylen(o->ptr, ptr, len);
+    o->lru = server.lruclock;
+    return o;
+}
+
+/* Release the arguments of the last command. Small strings nothing else took
+ * a reference to are kept in c->argpool for the next commands: an argument
+ * stored in the keyspace, a reply, a MULTI queue or the MySQL pending writes
+ * had its refcount incremented there, and is simply released to its new
+ * owners. */
 static void freeClientArgv(redisClient* c)
 {
     int j;
     for (j = 0; j < c->argc; j++) {
-        decrRefCount(c->argv[j]);
+        robj* o = c->argv[j];
+
+        if (o->refcount == 1 && o->type == REDIS_STRING &&
+            o->encoding == REDIS_ENCODING_RAW &&
+            c->argpool_len < REDIS_ARGPOOL_SIZE &&
+            sdslen(o->ptr) + sdsavail(o->ptr) <= REDIS_ARGPOOL_MAX_ALLOC) {
+            sdsclear(o->ptr);
+            c->argpool[c->argpool_len++] = o;
+        } else {
+            decrRefCount(o);
+        }
     }
     c->argc = 0;
     c->cmd = NULL;
 }
 
+static void freeClientArgPool(redisClient* c)
+{
+    while (c->argpool_len) {
+        decrRefCount(c->argpool[--c->argpool_len]);
+    }
+}
+
+/* Free the commands an I/O thread parsed that were never executed. */
+static void freeClientParsedCommands(redisClient* c)
+{
+    int i, j;
+    for (i = c->pcmds_pos; i < c->pcmds_len; i++) {
+        for (j = 0; j < c->pcmds[i].argc; j++) {
+            decrRefCount(c->pcmds[i].argv[j]);
+        }
+        zfree(c->pcmds[i].argv);
+    }
+    zfree(c->pcmds);
+    c->pcmds = NULL;
+    c->pcmds_pos = c->pcmds_len = c->pcmds_size = 0;
+    sdsfree(c->protoerr);
+    c->protoerr = NULL;
+}
+
 /* Close all the slaves connections. This is useful in chained replication
  * when we resync with our own master and want to force all our slaves to
  * resync with us as well. */
@@ -696,6 +841,8 @@ void freeClient(redisClient* c)
     aeDeleteFileEvent(server.el, c->fd, AE_WRITABLE);
     listRelease(c->reply);
     freeClientArgv(c);
+    freeClientParsedCommands(c);
+    freeClientArgPool(c);
     close(c->fd);
     /* Remove from the list of clients */
     ln = listSearchKey(server.clients, c);
@@ -708,6 +855,23 @@ void freeClient(redisClient* c)
         redisAssert(ln != NULL);
         listDelNode(server.unblocked_clients, ln);
     }
+    /* Remove from the writers delayed by MySQL persistence backpressure. */
+    if (c->flags & REDIS_PERSIST_PAUSED) {
+        ln = listSearchKey(server.persistencePausedClients, c);
+        redisAssert(ln != NULL);
+        listDelNode(server.persistencePausedClients, ln);
+    }
+    /* Remove from the clients queued for the I/O threads. */
+    if (c->flags & REDIS_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read, c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_read, ln);
+    }
+    if (c->flags & REDIS_PENDING_WRITE) {
+        ln = listSearchKey(server.clients_pending_write, c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_write, ln);
+    }
     listRelease(c->io_keys);
     /* Master/slave cleanup.
      * Case 1: we lost the connection with a slave. */
@@ -749,6 +913,7 @@ void freeClient(redisClient* c)
         decrRefCount(c->name);
     }
     zfree(c->argv);
+    zfree(c->dbkey);
     freeClientMultiState(c);
     zfree(c);
 }
@@ -778,64 +943,125 @@ void freeClientsInAsyncFreeQueue(void)
     }
 }
 
-void sendReplyToClient(aeEventLoop* el, int fd, void* privdata, int mask)
+#ifdef IOV_MAX
+#define REDIS_IOV_MAX (IOV_MAX < 1024 ? IOV_MAX : 1024)
+#else
+#define REDIS_IOV_MAX 16
+#endif
+
+/* Fill 'iov' with the unsent part of c->buf and of the reply objects from
+ * 'ln' on, up to REDIS_IOV_MAX entries or REDIS_MAX_WRITE_PER_EVENT bytes.
+ * The objects are referenced, not copied. Returns the number of entries,
+ * with their total length in '*len'. */
+static int gatherClientReply(redisClient* c, listNode* ln, struct iovec* iov, size_t* len)
 {
-    redisClient* c = privdata;
-    int nwritten = 0, totwritten = 0, objlen;
-    size_t objmem;
-    robj* o;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
+    size_t offset = c->sentlen, objlen;
+    int iovcnt = 0;
+
+    *len = 0;
+    if (c->bufpos > 0) {
+        iov[0].iov_base = c->buf + c->sentlen;
+        iov[0].iov_len = c->bufpos - c->sentlen;
+        *len = iov[0].iov_len;
+        iovcnt = 1;
+        offset = 0;
+    }
+    while (ln != NULL && iovcnt < REDIS_IOV_MAX && *len < REDIS_MAX_WRITE_PER_EVENT) {
+        robj* o = listNodeValue(ln);
+
+        objlen = sdslen(o->ptr);
+        if (objlen > offset) {
+            iov[iovcnt].iov_base = ((char*)o->ptr) + offset;
+            iov[iovcnt].iov_len = objlen - offset;
+            *len += objlen - offset;
+            iovcnt++;
+        }
+        offset = 0;
+        ln = listNextNode(ln);
+    }
+    return iovcnt;
+}
 
-    while (c->bufpos > 0 || listLength(c->reply)) {
-        if (c->bufpos > 0) {
-            if (c->flags & REDIS_MASTER) {
-                /* Don't reply to a master */
-                nwritten = c->bufpos - c->sentlen;
-            } else {
-                nwritten = write(fd, c->buf + c->sentlen, c->bufpos - c->sentlen);
-                if (nwritten <= 0) {
-                    break;
-                }
-            }
+/* Account 'nwritten' bytes sent out of what gatherClientReply() returned.
+ * Returns how many reply objects from 'ln' on were entirely sent, leaving
+ * c->sentlen at the offset of the first one that was not. */
+static int advanceClientReply(redisClient* c, listNode* ln, size_t nwritten)
+{
+    size_t left;
+    int objs = 0;
+
+    if (c->bufpos > 0) {
+        left = c->bufpos - c->sentlen;
+        if (nwritten < left) {
             c->sentlen += nwritten;
-            totwritten += nwritten;
+            return 0;
+        }
+        /* The buffer was sent, continue with the remainder of the reply. */
+        nwritten -= left;
+        c->bufpos = 0;
+        c->sentlen = 0;
+    }
+    while (ln != NULL) {
+        robj* o = listNodeValue(ln);
 
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if (c->sentlen == c->bufpos) {
-                c->bufpos = 0;
-                c->sentlen = 0;
+        left = sdslen(o->ptr) - c->sentlen;
+        if (left > 0 && nwritten < left) {
+            c->sentlen += nwritten;
+            break;
+        }
+        nwritten -= left;
+        c->sentlen = 0;
+        objs++;
+        ln = listNextNode(ln);
+    }
+    return objs;
+}
+
+/* Write the reply with one writev(2) for the static buffer and up to
+ * REDIS_IOV_MAX reply objects at a time. The objects sent are released, or
+ * when 'release' is 0 (the I/O threads can't free objects) only counted in
+ * c->io_sentobjs. Returns -1 on write errors, with errno set. */
+static int writeClientReply(redisClient* c, int release)
+{
+    struct iovec iov[REDIS_IOV_MAX];
+    listNode* ln = listFirst(c->reply);
+    ssize_t nwritten = 0;
+    size_t totwritten = 0, len;
+    int iovcnt, objs, j;
+
+    c->io_sentobjs = 0;
+    while (c->bufpos > 0 || ln != NULL) {
+        iovcnt = gatherClientReply(c, ln, iov, &len);
+        if (c->flags & REDIS_MASTER) {
+            /* Don't reply to a master */
+            nwritten = len;
+        } else if (iovcnt > 0) {
+            nwritten = writev(c->fd, iov, iovcnt);
+            if (nwritten <= 0) {
+                break;
             }
         } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o->ptr);
-            objmem = zmalloc_size_sds(o->ptr);
+            /* Only empty objects left. */
+            nwritten = 0;
+        }
+        objs = advanceClientReply(c, ln, nwritten);
+        for (j = 0; j < objs; j++) {
+            listNode* next = listNextNode(ln);
 
-            if (objlen == 0) {
-                listDelNode(c->reply, listFirst(c->reply));
-                continue;
-            }
+            if (release) {
+                robj* o = listNodeValue(ln);
 
-            if (c->flags & REDIS_MASTER) {
-                /* Don't reply to a master */
-                nwritten = objlen - c->sentlen;
-            } else {
-                nwritten = write(fd, ((char*)o->ptr) + c->sentlen, objlen - c->sentlen);
-                if (nwritten <= 0) {
-                    break;
+                if (sdslen(o->ptr)) {
+                    c->reply_bytes -= zmalloc_size_sds(o->ptr);
                 }
+                listDelNode(c->reply, ln);
+            } else {
+                c->io_sentobjs++;
             }
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply, listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objmem;
-            }
+            ln = next;
         }
+        totwritten += nwritten;
+
         /* Note that we avoid to send more than REDIS_MAX_WRITE_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -850,34 +1076,56 @@ void sendReplyToClient(aeEventLoop* el, int fd, void* privdata, int mask)
             break;
         }
     }
-    if (nwritten == -1) {
-        if (errno == EAGAIN) {
-            nwritten = 0;
-        } else {
-            redisLog(REDIS_VERBOSE,
-                     "Error writing to client: %s", strerror(errno));
-            freeClient(c);
-            return;
-        }
-    }
     if (totwritten > 0) {
         c->lastinteraction = server.unixtime;
     }
+    if (nwritten == -1 && errno != EAGAIN) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Write as much of the reply as the socket accepts. Returns REDIS_ERR if the
+ * client was freed, because of an error or since the whole reply was sent
+ * to a client flagged with REDIS_CLOSE_AFTER_REPLY. */
+static int writeToClient(redisClient* c)
+{
+    if (writeClientReply(c, 1) == -1) {
+        redisLog(REDIS_VERBOSE,
+                 "Error writing to client: %s", strerror(errno));
+        freeClient(c);
+        return REDIS_ERR;
+    }
     if (c->bufpos == 0 && listLength(c->reply) == 0) {
         c->sentlen = 0;
-        aeDeleteFileEvent(server.el, c->fd, AE_WRITABLE);
+        /* Replies written from handleClientsWithPendingWrites() may have
+         * no handler installed, save the syscall. */
+        if (aeGetFileEvents(server.el, c->fd) & AE_WRITABLE) {
+            aeDeleteFileEvent(server.el, c->fd, AE_WRITABLE);
+        }
 
         /* Close connection after entire reply has been sent. */
         if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
             freeClient(c);
+            return REDIS_ERR;
         }
     }
+    return REDIS_OK;
+}
+
+void sendReplyToClient(aeEventLoop* el, int fd, void* privdata, int mask)
+{
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+    writeToClient(privdata);
 }
 
 /* resetClient prepare the client to process the next command */
 void resetClient(redisClient* c)
 {
     freeClientArgv(c);
+    c->dbkey_arg = NULL;
     c->reqtype = 0;
     c->multibulklen = 0;
     c->bulklen = -1;
@@ -897,8 +1145,7 @@ int processInlineBuffer(redisClient* c)
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
         if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
-            addReplyError(c, "Protocol error: too big inline request");
-            setProtocolError(c, 0);
+            setProtocolError(c, 0, sdsnew("Protocol error: too big inline request"));
         }
         return REDIS_ERR;
     }
@@ -929,105 +1176,95 @@ int processInlineBuffer(redisClient* c)
     return REDIS_OK;
 }
 
-/* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
-static void setProtocolError(redisClient* c, int pos)
+/* Helper function. Replies with the error 'err' (that is freed) and trims
+ * query buffer to make the function that processes multi bulk requests
+ * idempotent. An I/O thread can't reply, so there the error is kept in
+ * c->protoerr and sent by processInputBuffer() after the replies of the
+ * commands parsed before it. */
+static void setProtocolError(redisClient* c, int pos, sds err)
 {
+    size_t j;
+
+    /* Make sure there are no newlines in the error, otherwise invalid
+     * protocol is emitted. */
+    for (j = 0; j < sdslen(err); j++) {
+        if (err[j] == '\r' || err[j] == '\n') {
+            err[j] = ' ';
+        }
+    }
     if (server.verbosity >= REDIS_VERBOSE) {
         sds client = getClientInfoString(c);
         redisLog(REDIS_VERBOSE,
                  "Protocol error from client: %s", client);
         sdsfree(client);
     }
-    c->flags |= REDIS_CLOSE_AFTER_REPLY;
+    if (c->flags & REDIS_PENDING_READ) {
+        c->protoerr = err;
+    } else {
+        addReplyErrorLength(c, err, sdslen(err));
+        sdsfree(err);
+        c->flags |= REDIS_CLOSE_AFTER_REPLY;
+    }
     c->querybuf = sdsrange(c->querybuf, pos, -1);
 }
 
 int processMultibulkBuffer(redisClient* c)
 {
-    char* newline = NULL;
-    int pos = 0, ok;
-    long long ll;
+    size_t pos = 0;
+    respArg arg;
+    char err[128];
+    int ret;
 
     if (c->multibulklen == 0) {
         /* The client should have been reset */
         redisAssertWithInfo(c, NULL, c->argc == 0);
+        redisAssertWithInfo(c, NULL, c->querybuf[0] == '*');
+    }
 
-        /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf, '\r');
-        if (newline == NULL) {
-            if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
-                addReplyError(c, "Protocol error: too big mbulk count string");
-                setProtocolError(c, 0);
-            }
-            return REDIS_ERR;
+    /* The protocol itself is parsed by respParseMultibulk(), shared with the
+     * test of the fast path in resp.c, here we only build the arguments. */
+    do {
+        /* Optimization: if the buffer contains JUST our bulk element
+         * instead of creating a new object by *copying* the sds we
+         * just use the current sds string. */
+        if (pos == 0 &&
+            c->multibulklen &&
+            c->bulklen >= REDIS_MBULK_BIG_ARG &&
+            (signed) sdslen(c->querybuf) == c->bulklen + 2) {
+            c->argv[c->argc++] = createObject(REDIS_STRING, c->querybuf);
+            sdsIncrLen(c->querybuf, -2); /* remove CRLF */
+            c->querybuf = sdsempty();
+            /* Assume that if we saw a fat argument we'll see another one
+             * likely... */
+            c->querybuf = sdsMakeRoomFor(c->querybuf, c->bulklen + 2);
+            c->bulklen = -1;
+            c->multibulklen--;
+            continue;
         }
 
-        /* Buffer should also contain \n */
-        if (newline - (c->querybuf) > ((signed)sdslen(c->querybuf) - 2)) {
+        ret = respParseMultibulk(c->querybuf, sdslen(c->querybuf), &pos,
+                                 &c->multibulklen, &c->bulklen,
+                                 REDIS_INLINE_MAX_SIZE, &arg, err, sizeof(err));
+        if (ret == RESP_PARSE_MORE) {
+            /* Still not read to process the command */
+            if (pos) {
+                c->querybuf = sdsrange(c->querybuf, pos, -1);
+            }
             return REDIS_ERR;
-        }
-
-        /* We know for sure there is a whole line since newline != NULL,
-         * so go ahead and find out the multi bulk length. */
-        redisAssertWithInfo(c, NULL, c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf + 1, newline - (c->querybuf + 1), &ll);
-        if (!ok || ll > 1024 * 1024) {
-            addReplyError(c, "Protocol error: invalid multibulk length");
-            setProtocolError(c, pos);
+        } else if (ret == RESP_PARSE_ERROR) {
+            setProtocolError(c, pos, sdsnew(err));
             return REDIS_ERR;
-        }
-
-        pos = (newline - c->querybuf) + 2;
-        if (ll <= 0) {
+        } else if (ret == RESP_PARSE_EMPTY) {
             c->querybuf = sdsrange(c->querybuf, pos, -1);
             return REDIS_OK;
-        }
-
-        c->multibulklen = ll;
-
-        /* Setup argv array on client structure */
-        if (c->argv) {
-            zfree(c->argv);
-        }
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
-    }
-
-    redisAssertWithInfo(c, NULL, c->multibulklen > 0);
-    while (c->multibulklen) {
-        /* Read bulk length if unknown */
-        if (c->bulklen == -1) {
-            newline = strchr(c->querybuf + pos, '\r');
-            if (newline == NULL) {
-                if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
-                    addReplyError(c, "Protocol error: too big bulk count string");
-                    setProtocolError(c, 0);
-                }
-                break;
-            }
-
-            /* Buffer should also contain \n */
-            if (newline - (c->querybuf) > ((signed)sdslen(c->querybuf) - 2)) {
-                break;
-            }
-
-            if (c->querybuf[pos] != '$') {
-                addReplyErrorFormat(c,
-                                    "Protocol error: expected '$', got '%c'",
-                                    c->querybuf[pos]);
-                setProtocolError(c, pos);
-                return REDIS_ERR;
+        } else if (ret == RESP_PARSE_COUNT) {
+            /* Setup argv array on client structure */
+            if (c->argv) {
+                zfree(c->argv);
             }
-
-            ok = string2ll(c->querybuf + pos + 1, newline - (c->querybuf + pos + 1), &ll);
-            if (!ok || ll < 0 || ll > 512 * 1024 * 1024) {
-                addReplyError(c, "Protocol error: invalid bulk length");
-                setProtocolError(c, pos);
-                return REDIS_ERR;
-            }
-
-            pos += newline - (c->querybuf + pos) + 2;
-            if (ll >= REDIS_MBULK_BIG_ARG) {
+            c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        } else if (ret == RESP_PARSE_BULKLEN) {
+            if (c->bulklen >= REDIS_MBULK_BIG_ARG) {
                 size_t qblen;
 
                 /* If we are going to read a large object from network
@@ -1039,61 +1276,108 @@ int processMultibulkBuffer(redisClient* c)
                 qblen = sdslen(c->querybuf);
                 /* Hint the sds library about the amount of bytes this string is
                  * going to contain. */
-                if (qblen < ll + 2) {
-                    c->querybuf = sdsMakeRoomFor(c->querybuf, ll + 2 - qblen);
+                if (qblen < (size_t)c->bulklen + 2) {
+                    c->querybuf = sdsMakeRoomFor(c->querybuf, c->bulklen + 2 - qblen);
                 }
             }
-            c->bulklen = ll;
-        }
-
-        /* Read bulk argument */
-        if (sdslen(c->querybuf) - pos < (unsigned)(c->bulklen + 2)) {
-            /* Not enough data (+2 == trailing \r\n) */
-            break;
         } else {
-            /* Optimization: if the buffer contains JUST our bulk element
-             * instead of creating a new object by *copying* the sds we
-             * just use the current sds string. */
-            if (pos == 0 &&
-                c->bulklen >= REDIS_MBULK_BIG_ARG &&
-                (signed) sdslen(c->querybuf) == c->bulklen + 2) {
-                c->argv[c->argc++] = createObject(REDIS_STRING, c->querybuf);
-                sdsIncrLen(c->querybuf, -2); /* remove CRLF */
-                c->querybuf = sdsempty();
-                /* Assume that if we saw a fat argument we'll see another one
-                 * likely... */
-                c->querybuf = sdsMakeRoomFor(c->querybuf, c->bulklen + 2);
-                pos = 0;
-            } else {
-                c->argv[c->argc++] =
-                    createStringObject(c->querybuf + pos, c->bulklen);
-                pos += c->bulklen + 2;
-            }
-            c->bulklen = -1;
-            c->multibulklen--;
+            c->argv[c->argc++] = createArgObject(c, c->querybuf + arg.offset, arg.len);
         }
+    } while (c->multibulklen);
+
+    /* We're done when c->multibulk == 0, trim to pos */
+    if (pos) {
+        c->querybuf = sdsrange(c->querybuf, pos, -1);
     }
+    return REDIS_OK;
+}
 
-    /* Trim to pos */
+/* Append a parsed command to c->pcmds, that takes ownership of argv. */
+static void queueParsedCommand(redisClient* c, int argc, robj** argv)
+{
+    if (c->pcmds_len == c->pcmds_size) {
+        c->pcmds_size = c->pcmds_size ? c->pcmds_size * 2 : 16;
+        c->pcmds = zrealloc(c->pcmds, sizeof(parsedCommand) * c->pcmds_size);
+    }
+    c->pcmds[c->pcmds_len].argc = argc;
+    c->pcmds[c->pcmds_len].argv = argv;
+    c->pcmds_len++;
+}
+
+/* Fast path for pipelined multi bulk requests: parse all the whole commands
+ * at the start of the query buffer into c->pcmds with respScanCommand(),
+ * then trim the buffer once for the whole batch. Must be called at a command
+ * boundary. Returns the number of commands parsed; whatever respScanCommand()
+ * does not handle is left to processMultibulkBuffer(). */
+static int processMultibulkBatch(redisClient* c)
+{
+    respArg args[REDIS_MBULK_FAST_MAX_ARGS];
+    size_t pos = 0, len = sdslen(c->querybuf);
+    int parsed = 0, argc, j;
+    long used;
+    robj** argv;
+
+    while (parsed < REDIS_MBULK_FAST_BATCH &&
+           (used = respScanCommand(c->querybuf + pos, len - pos, REDIS_MBULK_BIG_ARG,
+                                   args, REDIS_MBULK_FAST_MAX_ARGS, &argc)) > 0) {
+        argv = zmalloc(sizeof(robj*) * argc);
+        for (j = 0; j < argc; j++) {
+            argv[j] = createArgObject(c, c->querybuf + pos + args[j].offset, args[j].len);
+        }
+        queueParsedCommand(c, argc, argv);
+        pos += used;
+        parsed++;
+    }
     if (pos) {
         c->querybuf = sdsrange(c->querybuf, pos, -1);
     }
+    return parsed;
+}
 
-    /* We're done when c->multibulk == 0 */
-    if (c->multibulklen == 0) {
-        return REDIS_OK;
+/* Load from MySQL the string keys that the GET and MGET commands already
+ * parsed in c->pcmds are going to read. The misses of a whole pipeline are
+ * this way resolved with one query per table instead of one round trip per
+ * key. A single command is left alone, MGET batches its own keys. */
+#define REDIS_PREFETCH_MAX_KEYS 1024
+void prefetchParsedCommands(redisClient* c)
+{
+    robj* keys[REDIS_PREFETCH_MAX_KEYS];
+    int numkeys = 0, i, j;
+
+    if (c->pcmds_len - c->pcmds_pos < 2 ||
+        c->flags & (REDIS_BLOCKED | REDIS_PERSIST_PAUSED)) {
+        return;
+    }
+    for (i = c->pcmds_pos; i < c->pcmds_len && numkeys < REDIS_PREFETCH_MAX_KEYS; i++) {
+        parsedCommand* pc = c->pcmds + i;
+        struct redisCommand* cmd = lookupCommand(pc->argv[0]->ptr);
+
+        if (cmd == NULL) {
+            continue;
+        }
+        /* Keys after a SELECT belong to another DB. */
+        if (cmd->proc == selectCommand) {
+            break;
+        }
+        if (cmd->proc == mgetCommand || (cmd->proc == getCommand && pc->argc == 2)) {
+            for (j = 1; j < pc->argc && numkeys < REDIS_PREFETCH_MAX_KEYS; j++) {
+                keys[numkeys++] = pc->argv[j];
+            }
+        }
     }
 
-    /* Still not read to process the command */
-    return REDIS_ERR;
+    /* A single miss is left to the command itself. */
+    if (numkeys > 1) {
+        readStrKeysFromDB(c->db, keys, numkeys, 1);
+    }
 }
 
 void processInputBuffer(redisClient* c)
 {
     /* Keep processing while there is something in the input buffer */
-    while (sdslen(c->querybuf)) {
+    while (c->pcmds_pos < c->pcmds_len || c->protoerr || sdslen(c->querybuf)) {
         /* Immediately abort if the client is in the middle of something. */
-        if (c->flags & REDIS_BLOCKED) {
+        if (c->flags & (REDIS_BLOCKED | REDIS_PERSIST_PAUSED)) {
             return;
         }
 
@@ -1104,25 +1388,52 @@ void processInputBuffer(redisClient* c)
             return;
         }
 
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
-                c->reqtype = REDIS_REQ_MULTIBULK;
-            } else {
-                c->reqtype = REDIS_REQ_INLINE;
-            }
-        }
+        if (c->pcmds_pos < c->pcmds_len) {
+            /* Commands already parsed by an I/O thread come first. */
+            parsedCommand* pc = c->pcmds + c->pcmds_pos++;
 
-        if (c->reqtype == REDIS_REQ_INLINE) {
-            if (processInlineBuffer(c) != REDIS_OK) {
-                break;
+            redisAssertWithInfo(c, NULL, c->argc == 0 && c->reqtype == 0);
+            if (c->argv) {
+                zfree(c->argv);
             }
-        } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != REDIS_OK) {
-                break;
+            c->argv = pc->argv;
+            c->argc = pc->argc;
+            if (c->pcmds_pos == c->pcmds_len) {
+                c->pcmds_pos = c->pcmds_len = 0;
             }
+        } else if (c->protoerr) {
+            /* Then the protocol error the I/O thread stopped at. */
+            addReplyErrorLength(c, c->protoerr, sdslen(c->protoerr));
+            sdsfree(c->protoerr);
+            c->protoerr = NULL;
+            c->flags |= REDIS_CLOSE_AFTER_REPLY;
+            return;
         } else {
-            redisPanic("Unknown request type");
+            /* Whole pipelined commands are parsed in batches. */
+            if (!c->reqtype && c->querybuf[0] == '*' && processMultibulkBatch(c)) {
+                continue;
+            }
+
+            /* Determine request type when unknown. */
+            if (!c->reqtype) {
+                if (c->querybuf[0] == '*') {
+                    c->reqtype = REDIS_REQ_MULTIBULK;
+                } else {
+                    c->reqtype = REDIS_REQ_INLINE;
+                }
+            }
+
+            if (c->reqtype == REDIS_REQ_INLINE) {
+                if (processInlineBuffer(c) != REDIS_OK) {
+                    break;
+                }
+            } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
+                if (processMultibulkBuffer(c) != REDIS_OK) {
+                    break;
+                }
+            } else {
+                redisPanic("Unknown request type");
+            }
         }
 
         /* Multibulk processing could see a <= 0 length. */
@@ -1137,15 +1448,15 @@ void processInputBuffer(redisClient* c)
     }
 }
 
-void readQueryFromClient(aeEventLoop* el, int fd, void* privdata, int mask)
+/* Read what the socket has into the query buffer. Returns the number of bytes
+ * read, 0 if nothing was available, or -1 if the client must be closed, with
+ * c->io_errno set on errors and 0 if the peer closed the connection. Touches
+ * nothing but the client, so the I/O threads can call it. */
+static int readClientSocket(redisClient* c)
 {
-    redisClient* c = (redisClient*) privdata;
     int nread, readlen;
     size_t qblen;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
 
-    server.current_client = c;
     readlen = REDIS_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1167,25 +1478,36 @@ void readQueryFromClient(aeEventLoop* el, int fd, void* privdata, int mask)
         c->querybuf_peak = qblen;
     }
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-    nread = read(fd, c->querybuf + qblen, readlen);
+    c->io_errno = 0;
+    nread = read(c->fd, c->querybuf + qblen, readlen);
     if (nread == -1) {
         if (errno == EAGAIN) {
-            nread = 0;
-        } else {
-            redisLog(REDIS_VERBOSE, "Reading from client: %s", strerror(errno));
-            freeClient(c);
-            return;
+            return 0;
         }
+        c->io_errno = errno;
+        return -1;
     } else if (nread == 0) {
-        redisLog(REDIS_VERBOSE, "Client closed connection");
+        return -1;
+    }
+    sdsIncrLen(c->querybuf, nread);
+    c->lastinteraction = server.unixtime;
+    return nread;
+}
+
+/* Act on the result of readClientSocket(): close the client or run the
+ * commands it sent. */
+static void handleClientRead(redisClient* c, int nread)
+{
+    if (nread == -1) {
+        if (c->io_errno) {
+            redisLog(REDIS_VERBOSE, "Reading from client: %s", strerror(c->io_errno));
+        } else {
+            redisLog(REDIS_VERBOSE, "Client closed connection");
+        }
         freeClient(c);
         return;
     }
-    if (nread) {
-        sdsIncrLen(c->querybuf, nread);
-        c->lastinteraction = server.unixtime;
-    } else {
-        server.current_client = NULL;
+    if (nread == 0) {
         return;
     }
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
@@ -1198,7 +1520,40 @@ void readQueryFromClient(aeEventLoop* el, int fd, void* privdata, int mask)
         freeClient(c);
         return;
     }
+    if (server.mysqlHost != NULL) {
+        /* Split the whole commands now: processInputBuffer() executes them
+         * from c->pcmds, so the buffer is parsed once for both. */
+        if (c->pcmds_pos == c->pcmds_len && !c->reqtype &&
+            !(c->flags & (REDIS_BLOCKED | REDIS_PERSIST_PAUSED)) &&
+            c->querybuf[0] == '*') {
+            processMultibulkBatch(c);
+        }
+        prefetchParsedCommands(c);
+    }
     processInputBuffer(c);
+}
+
+void readQueryFromClient(aeEventLoop* el, int fd, void* privdata, int mask)
+{
+    redisClient* c = (redisClient*) privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    /* Leave the read to the I/O threads, see handleClientsWithPendingReads(). */
+    if (c->flags & REDIS_PENDING_READ) {
+        return;
+    }
+    if (server.io_threads_active && server.io_threads_do_reads &&
+        !processing_events_while_blocked &&
+        !(c->flags & (REDIS_MASTER | REDIS_SLAVE))) {
+        c->flags |= REDIS_PENDING_READ;
+        listAddNodeTail(server.clients_pending_read, c);
+        return;
+    }
+
+    server.current_client = c;
+    handleClientRead(c, readClientSocket(c));
     server.current_client = NULL;
 }
 
@@ -1601,3 +1956,394 @@ void flushSlavesOutputBuffers(void)
         }
     }
 }
+
+/* -----------------------------------------------------------------------------
+ * Threaded I/O
+ *
+ * With io-threads > 1 the main thread doesn't read from a client as soon as
+ * it is readable, nor installs the write handler when a reply is created:
+ * the client is queued, and the queues are served in beforeSleep(), reads
+ * at its start and writes at its end. The queued clients are split between
+ * the I/O threads and the main thread itself, that waits for the others to
+ * finish before going on. Commands are only executed by the main thread, so
+ * an I/O thread touches nothing but the clients it was given: it never
+ * creates a reply nor releases an object, as both would race on shared
+ * objects' refcount.
+ * -------------------------------------------------------------------------- */
+
+#define REDIS_IO_THREADS_OP_READ 0
+#define REDIS_IO_THREADS_OP_WRITE 1
+
+/* Iterations an idle I/O thread spins before to block on its mutex. */
+#define REDIS_IO_THREADS_SPIN 1000000
+
+static pthread_t io_threads[REDIS_IO_THREADS_MAX_NUM];
+/* Locked by the main thread while the I/O threads are stopped. */
+static pthread_mutex_t io_threads_mutex[REDIS_IO_THREADS_MAX_NUM];
+/* Set by the main thread to start a round, cleared by the I/O thread. */
+static volatile unsigned long io_threads_pending[REDIS_IO_THREADS_MAX_NUM];
+static int io_threads_op;
+/* The clients of the current round, thread j serves j, j+N, j+2N... */
+static redisClient** io_clients = NULL;
+static int io_clients_num = 0, io_clients_size = 0;
+
+static unsigned long getIOPendingCount(int id)
+{
+    unsigned long count = io_threads_pending[id];
+    __sync_synchronize();
+    return count;
+}
+
+static void setIOPendingCount(int id, unsigned long count)
+{
+    __sync_synchronize();
+    io_threads_pending[id] = count;
+}
+
+/* Returns 1 if the query buffer starts with a whole multi bulk command, or
+ * with something the parser will handle in one step anyway (inline requests
+ * and protocol errors). Commands queued in c->pcmds must be followed only by
+ * whole commands, as the main thread needs c->argv to execute them. */
+static int queryBufferHasCommand(redisClient* c)
+{
+    char* p = c->querybuf, *end = c->querybuf + sdslen(c->querybuf);
+    char* newline;
+    long long count, len, j;
+
+    if (*p != '*') {
+        return 1;
+    }
+    newline = memchr(p, '\r', end - p);
+    if (newline == NULL || newline + 2 > end) {
+        return 0;
+    }
+    if (!string2ll(p + 1, newline - (p + 1), &count)) {
+        return 1;
+    }
+    p = newline + 2;
+    for (j = 0; j < count; j++) {
+        if (p >= end) {
+            return 0;
+        }
+        if (*p != '$') {
+            return 1;
+        }
+        newline = memchr(p, '\r', end - p);
+        if (newline == NULL || newline + 2 > end) {
+            return 0;
+        }
+        if (!string2ll(p + 1, newline - (p + 1), &len) || len < 0) {
+            return 1;
+        }
+        p = newline + 2;
+        if (len + 2 > end - p) {
+            return 0;
+        }
+        p += len + 2;
+    }
+    return 1;
+}
+
+/* Parse the query buffer into c->pcmds, leaving the execution to
+ * processInputBuffer() in the main thread. Called by the I/O threads. */
+static void parseQueryBuffer(redisClient* c)
+{
+    while (sdslen(c->querybuf)) {
+        /* Same conditions processInputBuffer() stops at. */
+        if (c->flags & (REDIS_BLOCKED | REDIS_PERSIST_PAUSED | REDIS_CLOSE_AFTER_REPLY) ||
+            c->protoerr) {
+            break;
+        }
+        if (c->pcmds_len && !queryBufferHasCommand(c)) {
+            break;
+        }
+
+        if (!c->reqtype && c->querybuf[0] == '*' && processMultibulkBatch(c)) {
+            continue;
+        }
+
+        if (!c->reqtype) {
+            if (c->querybuf[0] == '*') {
+                c->reqtype = REDIS_REQ_MULTIBULK;
+            } else {
+                c->reqtype = REDIS_REQ_INLINE;
+            }
+        }
+        if (c->reqtype == REDIS_REQ_INLINE) {
+            if (processInlineBuffer(c) != REDIS_OK) {
+                break;
+            }
+        } else if (processMultibulkBuffer(c) != REDIS_OK) {
+            break;
+        }
+
+        /* Multibulk processing could see a <= 0 length. */
+        if (c->argc) {
+            queueParsedCommand(c, c->argc, c->argv);
+            c->argv = NULL;
+            c->argc = 0;
+        }
+        c->reqtype = 0;
+        c->multibulklen = 0;
+        c->bulklen = -1;
+    }
+}
+
+/* writeToClient() for the I/O threads: the reply objects fully written are
+ * released by handleThreadedWrite() in the main thread. */
+static void threadedWriteToClient(redisClient* c)
+{
+    c->io_errno = 0;
+    if (writeClientReply(c, 0) == -1) {
+        c->io_errno = errno;
+    }
+}
+
+/* Install the write handler if the reply was not sent entirely. */
+static void installWriteHandler(redisClient* c)
+{
+    if ((c->bufpos > 0 || listLength(c->reply)) &&
+        aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+                          sendReplyToClient, c) == AE_ERR) {
+        freeClientAsync(c);
+    }
+}
+
+/* Finish in the main thread the write threadedWriteToClient() did. */
+static void handleThreadedWrite(redisClient* c)
+{
+    int j;
+
+    for (j = 0; j < c->io_sentobjs; j++) {
+        listNode* ln = listFirst(c->reply);
+        robj* o = listNodeValue(ln);
+
+        if (sdslen(o->ptr)) {
+            c->reply_bytes -= zmalloc_size_sds(o->ptr);
+        }
+        listDelNode(c->reply, ln);
+    }
+    c->io_sentobjs = 0;
+    if (c->io_errno) {
+        redisLog(REDIS_VERBOSE,
+                 "Error writing to client: %s", strerror(c->io_errno));
+        freeClient(c);
+        return;
+    }
+    if (c->bufpos == 0 && listLength(c->reply) == 0) {
+        c->sentlen = 0;
+        /* Close connection after entire reply has been sent. */
+        if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
+            freeClient(c);
+        }
+    } else {
+        installWriteHandler(c);
+    }
+}
+
+static void ioThreadsProcess(int id, int step)
+{
+    int j;
+
+    for (j = id; j < io_clients_num; j += step) {
+        redisClient* c = io_clients[j];
+
+        if (io_threads_op == REDIS_IO_THREADS_OP_WRITE) {
+            threadedWriteToClient(c);
+        } else {
+            c->io_nread = readClientSocket(c);
+            if (c->io_nread > 0) {
+                parseQueryBuffer(c);
+            }
+        }
+    }
+}
+
+void* ioThreadMain(void* arg)
+{
+    int id = (long)arg;
+    sigset_t sigset;
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL)) {
+        redisLog(REDIS_WARNING,
+                 "Warning: can't mask SIGALRM in I/O thread: %s", strerror(errno));
+    }
+
+    while (1) {
+        int j;
+
+        /* Spin for a while waiting for a round before to block on the
+         * mutex, which is held by the main thread when there is no load. */
+        for (j = 0; j < REDIS_IO_THREADS_SPIN; j++) {
+            if (getIOPendingCount(id) != 0) {
+                break;
+            }
+        }
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+        ioThreadsProcess(id, server.io_threads_num);
+        setIOPendingCount(id, 0);
+    }
+    return NULL;
+}
+
+/* Spawn the io-threads - 1 I/O threads, stopped until the load asks for
+ * them, see handleClientsWithPendingWrites(). */
+void initThreadedIO(void)
+{
+    long j;
+
+    server.io_threads_active = 0;
+    if (server.io_threads_num == 1) {
+        return;
+    }
+    for (j = 1; j < server.io_threads_num; j++) {
+        pthread_mutex_init(&io_threads_mutex[j], NULL);
+        setIOPendingCount(j, 0);
+        pthread_mutex_lock(&io_threads_mutex[j]);
+        if (pthread_create(&io_threads[j], NULL, ioThreadMain, (void*)j) != 0) {
+            redisLog(REDIS_WARNING, "Fatal: Can't initialize the I/O threads.");
+            exit(1);
+        }
+    }
+    redisLog(REDIS_NOTICE, "Threaded I/O enabled with %d threads", server.io_threads_num);
+}
+
+static void startThreadedIO(void)
+{
+    int j;
+
+    for (j = 1; j < server.io_threads_num; j++) {
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    }
+    server.io_threads_active = 1;
+}
+
+static void stopThreadedIO(void)
+{
+    int j;
+
+    for (j = 1; j < server.io_threads_num; j++) {
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    }
+    server.io_threads_active = 0;
+}
+
+/* Run a round of 'op' over the clients of 'l': the I/O threads take their
+ * share, the main thread does its own and waits for the others. Without
+ * active I/O threads the main thread does everything. */
+static void runIOThreads(list* l, int op)
+{
+    int step = server.io_threads_active ? server.io_threads_num : 1;
+    listIter li;
+    listNode* ln;
+    int j;
+
+    if ((unsigned long)io_clients_size < listLength(l)) {
+        io_clients_size = listLength(l) * 2;
+        io_clients = zrealloc(io_clients, sizeof(redisClient*) * io_clients_size);
+    }
+    io_clients_num = 0;
+    listRewind(l, &li);
+    while ((ln = listNext(&li)) != NULL) {
+        io_clients[io_clients_num++] = listNodeValue(ln);
+    }
+
+    io_threads_op = op;
+    for (j = 1; j < step; j++) {
+        setIOPendingCount(j, 1);
+    }
+    ioThreadsProcess(0, step);
+    for (j = 1; j < step; j++) {
+        while (getIOPendingCount(j) != 0);
+    }
+    io_clients_num = 0;
+}
+
+/* Read and parse the queries of the clients readQueryFromClient() queued,
+ * then execute them in the order the clients were queued. */
+void handleClientsWithPendingReads(void)
+{
+    int processed = listLength(server.clients_pending_read);
+
+    if (processed == 0) {
+        return;
+    }
+    runIOThreads(server.clients_pending_read, REDIS_IO_THREADS_OP_READ);
+    if (server.io_threads_active) {
+        server.stat_io_reads_processed += processed;
+    }
+
+    /* Commands may free other queued clients, that leave the list. */
+    while (listLength(server.clients_pending_read)) {
+        listNode* ln = listFirst(server.clients_pending_read);
+        redisClient* c = listNodeValue(ln);
+
+        listDelNode(server.clients_pending_read, ln);
+        c->flags &= ~REDIS_PENDING_READ;
+        server.current_client = c;
+        handleClientRead(c, c->io_nread);
+        server.current_client = NULL;
+    }
+}
+
+/* Write the replies of the clients prepareClientToWrite() queued, installing
+ * the write handler only for those the socket didn't take entirely. The I/O
+ * threads are started when there are at least two clients per thread to
+ * write to, and stopped below that so they don't burn CPU for nothing. */
+void handleClientsWithPendingWrites(void)
+{
+    int processed = listLength(server.clients_pending_write);
+    listNode* ln;
+    redisClient* c;
+
+    if (processed == 0) {
+        return;
+    }
+    if (processed < server.io_threads_num * 2) {
+        if (server.io_threads_active) {
+            stopThreadedIO();
+        }
+        while (listLength(server.clients_pending_write)) {
+            ln = listFirst(server.clients_pending_write);
+            c = listNodeValue(ln);
+            listDelNode(server.clients_pending_write, ln);
+            c->flags &= ~REDIS_PENDING_WRITE;
+            if (writeToClient(c) == REDIS_OK) {
+                installWriteHandler(c);
+            }
+        }
+        return;
+    }
+
+    if (!server.io_threads_active) {
+        startThreadedIO();
+    }
+    runIOThreads(server.clients_pending_write, REDIS_IO_THREADS_OP_WRITE);
+    server.stat_io_writes_processed += processed;
+    while (listLength(server.clients_pending_write)) {
+        ln = listFirst(server.clients_pending_write);
+        c = listNodeValue(ln);
+        listDelNode(server.clients_pending_write, ln);
+        c->flags &= ~REDIS_PENDING_WRITE;
+        handleThreadedWrite(c);
+    }
+}
+
+/* Serve the clients while the main thread is busy loading a dataset or
+ * running a slow script. beforeSleep() won't run meanwhile, so the reads are
+ * not queued for the I/O threads and the replies are written here. */
+void processEventsWhileBlocked(void)
+{
+    processing_events_while_blocked++;
+    aeProcessEvents(server.el, AE_FILE_EVENTS | AE_DONT_WAIT);
+    handleClientsWithPendingWrites();
+    processing_events_while_blocked--;
+}
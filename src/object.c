@@ -101,12 +101,12 @@ robj* dupStringObject(robj* o)
     return createStringObject(o->ptr, sdslen(o->ptr));
 }
 
-robj* createListObject(void)
+robj* createQuicklistObject(void)
 {
-    list* l = listCreate();
+    quicklist* l = quicklistNew(server.list_max_ziplist_size,
+                                server.list_compress_depth);
     robj* o = createObject(REDIS_LIST, l);
-    listSetFreeMethod(l, decrRefCount);
-    o->encoding = REDIS_ENCODING_LINKEDLIST;
+    o->encoding = REDIS_ENCODING_QUICKLIST;
     return o;
 }
 
@@ -172,8 +172,8 @@ void freeStringObject(robj* o)
 void freeListObject(robj* o)
 {
     switch (o->encoding) {
-        case REDIS_ENCODING_LINKEDLIST:
-            listRelease((list*) o->ptr);
+        case REDIS_ENCODING_QUICKLIST:
+            quicklistRelease(o->ptr);
             break;
         case REDIS_ENCODING_ZIPLIST:
             zfree(o->ptr);
@@ -608,6 +608,8 @@ char* strEncoding(int encoding)
             return "linkedlist";
         case REDIS_ENCODING_ZIPLIST:
             return "ziplist";
+        case REDIS_ENCODING_QUICKLIST:
+            return "quicklist";
         case REDIS_ENCODING_INTSET:
             return "intset";
         case REDIS_ENCODING_SKIPLIST:
@@ -629,6 +631,63 @@ unsigned long estimateObjectIdleTime(robj* o)
     }
 }
 
+/* Return an estimate of the memory used by the object. Aggregate values
+ * encoded as real data structures are not walked: the size of one random
+ * element is taken as representative of all the others. */
+static size_t _estimateElementMemory(robj* o)
+{
+    if (o == NULL) {
+        return 0;
+    }
+    if (o->encoding == REDIS_ENCODING_RAW) {
+        return sizeof(*o) + sdsAllocSize(o->ptr);
+    }
+    return sizeof(*o);
+}
+
+size_t estimateObjectMemory(robj* o)
+{
+    size_t size = sizeof(*o);
+    dictEntry* de;
+    dict* d;
+
+    switch (o->encoding) {
+        case REDIS_ENCODING_RAW:
+            return size + sdsAllocSize(o->ptr);
+        case REDIS_ENCODING_INT:
+            return size;
+        case REDIS_ENCODING_ZIPLIST:
+            return size + ziplistBlobLen(o->ptr);
+        case REDIS_ENCODING_INTSET:
+            return size + intsetBlobLen(o->ptr);
+        case REDIS_ENCODING_QUICKLIST:
+            /* Sampled from the head node, that is never compressed. */
+            if (((quicklist*)o->ptr)->len == 0) {
+                return size + sizeof(quicklist);
+            }
+            return size + sizeof(quicklist) + ((quicklist*)o->ptr)->len *
+                   (sizeof(quicklistNode) + ((quicklist*)o->ptr)->head->sz);
+        case REDIS_ENCODING_HT:
+        case REDIS_ENCODING_SKIPLIST:
+            if (o->encoding == REDIS_ENCODING_SKIPLIST) {
+                d = ((zset*)o->ptr)->dict;
+                size += sizeof(zset) + sizeof(zskiplist) +
+                        dictSize(d) * (sizeof(zskiplistNode) + sizeof(struct zskiplistLevel));
+            } else {
+                d = o->ptr;
+            }
+            size += sizeof(dict) + dictSlots(d) * sizeof(dictEntry*);
+            if ((de = dictGetRandomKey(d)) == NULL) {
+                return size;
+            }
+            return size + dictSize(d) * (sizeof(dictEntry) +
+                   _estimateElementMemory(dictGetKey(de)) +
+                   (o->type == REDIS_HASH ? _estimateElementMemory(dictGetVal(de)) : 0));
+        default:
+            return size;
+    }
+}
+
 /* This is an helper function for the DEBUG command. We need to lookup keys
  * without any modification of LRU or other parameters. */
 robj* objectCommandLookup(redisClient* c, robj* key)
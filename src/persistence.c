@@ -9,33 +9,130 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+
+/* 任务头部: [int 时间][long long 序号][命令函数指针][JobKey], 之后是各个参数 */
+#define JOB_KEY_OFFSET (sizeof(int) + sizeof(long long) + sizeof(redisCommandProc*))
+
+static pthread_mutex_t _deadLetterLock = PTHREAD_MUTEX_INITIALIZER;
+static int _deadLetterFd = -1; /* 持有死信文件的排他锁, 不用于读写 */
+
+/* 每个MySQL分片各有一组队列和写线程, 一个分片变慢不会阻塞其它分片. 分片0即pmgr/lockPmgr */
+static PMgr* _shardPmgrs[MAX_DB_SHARD_NUM];
+static PMgr* _shardLockPmgrs[MAX_DB_SHARD_NUM];
+
+/* 未写入MySQL的修改索引, key -> PendingOp链表, 只在主线程访问 */
+static dict* _pendingWrites = NULL;
+static long long _pendingSeq = 0;
+/* 序号不大于它的任务是上次运行留在mmap队列中的, 头部中的表编号已失效 */
+static long long _runSeqBase = 0;
+static int _replaying = 0;
+static redisClient* _replayClient = NULL;
+/* 写线程完成的任务, 由主线程取出后从索引中删除 */
+static list* _pendingDone = NULL;
+/* 写线程正在写入的任务, 回源查询期间有这些key的任务在写入或完成时重新查询 */
+static list* _pendingWriting = NULL;
+/* 保护_pendingDone和_pendingWriting, 不在持有期间访问MySQL */
+static pthread_mutex_t _pendingDoneLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* EXEC期间持久化的命令合并成一个任务, 每个参数是一个完整的子任务, 只在主线程访问 */
+static char _multiBuf[MAX_PERSISTENCE_BUF_SIZE];
+static int _multiLen = 0;
+static int _multiCount = 0;
+static int _multiLock = 0;
+static int _multiShard = 0;
+/* 处于限流中的分片, 只在主线程访问 */
+static char _throttledShards[MAX_DB_SHARD_NUM];
+
+/* BGMYSQLSAVE期间序号大于fence的任务暂不分派, 等快照导入MySQL以后再写入, 0表示不限制 */
+static volatile long long _fenceSeq = 0;
 
 static void* _persistenceMain(void* arg);
 static void* _writeDBPorcess(void* arg);
-static int _packCmd(char* wbuf, redisClient* c);
-static int _unpackCmd(const char* rbuf, int rbufLen, CmdArgv** cmdArgvs, redisCommandProc** procPtr, int* time);
+static int _packCmd(char* wbuf, redisClient* c, int shard);
+static int _unpackCmd(const char* rbuf, int rbufLen, CmdArgv** cmdArgvs, redisCommandProc** procPtr, int* time, long long* seq, JobKey* jobKey);
 static void _wait(PMgr* this);
 static int _createMainWorkerProcess(PMgr* this);
-static int _createWriteWorkerProcess(int num, PMgr* this);
+static int _createWriteWorkerProcess(WriteWorker* worker);
+static WriteWorker* _pickWorker(PMgr* this);
+static int _addWorker(PMgr* this);
+static int _retireWorker(PMgr* this, int force);
+static void _growWorkers(PMgr* this, int jobTime);
+static void _shrinkWorkers(PMgr* this);
+static int _minWorkerNum(void);
+static int _maxWorkerNum(void);
+static int _dispatchRetryJob(PMgr* this);
+static int _failedJob(WriteWorker* worker, int ret);
+static void _reconnect(WriteWorker* worker);
+static int _lockDeadLetter(void);
+static int _appendDeadLetter(const char* buf, size_t len);
+static void _deadLetterJob(PMgr* this, const char* rbuf, int rbufLen, int ret);
+static sds _catDeadLetterCmd(sds dead, const char* name, int argc, CmdArgv** cmdArgvs);
+static int _replayDeadLetter(long* replayed);
+static void _initPendingWrites(void);
+static void _pendingWriteMark(long long seq, int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, int mark);
+static int _pendingWriteBusy(sds key);
+static void _addPendingOp(robj* key, long long seq, int complete, struct redisCommand* cmd, int argc, robj** argv);
+static void _freePendingOp(void* ptr);
+static int _replayPendingOps(redisClient* c, listNode* from);
+static int _packMultiHeader(char* wbuf);
+static void _cancelPendingWrite(const char* rbuf, int rbufLen);
+static int _queueShardJob(redisClient* c, const char* wbuf, int len, int lock, int shard);
+static void _addPendingWrite(redisClient* c, long long seq, int shard);
+static int _workersIdle(PMgr* this);
+static int _jobKeys(const char* rbuf, int rbufLen, CmdArgv** keys, int max);
+static int _jobsConflict(const char* a, int alen, const char* b, int blen);
+static int _retryBlocks(PMgr* this, const char* rbuf, int rbufLen, listNode* until);
+static void _holdJob(PMgr* this, const char* rbuf, int rbufLen);
 
 static void* _persistenceMain(void* arg)
 {
     PMgr* this = (PMgr*)arg;
-    int currWorkerIdx = 0;
     while (1) {
+        if (_dispatchRetryJob(this)) {
+            continue;
+        }
         char* recv;
         int len = popJobList(this->joblist, &recv);
+        if (_fenceSeq != 0) {
+            int hold = len > 0 && persistenceJobSeq(recv) > _fenceSeq;
+            this->fenceReached = (len <= 0 || hold) && listLength(this->retryJobs) == 0 && _workersIdle(this);
+            if (hold) {
+                this->headJobTime = *(int*)recv;
+                _wait(this);
+                continue;
+            }
+        }
         if (len <= 0) {
+            this->headJobTime = 0;
+            _shrinkWorkers(this);
             _wait(this);
         } else {
-            while (this->writeWorkers[currWorkerIdx]->buflen > 0) {
-                if (currWorkerIdx++ == this->workerNum - 1) {
-                    currWorkerIdx = 0;
-                    _wait(this);
+            WriteWorker* worker;
+            this->headJobTime = *(int*)recv;
+            if (listLength(this->retryJobs) > 0 || !_workersIdle(this)) {
+                if (_retryBlocks(this, recv, len, NULL)) {
+                    /* 同一key还有等待重试的任务, 放到它后面, 避免旧值覆盖新值.
+                     * 重试队列已满时留在队列中等待 */
+                    if (listLength(this->retryJobs) >= (unsigned long)server.persistenceRetryMaxJobs) {
+                        _wait(this);
+                        continue;
+                    }
+                    _holdJob(this, recv, len);
+                    incJoblistRsize(this->joblist, len);
+                    continue;
                 }
             }
-            memcpy(this->writeWorkers[currWorkerIdx]->buf, recv, len);
-            this->writeWorkers[currWorkerIdx]->buflen = len;
+            while ((worker = _pickWorker(this)) == NULL) {
+                _growWorkers(this, *(int*)recv);
+                _wait(this);
+            }
+            memcpy(worker->buf, recv, len);
+            worker->attempts = 0;
+            worker->fromRetry = 0;
+            worker->buflen = len;
             incJoblistRsize(this->joblist, len);
         }
     }
@@ -45,26 +142,76 @@ static void* _persistenceMain(void* arg)
 PMgr* initPersistence(int joblistsize, const char* mmapFile, int threadNum, const char* host, const int port, const char* user, const char* pwd, const char* dbName)
 {
     PMgr* this = (PMgr*)zmalloc(sizeof(PMgr));
-    this->workerNum = threadNum;
+    if (_pendingWrites == NULL) {
+        _initPendingWrites();
+    }
+    this->workerNum = 0;
+    this->currWorkerIdx = 0;
+    this->headJobTime = 0;
+    this->fenceReached = 0;
+    this->lateJobs = 0;
+    this->retriedJobs = 0;
+    this->deadJobs = 0;
+    this->reconnects = 0;
+    this->retryJobs = listCreate();
+    pthread_mutex_init(&this->retryLock, NULL);
     this->sleepSum = 0;
+    this->host = host;
+    this->port = port;
+    this->user = user;
+    this->pwd = pwd;
+    this->dbName = dbName;
     this->joblist = initJoblist(MAX_PERSISTENCE_BUF_SIZE, joblistsize, mmapFile);
     assert(this->joblist != NULL);
-    this->writeWorkers = (WriteWorker**)zmalloc(sizeof(WriteWorker*) * threadNum);
+    this->writeWorkers = (WriteWorker**)zcalloc(sizeof(WriteWorker*) * MAX_WRITE_THREAD_NUM);
+    if (threadNum > MAX_WRITE_THREAD_NUM) {
+        threadNum = MAX_WRITE_THREAD_NUM;
+    }
     int i = 0;
     for (; i < threadNum; i++) {
-        this->writeWorkers[i] = (WriteWorker*)zmalloc(sizeof(WriteWorker) + MAX_PERSISTENCE_BUF_SIZE);
-        this->writeWorkers[i]->dbConn = initDB(host, port, user, pwd, dbName);
-        this->writeWorkers[i]->buflen = 0;
+        int ret = _addWorker(this);
+        assert(ret == PERSISTENCE_RET_SUCCESS);
     }
     int ret = _createMainWorkerProcess(this);
     assert(ret == PERSISTENCE_RET_SUCCESS);
-    for (i = 0; i < threadNum; i++) {
-        ret = _createWriteWorkerProcess(i, this);
-        assert(ret == PERSISTENCE_RET_SUCCESS);
-    }
     return this;
 }
 
+/* 分片0沿用persistence_mmap_file, 其余分片在文件名后加 ".分片号" */
+int initPersistenceShards(int joblistsize, int threadNum)
+{
+    int i = 0;
+    if (_lockDeadLetter() != PERSISTENCE_RET_SUCCESS) {
+        return PERSISTENCE_RET_DEADLETTER_ERROR;
+    }
+    for (; i < dbShardNum(); i++) {
+        DBShard* shard = dbShard(i);
+        char* mmapFile = server.persistenceMmapFile;
+        char* lockMmapFile = server.lockPersistenceMmapFile;
+        if (i > 0) {
+            mmapFile = mmapFile ? sdscatprintf(sdsempty(), "%s.%d", mmapFile, i) : NULL;
+            lockMmapFile = lockMmapFile ? sdscatprintf(sdsempty(), "%s.%d", lockMmapFile, i) : NULL;
+        }
+        _shardPmgrs[i] = initPersistence(joblistsize, mmapFile, threadNum, shard->host, shard->port, shard->user, shard->pwd, shard->dbName);
+        _shardLockPmgrs[i] = initPersistence(joblistsize, lockMmapFile, threadNum, shard->host, shard->port, shard->user, shard->pwd, shard->dbName);
+        if (_shardPmgrs[i] == NULL || _shardLockPmgrs[i] == NULL) {
+            return PERSISTENCE_RET_THREAD_ERROR;
+        }
+    }
+    pmgr = _shardPmgrs[0];
+    lockPmgr = _shardLockPmgrs[0];
+    return PERSISTENCE_RET_SUCCESS;
+}
+
+/* 分片的队列, 分片号越界或持久化未开启时返回NULL */
+PMgr* persistenceQueue(int shard, int lock)
+{
+    if (shard < 0 || shard >= dbShardNum()) {
+        return NULL;
+    }
+    return lock ? _shardLockPmgrs[shard] : _shardPmgrs[shard];
+}
+
 static int _createMainWorkerProcess(PMgr* this)
 {
     pthread_t thread;
@@ -74,22 +221,576 @@ static int _createMainWorkerProcess(PMgr* this)
     return PERSISTENCE_RET_SUCCESS; 
 }
 
-static int _createWriteWorkerProcess(int num, PMgr* this)
+static int _createWriteWorkerProcess(WriteWorker* worker)
 {
     pthread_t thread;
     pthread_attr_t attr;
     pthread_attr_init(&attr);
-    this->writeWorkers[num]->pmgr = this;
-    pthread_create(&thread, &attr, _writeDBPorcess, this->writeWorkers[num]);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, _writeDBPorcess, worker) != 0) {
+        return PERSISTENCE_RET_THREAD_ERROR;
+    }
     return PERSISTENCE_RET_SUCCESS;  
 }
 
+/* 从上次分派的位置开始轮询一圈, 返回空闲的写线程, 全忙时返回NULL */
+static WriteWorker* _pickWorker(PMgr* this)
+{
+    int n = 0;
+    for (; n < this->workerNum; n++) {
+        if (this->currWorkerIdx >= this->workerNum) {
+            this->currWorkerIdx = 0;
+        }
+        WriteWorker* worker = this->writeWorkers[this->currWorkerIdx++];
+        if (worker->ready && worker->buflen == 0) {
+            return worker;
+        }
+    }
+    return NULL;
+}
+
+static int _workersIdle(PMgr* this)
+{
+    int i = 0;
+    for (; i < this->workerNum; i++) {
+        if (this->writeWorkers[i]->buflen != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int _addWorker(PMgr* this)
+{
+    if (this->workerNum >= MAX_WRITE_THREAD_NUM) {
+        return PERSISTENCE_RET_THREAD_ERROR;
+    }
+    WriteWorker* worker = (WriteWorker*)zmalloc(sizeof(WriteWorker) + MAX_PERSISTENCE_BUF_SIZE);
+    worker->buflen = 0;
+    worker->ready = 0;
+    worker->retire = 0;
+    worker->attempts = 0;
+    worker->fromRetry = 0;
+    worker->lastActive = (int)time(NULL);
+    worker->dbConn = NULL;
+    worker->pmgr = this;
+    if (_createWriteWorkerProcess(worker) != PERSISTENCE_RET_SUCCESS) {
+        zfree(worker);
+        return PERSISTENCE_RET_THREAD_ERROR;
+    }
+    this->writeWorkers[this->workerNum++] = worker;
+    redisLog(REDIS_NOTICE, "persistence write worker added, worker num %d", this->workerNum);
+    return PERSISTENCE_RET_SUCCESS;
+}
+
+/* 只回收末尾的空闲线程, 保证writeWorkers[0, workerNum)始终连续 */
+static int _retireWorker(PMgr* this, int force)
+{
+    if (this->workerNum == 0) {
+        return PERSISTENCE_RET_THREAD_ERROR;
+    }
+    WriteWorker* worker = this->writeWorkers[this->workerNum - 1];
+    int now = (int)time(NULL);
+    if (!worker->ready || worker->buflen != 0) {
+        return PERSISTENCE_RET_THREAD_ERROR;
+    }
+    if (!force && now - worker->lastActive < server.writeThreadIdleTime) {
+        return PERSISTENCE_RET_THREAD_ERROR;
+    }
+    this->writeWorkers[--this->workerNum] = NULL;
+    worker->retire = 1;
+    redisLog(REDIS_NOTICE, "persistence write worker retired, worker num %d", this->workerNum);
+    return PERSISTENCE_RET_SUCCESS;
+}
+
+/* 所有写线程都忙时调用, 队列积压或任务等待过久则扩容 */
+static void _growWorkers(PMgr* this, int jobTime)
+{
+    int i = 0;
+    if (this->workerNum >= _maxWorkerNum()) {
+        return;
+    }
+    for (; i < this->workerNum; i++) {
+        if (!this->writeWorkers[i]->ready) {
+            return; /* 上一个新线程还在连接中 */
+        }
+    }
+    unsigned long long untreated = this->joblist->jobbuff->wSize - this->joblist->jobbuff->rSize;
+    int now = (int)time(NULL);
+    if (untreated >= (unsigned long long)server.writeThreadScaleDepth
+        || now - jobTime >= server.writeThreadScaleAge
+        || this->workerNum < _minWorkerNum()) {
+        _addWorker(this);
+    }
+}
+
+/* 队列为空时调用, 补足下限并回收超出上限或空闲过久的线程 */
+static void _shrinkWorkers(PMgr* this)
+{
+    if (this->workerNum < _minWorkerNum()) {
+        _addWorker(this);
+    } else if (this->workerNum > _maxWorkerNum()) {
+        _retireWorker(this, 1);
+    } else if (this->workerNum > _minWorkerNum()) {
+        _retireWorker(this, 0);
+    }
+}
+
+static int _minWorkerNum(void)
+{
+    int min = server.writeThreadMin;
+    if (min < 1) {
+        min = 1;
+    }
+    return min > MAX_WRITE_THREAD_NUM ? MAX_WRITE_THREAD_NUM : min;
+}
+
+static int _maxWorkerNum(void)
+{
+    int min = _minWorkerNum();
+    int max = server.writeThreadMax;
+    if (max < min) {
+        max = min;
+    }
+    return max > MAX_WRITE_THREAD_NUM ? MAX_WRITE_THREAD_NUM : max;
+}
+
+int persistenceWorkerNum(PMgr* this)
+{
+    return this != NULL ? this->workerNum : -1;
+}
+
+int persistenceHeadJobAge(PMgr* this)
+{
+    int jobTime = this != NULL ? this->headJobTime : 0;
+    return jobTime != 0 ? (int)time(NULL) - jobTime : 0;
+}
+
+long long persistenceLateJobs(PMgr* this)
+{
+    return this != NULL ? this->lateJobs : -1;
+}
+
+void persistenceRetryInfo(unsigned long* retryLen, long long* retried, long long* dead, long long* reconnects, PMgr* this)
+{
+    *retryLen = this != NULL ? listLength(this->retryJobs) : 0;
+    *retried = this != NULL ? this->retriedJobs : -1;
+    *dead = this != NULL ? this->deadJobs : -1;
+    *reconnects = this != NULL ? this->reconnects : -1;
+}
+
+/* 取出一个到期的重试任务交给空闲写线程, 没有到期任务或写线程全忙时返回0.
+ * 同一key前面还有任务等待重试或正在重试时跳过, 保证同一key按入队顺序写入 */
+static int _dispatchRetryJob(PMgr* this)
+{
+    if (listLength(this->retryJobs) == 0) {
+        return 0;
+    }
+    long long now = mstime();
+    RetryJob* job = NULL;
+    WriteWorker* worker = NULL;
+    listIter li;
+    listNode* ln;
+    pthread_mutex_lock(&this->retryLock);
+    listRewind(this->retryJobs, &li);
+    while ((ln = listNext(&li)) != NULL) {
+        RetryJob* j = listNodeValue(ln);
+        if (j->retryAt <= now && !_retryBlocks(this, j->buf, j->len, ln)) {
+            job = j;
+            break;
+        }
+    }
+    if (job != NULL && (worker = _pickWorker(this)) != NULL) {
+        listDelNode(this->retryJobs, ln);
+    }
+    pthread_mutex_unlock(&this->retryLock);
+    if (worker == NULL) {
+        return 0;
+    }
+    memcpy(worker->buf, job->buf, job->len);
+    worker->attempts = job->attempts;
+    worker->fromRetry = 1;
+    worker->buflen = job->len;
+    zfree(job);
+    return 1;
+}
+
+/* 取出任务修改的key, EXEC合并任务取所有子任务的key, 返回key的数量 */
+static int _jobKeys(const char* rbuf, int rbufLen, CmdArgv** keys, int max)
+{
+    CmdArgv* cmdArgvs[MAX_CMD_ARGV];
+    redisCommandProc* proc;
+    int jobTime;
+    long long seq;
+    int argc = _unpackCmd(rbuf, rbufLen, cmdArgvs, &proc, &jobTime, &seq, NULL);
+    int n = 0;
+    int i = 0;
+    if (proc == execCommand) {
+        for (; i < argc && n < max; i++) {
+            n += _jobKeys(cmdArgvs[i]->buf, cmdArgvs[i]->len, keys + n, max - n);
+        }
+        return n;
+    }
+    int step = proc == msetCommand ? 2 : argc;
+    for (; i < argc && n < max; i += step) {
+        keys[n++] = cmdArgvs[i];
+    }
+    return n;
+}
+
+static int _jobsConflict(const char* a, int alen, const char* b, int blen)
+{
+    CmdArgv* akeys[MAX_CMD_ARGV];
+    CmdArgv* bkeys[MAX_CMD_ARGV];
+    int an = _jobKeys(a, alen, akeys, MAX_CMD_ARGV);
+    int bn = _jobKeys(b, blen, bkeys, MAX_CMD_ARGV);
+    int i = 0;
+    for (; i < an; i++) {
+        int j = 0;
+        for (; j < bn; j++) {
+            if (akeys[i]->len == bkeys[j]->len && memcmp(akeys[i]->buf, bkeys[j]->buf, akeys[i]->len) == 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* 任务修改的key是否有正在重试的任务, 或在重试队列中排在until之前(until为NULL时查整个队列)的任务.
+ * 写线程先把失败的任务放回重试队列再清空buflen, 所以先查写线程再查队列.
+ * until不为NULL时调用者已持有retryLock */
+static int _retryBlocks(PMgr* this, const char* rbuf, int rbufLen, listNode* until)
+{
+    int i = 0;
+    for (; i < this->workerNum; i++) {
+        WriteWorker* worker = this->writeWorkers[i];
+        if (worker->buflen != 0 && worker->fromRetry && _jobsConflict(worker->buf, worker->buflen, rbuf, rbufLen)) {
+            return 1;
+        }
+    }
+    int blocked = 0;
+    listIter li;
+    listNode* ln;
+    if (until == NULL) {
+        pthread_mutex_lock(&this->retryLock);
+    }
+    listRewind(this->retryJobs, &li);
+    while (!blocked && (ln = listNext(&li)) != NULL && ln != until) {
+        RetryJob* job = listNodeValue(ln);
+        blocked = _jobsConflict(job->buf, job->len, rbuf, rbufLen);
+    }
+    if (until == NULL) {
+        pthread_mutex_unlock(&this->retryLock);
+    }
+    return blocked;
+}
+
+/* 队列中的任务排到重试队列末尾, 等前面同一key的任务写完后按普通任务分派 */
+static void _holdJob(PMgr* this, const char* rbuf, int rbufLen)
+{
+    RetryJob* job = (RetryJob*)zmalloc(sizeof(RetryJob) + rbufLen);
+    job->attempts = 0;
+    job->retryAt = 0;
+    job->len = rbufLen;
+    memcpy(job->buf, rbuf, rbufLen);
+    pthread_mutex_lock(&this->retryLock);
+    listAddNodeTail(this->retryJobs, job);
+    pthread_mutex_unlock(&this->retryLock);
+}
+
+/* 临时错误按指数退避放入重试队列并返回1, 永久错误或重试耗尽时写入死信文件并返回0 */
+static int _failedJob(WriteWorker* worker, int ret)
+{
+    PMgr* this = worker->pmgr;
+    int attempts = worker->attempts + 1;
+    if (isDBRetryable(ret) && attempts < server.persistenceRetryMaxAttempts) {
+        long long delay = PERSISTENCE_RETRY_BASE_MS;
+        int i = 1;
+        for (; i < attempts && delay < PERSISTENCE_RETRY_MAX_MS; i++) {
+            delay *= 2;
+        }
+        if (delay > PERSISTENCE_RETRY_MAX_MS) {
+            delay = PERSISTENCE_RETRY_MAX_MS;
+        }
+        RetryJob* job = NULL;
+        pthread_mutex_lock(&this->retryLock);
+        if (listLength(this->retryJobs) < (unsigned long)server.persistenceRetryMaxJobs) {
+            job = (RetryJob*)zmalloc(sizeof(RetryJob) + worker->buflen);
+            job->attempts = attempts;
+            job->retryAt = mstime() + delay;
+            job->len = worker->buflen;
+            memcpy(job->buf, worker->buf, worker->buflen);
+            /* 排在同一key等待中的后续任务之前 */
+            listIter li;
+            listNode* ln;
+            listRewind(this->retryJobs, &li);
+            while ((ln = listNext(&li)) != NULL) {
+                RetryJob* held = listNodeValue(ln);
+                if (_jobsConflict(held->buf, held->len, job->buf, job->len)) {
+                    break;
+                }
+            }
+            if (ln != NULL) {
+                listInsertNode(this->retryJobs, ln, job, 0);
+            } else {
+                listAddNodeTail(this->retryJobs, job);
+            }
+        }
+        pthread_mutex_unlock(&this->retryLock);
+        if (job != NULL) {
+            redisLog(REDIS_NOTICE, "persistence job failed %d, retry %d in %lld ms", ret, attempts, delay);
+            __sync_fetch_and_add(&this->retriedJobs, 1);
+            return 1;
+        }
+        redisLog(REDIS_WARNING, "persistence retry queue is full");
+    }
+    _deadLetterJob(this, worker->buf, worker->buflen, ret);
+    return 0;
+}
+
+/* 断线后按指数退避重连, 期间分派线程不会把任务交给该写线程 */
+static void _reconnect(WriteWorker* worker)
+{
+    long long delay = PERSISTENCE_RETRY_BASE_MS;
+    while (!worker->retire && pingDB(worker->dbConn) != DB_RET_SUCCESS) {
+        redisLog(REDIS_WARNING, "persistence write worker reconnect in %lld ms", delay);
+        usleep(delay * 1000);
+        delay = delay * 2 > PERSISTENCE_RETRY_MAX_MS ? PERSISTENCE_RETRY_MAX_MS : delay * 2;
+    }
+    if (worker->retire) {
+        return; /* 放弃重连, 不再接收任务 */
+    }
+    __sync_fetch_and_add(&worker->pmgr->reconnects, 1);
+    worker->ready = 1;
+}
+
+/* 共用端口等多个实例部署在一起时, 死信文件不能被两个进程同时追加和清空 */
+static int _lockDeadLetter(void)
+{
+    _deadLetterFd = open(server.persistenceDeadLetterFile, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (_deadLetterFd == -1) {
+        redisLog(REDIS_WARNING, "open dead letter file %s error: %s", server.persistenceDeadLetterFile, strerror(errno));
+        return PERSISTENCE_RET_DEADLETTER_ERROR;
+    }
+    if (flock(_deadLetterFd, LOCK_EX | LOCK_NB) == -1) {
+        redisLog(REDIS_WARNING, "dead letter file %s is used by another process: %s", server.persistenceDeadLetterFile, strerror(errno));
+        close(_deadLetterFd);
+        _deadLetterFd = -1;
+        return PERSISTENCE_RET_DEADLETTER_ERROR;
+    }
+    return PERSISTENCE_RET_SUCCESS;
+}
+
+static int _appendDeadLetter(const char* buf, size_t len)
+{
+    int fd = open(server.persistenceDeadLetterFile, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1) {
+        redisLog(REDIS_WARNING, "open dead letter file %s error: %s", server.persistenceDeadLetterFile, strerror(errno));
+        return PERSISTENCE_RET_DEADLETTER_ERROR;
+    }
+    ssize_t nwritten = write(fd, buf, len);
+    close(fd);
+    return nwritten == (ssize_t)len ? PERSISTENCE_RET_SUCCESS : PERSISTENCE_RET_DEADLETTER_ERROR;
+}
+
+/* 按redis协议追加一条命令 */
+static sds _catDeadLetterCmd(sds dead, const char* name, int argc, CmdArgv** cmdArgvs)
+{
+    int i = 0;
+    dead = sdscatprintf(dead, "*%d\r\n$%d\r\n%s\r\n", argc + 1, (int)strlen(name), name);
+    for (; i < argc; i++) {
+        dead = sdscatprintf(dead, "$%d\r\n", cmdArgvs[i]->len);
+        dead = sdscatlen(dead, cmdArgvs[i]->buf, cmdArgvs[i]->len);
+        dead = sdscatlen(dead, "\r\n", 2);
+    }
+    return dead;
+}
+
+/* 死信文件使用redis协议格式, 可直接查看, 也可通过PERSISTENCE REPLAY重新入队 */
+static void _deadLetterJob(PMgr* this, const char* rbuf, int rbufLen, int ret)
+{
+    CmdArgv* cmdArgvs[MAX_CMD_ARGV];
+    redisCommandProc* proc;
+    int jobTime = 0;
+    long long seq;
+    int argc = _unpackCmd(rbuf, rbufLen, cmdArgvs, &proc, &jobTime, &seq, NULL);
+    int i = 0;
+    if (proc == execCommand) {
+        /* 合并的任务按子任务分别写入, 重放时不再保证原子性 */
+        for (; i < argc; i++) {
+            _deadLetterJob(this, cmdArgvs[i]->buf, cmdArgvs[i]->len, ret);
+        }
+        return;
+    }
+    struct redisCommand* cmd = lookupCommandByProc(proc);
+    char* name = cmd != NULL ? cmd->name : "unknown";
+
+    sds dead = sdsempty();
+    long long ttl;
+    if ((proc == setexCommand || proc == psetexCommand || proc == expireCommand)
+        && string2ll(cmdArgvs[1]->buf, cmdArgvs[1]->len, &ttl)) {
+        /* 相对的过期时间按入队时间换算成EXPIREAT, 重放时不会从重放的时间重新计时,
+         * 与写线程一样把参数按秒加在任务时间上 */
+        CmdArgv* when = (CmdArgv*)zmalloc(sizeof(CmdArgv) + 32);
+        CmdArgv* args[2];
+        when->len = ll2string(when->buf, 32, jobTime + ttl);
+        args[0] = cmdArgvs[0];
+        if (proc != expireCommand) {
+            args[1] = cmdArgvs[2];
+            dead = _catDeadLetterCmd(dead, "set", 2, args);
+        }
+        args[1] = when;
+        dead = _catDeadLetterCmd(dead, "expireat", 2, args);
+        zfree(when);
+    } else {
+        dead = _catDeadLetterCmd(dead, name, argc, cmdArgvs);
+    }
+    pthread_mutex_lock(&_deadLetterLock);
+    int wret = _appendDeadLetter(dead, sdslen(dead));
+    pthread_mutex_unlock(&_deadLetterLock);
+    sdsfree(dead);
+    __sync_fetch_and_add(&this->deadJobs, 1);
+    redisLog(REDIS_WARNING, "persistence job %s queued at %d failed %d, %s", name, jobTime, ret,
+             wret == PERSISTENCE_RET_SUCCESS ? "moved to dead letter file" : "dropped");
+}
+
+/* 读出死信文件并清空, 把其中的命令重新打包放入持久化队列 */
+static int _replayDeadLetter(long* replayed)
+{
+    *replayed = 0;
+    pthread_mutex_lock(&_deadLetterLock);
+    FILE* fp = fopen(server.persistenceDeadLetterFile, "r");
+    if (fp == NULL) {
+        pthread_mutex_unlock(&_deadLetterLock);
+        return errno == ENOENT ? PERSISTENCE_RET_SUCCESS : PERSISTENCE_RET_DEADLETTER_ERROR;
+    }
+    sds content = sdsempty();
+    char buf[REDIS_IOBUF_LEN];
+    size_t nread;
+    while ((nread = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        content = sdscatlen(content, buf, nread);
+    }
+    fclose(fp);
+    int ret = truncate(server.persistenceDeadLetterFile, 0) == 0 ? PERSISTENCE_RET_SUCCESS : PERSISTENCE_RET_DEADLETTER_ERROR;
+    pthread_mutex_unlock(&_deadLetterLock);
+    if (ret != PERSISTENCE_RET_SUCCESS) {
+        sdsfree(content);
+        return ret;
+    }
+
+    char* p = content;
+    char* end = content + sdslen(content);
+    while (p < end) {
+        char* q;
+        robj* argv[MAX_CMD_ARGV];
+        int argc = 0;
+        long count;
+        char* start = p;
+        if (*p != '*' || (count = strtol(p + 1, &q, 10)) <= 0 || count > MAX_CMD_ARGV || q + 2 > end) {
+            goto fmterr;
+        }
+        p = q + 2;
+        for (; argc < count; argc++) {
+            long len;
+            if (p >= end || *p != '$' || (len = strtol(p + 1, &q, 10)) < 0 || q + 2 + len + 2 > end) {
+                break;
+            }
+            p = q + 2;
+            argv[argc] = createStringObject(p, len);
+            p += len + 2;
+        }
+        int complete = argc == count;
+        if (complete) {
+            redisClient fake;
+            char wbuf[MAX_PERSISTENCE_BUF_SIZE];
+            fake.argc = argc;
+            fake.argv = argv;
+            fake.flags = 0;
+            fake.dbkey = NULL;
+            fake.dbkey_arg = NULL;
+            fake.cmd = lookupCommand(argv[0]->ptr);
+            if (fake.cmd != NULL) {
+                int len = packPersistenceJob(&fake, wbuf);
+                if (len > 0 && queuePersistenceJob(&fake, wbuf, len, needLockTable(fake.cmd->proc)) == JOBLIST_RET_SUCCESS) {
+                    (*replayed)++;
+                }
+            }
+            zfree(fake.dbkey);
+        }
+        while (argc > 0) {
+            decrRefCount(argv[--argc]);
+        }
+        if (!complete) {
+            p = start;
+            goto fmterr;
+        }
+        continue;
+fmterr:
+        /* 无法解析的部分写回死信文件, 避免丢失 */
+        redisLog(REDIS_WARNING, "bad format in dead letter file at offset %ld", (long)(p - content));
+        pthread_mutex_lock(&_deadLetterLock);
+        _appendDeadLetter(p, end - p);
+        pthread_mutex_unlock(&_deadLetterLock);
+        break;
+    }
+    sdsfree(content);
+    return PERSISTENCE_RET_SUCCESS;
+}
+
+/* PERSISTENCE RETRYLEN | REPLAY */
+void persistenceCommand(redisClient* c)
+{
+    if (pmgr == NULL) {
+        addReplyError(c, "MySQL persistence is not configured");
+    } else if (!strcasecmp(c->argv[1]->ptr, "retrylen") && c->argc == 2) {
+        long long len = 0;
+        int i = 0;
+        for (; i < dbShardNum(); i++) {
+            len += listLength(_shardPmgrs[i]->retryJobs) + listLength(_shardLockPmgrs[i]->retryJobs);
+        }
+        addReplyLongLong(c, len);
+    } else if (!strcasecmp(c->argv[1]->ptr, "replay") && c->argc == 2) {
+        long replayed;
+        if (_replayDeadLetter(&replayed) != PERSISTENCE_RET_SUCCESS) {
+            addReplyErrorFormat(c, "Can't read dead letter file %s", server.persistenceDeadLetterFile);
+            return;
+        }
+        addReplyLongLong(c, replayed);
+    } else {
+        addReplyError(c, "Syntax error, try PERSISTENCE (RETRYLEN | REPLAY)");
+    }
+}
+
 int packPersistenceJob(redisClient* c, char* wbuf)
 {
     if (c->argc >= MAX_CMD_ARGV) {
         return PERSISTENCE_RET_ARGC_OVERFLOW;
     }
-    return isPersistenceCmd(c) ? _packCmd(wbuf, c) : PERSISTENCE_RET_NOTFOUNDCMD;
+    if (!isPersistenceCmd(c)) {
+        return PERSISTENCE_RET_NOTFOUNDCMD;
+    }
+    int len = _packCmd(wbuf, c, -1);
+    /* MSET按第一个key所在表的策略处理 */
+    if (len > 0 && persistenceJobPolicy(wbuf) == TABLE_POLICY_CACHE_ONLY) {
+        return PERSISTENCE_RET_CACHE_ONLY;
+    }
+    return len;
+}
+
+/* 按头部中的表编号查找策略, 注册表已满时按key中的表名查找 */
+int persistenceJobPolicy(const char* wbuf)
+{
+    JobKey jobKey;
+    memcpy(&jobKey, wbuf + JOB_KEY_OFFSET, sizeof(JobKey));
+    if (jobKey.tableId >= 0 || dictSize(server.tablePolicies) == 0) {
+        return dbTablePolicy(jobKey.tableId);
+    }
+    DBKey dbKey;
+    if (unpackJobKey(NULL, (CmdArgv*)(wbuf + JOB_KEY_OFFSET + sizeof(JobKey)), &dbKey) != DB_RET_SUCCESS) {
+        return TABLE_POLICY_WRITE_BEHIND;
+    }
+    dictEntry* de = dictFind(server.tablePolicies, dbKey.table);
+    return de != NULL ? (int)dictGetSignedIntegerVal(de) : TABLE_POLICY_WRITE_BEHIND;
 }
 
 int addPersistenceJob(const char* wbuf, int len, PMgr* this)
@@ -97,13 +798,214 @@ int addPersistenceJob(const char* wbuf, int len, PMgr* this)
     return len > 0 ? pushJobList(this->joblist, wbuf, len) : JOBLIST_RET_SIZE_OVERFLOW;
 }
 
-static int _packCmd(char* wbuf, redisClient* c)
+/* 命令执行后调用, 按key所在分片放入队列, 成功后在未写入索引中登记.
+ * MSET的key分布在多个分片时按分片拆成多个MSET任务, 分片之间不保证原子性 */
+int queuePersistenceJob(redisClient* c, const char* wbuf, int len, int lock)
+{
+    if (dbShardNum() == 1) {
+        return _queueShardJob(c, wbuf, len, lock, 0);
+    }
+    if (c->cmd->proc != msetCommand) {
+        return _queueShardJob(c, wbuf, len, lock, dbShardOfKey(c->argv[1]->ptr, sdslen(c->argv[1]->ptr)));
+    }
+    char done[MAX_DB_SHARD_NUM] = {0};
+    char sbuf[MAX_PERSISTENCE_BUF_SIZE];
+    int ret = JOBLIST_RET_SUCCESS;
+    int j = 1;
+    for (; j < c->argc; j += 2) {
+        int shard = dbShardOfKey(c->argv[j]->ptr, sdslen(c->argv[j]->ptr));
+        if (done[shard]) {
+            continue;
+        }
+        done[shard] = 1;
+        int slen = _packCmd(sbuf, c, shard);
+        int r = slen > 0 ? _queueShardJob(c, sbuf, slen, lock, shard) : JOBLIST_RET_SIZE_OVERFLOW;
+        if (r != JOBLIST_RET_SUCCESS) {
+            ret = r;
+        }
+    }
+    return ret;
+}
+
+static int _queueShardJob(redisClient* c, const char* wbuf, int len, int lock, int shard)
+{
+    int ret;
+    if (c->flags & REDIS_MULTI) {
+        ret = addPersistenceMultiJob(wbuf, len, lock, shard);
+    } else {
+        ret = addPersistenceJob(wbuf, len, persistenceQueue(shard, lock));
+    }
+    if (ret == JOBLIST_RET_SUCCESS) {
+        _addPendingWrite(c, persistenceJobSeq(wbuf), c->cmd->proc == msetCommand && dbShardNum() > 1 ? shard : -1);
+    }
+    return ret;
+}
+
+/* write-through的表在命令执行并修改了数据后调用, 同步写入MySQL. 执行前已由persistenceKeysPending()
+ * 确认key没有排队中的修改, MySQL中就是执行前的值, 写入失败时把key从内存中删除, 下次读取时读回
+ * 执行前的值, 由调用者把回复换成错误. 跨分片的MSET可能只写入了部分分片, 删除后同样与MySQL一致.
+ * BGMYSQLSAVE不导入write-through的表, 导入期间也同步写入 */
+int writeThroughPersistenceJob(redisClient* c, const char* wbuf, int len)
+{
+    int ret = writePersistenceJob(wbuf, len);
+    if (ret == DB_RET_SUCCESS) {
+        return ret;
+    }
+    redisLog(REDIS_WARNING, "MySQL write-through failed(%d), command on key %s undone", ret, (char*)c->argv[1]->ptr);
+    if (c->cmd->proc != msetCommand) {
+        if (dbDelete(c->db, c->argv[1])) {
+            signalModifiedKey(c->db, c->argv[1]);
+        }
+        return ret;
+    }
+    int j = 1;
+    for (; j < c->argc; j += 2) {
+        if (dbDelete(c->db, c->argv[j])) {
+            signalModifiedKey(c->db, c->argv[j]);
+        }
+    }
+    return ret;
+}
+
+/* 命令涉及的key中是否有尚未写入MySQL的修改, write-through的命令此时不执行,
+ * 否则同步写入会越过排队中的修改 */
+int persistenceKeysPending(redisClient* c)
+{
+    if (c->cmd->proc != msetCommand) {
+        return hasPendingWrite(c->argv[1]);
+    }
+    int j = 1;
+    for (; j < c->argc; j += 2) {
+        if (hasPendingWrite(c->argv[j])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* 主线程同步写入, 不经过队列 */
+int writePersistenceJob(const char* wbuf, int len)
+{
+    CmdArgv* cmdArgvs[MAX_CMD_ARGV];
+    redisCommandProc* proc;
+    int jobTime;
+    long long seq;
+    JobKey jobKey;
+    int argc = _unpackCmd(wbuf, len, cmdArgvs, &proc, &jobTime, &seq, &jobKey);
+    int ret = writeSyncToDB(argc, cmdArgvs, proc, &jobKey, jobTime);
+    if (ret == DB_RET_NOTRESULT) {
+        ret = DB_RET_SUCCESS;
+    }
+    return ret;
+}
+
+/* EXEC中的命令先放进合并任务, EXEC结束时由flushPersistenceMulti()一次入队.
+ * 命令属于另一个分片时先把已有的部分入队, 保持命令的先后顺序, 因此只有连续属于同一分片
+ * 的命令在同一个事务中写入. 合并任务放不下时同样先把已有的部分入队, 此时EXEC在MySQL中
+ * 拆成多个事务写入, 不再保证原子性, 记录日志 */
+int addPersistenceMultiJob(const char* wbuf, int len, int lock, int shard)
+{
+    if (len <= 0) {
+        return JOBLIST_RET_SIZE_OVERFLOW;
+    }
+    if (_multiLen > 0 && shard != _multiShard) {
+        flushPersistenceMulti();
+    }
+    if (_multiLen == 0) {
+        _multiLen = _packMultiHeader(_multiBuf);
+        _multiShard = shard;
+    }
+    if (_multiLen + (int)sizeof(int) + len > MAX_PERSISTENCE_BUF_SIZE) {
+        redisLog(REDIS_WARNING, "EXEC needs more than %d bytes, written to MySQL in several transactions",
+                 MAX_PERSISTENCE_BUF_SIZE);
+        flushPersistenceMulti();
+        _multiLen = _packMultiHeader(_multiBuf);
+        _multiShard = shard;
+        if (_multiLen + (int)sizeof(int) + len > MAX_PERSISTENCE_BUF_SIZE) {
+            _multiLen = 0;
+            return addPersistenceJob(wbuf, len, persistenceQueue(shard, lock));
+        }
+    }
+    CmdArgv* sub = (CmdArgv*)(_multiBuf + _multiLen);
+    sub->len = len;
+    memcpy(sub->buf, wbuf, len);
+    _multiLen += sizeof(int) + len;
+    _multiCount++;
+    _multiLock |= lock;
+    return JOBLIST_RET_SUCCESS;
+}
+
+/* 只有一个子任务时直接按普通任务入队. 入队失败时子任务不会再被写入, 从未写入索引中删除 */
+int flushPersistenceMulti(void)
+{
+    int ret = JOBLIST_RET_SUCCESS;
+    PMgr* this = persistenceQueue(_multiShard, _multiLock);
+    if (_multiCount == 1) {
+        CmdArgv* sub = (CmdArgv*)(_multiBuf + _packMultiHeader(NULL));
+        ret = addPersistenceJob(sub->buf, sub->len, this);
+        if (ret != JOBLIST_RET_SUCCESS) {
+            _cancelPendingWrite(sub->buf, sub->len);
+        }
+    } else if (_multiCount > 1) {
+        ret = addPersistenceJob(_multiBuf, _multiLen, this);
+        if (ret != JOBLIST_RET_SUCCESS) {
+            _cancelPendingWrite(_multiBuf, _multiLen);
+        }
+    }
+    if (ret != JOBLIST_RET_SUCCESS) {
+        redisLog(REDIS_WARNING, "persistence queue is full, %d commands of EXEC dropped", _multiCount);
+    }
+    _multiLen = 0;
+    _multiCount = 0;
+    _multiLock = 0;
+    _multiShard = 0;
+    return ret;
+}
+
+/* 合并任务的头部与普通任务相同, 命令为EXEC, 没有key. wbuf为NULL时只返回长度 */
+static int _packMultiHeader(char* wbuf)
+{
+    int len = JOB_KEY_OFFSET + sizeof(JobKey);
+    if (wbuf != NULL) {
+        int now = (int)time(NULL);
+        long long seq = ++_pendingSeq;
+        redisCommandProc* proc = execCommand;
+        JobKey jobKey;
+        memset(&jobKey, 0, sizeof(jobKey));
+        jobKey.tableId = -1;
+        memcpy(wbuf, &now, sizeof(int));
+        memcpy(wbuf + sizeof(int), &seq, sizeof(long long));
+        memcpy(wbuf + sizeof(int) + sizeof(long long), &proc, sizeof(redisCommandProc*));
+        memcpy(wbuf + JOB_KEY_OFFSET, &jobKey, sizeof(JobKey));
+    }
+    return len;
+}
+
+int unpackPersistenceJob(const char* rbuf, int rbufLen, CmdArgv** cmdArgvs, redisCommandProc** procPtr, int* jobTime, long long* seq, JobKey* jobKey)
+{
+    return _unpackCmd(rbuf, rbufLen, cmdArgvs, procPtr, jobTime, seq, jobKey);
+}
+
+/* shard不为-1时只打包MSET中属于该分片的key */
+static int _packCmd(char* wbuf, redisClient* c, int shard)
 {
     int n = 1;
-    int keylen = strlen(c->argv[1]->ptr);
-    if (keylen >= MAX_KEY_LEN) {
+    DBKey* dbKey = clientDBKey(c);
+    if (dbKey == NULL) {
         return PERSISTENCE_RET_KEYSIZE_EXCEED;
     }
+    if (c->cmd->proc == incrCommand || c->cmd->proc == incrbyCommand) {
+        DBTable* t = dbTable(dbKey->tableId);
+        if (t != NULL) {
+            t->counter = 1;
+        }
+    }
+    JobKey jobKey;
+    packJobKey(dbKey, &jobKey);
+    if (c->cmd->proc == msetCommand) {
+        /* 按分片拆开后第一个key不一定是argv[1], 只保留表编号用于查找策略 */
+        jobKey.tableLen = 0;
+    }
     int offset = 0;
     char* end = wbuf;
     redisLog(REDIS_DEBUG, "packCmd proc %p ", c->cmd->proc);
@@ -111,9 +1013,19 @@ static int _packCmd(char* wbuf, redisClient* c)
     int now = (int)time(NULL);
     *(int*)end = now;
     offset += sizeof(int);
+    long long seq = ++_pendingSeq;
+    memcpy(end + offset, &seq, sizeof(long long));
+    offset += sizeof(long long);
     memcpy(end + offset, &c->cmd->proc, sizeof(redisCommandProc*));
     offset += sizeof(redisCommandProc*);
+    memcpy(end + offset, &jobKey, sizeof(JobKey));
+    offset += sizeof(JobKey);
     for (; n < c->argc; n++) {
+        if (shard != -1 && c->cmd->proc == msetCommand && n % 2 == 1
+            && dbShardOfKey(c->argv[n]->ptr, sdslen(c->argv[n]->ptr)) != shard) {
+            n++; /* 跳过key和value */
+            continue;
+        }
         end = wbuf + offset;
         CmdArgv* cmdArgv = (CmdArgv*)end;
         cmdArgv->len = strlen(c->argv[n]->ptr);
@@ -126,15 +1038,25 @@ static int _packCmd(char* wbuf, redisClient* c)
     return offset;
 }
 
-static int _unpackCmd(const char* rbuf, int rbufLen, CmdArgv** cmdArgvs, redisCommandProc** procPtr, int* jobTime)
+/* jobKey可以为NULL */
+static int _unpackCmd(const char* rbuf, int rbufLen, CmdArgv** cmdArgvs, redisCommandProc** procPtr, int* jobTime, long long* seq, JobKey* jobKey)
 {
     const char* end = rbuf;
     int i = 0;
     *jobTime = *(int*)end;
     end += sizeof(int);
+    memcpy(seq, end, sizeof(long long));
+    end += sizeof(long long);
     memcpy(procPtr, end, sizeof(redisCommandProc*));
     redisLog(REDIS_DEBUG, "unpackCmd proc %p ", *procPtr);
     end += sizeof(redisCommandProc*);
+    if (jobKey != NULL) {
+        memcpy(jobKey, end, sizeof(JobKey));
+        if (*seq <= _runSeqBase) {
+            jobKey->tableId = -1;
+        }
+    }
+    end += sizeof(JobKey);
     while ((end - rbuf) < rbufLen) {
         cmdArgvs[i] = (CmdArgv*)end;
         end += sizeof(cmdArgvs[i]->len) + cmdArgvs[i++]->len;
@@ -151,6 +1073,163 @@ void persistenceInfo(int* untreatedSize, int* sleepSum, unsigned long long * wSi
     *rSize = this != NULL ? this->joblist->jobbuff->rSize : -1;
 }
 
+/* 以下统计所有分片的加锁(lock为1)或不加锁队列, 持久化未开启时与单个队列一样返回-1 */
+void persistenceTotalInfo(int lock, int* untreatedSize, int* sleepSum, unsigned long long* wSize, unsigned long long* rSize)
+{
+    int i = 1;
+    persistenceInfo(untreatedSize, sleepSum, wSize, rSize, persistenceQueue(0, lock));
+    for (; pmgr != NULL && i < dbShardNum(); i++) {
+        int u, s;
+        unsigned long long w, r;
+        persistenceInfo(&u, &s, &w, &r, persistenceQueue(i, lock));
+        *untreatedSize += u;
+        *sleepSum += s;
+        *wSize += w;
+        *rSize += r;
+    }
+}
+
+void persistenceTotalRetryInfo(int lock, unsigned long* retryLen, long long* retried, long long* dead, long long* reconnects)
+{
+    int i = 1;
+    persistenceRetryInfo(retryLen, retried, dead, reconnects, persistenceQueue(0, lock));
+    for (; pmgr != NULL && i < dbShardNum(); i++) {
+        unsigned long l;
+        long long r, d, c;
+        persistenceRetryInfo(&l, &r, &d, &c, persistenceQueue(i, lock));
+        *retryLen += l;
+        *retried += r;
+        *dead += d;
+        *reconnects += c;
+    }
+}
+
+int persistenceTotalWorkerNum(int lock)
+{
+    int num = persistenceWorkerNum(persistenceQueue(0, lock));
+    int i = 1;
+    for (; pmgr != NULL && i < dbShardNum(); i++) {
+        num += persistenceWorkerNum(persistenceQueue(i, lock));
+    }
+    return num;
+}
+
+/* 所有分片中最老的队头任务 */
+int persistenceMaxHeadJobAge(int lock)
+{
+    int age = 0;
+    int i = 0;
+    for (; pmgr != NULL && i < dbShardNum(); i++) {
+        int a = persistenceHeadJobAge(persistenceQueue(i, lock));
+        if (a > age) {
+            age = a;
+        }
+    }
+    return age;
+}
+
+/* 一个分片加锁和不加锁队列中未处理的字节数之和, 限流按分片判断, 一个分片积压不影响其它分片 */
+long long persistenceShardQueued(int shard)
+{
+    int u, l, s;
+    unsigned long long w, r;
+    persistenceInfo(&u, &s, &w, &r, persistenceQueue(shard, 0));
+    persistenceInfo(&l, &s, &w, &r, persistenceQueue(shard, 1));
+    return (long long)u + l;
+}
+
+int persistenceShardHeadJobAge(int shard)
+{
+    int age = persistenceHeadJobAge(persistenceQueue(shard, 0));
+    int lockAge = persistenceHeadJobAge(persistenceQueue(shard, 1));
+    return lockAge > age ? lockAge : age;
+}
+
+void setPersistenceShardThrottled(int shard, int on)
+{
+    _throttledShards[shard] = on;
+}
+
+int persistenceShardThrottled(int shard)
+{
+    return _throttledShards[shard];
+}
+
+/* 命令的key所在分片是否在限流中, MSET任意一个key所在分片限流即算 */
+int persistenceCmdThrottled(redisClient* c)
+{
+    if (dbShardNum() == 1) {
+        return _throttledShards[0];
+    }
+    int step = c->cmd->proc == msetCommand ? 2 : c->argc;
+    int j = 1;
+    for (; j < c->argc; j += step) {
+        if (_throttledShards[dbShardOfKey(c->argv[j]->ptr, sdslen(c->argv[j]->ptr))]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+long long persistenceTotalLateJobs(void)
+{
+    long long late = persistenceLateJobs(persistenceQueue(0, 0)) + persistenceLateJobs(persistenceQueue(0, 1));
+    int i = 1;
+    for (; pmgr != NULL && i < dbShardNum(); i++) {
+        late += persistenceLateJobs(persistenceQueue(i, 0)) + persistenceLateJobs(persistenceQueue(i, 1));
+    }
+    return late;
+}
+
+/* 每个分片一行, 只在配置了多个分片时输出 */
+sds catPersistenceShardInfo(sds info)
+{
+    int i = 0;
+    for (; pmgr != NULL && dbShardNum() > 1 && i < dbShardNum(); i++) {
+        DBShard* shard = dbShard(i);
+        int u, lu, s;
+        unsigned long long w, r;
+        unsigned long l, ll;
+        long long rt, d, c;
+        persistenceInfo(&u, &s, &w, &r, persistenceQueue(i, 0));
+        persistenceInfo(&lu, &s, &w, &r, persistenceQueue(i, 1));
+        persistenceRetryInfo(&l, &rt, &d, &c, persistenceQueue(i, 0));
+        persistenceRetryInfo(&ll, &rt, &d, &c, persistenceQueue(i, 1));
+        int age = persistenceHeadJobAge(persistenceQueue(i, 0));
+        if (persistenceHeadJobAge(persistenceQueue(i, 1)) > age) {
+            age = persistenceHeadJobAge(persistenceQueue(i, 1));
+        }
+        info = sdscatprintf(info, "persistence shard %d :host=%s,port=%d,untreated_size=%d,workers=%d,head_job_age=%d,retry_queue_len=%lu\r\n",
+                            i, shard->host, shard->port, u + lu,
+                            persistenceWorkerNum(persistenceQueue(i, 0)) + persistenceWorkerNum(persistenceQueue(i, 1)),
+                            age, l + ll);
+    }
+    return info;
+}
+
+/* on为1时以当前最后一个任务的序号为fence, 之后入队的任务暂停分派; on为0时恢复 */
+void setPersistenceFence(int on)
+{
+    int i = 0;
+    for (; pmgr != NULL && i < dbShardNum(); i++) {
+        _shardPmgrs[i]->fenceReached = 0;
+        _shardLockPmgrs[i]->fenceReached = 0;
+    }
+    _fenceSeq = on ? _pendingSeq : 0;
+}
+
+/* fence之前的任务都已写入MySQL(或进入死信文件), 重试队列为空 */
+int persistenceFenceReached(void)
+{
+    int i = 0;
+    for (; pmgr != NULL && i < dbShardNum(); i++) {
+        if (!_shardPmgrs[i]->fenceReached || !_shardLockPmgrs[i]->fenceReached) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 static void _wait(PMgr* this)
 {
     usleep(1000);
@@ -164,22 +1243,369 @@ static void* _writeDBPorcess(void* arg)
 {
     WriteWorker* worker = (WriteWorker*)arg;
     PMgr* this = worker->pmgr;
-    while (1) {
+    while (worker->dbConn == NULL && !worker->retire) {
+        worker->dbConn = initDB(this->host, this->port, this->user, this->pwd, this->dbName);
+        if (worker->dbConn == NULL) {
+            redisLog(REDIS_WARNING, "persistence write worker connect error, retry later");
+            sleep(1);
+        }
+    }
+    worker->lastActive = (int)time(NULL);
+    worker->ready = 1;
+    while (!worker->retire) {
         if (worker->buflen == 0) {
             _wait(this);
         } else {
             CmdArgv* cmdArgvs[MAX_CMD_ARGV];
             redisCommandProc* proc;
             int jobTime = 0;
-            int argc = _unpackCmd(worker->buf, worker->buflen, cmdArgvs, &proc, &jobTime);
+            long long seq;
+            JobKey jobKey;
+            int argc = _unpackCmd(worker->buf, worker->buflen, cmdArgvs, &proc, &jobTime, &seq, &jobKey);
             assert(argc > 0);
-            if (server.stat_starttime <= jobTime) {
+            if (server.stat_starttime <= jobTime && server.persistenceTolerateTime > 0) {
                 int now = (int)time(NULL);
-                assert(now - jobTime <= server.persistenceTolerateTime);
+                if (now - jobTime > server.persistenceTolerateTime) {
+                    redisLog(REDIS_WARNING, "persistence job written %d seconds late, over persistence_tolerate_time", now - jobTime);
+                    __sync_fetch_and_add(&this->lateJobs, 1);
+                }
             }
-            writeToDB(argc, cmdArgvs, proc, worker->dbConn, jobTime);
+            _pendingWriteMark(seq, argc, cmdArgvs, proc, PENDING_MARK_WRITING);
+            int ret = writeToDB(argc, cmdArgvs, proc, &jobKey, worker->dbConn, jobTime);
+            int done = 1;
+            if (ret != DB_RET_SUCCESS && ret != DB_RET_NOTRESULT) {
+                done = !_failedJob(worker, ret);
+                if (isDBConnError(ret)) {
+                    worker->ready = 0; /* 重连期间不再接收任务 */
+                }
+            }
+            _pendingWriteMark(seq, argc, cmdArgvs, proc, done ? PENDING_MARK_DONE : PENDING_MARK_RETRY);
+            worker->lastActive = (int)time(NULL);
             worker->buflen = 0;
+            if (!worker->ready) {
+                _reconnect(worker);
+            }
         }
     }
+    if (worker->dbConn != NULL) {
+        freeDB(worker->dbConn);
+    }
+    zfree(worker);
     return NULL;
 }
+
+static void _initPendingWrites(void)
+{
+    _pendingWrites = dictCreate(&pendingWriteDictType, NULL);
+    _pendingDone = listCreate();
+    _pendingWriting = listCreate();
+    /* mmap队列中可能还有上次运行留下的任务, 序号从启动时间开始避免与其重复 */
+    _pendingSeq = (long long)time(NULL) << 32;
+    _runSeqBase = _pendingSeq;
+}
+
+long long persistenceJobSeq(const char* wbuf)
+{
+    long long seq;
+    memcpy(&seq, wbuf + sizeof(int), sizeof(long long));
+    return seq;
+}
+
+/* 任务已成功入队, 在索引中登记它修改的key, shard不为-1时只登记MSET中属于该分片的key */
+static void _addPendingWrite(redisClient* c, long long seq, int shard)
+{
+    redisCommandProc* proc = c->cmd->proc;
+    if (proc == msetCommand) {
+        struct redisCommand* set = lookupCommandByProc(setCommand);
+        robj* argv[3];
+        int j = 1;
+        argv[0] = createStringObject("SET", 3);
+        for (; j + 1 < c->argc; j += 2) {
+            if (shard != -1 && dbShardOfKey(c->argv[j]->ptr, sdslen(c->argv[j]->ptr)) != shard) {
+                continue;
+            }
+            argv[1] = c->argv[j];
+            argv[2] = c->argv[j + 1];
+            _addPendingOp(c->argv[j], seq, 1, set, 3, argv);
+        }
+        decrRefCount(argv[0]);
+        return;
+    }
+    /* 相对的过期时间换算成绝对时间, 重放时不会重新开始计时 */
+    long long when = -1;
+    if (proc == setexCommand || proc == psetexCommand || proc == expireCommand) {
+        long long ttl = 0;
+        getLongLongFromObject(c->argv[2], &ttl);
+        when = mstime() + (proc == psetexCommand ? ttl : ttl * 1000);
+    }
+    robj* argv[3];
+    if (proc == setCommand || proc == setnxCommand || proc == setexCommand || proc == psetexCommand) {
+        /* 只有修改了数据的命令才会入队, 这里的SETNX一定设置了key, 写线程也按SET写入,
+         * 因此按SET登记为完整的修改 */
+        argv[0] = createStringObject("SET", 3);
+        argv[1] = c->argv[1];
+        argv[2] = (proc == setCommand || proc == setnxCommand) ? c->argv[2] : c->argv[3];
+        _addPendingOp(c->argv[1], seq, 1, lookupCommandByProc(setCommand), 3, argv);
+        decrRefCount(argv[0]);
+    } else if (when == -1) {
+        _addPendingOp(c->argv[1], seq, 0, c->cmd, c->argc, c->argv);
+    }
+    if (when != -1) {
+        argv[0] = createStringObject("PEXPIREAT", 9);
+        argv[1] = c->argv[1];
+        argv[2] = createStringObjectFromLongLong(when);
+        _addPendingOp(c->argv[1], seq, 0, lookupCommandByProc(pexpireatCommand), 3, argv);
+        decrRefCount(argv[0]);
+        decrRefCount(argv[2]);
+    }
+}
+
+static void _addPendingOp(robj* key, long long seq, int complete, struct redisCommand* cmd, int argc, robj** argv)
+{
+    list* ops = dictFetchValue(_pendingWrites, key->ptr);
+    if (ops == NULL) {
+        ops = listCreate();
+        listSetFreeMethod(ops, _freePendingOp);
+        dictAdd(_pendingWrites, sdsdup(key->ptr), ops);
+    }
+    PendingOp* op = (PendingOp*)zmalloc(sizeof(PendingOp));
+    int j = 0;
+    op->seq = seq;
+    op->complete = complete;
+    op->cmd = cmd;
+    op->argc = argc;
+    op->argv = (robj**)zmalloc(sizeof(robj*) * argc);
+    for (; j < argc; j++) {
+        op->argv[j] = argv[j];
+        incrRefCount(argv[j]);
+    }
+    listAddNodeTail(ops, op);
+}
+
+static void _freePendingOp(void* ptr)
+{
+    PendingOp* op = ptr;
+    int j = 0;
+    for (; j < op->argc; j++) {
+        decrRefCount(op->argv[j]);
+    }
+    zfree(op->argv);
+    zfree(op);
+}
+
+/* 写线程在写入前后调用. WRITING登记任务的key正在写入; 写入后从中删除, 写入成功或已转入死信时(DONE)
+ * 同时登记完成, 进入重试队列的任务(RETRY)仍算未完成. 删除和登记在同一次加锁中进行,
+ * 回源读取据此判断查询结果是否可能包含了这些修改 */
+static void _pendingWriteMark(long long seq, int argc, CmdArgv** cmdArgvs, redisCommandProc* proc, int mark)
+{
+    int step = proc == msetCommand ? 2 : argc;
+    int i = 0;
+    if (proc == execCommand) {
+        for (; i < argc; i++) {
+            CmdArgv* subArgvs[MAX_CMD_ARGV];
+            redisCommandProc* subProc;
+            int subTime;
+            long long subSeq;
+            int subArgc = _unpackCmd(cmdArgvs[i]->buf, cmdArgvs[i]->len, subArgvs, &subProc, &subTime, &subSeq, NULL);
+            _pendingWriteMark(subSeq, subArgc, subArgvs, subProc, mark);
+        }
+        return;
+    }
+    pthread_mutex_lock(&_pendingDoneLock);
+    for (; i < argc; i += step) {
+        if (mark != PENDING_MARK_WRITING) {
+            listIter li;
+            listNode* ln;
+            listRewind(_pendingWriting, &li);
+            while ((ln = listNext(&li)) != NULL) {
+                PendingDone* w = listNodeValue(ln);
+                if (w->seq == seq && sdslen(w->key) == cmdArgvs[i]->len
+                    && memcmp(w->key, cmdArgvs[i]->buf, cmdArgvs[i]->len) == 0) {
+                    sdsfree(w->key);
+                    zfree(w);
+                    listDelNode(_pendingWriting, ln);
+                    break;
+                }
+            }
+        }
+        if (mark != PENDING_MARK_RETRY) {
+            PendingDone* done = (PendingDone*)zmalloc(sizeof(PendingDone));
+            done->seq = seq;
+            done->key = sdsnewlen(cmdArgvs[i]->buf, cmdArgvs[i]->len);
+            listAddNodeTail(mark == PENDING_MARK_WRITING ? _pendingWriting : _pendingDone, done);
+        }
+    }
+    pthread_mutex_unlock(&_pendingDoneLock);
+}
+
+/* key是否有任务正在写入, 或已写完但还没有从索引中删除 */
+static int _pendingWriteBusy(sds key)
+{
+    list* lists[2];
+    int busy = 0;
+    int i = 0;
+    pthread_mutex_lock(&_pendingDoneLock);
+    lists[0] = _pendingWriting;
+    lists[1] = _pendingDone;
+    for (; i < 2 && !busy; i++) {
+        listIter li;
+        listNode* ln;
+        listRewind(lists[i], &li);
+        while ((ln = listNext(&li)) != NULL) {
+            if (sdscmp(((PendingDone*)listNodeValue(ln))->key, key) == 0) {
+                busy = 1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&_pendingDoneLock);
+    return busy;
+}
+
+/* 主线程调用, 把写线程已完成的任务从索引中删除 */
+void drainPendingWrites(void)
+{
+    if (_pendingDone == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&_pendingDoneLock);
+    list* done = _pendingDone;
+    if (listLength(done) == 0) {
+        pthread_mutex_unlock(&_pendingDoneLock);
+        return;
+    }
+    _pendingDone = listCreate();
+    pthread_mutex_unlock(&_pendingDoneLock);
+
+    listIter li;
+    listNode* ln;
+    listRewind(done, &li);
+    while ((ln = listNext(&li)) != NULL) {
+        PendingDone* d = listNodeValue(ln);
+        list* ops = dictFetchValue(_pendingWrites, d->key);
+        if (ops != NULL) {
+            listIter oi;
+            listNode* on;
+            listRewind(ops, &oi);
+            while ((on = listNext(&oi)) != NULL) {
+                /* SETEX等登记为SET和PEXPIREAT两个修改, 序号相同 */
+                if (((PendingOp*)listNodeValue(on))->seq == d->seq) {
+                    listDelNode(ops, on);
+                }
+            }
+            if (listLength(ops) == 0) {
+                listRelease(ops);
+                dictDelete(_pendingWrites, d->key);
+            }
+        }
+        sdsfree(d->key);
+        zfree(d);
+    }
+    listRelease(done);
+}
+
+/* 回源读取. 没有未写入的修改时直接查询MySQL; 最近有覆盖整个值的修改时
+ * 只在内存中重放, 不再回源; 否则查询MySQL, 查询后这个key没有正在写入或刚写完的任务时,
+ * 查询结果恰好不包含索引中剩余的修改, 把它们依次重放在结果之上. 否则结果是否包含
+ * 这些修改不确定, 丢弃后重新查询, 多次仍不确定时返回错误. 查询期间不持有任何锁,
+ * 写线程在MySQL上的等待不会阻塞主线程 */
+int readPendingWrite(redisClient* c, int (*load)(redisClient* c))
+{
+    if (_replaying) {
+        return DB_RET_NOTRESULT;
+    }
+    drainPendingWrites();
+    list* ops = _pendingWrites != NULL ? dictFetchValue(_pendingWrites, c->argv[1]->ptr) : NULL;
+    if (ops == NULL) {
+        return load(c);
+    }
+    listIter li;
+    listNode* ln;
+    listNode* from = NULL;
+    listRewind(ops, &li);
+    while ((ln = listNext(&li)) != NULL) {
+        if (((PendingOp*)listNodeValue(ln))->complete) {
+            from = ln;
+        }
+    }
+    if (from != NULL) {
+        return _replayPendingOps(c, from);
+    }
+
+    int ret;
+    int tries = 0;
+    while (1) {
+        ret = load(c);
+        if (isDBError(ret) || !_pendingWriteBusy(c->argv[1]->ptr)) {
+            break;
+        }
+        dbDelete(c->db, c->argv[1]);
+        if (++tries == PENDING_READ_MAX_TRIES) {
+            redisLog(REDIS_WARNING, "key %s kept being written to MySQL while loaded, giving up", (char*)c->argv[1]->ptr);
+            return DB_RET_PENDING_BUSY;
+        }
+        drainPendingWrites();
+    }
+    /* 不能再取出已完成的任务, 检查之后完成的修改不在查询结果中 */
+    ops = dictFetchValue(_pendingWrites, c->argv[1]->ptr);
+    if (ops != NULL && !isDBError(ret)) {
+        ret = _replayPendingOps(c, listFirst(ops));
+    }
+    return ret;
+}
+
+/* 用伪客户端依次执行未写入的修改, 重放期间的回源直接返回无结果 */
+static int _replayPendingOps(redisClient* c, listNode* from)
+{
+    if (_replayClient == NULL) {
+        _replayClient = createClient(-1);
+    }
+    redisClient* fake = _replayClient;
+    long long dirty = server.dirty;
+    selectDb(fake, c->db->id);
+    _replaying = 1;
+    for (; from != NULL; from = listNextNode(from)) {
+        PendingOp* op = listNodeValue(from);
+        int j = 0;
+        fake->argc = op->argc;
+        fake->argv = (robj**)zmalloc(sizeof(robj*) * op->argc);
+        for (; j < op->argc; j++) {
+            fake->argv[j] = op->argv[j];
+            incrRefCount(op->argv[j]);
+        }
+        fake->cmd = op->cmd;
+        op->cmd->proc(fake);
+        /* 命令可能改写了argv, 按改写后的参数释放 */
+        for (j = 0; j < fake->argc; j++) {
+            decrRefCount(fake->argv[j]);
+        }
+        zfree(fake->argv);
+    }
+    _replaying = 0;
+    fake->argc = 0;
+    fake->argv = NULL;
+    fake->cmd = NULL;
+    server.dirty = dirty;
+    return lookupKey(c->db, c->argv[1]) != NULL ? DB_RET_SUCCESS : DB_RET_NOTRESULT;
+}
+
+int hasPendingWrite(robj* key)
+{
+    drainPendingWrites();
+    return _pendingWrites != NULL && dictFind(_pendingWrites, key->ptr) != NULL;
+}
+
+static void _cancelPendingWrite(const char* rbuf, int rbufLen)
+{
+    CmdArgv* cmdArgvs[MAX_CMD_ARGV];
+    redisCommandProc* proc;
+    int jobTime;
+    long long seq;
+    int argc = _unpackCmd(rbuf, rbufLen, cmdArgvs, &proc, &jobTime, &seq, NULL);
+    _pendingWriteMark(seq, argc, cmdArgvs, proc, PENDING_MARK_DONE);
+}
+
+unsigned long pendingWriteKeys(void)
+{
+    return _pendingWrites != NULL ? dictSize(_pendingWrites) : 0;
+}
@@ -10,11 +10,59 @@
 #define PERSISTENCE_RET_NOTFOUNDCMD -3
 #define PERSISTENCE_RET_KEYSIZE_EXCEED -4
 #define PERSISTENCE_RET_MMAP_ERROR -6
+#define PERSISTENCE_RET_THREAD_ERROR -7
+#define PERSISTENCE_RET_DEADLETTER_ERROR -8
+#define PERSISTENCE_RET_CACHE_ONLY -9
 #define PERSISTENCE_RET_SUCCESS 0
+
+/* 写线程池弹性伸缩 */
+#define MAX_WRITE_THREAD_NUM 1024
+#define PERSISTENCE_SCALE_DEPTH (1024 * 64)  /* 未处理字节数超过该值时扩容 */
+#define PERSISTENCE_SCALE_AGE 1              /* 任务排队秒数超过该值时扩容 */
+#define PERSISTENCE_IDLE_TIME 60             /* 线程空闲秒数超过该值时回收 */
+
+/* 写失败重试与死信 */
+#define PERSISTENCE_RETRY_MAX_ATTEMPTS 5
+#define PERSISTENCE_RETRY_MAX_JOBS 10000
+#define PERSISTENCE_RETRY_BASE_MS 100
+#define PERSISTENCE_RETRY_MAX_MS (30 * 1000)
+#define PERSISTENCE_DEADLETTER_FILE "persistence_deadletter.log"
 struct _PMgr;
 
+typedef struct _RetryJob {
+    int attempts;
+    long long retryAt; /* 毫秒时间戳, 到期后重新分派 */
+    int len;
+    char buf[];
+} RetryJob;
+
+/* 已入队但尚未写入MySQL的修改, 回源读取时叠加在MySQL的结果之上 */
+typedef struct _PendingOp {
+    long long seq;     /* 所属任务的序号, 任务完成后据此删除 */
+    int complete;      /* 覆盖整个值的修改(SET/MSET, SETNX/SETEX等按SET登记), 之前的状态无需回源 */
+    struct redisCommand* cmd;
+    int argc;
+    robj** argv;
+} PendingOp;
+
+typedef struct _PendingDone {
+    long long seq;
+    sds key;
+} PendingDone;
+
+/* 写线程登记任务的状态 */
+#define PENDING_MARK_WRITING 0  /* 开始写入 */
+#define PENDING_MARK_DONE 1     /* 写入成功或已转入死信 */
+#define PENDING_MARK_RETRY 2    /* 写入失败进入重试队列, 仍算未写入 */
+#define PENDING_READ_MAX_TRIES 3 /* 回源时key一直有任务在写入, 超过次数返回错误 */
+
 typedef struct _WriteWorker {
     int buflen;
+    int ready;      /* 连接建立完成后才会被分派任务 */
+    int retire;     /* 由分派线程置位, 写线程退出并释放连接 */
+    int lastActive; /* 最近一次处理任务的时间 */
+    int attempts;   /* 当前任务已失败的次数 */
+    int fromRetry;  /* 当前任务来自重试队列, 同一key之后的任务等它写完再分派 */
     DBConn* dbConn;
     struct _PMgr* pmgr;
     char buf[];
@@ -24,11 +72,61 @@ typedef struct _PMgr {
     JobList* joblist;
     int sleepSum;
     int workerNum;
+    int currWorkerIdx;
+    int headJobTime;          /* 正在分派的任务的入队时间, 队列为空时为0 */
+    volatile int fenceReached; /* fence之前的任务已全部写入, 由分派线程更新 */
+    long long lateJobs;       /* 超过persistence_tolerate_time才写入的任务数 */
+    long long retriedJobs;    /* 进入重试队列的次数 */
+    long long deadJobs;       /* 写入死信文件的任务数 */
+    long long reconnects;     /* 写线程断线重连次数 */
+    list* retryJobs;          /* RetryJob, 由retryLock保护, 同一key的任务按入队顺序分派 */
+    pthread_mutex_t retryLock;
+    const char* host;
+    int port;
+    const char* user;
+    const char* pwd;
+    const char* dbName;
     WriteWorker** writeWorkers;
 } PMgr;
 
+extern PMgr* pmgr;
+extern PMgr* lockPmgr;
+
 PMgr* initPersistence(int joblistsize, const char* mmapFile, int threadNum, const char* host, const int port, const char* user, const char* pwd, const char* dbName);
+int initPersistenceShards(int joblistsize, int threadNum);
+PMgr* persistenceQueue(int shard, int lock);
+int queuePersistenceJob(redisClient* c, const char* wbuf, int len, int lock);
 int packPersistenceJob(redisClient* c, char* wbuf);
 int addPersistenceJob(const char* wbuf, int len, PMgr* this);
+int writePersistenceJob(const char* wbuf, int len);
+int writeThroughPersistenceJob(redisClient* c, const char* wbuf, int len);
+int persistenceKeysPending(redisClient* c);
 void persistenceInfo(int* untreatedSize, int* sleepSum, unsigned long long * wSize, unsigned long long * rSize, PMgr* this);
+int persistenceWorkerNum(PMgr* this);
+int persistenceHeadJobAge(PMgr* this);
+long long persistenceLateJobs(PMgr* this);
+void persistenceRetryInfo(unsigned long* retryLen, long long* retried, long long* dead, long long* reconnects, PMgr* this);
+void persistenceTotalInfo(int lock, int* untreatedSize, int* sleepSum, unsigned long long* wSize, unsigned long long* rSize);
+void persistenceTotalRetryInfo(int lock, unsigned long* retryLen, long long* retried, long long* dead, long long* reconnects);
+int persistenceTotalWorkerNum(int lock);
+int persistenceMaxHeadJobAge(int lock);
+long long persistenceTotalLateJobs(void);
+long long persistenceShardQueued(int shard);
+int persistenceShardHeadJobAge(int shard);
+void setPersistenceShardThrottled(int shard, int on);
+int persistenceShardThrottled(int shard);
+int persistenceCmdThrottled(redisClient* c);
+sds catPersistenceShardInfo(sds info);
+void persistenceCommand(redisClient* c);
+int unpackPersistenceJob(const char* rbuf, int rbufLen, CmdArgv** cmdArgvs, redisCommandProc** procPtr, int* jobTime, long long* seq, JobKey* jobKey);
+int persistenceJobPolicy(const char* wbuf);
+int addPersistenceMultiJob(const char* wbuf, int len, int lock, int shard);
+int flushPersistenceMulti(void);
+long long persistenceJobSeq(const char* wbuf);
+void drainPendingWrites(void);
+int readPendingWrite(redisClient* c, int (*load)(redisClient* c));
+int hasPendingWrite(robj* key);
+unsigned long pendingWriteKeys(void);
+void setPersistenceFence(int on);
+int persistenceFenceReached(void);
 #endif
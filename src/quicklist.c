@@ -0,0 +1,1113 @@
+/*
+ * Copyright (c) 2009-2013, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A doubly linked list of ziplists.
+ *
+ * A list encoded as a single ziplist is compact, but every push and pop
+ * moves the whole ziplist, so it only works for small lists. A linked list
+ * of objects works for any length, but costs a list node, an object and an
+ * sds header for every element. The quicklist is in between: the entries
+ * live in small ziplists bounded by the fill factor of the list, that are
+ * linked together, so the overhead is paid once per node and pushing or
+ * popping at the ends only moves a small ziplist.
+ *
+ * Long lists are mostly accessed at the ends, so the nodes further than
+ * 'compress' nodes from both ends can be stored LZF compressed. They are
+ * decompressed when an operation needs them and compressed again as soon
+ * as it is done. */
+
+#include <string.h>
+#include <stdint.h>
+#include "zmalloc.h"
+#include "ziplist.h"
+#include "util.h"
+#include "lzf.h"
+#include "quicklist.h"
+#include "redisassert.h"
+
+/* Byte limits of the ziplist of a node, for fill factors -1 to -5. */
+static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
+
+/* With a positive fill factor the ziplist of a node is still limited to
+ * this size, unless it holds a single entry. */
+#define SIZE_SAFETY_LIMIT 8192
+
+/* The entries of a node are counted with 16 bits. */
+#define FILL_MAX (1 << 15)
+#define COUNT_MAX UINT16_MAX
+
+/* Nodes smaller than this are not worth compressing. */
+#define MIN_COMPRESS_BYTES 48
+
+/* A compressed node must be at least this many bytes smaller. */
+#define MIN_COMPRESS_IMPROVE 8
+
+#define quicklistNodeUpdateSz(node) do {                                    \
+    (node)->sz = ziplistBlobLen((node)->zl);                                \
+} while (0)
+
+static void __quicklistCompress(quicklist* ql, quicklistNode* node);
+
+/* Create a new quicklist with the default options. */
+quicklist* quicklistCreate(void)
+{
+    quicklist* ql = zmalloc(sizeof(*ql));
+
+    ql->head = ql->tail = NULL;
+    ql->len = 0;
+    ql->count = 0;
+    ql->fill = -2;
+    ql->compress = 0;
+    return ql;
+}
+
+/* Set the fill factor and the compress depth of the list. */
+void quicklistSetOptions(quicklist* ql, int fill, int compress)
+{
+    if (fill > FILL_MAX) {
+        fill = FILL_MAX;
+    } else if (fill < -5) {
+        fill = -5;
+    } else if (fill == 0) {
+        fill = 1;
+    }
+    ql->fill = fill;
+    ql->compress = compress < 0 ? 0 : compress;
+}
+
+/* Create a new quicklist with the specified options. */
+quicklist* quicklistNew(int fill, int compress)
+{
+    quicklist* ql = quicklistCreate();
+
+    quicklistSetOptions(ql, fill, compress);
+    return ql;
+}
+
+static quicklistNode* quicklistCreateNode(void)
+{
+    quicklistNode* node = zmalloc(sizeof(*node));
+
+    node->prev = node->next = NULL;
+    node->zl = NULL;
+    node->sz = 0;
+    node->count = 0;
+    node->encoding = QUICKLIST_NODE_RAW;
+    node->recompress = 0;
+    node->extra = 0;
+    return node;
+}
+
+/* Create a node holding a single entry. */
+static quicklistNode* quicklistCreateNodeWith(void* value, size_t sz)
+{
+    quicklistNode* node = quicklistCreateNode();
+
+    node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_TAIL);
+    node->count = 1;
+    quicklistNodeUpdateSz(node);
+    return node;
+}
+
+/* Return the number of entries of the list. */
+unsigned long quicklistCount(quicklist* ql)
+{
+    return ql->count;
+}
+
+/* Free the list and all its nodes. */
+void quicklistRelease(quicklist* ql)
+{
+    quicklistNode* current = ql->head, *next;
+
+    while (current) {
+        next = current->next;
+        zfree(current->zl);
+        zfree(current);
+        current = next;
+    }
+    zfree(ql);
+}
+
+/* ----------------------------- Compression -------------------------------- */
+
+/* Compress the ziplist of the node. Returns 1 on success, 0 if the node
+ * is too small or does not compress well, in which case it is left as it
+ * is. */
+static int __quicklistCompressNode(quicklistNode* node)
+{
+    quicklistLZF* lzf;
+
+    node->recompress = 0;
+    if (node->sz < MIN_COMPRESS_BYTES) {
+        return 0;
+    }
+    lzf = zmalloc(sizeof(*lzf) + node->sz);
+    lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed, node->sz);
+    if (lzf->sz == 0 || lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+        zfree(lzf);
+        return 0;
+    }
+    lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
+    zfree(node->zl);
+    node->zl = (unsigned char*)lzf;
+    node->encoding = QUICKLIST_NODE_LZF;
+    return 1;
+}
+
+static void __quicklistDecompressNode(quicklistNode* node)
+{
+    quicklistLZF* lzf = (quicklistLZF*)node->zl;
+    unsigned char* zl = zmalloc(node->sz);
+
+    assert(lzf_decompress(lzf->compressed, lzf->sz, zl, node->sz) == node->sz);
+    zfree(lzf);
+    node->zl = zl;
+    node->encoding = QUICKLIST_NODE_RAW;
+}
+
+#define quicklistCompressNode(_node) do {                                   \
+    if ((_node) && (_node)->encoding == QUICKLIST_NODE_RAW)                 \
+        __quicklistCompressNode(_node);                                     \
+} while (0)
+
+/* Decompress a node for good, as it is now near one of the ends. */
+#define quicklistDecompressNode(_node) do {                                 \
+    if ((_node) && (_node)->encoding == QUICKLIST_NODE_LZF)                 \
+        __quicklistDecompressNode(_node);                                   \
+    if (_node) (_node)->recompress = 0;                                     \
+} while (0)
+
+/* Decompress a node for an operation, it is compressed again by
+ * quicklistRecompressOnly() or __quicklistCompress() when done. */
+#define quicklistDecompressNodeForUse(_node) do {                           \
+    if ((_node) && (_node)->encoding == QUICKLIST_NODE_LZF) {               \
+        __quicklistDecompressNode(_node);                                   \
+        (_node)->recompress = 1;                                            \
+    }                                                                       \
+} while (0)
+
+/* Compress again a node decompressed by quicklistDecompressNodeForUse(),
+ * for operations that didn't change the position of the node. */
+void quicklistRecompressOnly(quicklist* ql, quicklistNode* node)
+{
+    if (ql->compress && node && node->recompress) {
+        __quicklistCompressNode(node);
+    }
+}
+
+/* Make sure the 'compress' nodes at both ends of the list are not
+ * compressed, and compress 'node' if it is not one of them. The first
+ * nodes past the ends are compressed too, as a push or a delete may have
+ * just moved them out of the ends. */
+static void __quicklistCompress(quicklist* ql, quicklistNode* node)
+{
+    quicklistNode* forward = ql->head;
+    quicklistNode* reverse = ql->tail;
+    unsigned int depth = 0;
+    int in_depth = 0;
+
+    if (ql->compress == 0 || ql->len == 0) {
+        return;
+    }
+    while (depth++ < ql->compress) {
+        quicklistDecompressNode(forward);
+        quicklistDecompressNode(reverse);
+        if (forward == node || reverse == node) {
+            in_depth = 1;
+        }
+        /* The two walks met, every node is near one of the ends. */
+        if (forward == reverse || forward->next == reverse) {
+            return;
+        }
+        forward = forward->next;
+        reverse = reverse->prev;
+    }
+    if (!in_depth) {
+        quicklistCompressNode(node);
+    }
+    quicklistCompressNode(forward);
+    quicklistCompressNode(reverse);
+}
+
+/* Return the LZF data of a compressed node and its size. */
+size_t quicklistGetLzf(const quicklistNode* node, void** data)
+{
+    quicklistLZF* lzf = (quicklistLZF*)node->zl;
+
+    *data = lzf->compressed;
+    return lzf->sz;
+}
+
+/* ------------------------------ Nodes ------------------------------------- */
+
+/* Link 'new_node' after (or before) 'old_node'. If the list is empty
+ * 'old_node' is NULL. */
+static void __quicklistInsertNode(quicklist* ql, quicklistNode* old_node,
+                                  quicklistNode* new_node, int after)
+{
+    if (after) {
+        new_node->prev = old_node;
+        if (old_node) {
+            new_node->next = old_node->next;
+            if (old_node->next) {
+                old_node->next->prev = new_node;
+            }
+            old_node->next = new_node;
+        }
+        if (ql->tail == old_node) {
+            ql->tail = new_node;
+        }
+    } else {
+        new_node->next = old_node;
+        if (old_node) {
+            new_node->prev = old_node->prev;
+            if (old_node->prev) {
+                old_node->prev->next = new_node;
+            }
+            old_node->prev = new_node;
+        }
+        if (ql->head == old_node) {
+            ql->head = new_node;
+        }
+    }
+    if (ql->len == 0) {
+        ql->head = ql->tail = new_node;
+    }
+    ql->len++;
+    __quicklistCompress(ql, new_node);
+}
+
+/* Unlink and free a node, together with its entries. */
+static void __quicklistDelNode(quicklist* ql, quicklistNode* node)
+{
+    if (node->next) {
+        node->next->prev = node->prev;
+    }
+    if (node->prev) {
+        node->prev->next = node->next;
+    }
+    if (node == ql->tail) {
+        ql->tail = node->prev;
+    }
+    if (node == ql->head) {
+        ql->head = node->next;
+    }
+    ql->len--;
+    ql->count -= node->count;
+    zfree(node->zl);
+    zfree(node);
+
+    /* The nodes next to the removed one may now be near the ends. */
+    __quicklistCompress(ql, NULL);
+}
+
+static int _quicklistNodeSizeMeetsOptimizationRequirement(size_t sz, int fill)
+{
+    size_t level;
+
+    if (fill >= 0) {
+        return 0;
+    }
+    level = (-fill) - 1;
+    if (level < sizeof(optimization_level) / sizeof(*optimization_level)) {
+        return sz <= optimization_level[level];
+    }
+    return 0;
+}
+
+/* Return 1 if an entry of 'sz' bytes can be added to 'node' without going
+ * over the fill factor of the list. */
+static int _quicklistNodeAllowInsert(const quicklistNode* node, int fill, size_t sz)
+{
+    size_t new_sz;
+    int overhead;
+
+    if (node == NULL || node->count == COUNT_MAX) {
+        return 0;
+    }
+
+    /* Estimate the previous entry length and encoding headers. */
+    overhead = sz < 254 ? 1 : 5;
+    if (sz < 64) {
+        overhead += 1;
+    } else if (sz < 16384) {
+        overhead += 2;
+    } else {
+        overhead += 5;
+    }
+    new_sz = node->sz + sz + overhead;
+
+    if (_quicklistNodeSizeMeetsOptimizationRequirement(new_sz, fill)) {
+        return 1;
+    } else if (new_sz > SIZE_SAFETY_LIMIT) {
+        return 0;
+    } else if ((int)node->count < fill) {
+        return 1;
+    }
+    return 0;
+}
+
+/* Split 'node' at 'offset'. With 'after' the entries after the offset are
+ * moved to the returned node, otherwise the entries before it. */
+static quicklistNode* _quicklistSplitNode(quicklistNode* node, int offset, int after)
+{
+    quicklistNode* new_node = quicklistCreateNode();
+    unsigned int count = node->count;
+
+    new_node->zl = zmalloc(node->sz);
+    memcpy(new_node->zl, node->zl, node->sz);
+    if (after) {
+        node->zl = ziplistDeleteRange(node->zl, offset + 1, count);
+        new_node->zl = ziplistDeleteRange(new_node->zl, 0, offset + 1);
+    } else {
+        node->zl = ziplistDeleteRange(node->zl, 0, offset);
+        new_node->zl = ziplistDeleteRange(new_node->zl, offset, count);
+    }
+    node->count = ziplistLen(node->zl);
+    quicklistNodeUpdateSz(node);
+    new_node->count = ziplistLen(new_node->zl);
+    quicklistNodeUpdateSz(new_node);
+    return new_node;
+}
+
+/* Delete the entry at 'p' from 'node', freeing the node if it becomes
+ * empty. Returns 1 if the node was freed. */
+static int quicklistDelIndex(quicklist* ql, quicklistNode* node, unsigned char** p)
+{
+    node->zl = ziplistDelete(node->zl, p);
+    node->count--;
+    ql->count--;
+    if (node->count == 0) {
+        __quicklistDelNode(ql, node);
+        return 1;
+    }
+    quicklistNodeUpdateSz(node);
+    return 0;
+}
+
+/* ------------------------------ Push / Pop -------------------------------- */
+
+/* Add an entry at the head of the list. Returns 1 if a new head node was
+ * created. */
+int quicklistPushHead(quicklist* ql, void* value, size_t sz)
+{
+    quicklistNode* orig_head = ql->head;
+
+    if (_quicklistNodeAllowInsert(ql->head, ql->fill, sz)) {
+        quicklistDecompressNode(ql->head);
+        ql->head->zl = ziplistPush(ql->head->zl, value, sz, ZIPLIST_HEAD);
+        ql->head->count++;
+        quicklistNodeUpdateSz(ql->head);
+    } else {
+        __quicklistInsertNode(ql, ql->head, quicklistCreateNodeWith(value, sz), 0);
+    }
+    ql->count++;
+    return orig_head != ql->head;
+}
+
+/* Add an entry at the tail of the list. Returns 1 if a new tail node was
+ * created. */
+int quicklistPushTail(quicklist* ql, void* value, size_t sz)
+{
+    quicklistNode* orig_tail = ql->tail;
+
+    if (_quicklistNodeAllowInsert(ql->tail, ql->fill, sz)) {
+        quicklistDecompressNode(ql->tail);
+        ql->tail->zl = ziplistPush(ql->tail->zl, value, sz, ZIPLIST_TAIL);
+        ql->tail->count++;
+        quicklistNodeUpdateSz(ql->tail);
+    } else {
+        __quicklistInsertNode(ql, ql->tail, quicklistCreateNodeWith(value, sz), 1);
+    }
+    ql->count++;
+    return orig_tail != ql->tail;
+}
+
+void quicklistPush(quicklist* ql, void* value, size_t sz, int where)
+{
+    if (where == QUICKLIST_HEAD) {
+        quicklistPushHead(ql, value, sz);
+    } else {
+        quicklistPushTail(ql, value, sz);
+    }
+}
+
+/* Append a whole ziplist as a new tail node, used when loading a list
+ * saved node by node. The ziplist is owned by the list from now on. */
+void quicklistAppendZiplist(quicklist* ql, unsigned char* zl)
+{
+    quicklistNode* node = quicklistCreateNode();
+
+    node->zl = zl;
+    node->count = ziplistLen(zl);
+    node->sz = ziplistBlobLen(zl);
+    ql->count += node->count;
+    __quicklistInsertNode(ql, ql->tail, node, 1);
+}
+
+/* Append all the entries of 'zl' one by one, so that they are split in
+ * nodes according to the fill factor, then free 'zl'. */
+quicklist* quicklistAppendValuesFromZiplist(quicklist* ql, unsigned char* zl)
+{
+    unsigned char* p = ziplistIndex(zl, 0);
+    unsigned char* value;
+    unsigned int sz;
+    long long longval;
+    char longstr[32];
+
+    while (ziplistGet(p, &value, &sz, &longval)) {
+        if (!value) {
+            sz = ll2string(longstr, sizeof(longstr), longval);
+            value = (unsigned char*)longstr;
+        }
+        quicklistPushTail(ql, value, sz);
+        p = ziplistNext(zl, p);
+    }
+    zfree(zl);
+    return ql;
+}
+
+/* Create a list with the entries of 'zl', that is freed. */
+quicklist* quicklistCreateFromZiplist(int fill, int compress, unsigned char* zl)
+{
+    return quicklistAppendValuesFromZiplist(quicklistNew(fill, compress), zl);
+}
+
+/* Remove an entry from the head or the tail of the list. String entries
+ * are returned in '*data' as created by 'saver', integers in '*sval'.
+ * Returns 0 if the list is empty. */
+int quicklistPopCustom(quicklist* ql, int where, unsigned char** data,
+                       unsigned int* sz, long long* sval,
+                       void* (*saver)(unsigned char* data, unsigned int sz))
+{
+    quicklistNode* node = (where == QUICKLIST_HEAD) ? ql->head : ql->tail;
+    unsigned char* p;
+    unsigned char* vstr;
+    unsigned int vlen;
+    long long vlong;
+
+    if (data) {
+        *data = NULL;
+    }
+    if (node == NULL) {
+        return 0;
+    }
+    quicklistDecompressNode(node);
+    p = ziplistIndex(node->zl, (where == QUICKLIST_HEAD) ? 0 : -1);
+    if (!ziplistGet(p, &vstr, &vlen, &vlong)) {
+        return 0;
+    }
+    if (vstr) {
+        if (data) {
+            *data = saver(vstr, vlen);
+        }
+        if (sz) {
+            *sz = vlen;
+        }
+    } else if (sval) {
+        *sval = vlong;
+    }
+    quicklistDelIndex(ql, node, &p);
+    return 1;
+}
+
+/* ------------------------------ Insert / Delete --------------------------- */
+
+static void _quicklistInsert(quicklist* ql, quicklistEntry* entry,
+                             void* value, size_t sz, int after)
+{
+    quicklistNode* node = entry->node, *new_node;
+    int offset, at_tail, at_head;
+
+    if (node == NULL) {
+        /* Empty list: the entry doesn't point anywhere. */
+        quicklistPushTail(ql, value, sz);
+        return;
+    }
+    offset = entry->offset < 0 ? entry->offset + (int)node->count : entry->offset;
+    at_tail = after && offset == (int)node->count - 1;
+    at_head = !after && offset == 0;
+
+    if (_quicklistNodeAllowInsert(node, ql->fill, sz)) {
+        quicklistDecompressNodeForUse(node);
+        if (after) {
+            unsigned char* next = ziplistNext(node->zl, entry->zi);
+
+            if (next == NULL) {
+                node->zl = ziplistPush(node->zl, value, sz, ZIPLIST_TAIL);
+            } else {
+                node->zl = ziplistInsert(node->zl, next, value, sz);
+            }
+        } else {
+            node->zl = ziplistInsert(node->zl, entry->zi, value, sz);
+        }
+        node->count++;
+        quicklistNodeUpdateSz(node);
+        quicklistRecompressOnly(ql, node);
+    } else if (at_tail && _quicklistNodeAllowInsert(node->next, ql->fill, sz)) {
+        /* The entry is the last of a full node: push at the head of the
+         * next node. */
+        new_node = node->next;
+        quicklistDecompressNodeForUse(new_node);
+        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_HEAD);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        quicklistRecompressOnly(ql, new_node);
+    } else if (at_head && _quicklistNodeAllowInsert(node->prev, ql->fill, sz)) {
+        new_node = node->prev;
+        quicklistDecompressNodeForUse(new_node);
+        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_TAIL);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        quicklistRecompressOnly(ql, new_node);
+    } else if (at_tail || at_head) {
+        /* The neighbor is full too: create a new node in between. */
+        __quicklistInsertNode(ql, node, quicklistCreateNodeWith(value, sz), after);
+    } else {
+        /* Split the full node at the entry, and add the new entry to the
+         * half that is now next to it. */
+        quicklistDecompressNodeForUse(node);
+        new_node = _quicklistSplitNode(node, offset, after);
+        new_node->zl = ziplistPush(new_node->zl, value, sz,
+                                   after ? ZIPLIST_HEAD : ZIPLIST_TAIL);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        __quicklistInsertNode(ql, node, new_node, after);
+        quicklistRecompressOnly(ql, node);
+    }
+    /* The entry node was decompressed by the caller lookup. */
+    quicklistRecompressOnly(ql, node);
+    ql->count++;
+}
+
+/* Insert an entry after (or before) the entry returned by quicklistNext()
+ * or quicklistIndex(). The entry is no longer valid afterwards. */
+void quicklistInsertAfter(quicklist* ql, quicklistEntry* entry, void* value, size_t sz)
+{
+    _quicklistInsert(ql, entry, value, sz, 1);
+}
+
+void quicklistInsertBefore(quicklist* ql, quicklistEntry* entry, void* value, size_t sz)
+{
+    _quicklistInsert(ql, entry, value, sz, 0);
+}
+
+/* Delete the entry returned by the last quicklistNext() call. The iterator
+ * stays valid, the next call returns the entry following the deleted one. */
+void quicklistDelEntry(quicklistIter* iter, quicklistEntry* entry)
+{
+    quicklistNode* prev = entry->node->prev;
+    quicklistNode* next = entry->node->next;
+    int deleted_node = quicklistDelIndex(iter->quicklist, entry->node, &entry->zi);
+
+    /* The iterator offset now refers to the following entry, that is looked
+     * up again by quicklistNext(). */
+    iter->zi = NULL;
+    if (deleted_node) {
+        if (iter->direction == QUICKLIST_START_HEAD) {
+            iter->current = next;
+            iter->offset = 0;
+        } else {
+            iter->current = prev;
+            iter->offset = -1;
+        }
+    }
+}
+
+/* Replace the entry at 'index'. Returns 0 if the index is out of range. */
+int quicklistReplaceAtIndex(quicklist* ql, long index, void* data, size_t sz)
+{
+    quicklistEntry entry;
+
+    if (!quicklistIndex(ql, index, &entry)) {
+        return 0;
+    }
+    entry.node->zl = ziplistDelete(entry.node->zl, &entry.zi);
+    entry.node->zl = ziplistInsert(entry.node->zl, entry.zi, data, sz);
+    quicklistNodeUpdateSz(entry.node);
+    quicklistRecompressOnly(ql, entry.node);
+    return 1;
+}
+
+/* Delete 'count' entries starting from 'start', that can be negative to
+ * count from the tail. Returns 1 if entries were deleted. */
+int quicklistDelRange(quicklist* ql, long start, long count)
+{
+    quicklistEntry entry;
+    quicklistNode* node;
+    unsigned long extent;
+    long offset;
+
+    if (count <= 0 || !quicklistIndex(ql, start, &entry)) {
+        return 0;
+    }
+    extent = count;
+    if (start >= 0 && extent > ql->count - start) {
+        extent = ql->count - start;
+    } else if (start < 0 && extent > (unsigned long)(-start)) {
+        extent = -start;
+    }
+
+    node = entry.node;
+    offset = entry.offset < 0 ? entry.offset + (long)node->count : entry.offset;
+    while (extent) {
+        quicklistNode* next = node->next;
+        unsigned long del = node->count - offset;
+
+        if (del > extent) {
+            del = extent;
+        }
+        if (offset == 0 && del == node->count) {
+            __quicklistDelNode(ql, node);
+        } else {
+            quicklistDecompressNodeForUse(node);
+            node->zl = ziplistDeleteRange(node->zl, offset, del);
+            node->count -= del;
+            ql->count -= del;
+            quicklistNodeUpdateSz(node);
+            quicklistRecompressOnly(ql, node);
+        }
+        extent -= del;
+        node = next;
+        offset = 0;
+    }
+    return 1;
+}
+
+/* ------------------------------ Iteration --------------------------------- */
+
+static void initEntry(quicklistEntry* entry)
+{
+    entry->quicklist = NULL;
+    entry->node = NULL;
+    entry->zi = NULL;
+    entry->value = NULL;
+    entry->longval = 0;
+    entry->sz = 0;
+    entry->offset = 0;
+}
+
+/* Return an iterator starting at the head (QUICKLIST_START_HEAD) or at
+ * the tail (QUICKLIST_START_TAIL) of the list. */
+quicklistIter* quicklistGetIterator(quicklist* ql, int direction)
+{
+    quicklistIter* iter = zmalloc(sizeof(*iter));
+
+    if (direction == QUICKLIST_START_HEAD) {
+        iter->current = ql->head;
+        iter->offset = 0;
+    } else {
+        iter->current = ql->tail;
+        iter->offset = -1;
+    }
+    iter->direction = direction;
+    iter->quicklist = ql;
+    iter->zi = NULL;
+    return iter;
+}
+
+/* Return an iterator starting at 'idx', or NULL if out of range. */
+quicklistIter* quicklistGetIteratorAtIdx(quicklist* ql, int direction, long long idx)
+{
+    quicklistEntry entry;
+    quicklistIter* iter;
+
+    if (!quicklistIndex(ql, idx, &entry)) {
+        return NULL;
+    }
+    iter = quicklistGetIterator(ql, direction);
+    iter->current = entry.node;
+    iter->offset = entry.offset;
+
+    /* Offsets count from the head of the ziplist when iterating forward
+     * and from the tail backward, so that deleting the current entry
+     * leaves the offset on the next one. */
+    if (direction == QUICKLIST_START_HEAD && iter->offset < 0) {
+        iter->offset += entry.node->count;
+    } else if (direction == QUICKLIST_START_TAIL && iter->offset >= 0) {
+        iter->offset -= entry.node->count;
+    }
+    return iter;
+}
+
+/* Store the next entry in 'entry'. Returns 0 when there are no more
+ * entries. */
+int quicklistNext(quicklistIter* iter, quicklistEntry* entry)
+{
+    initEntry(entry);
+    if (iter == NULL) {
+        return 0;
+    }
+    entry->quicklist = iter->quicklist;
+    while (iter->current) {
+        if (iter->zi == NULL) {
+            quicklistDecompressNodeForUse(iter->current);
+            iter->zi = ziplistIndex(iter->current->zl, iter->offset);
+        } else if (iter->direction == QUICKLIST_START_HEAD) {
+            iter->zi = ziplistNext(iter->current->zl, iter->zi);
+            iter->offset++;
+        } else {
+            iter->zi = ziplistPrev(iter->current->zl, iter->zi);
+            iter->offset--;
+        }
+        if (iter->zi) {
+            entry->node = iter->current;
+            entry->zi = iter->zi;
+            entry->offset = iter->offset;
+            ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+            return 1;
+        }
+
+        /* Done with this node, move to the next one. */
+        __quicklistCompress(iter->quicklist, iter->current);
+        if (iter->direction == QUICKLIST_START_HEAD) {
+            iter->current = iter->current->next;
+            iter->offset = 0;
+        } else {
+            iter->current = iter->current->prev;
+            iter->offset = -1;
+        }
+    }
+    return 0;
+}
+
+void quicklistReleaseIterator(quicklistIter* iter)
+{
+    if (iter == NULL) {
+        return;
+    }
+    if (iter->current) {
+        __quicklistCompress(iter->quicklist, iter->current);
+    }
+    zfree(iter);
+}
+
+/* Populate 'entry' with the entry at 'index', negative indexes count from
+ * the tail. Returns 0 if the index is out of range. The node of the entry
+ * is left decompressed: callers that don't modify the list should call
+ * quicklistRecompressOnly() once done with the entry. */
+int quicklistIndex(quicklist* ql, long long index, quicklistEntry* entry)
+{
+    int forward = index >= 0;
+    unsigned long long target = forward ? index : (-index) - 1;
+    unsigned long long accum = 0;
+    quicklistNode* n = forward ? ql->head : ql->tail;
+
+    initEntry(entry);
+    entry->quicklist = ql;
+    if (target >= ql->count) {
+        return 0;
+    }
+    while (n && accum + n->count <= target) {
+        accum += n->count;
+        n = forward ? n->next : n->prev;
+    }
+    if (n == NULL) {
+        return 0;
+    }
+    entry->node = n;
+    entry->offset = forward ? (int)(target - accum) : (int)(accum - target) - 1;
+    quicklistDecompressNodeForUse(n);
+    entry->zi = ziplistIndex(n->zl, entry->offset);
+    ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+    return 1;
+}
+
+/* Compare the entry at 'p1' with the string 'p2'. */
+int quicklistCompare(unsigned char* p1, unsigned char* p2, int p2_len)
+{
+    return ziplistCompare(p1, p2, p2_len);
+}
+
+#ifdef QUICKLIST_TEST_MAIN
+/* Random operations checked against a plain array of strings, with the
+ * structure of the list verified after each one. Build with:
+ *
+ *   cc -DQUICKLIST_TEST_MAIN -o quicklist-test quicklist.c ziplist.c \
+ *      zmalloc.c util.c lzf_c.c lzf_d.c -lm
+ *
+ * and run as: quicklist-test [ops] [seed] */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_MAX_ENTRIES 20000
+
+static char* ref[TEST_MAX_ENTRIES];
+static unsigned int ref_len[TEST_MAX_ENTRIES];
+static long ref_count;
+
+void _redisAssert(char* estr, char* file, int line)
+{
+    fprintf(stderr, "ASSERTION FAILED: %s:%d '%s'\n", file, line, estr);
+    abort();
+}
+
+static void* testSaver(unsigned char* data, unsigned int sz)
+{
+    char* copy = malloc(sz + 1);
+
+    memcpy(copy, data, sz);
+    copy[sz] = '\0';
+    return copy;
+}
+
+static void testRandomValue(char* buf, unsigned int* len)
+{
+    int i;
+
+    if (rand() % 3 == 0) {
+        *len = ll2string(buf, 32, (rand() % 2 ? -1 : 1) * (long long)rand());
+    } else {
+        *len = (rand() % 5 == 0) ? rand() % 300 : rand() % 12;
+        for (i = 0; i < (int)*len; i++) {
+            buf[i] = 'a' + rand() % 3;
+        }
+    }
+}
+
+static void testRefInsert(long idx, char* value, unsigned int len)
+{
+    memmove(ref + idx + 1, ref + idx, (ref_count - idx) * sizeof(*ref));
+    memmove(ref_len + idx + 1, ref_len + idx, (ref_count - idx) * sizeof(*ref_len));
+    ref[idx] = testSaver((unsigned char*)value, len);
+    ref_len[idx] = len;
+    ref_count++;
+}
+
+static void testRefDelete(long idx, long count)
+{
+    long i;
+
+    for (i = idx; i < idx + count; i++) {
+        free(ref[i]);
+    }
+    memmove(ref + idx, ref + idx + count, (ref_count - idx - count) * sizeof(*ref));
+    memmove(ref_len + idx, ref_len + idx + count, (ref_count - idx - count) * sizeof(*ref_len));
+    ref_count -= count;
+}
+
+static int testEntryEquals(quicklistEntry* entry, long idx)
+{
+    if (entry->value) {
+        return entry->sz == ref_len[idx] && memcmp(entry->value, ref[idx], entry->sz) == 0;
+    }
+    return (long long)strtoll(ref[idx], NULL, 10) == entry->longval;
+}
+
+/* Check the links, counters and compression of every node, and compare
+ * the entries with the reference array walking in both directions. */
+static void testVerify(quicklist* ql)
+{
+    quicklistNode* node = ql->head, *prev = NULL;
+    unsigned long len = 0, count = 0, pos = 0;
+    quicklistEntry entry;
+    quicklistIter* iter;
+    long idx;
+
+    while (node) {
+        assert(node->prev == prev);
+        assert(node->count > 0);
+        if (node->encoding == QUICKLIST_NODE_RAW) {
+            assert(ziplistLen(node->zl) == node->count);
+            assert(ziplistBlobLen(node->zl) == node->sz);
+        }
+        if (pos < ql->compress || pos + ql->compress >= ql->len) {
+            assert(node->encoding == QUICKLIST_NODE_RAW);
+        }
+        count += node->count;
+        len++;
+        pos++;
+        prev = node;
+        node = node->next;
+    }
+    assert(ql->tail == prev);
+    assert(ql->len == len);
+    assert(ql->count == count);
+    assert((long)ql->count == ref_count);
+
+    iter = quicklistGetIterator(ql, QUICKLIST_START_HEAD);
+    idx = 0;
+    while (quicklistNext(iter, &entry)) {
+        assert(testEntryEquals(&entry, idx++));
+    }
+    quicklistReleaseIterator(iter);
+    assert(idx == ref_count);
+
+    iter = quicklistGetIterator(ql, QUICKLIST_START_TAIL);
+    while (quicklistNext(iter, &entry)) {
+        assert(testEntryEquals(&entry, --idx));
+    }
+    quicklistReleaseIterator(iter);
+    assert(idx == 0);
+}
+
+int main(int argc, char** argv)
+{
+    long ops = argc > 1 ? atol(argv[1]) : 200000;
+    unsigned int seed = argc > 2 ? atoi(argv[2]) : 1234;
+    static const int fills[] = {-2, -1, 1, 4, 32, -5};
+    quicklist* ql = NULL;
+    quicklistEntry entry;
+    quicklistIter* iter;
+    char buf[512];
+    unsigned int len;
+    long op, idx, n;
+
+    srand(seed);
+    for (op = 0; op < ops; op++) {
+        if (op % 20000 == 0) {
+            if (ql) {
+                quicklistRelease(ql);
+            }
+            testRefDelete(0, ref_count);
+            ql = quicklistNew(fills[(op / 20000) % 6], (op / 20000) % 3);
+            printf("fill %d compress %u\n", ql->fill, ql->compress);
+        }
+        testRandomValue(buf, &len);
+        switch (rand() % 9) {
+        case 0:
+        case 1:
+            if (ref_count == TEST_MAX_ENTRIES) {
+                break;
+            }
+            if (rand() % 2) {
+                quicklistPush(ql, buf, len, QUICKLIST_HEAD);
+                testRefInsert(0, buf, len);
+            } else {
+                quicklistPush(ql, buf, len, QUICKLIST_TAIL);
+                testRefInsert(ref_count, buf, len);
+            }
+            break;
+        case 2:
+            if (ref_count) {
+                unsigned char* data;
+                unsigned int sz;
+                long long sval;
+                int head = rand() % 2;
+
+                idx = head ? 0 : ref_count - 1;
+                assert(quicklistPopCustom(ql, head ? QUICKLIST_HEAD : QUICKLIST_TAIL,
+                                          &data, &sz, &sval, testSaver));
+                if (data) {
+                    assert(sz == ref_len[idx] && memcmp(data, ref[idx], sz) == 0);
+                    free(data);
+                } else {
+                    assert(sval == strtoll(ref[idx], NULL, 10));
+                }
+                testRefDelete(idx, 1);
+            }
+            break;
+        case 3:
+            if (ref_count && ref_count < TEST_MAX_ENTRIES) {
+                int after = rand() % 2;
+
+                idx = rand() % ref_count;
+                assert(quicklistIndex(ql, rand() % 2 ? idx : idx - ref_count, &entry));
+                if (after) {
+                    quicklistInsertAfter(ql, &entry, buf, len);
+                } else {
+                    quicklistInsertBefore(ql, &entry, buf, len);
+                }
+                testRefInsert(idx + after, buf, len);
+            }
+            break;
+        case 4:
+            if (ref_count) {
+                idx = rand() % ref_count;
+                assert(quicklistReplaceAtIndex(ql, idx, buf, len));
+                free(ref[idx]);
+                ref[idx] = testSaver((unsigned char*)buf, len);
+                ref_len[idx] = len;
+            }
+            break;
+        case 5:
+            if (ref_count && rand() % 8 == 0) {
+                idx = rand() % ref_count;
+                n = rand() % 50 + 1;
+                assert(quicklistDelRange(ql, rand() % 2 ? idx : idx - ref_count, n));
+                testRefDelete(idx, n > ref_count - idx ? ref_count - idx : n);
+            }
+            break;
+        case 6:
+            /* Delete the entries equal to a value, as LREM does. */
+            if (ref_count && rand() % 8 == 0) {
+                int forward = rand() % 2;
+
+                idx = forward ? 0 : ref_count - 1;
+                iter = quicklistGetIterator(ql, forward ? QUICKLIST_START_HEAD : QUICKLIST_START_TAIL);
+                len = ref_len[rand() % ref_count];
+                while (quicklistNext(iter, &entry)) {
+                    if (rand() % 4 == 0) {
+                        quicklistDelEntry(iter, &entry);
+                        testRefDelete(idx, 1);
+                        if (forward) {
+                            idx--;
+                        }
+                    }
+                    idx += forward ? 1 : -1;
+                }
+                quicklistReleaseIterator(iter);
+            }
+            break;
+        case 7:
+            if (ref_count) {
+                int forward = rand() % 2;
+
+                idx = rand() % ref_count;
+                iter = quicklistGetIteratorAtIdx(ql, forward ? QUICKLIST_START_HEAD : QUICKLIST_START_TAIL,
+                                                 rand() % 2 ? idx : idx - ref_count);
+                for (n = 0; n < 10 && quicklistNext(iter, &entry); n++) {
+                    assert(testEntryEquals(&entry, idx));
+                    idx += forward ? 1 : -1;
+                }
+                quicklistReleaseIterator(iter);
+            }
+            assert(quicklistGetIteratorAtIdx(ql, QUICKLIST_START_HEAD, ref_count) == NULL);
+            break;
+        case 8:
+            if (ref_count) {
+                idx = rand() % ref_count;
+                assert(quicklistIndex(ql, idx, &entry));
+                assert(testEntryEquals(&entry, idx));
+                quicklistRecompressOnly(ql, entry.node);
+            }
+            break;
+        }
+        if (op % 97 == 0) {
+            testVerify(ql);
+        }
+    }
+    testVerify(ql);
+    quicklistRelease(ql);
+    testRefDelete(0, ref_count);
+    printf("%ld operations OK\n", ops);
+    return 0;
+}
+#endif
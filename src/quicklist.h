@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2009-2013, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __QUICKLIST_H__
+#define __QUICKLIST_H__
+
+/* A quicklist is a doubly linked list of ziplists. Every node holds up to
+ * 'fill' entries (fill > 0) or a ziplist of up to 4kb, 8kb, 16kb, 32kb or
+ * 64kb (fill -1 to -5), so that pushing and popping at the ends touches a
+ * small ziplist, while the overhead of the list is paid per node and not
+ * per entry. The nodes further than 'compress' nodes from both ends are
+ * stored LZF compressed. */
+
+typedef struct quicklistNode {
+    struct quicklistNode* prev;
+    struct quicklistNode* next;
+    unsigned char* zl;          /* Ziplist, or quicklistLZF if compressed */
+    unsigned int sz;            /* Ziplist size in bytes, even if compressed */
+    unsigned int count : 16;    /* Number of entries in the ziplist */
+    unsigned int encoding : 2;  /* QUICKLIST_NODE_RAW or QUICKLIST_NODE_LZF */
+    unsigned int recompress : 1; /* Temporarily decompressed for use */
+    unsigned int extra : 13;    /* Unused */
+} quicklistNode;
+
+/* A compressed node: 'sz' is the size of the LZF data that follows. */
+typedef struct quicklistLZF {
+    unsigned int sz;
+    char compressed[];
+} quicklistLZF;
+
+typedef struct quicklist {
+    quicklistNode* head;
+    quicklistNode* tail;
+    unsigned long count;        /* Total number of entries */
+    unsigned long len;          /* Number of nodes */
+    int fill;                   /* Fill factor of the nodes */
+    unsigned int compress;      /* Nodes at both ends left uncompressed */
+} quicklist;
+
+typedef struct quicklistIter {
+    quicklist* quicklist;
+    quicklistNode* current;
+    unsigned char* zi;          /* Current entry, NULL to re-seek 'offset' */
+    long offset;                /* Offset of the entry in the ziplist */
+    int direction;
+} quicklistIter;
+
+typedef struct quicklistEntry {
+    quicklist* quicklist;
+    quicklistNode* node;
+    unsigned char* zi;
+    unsigned char* value;       /* String value, or NULL ... */
+    long long longval;          /* ... if the entry is an integer */
+    unsigned int sz;
+    int offset;
+} quicklistEntry;
+
+#define QUICKLIST_HEAD 0
+#define QUICKLIST_TAIL -1
+
+#define QUICKLIST_NODE_RAW 1
+#define QUICKLIST_NODE_LZF 2
+
+/* Iterator directions, like AL_START_HEAD / AL_START_TAIL of adlist.h. */
+#define QUICKLIST_START_HEAD 0
+#define QUICKLIST_START_TAIL 1
+
+/* Prototypes */
+quicklist* quicklistCreate(void);
+quicklist* quicklistNew(int fill, int compress);
+void quicklistSetOptions(quicklist* ql, int fill, int compress);
+void quicklistRelease(quicklist* ql);
+int quicklistPushHead(quicklist* ql, void* value, size_t sz);
+int quicklistPushTail(quicklist* ql, void* value, size_t sz);
+void quicklistPush(quicklist* ql, void* value, size_t sz, int where);
+void quicklistAppendZiplist(quicklist* ql, unsigned char* zl);
+quicklist* quicklistAppendValuesFromZiplist(quicklist* ql, unsigned char* zl);
+quicklist* quicklistCreateFromZiplist(int fill, int compress, unsigned char* zl);
+void quicklistInsertAfter(quicklist* ql, quicklistEntry* entry, void* value, size_t sz);
+void quicklistInsertBefore(quicklist* ql, quicklistEntry* entry, void* value, size_t sz);
+void quicklistDelEntry(quicklistIter* iter, quicklistEntry* entry);
+int quicklistReplaceAtIndex(quicklist* ql, long index, void* data, size_t sz);
+int quicklistDelRange(quicklist* ql, long start, long count);
+quicklistIter* quicklistGetIterator(quicklist* ql, int direction);
+quicklistIter* quicklistGetIteratorAtIdx(quicklist* ql, int direction, long long idx);
+int quicklistNext(quicklistIter* iter, quicklistEntry* entry);
+void quicklistReleaseIterator(quicklistIter* iter);
+int quicklistIndex(quicklist* ql, long long index, quicklistEntry* entry);
+void quicklistRecompressOnly(quicklist* ql, quicklistNode* node);
+int quicklistPopCustom(quicklist* ql, int where, unsigned char** data,
+                       unsigned int* sz, long long* sval,
+                       void* (*saver)(unsigned char* data, unsigned int sz));
+unsigned long quicklistCount(quicklist* ql);
+int quicklistCompare(unsigned char* p1, unsigned char* p2, int p2_len);
+size_t quicklistGetLzf(const quicklistNode* node, void** data);
+
+#endif /* __QUICKLIST_H__ */
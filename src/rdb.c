@@ -256,11 +256,40 @@ int rdbTryIntegerEncoding(char* s, size_t len, unsigned char* enc)
     return rdbEncodeInteger(value, enc);
 }
 
-int rdbSaveLzfStringObject(rio* rdb, unsigned char* s, size_t len)
+/* Save data already compressed with LZF, 'original_len' bytes long once
+ * decompressed, so that it is loaded back as a plain string. */
+int rdbSaveLzfBlob(rio* rdb, void* data, size_t compress_len, size_t original_len)
 {
-    size_t comprlen, outlen;
     unsigned char byte;
     int n, nwritten = 0;
+
+    byte = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_LZF;
+    if ((n = rdbWriteRaw(rdb, &byte, 1)) == -1) {
+        return -1;
+    }
+    nwritten += n;
+
+    if ((n = rdbSaveLen(rdb, compress_len)) == -1) {
+        return -1;
+    }
+    nwritten += n;
+
+    if ((n = rdbSaveLen(rdb, original_len)) == -1) {
+        return -1;
+    }
+    nwritten += n;
+
+    if ((n = rdbWriteRaw(rdb, data, compress_len)) == -1) {
+        return -1;
+    }
+    nwritten += n;
+    return nwritten;
+}
+
+int rdbSaveLzfStringObject(rio* rdb, unsigned char* s, size_t len)
+{
+    size_t comprlen, outlen;
+    int nwritten;
     void* out;
 
     /* We require at least four bytes compression for this to be worth it */
@@ -277,33 +306,9 @@ int rdbSaveLzfStringObject(rio* rdb, unsigned char* s, size_t len)
         return 0;
     }
     /* Data compressed! Let's save it on disk */
-    byte = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_LZF;
-    if ((n = rdbWriteRaw(rdb, &byte, 1)) == -1) {
-        goto writeerr;
-    }
-    nwritten += n;
-
-    if ((n = rdbSaveLen(rdb, comprlen)) == -1) {
-        goto writeerr;
-    }
-    nwritten += n;
-
-    if ((n = rdbSaveLen(rdb, len)) == -1) {
-        goto writeerr;
-    }
-    nwritten += n;
-
-    if ((n = rdbWriteRaw(rdb, out, comprlen)) == -1) {
-        goto writeerr;
-    }
-    nwritten += n;
-
+    nwritten = rdbSaveLzfBlob(rdb, out, comprlen, len);
     zfree(out);
     return nwritten;
-
-writeerr:
-    zfree(out);
-    return -1;
 }
 
 robj* rdbLoadLzfStringObject(rio* rdb)
@@ -542,8 +547,8 @@ int rdbSaveObjectType(rio* rdb, robj* o)
         case REDIS_LIST:
             if (o->encoding == REDIS_ENCODING_ZIPLIST) {
                 return rdbSaveType(rdb, REDIS_RDB_TYPE_LIST_ZIPLIST);
-            } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-                return rdbSaveType(rdb, REDIS_RDB_TYPE_LIST);
+            } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+                return rdbSaveType(rdb, REDIS_RDB_TYPE_LIST_QUICKLIST);
             } else {
                 redisPanic("Unknown list encoding");
             }
@@ -611,23 +616,31 @@ int rdbSaveObject(rio* rdb, robj* o)
                 return -1;
             }
             nwritten += n;
-        } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-            list* list = o->ptr;
-            listIter li;
-            listNode* ln;
+        } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist* ql = o->ptr;
+            quicklistNode* node = ql->head;
 
-            if ((n = rdbSaveLen(rdb, listLength(list))) == -1) {
+            /* Save the ziplist of every node, compressed nodes are written
+             * as they are. */
+            if ((n = rdbSaveLen(rdb, ql->len)) == -1) {
                 return -1;
             }
             nwritten += n;
 
-            listRewind(list, &li);
-            while ((ln = listNext(&li))) {
-                robj* eleobj = listNodeValue(ln);
-                if ((n = rdbSaveStringObject(rdb, eleobj)) == -1) {
-                    return -1;
+            while (node) {
+                if (node->encoding == QUICKLIST_NODE_LZF) {
+                    void* data;
+                    size_t compress_len = quicklistGetLzf(node, &data);
+                    if ((n = rdbSaveLzfBlob(rdb, data, compress_len, node->sz)) == -1) {
+                        return -1;
+                    }
+                } else {
+                    if ((n = rdbSaveRawString(rdb, node->zl, node->sz)) == -1) {
+                        return -1;
+                    }
                 }
                 nwritten += n;
+                node = node->next;
             }
         } else {
             redisPanic("Unknown list encoding");
@@ -973,9 +986,9 @@ robj* rdbLoadObject(int rdbtype, rio* rdb)
             return NULL;
         }
 
-        /* Use a real list when there are too many entries */
+        /* Use a quicklist when there are too many entries */
         if (len > server.list_max_ziplist_entries) {
-            o = createListObject();
+            o = createQuicklistObject();
         } else {
             o = createZiplistObject();
         }
@@ -987,22 +1000,21 @@ robj* rdbLoadObject(int rdbtype, rio* rdb)
             }
 
             /* If we are using a ziplist and the value is too big, convert
-             * the object to a real list. */
+             * the object to a quicklist. */
             if (o->encoding == REDIS_ENCODING_ZIPLIST &&
                 ele->encoding == REDIS_ENCODING_RAW &&
                 sdslen(ele->ptr) > server.list_max_ziplist_value) {
-                listTypeConvert(o, REDIS_ENCODING_LINKEDLIST);
+                listTypeConvert(o, REDIS_ENCODING_QUICKLIST);
             }
 
+            dec = getDecodedObject(ele);
             if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-                dec = getDecodedObject(ele);
                 o->ptr = ziplistPush(o->ptr, dec->ptr, sdslen(dec->ptr), REDIS_TAIL);
-                decrRefCount(dec);
-                decrRefCount(ele);
             } else {
-                ele = tryObjectEncoding(ele);
-                listAddNodeTail(o->ptr, ele);
+                quicklistPushTail(o->ptr, dec->ptr, sdslen(dec->ptr));
             }
+            decrRefCount(dec);
+            decrRefCount(ele);
         }
     } else if (rdbtype == REDIS_RDB_TYPE_SET) {
         /* Read list/set value */
@@ -1164,6 +1176,25 @@ robj* rdbLoadObject(int rdbtype, rio* rdb)
         /* All pairs should be read by now */
         redisAssert(len == 0);
 
+    } else if (rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST) {
+        /* Read the ziplist of every node */
+        if ((len = rdbLoadLen(rdb, NULL)) == REDIS_RDB_LENERR) {
+            return NULL;
+        }
+        o = createQuicklistObject();
+
+        while (len--) {
+            robj* aux = rdbLoadStringObject(rdb);
+            unsigned char* zl;
+
+            if (aux == NULL) {
+                return NULL;
+            }
+            zl = zmalloc(sdslen(aux->ptr));
+            memcpy(zl, aux->ptr, sdslen(aux->ptr));
+            decrRefCount(aux);
+            quicklistAppendZiplist(o->ptr, zl);
+        }
     } else if (rdbtype == REDIS_RDB_TYPE_HASH_ZIPMAP  ||
                rdbtype == REDIS_RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == REDIS_RDB_TYPE_SET_INTSET   ||
@@ -1222,7 +1253,7 @@ robj* rdbLoadObject(int rdbtype, rio* rdb)
                 o->type = REDIS_LIST;
                 o->encoding = REDIS_ENCODING_ZIPLIST;
                 if (ziplistLen(o->ptr) > server.list_max_ziplist_entries) {
-                    listTypeConvert(o, REDIS_ENCODING_LINKEDLIST);
+                    listTypeConvert(o, REDIS_ENCODING_QUICKLIST);
                 }
                 break;
             case REDIS_RDB_TYPE_SET_INTSET:
@@ -1332,7 +1363,7 @@ int rdbLoad(char* filename)
         /* Serve the clients from time to time */
         if (!(loops++ % 1000)) {
             loadingProgress(rioTell(&rdb));
-            aeProcessEvents(server.el, AE_FILE_EVENTS | AE_DONT_WAIT);
+            processEventsWhileBlocked();
         }
 
         /* Read type. */
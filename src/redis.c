@@ -125,6 +125,7 @@ struct redisCommand redisCommandTable[] = {
     {"append", appendCommand, 3, "wm", 0, NULL, 1, 1, 1, 0, 0},
     {"strlen", strlenCommand, 2, "r", 0, NULL, 1, 1, 1, 0, 0},
     {"del", delCommand, -2, "w", 0, noPreloadGetKeys, 1, -1, 1, 0, 0},
+    {"unlink", unlinkCommand, -2, "w", 0, noPreloadGetKeys, 1, -1, 1, 0, 0},
     {"exists", existsCommand, 2, "r", 0, NULL, 1, 1, 1, 0, 0},
     {"setbit", setbitCommand, 4, "wm", 0, NULL, 1, 1, 1, 0, 0},
     {"getbit", getbitCommand, 3, "r", 0, NULL, 1, 1, 1, 0, 0},
@@ -156,6 +157,7 @@ struct redisCommand redisCommandTable[] = {
     {"smove", smoveCommand, 4, "w", 0, NULL, 1, 2, 1, 0, 0},
     {"sismember", sismemberCommand, 3, "r", 0, NULL, 1, 1, 1, 0, 0},
     {"scard", scardCommand, 2, "r", 0, NULL, 1, 1, 1, 0, 0},
+    {"sscan", sscanCommand, -3, "rR", 0, NULL, 1, 1, 1, 0, 0},
     {"spop", spopCommand, 2, "wRs", 0, NULL, 1, 1, 1, 0, 0},
     {"srandmember", srandmemberCommand, -2, "rR", 0, NULL, 1, 1, 1, 0, 0},
     {"sinter", sinterCommand, -2, "rS", 0, NULL, 1, -1, 1, 0, 0},
@@ -179,6 +181,7 @@ struct redisCommand redisCommandTable[] = {
     {"zrevrange", zrevrangeCommand, -4, "r", 0, NULL, 1, 1, 1, 0, 0},
     {"zcard", zcardCommand, 2, "r", 0, NULL, 1, 1, 1, 0, 0},
     {"zscore", zscoreCommand, 3, "r", 0, NULL, 1, 1, 1, 0, 0},
+    {"zscan", zscanCommand, -3, "rR", 0, NULL, 1, 1, 1, 0, 0},
     {"zrank", zrankCommand, 3, "r", 0, NULL, 1, 1, 1, 0, 0},
     {"zrevrank", zrevrankCommand, 3, "r", 0, NULL, 1, 1, 1, 0, 0},
     {"hset", hsetCommand, 4, "wm", 0, NULL, 1, 1, 1, 0, 0},
@@ -190,6 +193,7 @@ struct redisCommand redisCommandTable[] = {
     {"hincrbyfloat", hincrbyfloatCommand, 4, "wm", 0, NULL, 1, 1, 1, 0, 0},
     {"hdel", hdelCommand, -3, "w", 0, NULL, 1, 1, 1, 0, 0},
     {"hlen", hlenCommand, 2, "r", 0, NULL, 1, 1, 1, 0, 0},
+    {"hscan", hscanCommand, -3, "rR", 0, NULL, 1, 1, 1, 0, 0},
     {"hkeys", hkeysCommand, 2, "rS", 0, NULL, 1, 1, 1, 0, 0},
     {"hvals", hvalsCommand, 2, "rS", 0, NULL, 1, 1, 1, 0, 0},
     {"hgetall", hgetallCommand, 2, "r", 0, NULL, 1, 1, 1, 0, 0},
@@ -210,12 +214,14 @@ struct redisCommand redisCommandTable[] = {
     {"pexpire", pexpireCommand, 3, "w", 0, NULL, 1, 1, 1, 0, 0},
     {"pexpireat", pexpireatCommand, 3, "w", 0, NULL, 1, 1, 1, 0, 0},
     {"keys", keysCommand, 2, "rS", 0, NULL, 0, 0, 0, 0, 0},
+    {"scan", scanCommand, -2, "rR", 0, NULL, 0, 0, 0, 0, 0},
     {"dbsize", dbsizeCommand, 1, "r", 0, NULL, 0, 0, 0, 0, 0},
     {"auth", authCommand, 2, "rsl", 0, NULL, 0, 0, 0, 0, 0},
     {"ping", pingCommand, 1, "r", 0, NULL, 0, 0, 0, 0, 0},
     {"echo", echoCommand, 2, "r", 0, NULL, 0, 0, 0, 0, 0},
     {"save", saveCommand, 1, "ars", 0, NULL, 0, 0, 0, 0, 0},
     {"bgsave", bgsaveCommand, 1, "ar", 0, NULL, 0, 0, 0, 0, 0},
+    {"bgmysqlsave", bgmysqlsaveCommand, -1, "ar", 0, NULL, 0, 0, 0, 0, 0},
     {"bgrewriteaof", bgrewriteaofCommand, 1, "ar", 0, NULL, 0, 0, 0, 0, 0},
     {"shutdown", shutdownCommand, -1, "ar", 0, NULL, 0, 0, 0, 0, 0},
     {"lastsave", lastsaveCommand, 1, "rR", 0, NULL, 0, 0, 0, 0, 0},
@@ -225,8 +231,8 @@ struct redisCommand redisCommandTable[] = {
     {"discard", discardCommand, 1, "rs", 0, NULL, 0, 0, 0, 0, 0},
     {"sync", syncCommand, 1, "ars", 0, NULL, 0, 0, 0, 0, 0},
     {"replconf", replconfCommand, -1, "ars", 0, NULL, 0, 0, 0, 0, 0},
-    {"flushdb", flushdbCommand, 1, "w", 0, NULL, 0, 0, 0, 0, 0},
-    {"flushall", flushallCommand, 1, "w", 0, NULL, 0, 0, 0, 0, 0},
+    {"flushdb", flushdbCommand, -1, "w", 0, NULL, 0, 0, 0, 0, 0},
+    {"flushall", flushallCommand, -1, "w", 0, NULL, 0, 0, 0, 0, 0},
     {"sort", sortCommand, -2, "wm", 0, NULL, 1, 1, 1, 0, 0},
     {"info", infoCommand, -1, "rlt", 0, NULL, 0, 0, 0, 0, 0},
     {"monitor", monitorCommand, 1, "ars", 0, NULL, 0, 0, 0, 0, 0},
@@ -254,7 +260,8 @@ struct redisCommand redisCommandTable[] = {
     {"script", scriptCommand, -2, "ras", 0, NULL, 0, 0, 0, 0, 0},
     {"time", timeCommand, 1, "rR", 0, NULL, 0, 0, 0, 0, 0},
     {"bitop", bitopCommand, -4, "wm", 0, NULL, 2, -1, 1, 0, 0},
-    {"bitcount", bitcountCommand, -2, "r", 0, NULL, 1, 1, 1, 0, 0}
+    {"bitcount", bitcountCommand, -2, "r", 0, NULL, 1, 1, 1, 0, 0},
+    {"persistence", persistenceCommand, -2, "ar", 0, NULL, 0, 0, 0, 0, 0}
 };
 
 /*============================ Utility functions ============================ */
@@ -586,6 +593,74 @@ dictType commandTableDictType = {
     NULL                       /* val destructor */
 };
 
+/* MySQL pending writes index. sds key -> list of PendingOp, the lists are
+ * released by the persistence code itself. */
+dictType pendingWriteDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
+/* Table persistence policies. The keys are sds strings, but lookups are
+ * done with plain C strings, so hash and compare them as such. The values
+ * are stored as signed integers in the entry itself. */
+static unsigned int dictCStringHash(const void* key)
+{
+    return dictGenHashFunction(key, strlen(key));
+}
+
+static int dictCStringKeyCompare(void* privdata, const void* key1,
+                                 const void* key2)
+{
+    DICT_NOTUSED(privdata);
+    return strcmp(key1, key2) == 0;
+}
+
+dictType tablePolicyDictType = {
+    dictCStringHash,           /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictCStringKeyCompare,     /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
+/* Per table accounting. Same keys as tablePolicyDictType, values are the
+ * tableStats structures, never freed. */
+dictType tableStatsDictType = {
+    dictCStringHash,           /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictCStringKeyCompare,     /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
+/* MySQL shard maps. Same keys as tablePolicyDictType, values are the
+ * ShardMap structures. */
+dictType shardMapDictType = {
+    dictCStringHash,           /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictCStringKeyCompare,     /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    dictVanillaFree            /* val destructor */
+};
+
+/* MySQL read prefetch. sds -> ReadPrefetch, both for the table policies and
+ * for the prefetched keys, policies are never freed. */
+dictType readPrefetchDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    dictSdsDestructor,         /* key destructor */
+    NULL                       /* val destructor */
+};
+
 /* Hash type hash table (note that small hashes are represented with ziplists) */
 dictType hashDictType = {
     dictEncObjHash,             /* hash function */
@@ -660,7 +735,8 @@ int incrementallyRehash(int dbid)
  * running childs. */
 void updateDictResizePolicy(void)
 {
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+        server.mysqlFlushChildPid == -1) {
         dictEnableResize();
     } else {
         dictDisableResize();
@@ -900,6 +976,7 @@ int clientsCronHandleTimeout(redisClient* c)
         !(c->flags & REDIS_SLAVE) &&    /* no timeout for slaves */
         !(c->flags & REDIS_MASTER) &&   /* no timeout for masters */
         !(c->flags & REDIS_BLOCKED) &&  /* no timeout for BLPOP */
+        !(c->flags & REDIS_PERSIST_PAUSED) && /* delayed by backpressure */
         dictSize(c->pubsub_channels) == 0 && /* no timeout for pubsub */
         listLength(c->pubsub_patterns) == 0 &&
         (now - c->lastinteraction > server.maxidletime)) {
@@ -990,7 +1067,8 @@ void databasesCron(void)
     /* Perform hash tables rehashing if needed, but only if there are no
      * other processes saving the DB on disk. Otherwise rehashing is bad
      * as will cause a lot of copy-on-write of memory pages. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+        server.mysqlFlushChildPid == -1) {
         /* We use global counters so if we stop the computation at a given
          * DB we'll be able to start from the successive in the next
          * cron loop iteration. */
@@ -1134,8 +1212,10 @@ int serverCron(struct aeEventLoop* eventLoop, long long id, void* clientData)
         rewriteAppendOnlyFileBackground();
     }
 
-    /* Check if a background saving or AOF rewrite in progress terminated. */
-    if (server.rdb_child_pid != -1 || server.aof_child_pid != -1) {
+    /* Check if a background saving, AOF rewrite or MySQL flush in progress
+     * terminated. */
+    if (server.rdb_child_pid != -1 || server.aof_child_pid != -1 ||
+        server.mysqlFlushChildPid != -1) {
         int statloc;
         pid_t pid;
 
@@ -1151,6 +1231,8 @@ int serverCron(struct aeEventLoop* eventLoop, long long id, void* clientData)
                 backgroundSaveDoneHandler(exitcode, bysignal);
             } else if (pid == server.aof_child_pid) {
                 backgroundRewriteDoneHandler(exitcode, bysignal);
+            } else if (pid == server.mysqlFlushChildPid) {
+                mysqlFlushDoneHandler(exitcode, bysignal);
             } else {
                 redisLog(REDIS_WARNING,
                          "Warning, detected child with unmatched pid: %ld",
@@ -1216,6 +1298,24 @@ int serverCron(struct aeEventLoop* eventLoop, long long id, void* clientData)
         }
     }
 
+    /* Enter or leave MySQL persistence throttling. */
+    run_with_period(100) persistenceBackpressureCron();
+
+    /* Let a BGMYSQLSAVE child load its snapshot once the older jobs are in. */
+    run_with_period(100) mysqlFlushCron();
+
+    /* Drop the keys other writers changed in MySQL. */
+    run_with_period(100) binlogInvalidateCron();
+
+    /* Refresh the per table memory estimates and enforce hard quotas. */
+    run_with_period(100) {
+        tableStatsCron();
+        evictOverQuotaTables();
+    }
+
+    /* Drop the references the lazyfree thread found still shared. */
+    lazyfreeReleaseShared();
+
     server.cronloops++;
     return 1000 / server.hz;
 }
@@ -1229,6 +1329,9 @@ void beforeSleep(struct aeEventLoop* eventLoop)
     listNode* ln;
     redisClient* c;
 
+    /* Execute what the clients sent, read by the I/O threads if enabled. */
+    handleClientsWithPendingReads();
+
     /* Run a fast expire cycle. */
     activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
 
@@ -1241,15 +1344,21 @@ void beforeSleep(struct aeEventLoop* eventLoop)
         c->flags &= ~REDIS_UNBLOCKED;
 
         /* Process remaining data in the input buffer. */
-        if (c->querybuf && sdslen(c->querybuf) > 0) {
+        if (c->querybuf && (sdslen(c->querybuf) > 0 || c->pcmds_len > 0)) {
             server.current_client = c;
             processInputBuffer(c);
             server.current_client = NULL;
         }
     }
 
+    /* Forget the pending MySQL writes the write workers completed. */
+    drainPendingWrites();
+
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
+
+    /* Now that the AOF was written, send the replies. */
+    handleClientsWithPendingWrites();
 }
 
 /* =========================== Server initialization ======================== */
@@ -1268,6 +1377,7 @@ void createSharedObjects(void)
     shared.nullbulk = createObject(REDIS_STRING, sdsnew("$-1\r\n"));
     shared.nullmultibulk = createObject(REDIS_STRING, sdsnew("*-1\r\n"));
     shared.emptymultibulk = createObject(REDIS_STRING, sdsnew("*0\r\n"));
+    shared.emptyscan = createObject(REDIS_STRING, sdsnew("*2\r\n$1\r\n0\r\n*0\r\n"));
     shared.pong = createObject(REDIS_STRING, sdsnew("+PONG\r\n"));
     shared.queued = createObject(REDIS_STRING, sdsnew("+QUEUED\r\n"));
     shared.wrongtypeerr = createObject(REDIS_STRING, sdsnew(
@@ -1296,6 +1406,8 @@ void createSharedObjects(void)
                                      "-OOM command not allowed when used memory > 'maxmemory'.\r\n"));
     shared.execaborterr = createObject(REDIS_STRING, sdsnew(
                                            "-EXECABORT Transaction discarded because of previous errors.\r\n"));
+    shared.persistbehinderr = createObject(REDIS_STRING, sdsnew(
+                                               "-PERSISTBEHIND MySQL persistence is over the high watermark, write commands are rejected.\r\n"));
     shared.space = createObject(REDIS_STRING, sdsnew(" "));
     shared.colon = createObject(REDIS_STRING, sdsnew(":"));
     shared.plus = createObject(REDIS_STRING, sdsnew("+"));
@@ -1342,8 +1454,12 @@ void initServerConfig()
     server.verbosity = REDIS_NOTICE;
     server.maxidletime = REDIS_MAXIDLETIME;
     server.tcpkeepalive = 0;
+    server.tcp_reuseport = 0;
     server.active_expire_enabled = 1;
     server.client_max_querybuf_len = REDIS_MAX_QUERYBUF_LEN;
+    server.io_threads_num = REDIS_DEFAULT_IO_THREADS;
+    server.io_threads_do_reads = 1;
+    server.io_threads_active = 0;
     server.saveparams = NULL;
     server.loading = 0;
     server.logfile = NULL; /* NULL = log on standard output */
@@ -1375,6 +1491,9 @@ void initServerConfig()
     server.rdb_checksum = 1;
     server.stop_writes_on_bgsave_err = 1;
     server.activerehashing = 1;
+    server.keyspace_open_addressing = 0;
+    server.lazyfree_lazy_eviction = 0;
+    server.lazyfree_lazy_server_del = 0;
     server.maxclients = REDIS_MAX_CLIENTS;
     server.bpop_blocked_clients = 0;
     server.maxmemory = 0;
@@ -1384,6 +1503,8 @@ void initServerConfig()
     server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE;
     server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
     server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
+    server.list_max_ziplist_size = REDIS_LIST_MAX_ZIPLIST_SIZE;
+    server.list_compress_depth = REDIS_LIST_COMPRESS_DEPTH;
     server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
     server.zset_max_ziplist_entries = REDIS_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = REDIS_ZSET_MAX_ZIPLIST_VALUE;
@@ -1394,6 +1515,30 @@ void initServerConfig()
     server.lua_time_limit = REDIS_LUA_TIME_LIMIT;
     server.lua_client = NULL;
     server.lua_timedout = 0;
+    server.writeThreadNum = 1;
+    server.writeThreadMin = 0;
+    server.writeThreadMax = 0;
+    server.writeThreadScaleDepth = PERSISTENCE_SCALE_DEPTH;
+    server.writeThreadScaleAge = PERSISTENCE_SCALE_AGE;
+    server.writeThreadIdleTime = PERSISTENCE_IDLE_TIME;
+    server.persistenceBackpressure = REDIS_PERSIST_BACKPRESSURE_ALERT;
+    server.persistenceHighWatermark = REDIS_PERSIST_HIGH_WATERMARK;
+    server.persistenceLowWatermark = REDIS_PERSIST_LOW_WATERMARK;
+    server.persistenceRetryMaxAttempts = PERSISTENCE_RETRY_MAX_ATTEMPTS;
+    server.persistenceRetryMaxJobs = PERSISTENCE_RETRY_MAX_JOBS;
+    server.persistenceDeadLetterFile = zstrdup(PERSISTENCE_DEADLETTER_FILE);
+    server.tablePolicies = dictCreate(&tablePolicyDictType, NULL);
+    server.tableStats = dictCreate(&tableStatsDictType, NULL);
+    server.tablesOverSoft = 0;
+    server.tablesOverHard = 0;
+    server.readPrefetch = dictCreate(&readPrefetchDictType, NULL);
+    server.readPrefetched = dictCreate(&readPrefetchDictType, NULL);
+    server.shardMaps = dictCreate(&shardMapDictType, NULL);
+    server.mysqlFlushRate = 0;
+    server.mysqlFlushMaxHold = 3600;
+    server.binlogInvalidation = 0;
+    server.binlogServerId = 0;
+    server.binlogRefresh = 0;
 
     updateLRUClock();
     resetServerSaveParams();
@@ -1520,9 +1665,17 @@ void initServer()
     server.current_client = NULL;
     server.clients = listCreate();
     server.clients_to_close = listCreate();
+    server.clients_pending_read = listCreate();
+    server.clients_pending_write = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.unblocked_clients = listCreate();
+    server.persistencePausedClients = listCreate();
+    server.persistenceThrottled = 0;
+    server.persistenceThrottledSince = 0;
+    server.stat_persistence_throttled = 0;
+    server.stat_persistence_rejected = 0;
+    server.stat_persistence_delayed = 0;
     server.ready_keys = listCreate();
 
     createSharedObjects();
@@ -1531,7 +1684,18 @@ void initServer()
     server.db = zmalloc(sizeof(redisDb) * server.dbnum);
 
     if (server.port != 0) {
-        server.ipfd = anetTcpServer(server.neterr, server.port, server.bindaddr);
+        if (server.tcp_reuseport) {
+            /* Instances sharing the port cache the same keys, without the
+             * binlog invalidation a write served by one of them leaves
+             * stale values in the others. */
+            if (!server.binlogInvalidation) {
+                redisLog(REDIS_WARNING, "tcp-reuseport requires binlog_invalidation yes");
+                exit(1);
+            }
+            server.ipfd = anetTcpReusePortServer(server.neterr, server.port, server.bindaddr);
+        } else {
+            server.ipfd = anetTcpServer(server.neterr, server.port, server.bindaddr);
+        }
         if (server.ipfd == ANET_ERR) {
             redisLog(REDIS_WARNING, "Opening port %d: %s",
                      server.port, server.neterr);
@@ -1551,9 +1715,13 @@ void initServer()
         exit(1);
     }
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&dbDictType, NULL);
-        server.db[j].expires = dictCreate(&keyptrDictType, NULL);
-        server.db[j].lastsaves = dictCreate(&keyptrDictType, NULL);
+        if (server.keyspace_open_addressing) {
+            server.db[j].dict = dictCreateOpen(&dbDictType, NULL);
+            server.db[j].expires = dictCreateOpen(&keyptrDictType, NULL);
+        } else {
+            server.db[j].dict = dictCreate(&dbDictType, NULL);
+            server.db[j].expires = dictCreate(&keyptrDictType, NULL);
+        }
         server.db[j].blocking_keys = dictCreate(&keylistDictType, NULL);
         server.db[j].ready_keys = dictCreate(&setDictType, NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType, NULL);
@@ -1567,6 +1735,10 @@ void initServer()
     server.cronloops = 0;
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
+    server.mysqlFlushChildPid = -1;
+    server.mysqlFlushTimeStart = -1;
+    server.mysqlFlushTimeLast = -1;
+    server.lastMysqlFlushStatus = REDIS_OK;
     aofRewriteBufferReset();
     server.aof_buf = sdsempty();
     server.lastsave = time(NULL); /* At startup we consider the DB saved. */
@@ -1584,6 +1756,8 @@ void initServer()
     server.stat_peak_memory = 0;
     server.stat_fork_time = 0;
     server.stat_rejected_conn = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
     memset(server.ops_sec_samples, 0, sizeof(server.ops_sec_samples));
     server.ops_sec_idx = 0;
     server.ops_sec_last_sample_time = mstime();
@@ -1627,6 +1801,7 @@ void initServer()
     scriptingInit();
     slowlogInit();
     bioInit();
+    initThreadedIO();
     if (server.mysqlHost != NULL && server.mysqlUser != NULL && server.mysqlPwd != NULL
         && server.mysqlDBName != NULL && server.mysqlPort != 0
     ) {
@@ -1636,12 +1811,22 @@ void initServer()
             exit(1);
         }
         ret = initDBLockDict();
-        pmgr = initPersistence(MAX_PERSISTENCE_BUF_SIZE * 1000, server.persistenceMmapFile, server.writeThreadNum, server.mysqlHost, server.mysqlPort, server.mysqlUser, server.mysqlPwd, server.mysqlDBName); 
-        lockPmgr = initPersistence(MAX_PERSISTENCE_BUF_SIZE * 1000, server.lockPersistenceMmapFile, server.writeThreadNum, server.mysqlHost, server.mysqlPort, server.mysqlUser, server.mysqlPwd, server.mysqlDBName);
-        if (pmgr == NULL) {
+        /* One pair of queues per MySQL shard, shard 0 is mysql_host. */
+        ret = initPersistenceShards(MAX_PERSISTENCE_BUF_SIZE * 1000, server.writeThreadNum);
+        if (ret != PERSISTENCE_RET_SUCCESS || pmgr == NULL) {
             redisLog(REDIS_WARNING, "initPersistence error");
             exit(1);
         }
+        if (server.binlogInvalidation) {
+            if (server.binlogServerId == 0) {
+                /* 共用端口的实例按pid区分 */
+                server.binlogServerId = server.tcp_reuseport ? 65536 + getpid() : 65536 + server.port;
+            }
+            if (initBinlogReaders() != DB_RET_SUCCESS) {
+                redisLog(REDIS_WARNING, "initBinlogReaders error");
+                exit(1);
+            }
+        }
     }
 }
 
@@ -1778,6 +1963,21 @@ struct redisCommand* lookupCommandByCString(char* s) {
     return cmd;
 }
 
+/* Lookup the original command implemented by 'proc'. Only the static
+ * command table is scanned, so this is safe to call from other threads
+ * (the MySQL write workers use it to name failed jobs). */
+struct redisCommand* lookupCommandByProc(redisCommandProc* proc) {
+    int j;
+    int numcommands = sizeof(redisCommandTable) / sizeof(struct redisCommand);
+
+    for (j = 0; j < numcommands; j++) {
+        if (redisCommandTable[j].proc == proc) {
+            return redisCommandTable + j;
+        }
+    }
+    return NULL;
+}
+
 /* Lookup the command in the current table, if not found also check in
  * the original table containing the original command names unaffected by
  * redis.conf rename-command statement.
@@ -1836,10 +2036,41 @@ void call(redisClient* c, int flags)
     
     char persistenceBuf[MAX_PERSISTENCE_BUF_SIZE] = {'\0'};
     int persistenceLen = -1;
+    int persistencePolicy = TABLE_POLICY_WRITE_BEHIND;
     if (server.mysqlHost != NULL && server.mysqlUser != NULL && server.mysqlPwd != NULL
         && server.mysqlDBName != NULL && server.mysqlPort != 0
     ) {
         persistenceLen = packPersistenceJob(c, persistenceBuf);
+        if (persistenceLen > 0) {
+            persistencePolicy = persistenceJobPolicy(persistenceBuf);
+        }
+    }
+
+    /* Write-through tables are written to MySQL synchronously, which must
+     * not overtake writes still queued for the same keys. Refuse the
+     * command until they are written. Inside EXEC they are refused when
+     * queued, see processCommand(). */
+    /* Instances sharing the port with tcp-reuseport may all cache the same
+     * key. A read-modify-write served by one of them would be computed on
+     * a stale copy and overwrite the others in MySQL, so they only read
+     * MySQL tables. Inside EXEC this is refused when queued. */
+    if (persistenceLen > 0 && server.tcp_reuseport) {
+        addReplyError(c, "Writes to MySQL tables are not allowed with tcp-reuseport");
+        c->dbkey_arg = NULL;
+        return;
+    }
+
+    int writeThrough = persistenceLen > 0 &&
+                       persistencePolicy == TABLE_POLICY_WRITE_THROUGH &&
+                       !(c->flags & REDIS_MULTI);
+    replyMark mark;
+    if (writeThrough) {
+        if (persistenceKeysPending(c)) {
+            addReplyError(c, "Key has writes queued for MySQL, write-through command refused, try again later");
+            c->dbkey_arg = NULL;
+            return;
+        }
+        markClientReply(c, &mark);
     }
 
     /* Call the command. */
@@ -1847,6 +2078,20 @@ void call(redisClient* c, int flags)
     dirty = server.dirty;
     c->cmd->proc(c);
     dirty = server.dirty - dirty;
+
+    /* Only commands that changed the dataset are written. If the write
+     * fails the keys are dropped from memory so that they are read back
+     * from MySQL as they were, and the reply of the command is replaced by
+     * an error. The command is then neither propagated nor queued. */
+    if (writeThrough && dirty) {
+        if (writeThroughPersistenceJob(c, persistenceBuf, persistenceLen) != DB_RET_SUCCESS) {
+            discardClientReply(c, &mark);
+            addReplyError(c, "MySQL write-through failed, command not executed");
+            redisOpArrayFree(&server.also_propagate);
+            dirty = 0;
+        }
+        persistenceLen = -1;
+    }
     duration = ustime() - start;
 
     /* When EVAL is called loading the AOF we don't want commands called
@@ -1893,11 +2138,39 @@ void call(redisClient* c, int flags)
         redisOpArrayFree(&server.also_propagate);
     }
     server.stat_numcommands++;
-    if (!needLockTable(c->cmd->proc)) {
-        addPersistenceJob(persistenceBuf, persistenceLen, pmgr);
-    } else {
-        addPersistenceJob(persistenceBuf, persistenceLen, lockPmgr);
+    if (persistenceLen > 0 && dirty) {
+        int ret;
+
+        /* Only commands that actually changed the dataset are persisted.
+         * The job goes to the queue of the shard owning the key, and until
+         * a worker writes it reads through MySQL see it as a pending write.
+         * Commands executed by EXEC are collected and written to MySQL in
+         * a single transaction per shard, see flushPersistenceMulti().
+         * Write-through tables were already written above. */
+        ret = queuePersistenceJob(c, persistenceBuf, persistenceLen,
+                                  needLockTable(c->cmd->proc));
+        if (ret == JOBLIST_RET_SUCCESS) {
+            /* Write-around tables don't keep the written value in memory,
+             * the next read gets it back from the pending writes or MySQL.
+             * MSET may touch tables with different policies, so check
+             * every key. */
+            if (c->cmd->proc == msetCommand) {
+                int j;
+
+                for (j = 1; j < c->argc; j += 2) {
+                    if (tablePolicy(c->argv[j]->ptr) == TABLE_POLICY_WRITE_AROUND &&
+                        dbDelete(c->db, c->argv[j])) {
+                        signalModifiedKey(c->db, c->argv[j]);
+                    }
+                }
+            } else if (persistencePolicy == TABLE_POLICY_WRITE_AROUND &&
+                       dbDelete(c->db, c->argv[1])) {
+                signalModifiedKey(c->db, c->argv[1]);
+            }
+        }
     }
+    /* The argv of Lua and EXEC may be released once the command returns. */
+    c->dbkey_arg = NULL;
 }
 
 /* If this function gets called we already read a whole
@@ -2018,6 +2291,38 @@ int processCommand(redisClient* c)
         return REDIS_OK;
     }
 
+    /* Keys written to MySQL must map to a row: "table_ID" with an integer
+     * ID, unless the table is cache-only. */
+    if (pmgr != NULL && isPersistenceCmd(c) && !checkPersistenceKeys(c)) {
+        flagTransaction(c);
+        addReplyError(c, "MySQL keys must be tablename_ID with an integer ID");
+        return REDIS_OK;
+    }
+
+    /* See call() about tcp-reuseport, refuse the whole transaction. */
+    if (pmgr != NULL && c->flags & REDIS_MULTI && server.tcp_reuseport &&
+        isPersistenceCmd(c) &&
+        tablePolicy(c->argv[1]->ptr) != TABLE_POLICY_CACHE_ONLY) {
+        flagTransaction(c);
+        addReplyError(c, "Writes to MySQL tables are not allowed with tcp-reuseport");
+        return REDIS_OK;
+    }
+
+    /* Write-through tables are written synchronously and the command is
+     * undone if that fails, which can't be done for a part of EXEC. */
+    if (pmgr != NULL && c->flags & REDIS_MULTI && isPersistenceCmd(c) &&
+        tablePolicy(c->argv[1]->ptr) == TABLE_POLICY_WRITE_THROUGH) {
+        flagTransaction(c);
+        addReplyError(c, "Write-through tables can't be written inside MULTI");
+        return REDIS_OK;
+    }
+
+    /* Apply the backpressure policy if MySQL persistence is behind. */
+    if (server.persistenceThrottled && !(c->flags & REDIS_MULTI) &&
+        persistenceBackpressureCommand(c)) {
+        return (c->flags & REDIS_PERSIST_PAUSED) ? REDIS_ERR : REDIS_OK;
+    }
+
     /* Exec the command */
     if (c->flags & REDIS_MULTI &&
         c->cmd->proc != execCommand && c->cmd->proc != discardCommand &&
@@ -2049,6 +2354,10 @@ int prepareForShutdown(int flags)
         kill(server.rdb_child_pid, SIGUSR1);
         rdbRemoveTempFile(server.rdb_child_pid);
     }
+    if (server.mysqlFlushChildPid != -1) {
+        redisLog(REDIS_WARNING, "There is a child flushing to MySQL. Killing it!");
+        kill(server.mysqlFlushChildPid, SIGUSR1);
+    }
     if (server.aof_state != REDIS_AOF_OFF) {
         /* Kill the AOF saving child as the AOF we already have may be longer
          * but contains the full dataset anyway. */
@@ -2308,7 +2617,8 @@ sds genRedisInfoString(char* section)
                             "used_memory_peak_human:%s\r\n"
                             "used_memory_lua:%lld\r\n"
                             "mem_fragmentation_ratio:%.2f\r\n"
-                            "mem_allocator:%s\r\n",
+                            "mem_allocator:%s\r\n"
+                            "lazyfree_pending_objects:%zu\r\n",
                             zmalloc_used_memory(),
                             hmem,
                             zmalloc_get_rss(),
@@ -2316,7 +2626,8 @@ sds genRedisInfoString(char* section)
                             peak_hmem,
                             ((long long)lua_gc(server.lua, LUA_GCCOUNT, 0)) * 1024LL,
                             zmalloc_get_fragmentation_ratio(),
-                            ZMALLOC_LIB
+                            ZMALLOC_LIB,
+                            lazyfreeGetPendingObjectsCount()
                            );
     }
 
@@ -2419,8 +2730,12 @@ sds genRedisInfoString(char* section)
         int lockSleepSum = 0;
         unsigned long long lockWsize = 0;
         unsigned long long lockRsize = 0;
-        persistenceInfo(&untreatedSize, &sleepSum, &wsize, &rsize, pmgr);
-        persistenceInfo(&lockUntreatedSize, &lockSleepSum, &lockWsize, &lockRsize, lockPmgr);
+        persistenceTotalInfo(0, &untreatedSize, &sleepSum, &wsize, &rsize);
+        persistenceTotalInfo(1, &lockUntreatedSize, &lockSleepSum, &lockWsize, &lockRsize);
+        unsigned long retryLen, lockRetryLen;
+        long long retried, lockRetried, dead, lockDead, reconnects, lockReconnects;
+        persistenceTotalRetryInfo(0, &retryLen, &retried, &dead, &reconnects);
+        persistenceTotalRetryInfo(1, &lockRetryLen, &lockRetried, &lockDead, &lockReconnects);
         info = sdscatprintf(info,
                             "# Stats\r\n"
                             "total_connections_received:%lld\r\n"
@@ -2434,6 +2749,9 @@ sds genRedisInfoString(char* section)
                             "pubsub_channels:%ld\r\n"
                             "pubsub_patterns:%lu\r\n"
                             "latest_fork_usec:%lld\r\n"
+                            "io_threads_active:%d\r\n"
+                            "io_threaded_reads_processed:%lld\r\n"
+                            "io_threaded_writes_processed:%lld\r\n"
                             "lock persistence sleep sum :%d\r\n"
                             "lock persistence untreated size :%d\r\n"
                             "lock persistence wsize :%lld\r\n"
@@ -2453,6 +2771,9 @@ sds genRedisInfoString(char* section)
                             dictSize(server.pubsub_channels),
                             listLength(server.pubsub_patterns),
                             server.stat_fork_time,
+                            server.io_threads_active,
+                            server.stat_io_reads_processed,
+                            server.stat_io_writes_processed,
                             lockSleepSum,
                             lockUntreatedSize,
                             lockWsize,
@@ -2461,6 +2782,47 @@ sds genRedisInfoString(char* section)
                             untreatedSize,
                             wsize, 
                             rsize);
+        info = sdscatprintf(info,
+                            "lock persistence worker num :%d\r\n"
+                            "persistence worker num :%d\r\n"
+                            "lock persistence head job age :%d\r\n"
+                            "persistence head job age :%d\r\n"
+                            "persistence late jobs :%lld\r\n"
+                            "persistence backpressure :%s\r\n"
+                            "persistence throttled :%d\r\n"
+                            "persistence throttled seconds :%ld\r\n"
+                            "persistence throttled count :%lld\r\n"
+                            "persistence rejected writes :%lld\r\n"
+                            "persistence delayed writes :%lld\r\n"
+                            "persistence paused clients :%lu\r\n"
+                            "persistence retry queue len :%lu\r\n"
+                            "persistence retried jobs :%lld\r\n"
+                            "persistence dead letter jobs :%lld\r\n"
+                            "persistence reconnects :%lld\r\n"
+                            "persistence pending keys :%lu\r\n",
+                            persistenceTotalWorkerNum(1),
+                            persistenceTotalWorkerNum(0),
+                            persistenceMaxHeadJobAge(1),
+                            persistenceMaxHeadJobAge(0),
+                            persistenceTotalLateJobs(),
+                            persistenceBackpressureName(server.persistenceBackpressure),
+                            server.persistenceThrottled,
+                            server.persistenceThrottled ?
+                                (long)(server.unixtime - server.persistenceThrottledSince) : 0L,
+                            server.stat_persistence_throttled,
+                            server.stat_persistence_rejected,
+                            server.stat_persistence_delayed,
+                            listLength(server.persistencePausedClients),
+                            retryLen + lockRetryLen,
+                            retried + lockRetried,
+                            dead + lockDead,
+                            reconnects + lockReconnects,
+                            pendingWriteKeys());
+        info = catReadPrefetchInfo(info);
+        info = catTableCompressInfo(info);
+        info = catMysqlFlushInfo(info);
+        info = catBinlogInfo(info);
+        info = catPersistenceShardInfo(info);
     }
 
     /* Replication */
@@ -2604,6 +2966,15 @@ sds genRedisInfoString(char* section)
             }
         }
     }
+
+    /* Per table stats, not in the default sections as there may be many */
+    if (allsections || !strcasecmp(section, "tables")) {
+        if (sections++) {
+            info = sdscat(info, "\r\n");
+        }
+        info = sdscatprintf(info, "# Tables\r\n");
+        info = catTableStatsInfo(info);
+    }
     return info;
 }
 
@@ -2637,30 +3008,13 @@ void monitorCommand(redisClient* c)
 
 /* ============================ Maxmemory directive  ======================== */
 
-/* This function gets called when 'maxmemory' is set on the config file to limit
- * the max memory used by the server, before processing a command.
- *
- * The goal of the function is to free enough memory to keep Redis under the
- * configured memory limit.
- *
- * The function starts calculating how many bytes should be freed to keep
- * Redis under the limit, and enters a loop selecting the best keys to
- * evict accordingly to the configured policy.
- *
- * If all the bytes needed to return back under the limit were freed the
- * function returns REDIS_OK, otherwise REDIS_ERR is returned, and the caller
- * should block the execution of commands that will result in more memory
- * used by the server.
- */
-int freeMemoryIfNeeded(void)
+/* Return the memory used as counted by maxmemory: the size of slaves
+ * output buffers and AOF buffer is removed from the used memory. */
+static size_t freeMemoryGetUsedMemory(void)
 {
-    size_t mem_used, mem_tofree, mem_freed;
-    int slaves = listLength(server.slaves);
+    size_t mem_used = zmalloc_used_memory();
 
-    /* Remove the size of slaves output buffers and AOF buffer from the
-     * count of used memory. */
-    mem_used = zmalloc_used_memory();
-    if (slaves) {
+    if (listLength(server.slaves)) {
         listIter li;
         listNode* ln;
 
@@ -2679,8 +3033,31 @@ int freeMemoryIfNeeded(void)
         mem_used -= sdslen(server.aof_buf);
         mem_used -= aofRewriteBufferSize();
     }
+    return mem_used;
+}
+
+/* This function gets called when 'maxmemory' is set on the config file to limit
+ * the max memory used by the server, before processing a command.
+ *
+ * The goal of the function is to free enough memory to keep Redis under the
+ * configured memory limit.
+ *
+ * The function starts calculating how many bytes should be freed to keep
+ * Redis under the limit, and enters a loop selecting the best keys to
+ * evict accordingly to the configured policy.
+ *
+ * If all the bytes needed to return back under the limit were freed the
+ * function returns REDIS_OK, otherwise REDIS_ERR is returned, and the caller
+ * should block the execution of commands that will result in more memory
+ * used by the server.
+ */
+int freeMemoryIfNeeded(void)
+{
+    size_t mem_used, mem_tofree, mem_freed;
+    int slaves = listLength(server.slaves);
 
     /* Check if we are over the memory limit. */
+    mem_used = freeMemoryGetUsedMemory();
     if (mem_used <= server.maxmemory) {
         return REDIS_OK;
     }
@@ -2697,6 +3074,7 @@ int freeMemoryIfNeeded(void)
 
         for (j = 0; j < server.dbnum; j++) {
             long bestval = 0; /* just to prevent warning */
+            int bestquota = 0;
             sds bestkey = NULL;
             struct dictEntry* de;
             redisDb* db = server.db + j;
@@ -2715,8 +3093,15 @@ int freeMemoryIfNeeded(void)
             /* volatile-random and allkeys-random policy */
             if (server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM ||
                 server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_RANDOM) {
-                de = dictGetRandomKey(dict);
-                bestkey = dictGetKey(de);
+                /* Keys of tables over their quota are preferred: when there
+                 * are any try a few random keys to find one of them. */
+                for (k = 0; k < server.maxmemory_samples; k++) {
+                    de = dictGetRandomKey(dict);
+                    bestkey = dictGetKey(de);
+                    if (!server.tablesOverSoft || tableOverQuota(bestkey)) {
+                        break;
+                    }
+                }
             }
 
             /* volatile-lru and allkeys-lru policy */
@@ -2725,6 +3110,7 @@ int freeMemoryIfNeeded(void)
                 for (k = 0; k < server.maxmemory_samples; k++) {
                     sds thiskey;
                     long thisval;
+                    int thisquota;
                     robj* o;
 
                     de = dictGetRandomKey(dict);
@@ -2736,11 +3122,15 @@ int freeMemoryIfNeeded(void)
                     }
                     o = dictGetVal(de);
                     thisval = estimateObjectIdleTime(o);
+                    thisquota = tableOverQuota(thiskey);
 
-                    /* Higher idle time is better candidate for deletion */
-                    if (bestkey == NULL || thisval > bestval) {
+                    /* Keys of tables over quota first, then higher idle time
+                     * is better candidate for deletion */
+                    if (bestkey == NULL || thisquota > bestquota ||
+                        (thisquota == bestquota && thisval > bestval)) {
                         bestkey = thiskey;
                         bestval = thisval;
+                        bestquota = thisquota;
                     }
                 }
             }
@@ -2750,23 +3140,27 @@ int freeMemoryIfNeeded(void)
                 for (k = 0; k < server.maxmemory_samples; k++) {
                     sds thiskey;
                     long thisval;
+                    int thisquota;
 
                     de = dictGetRandomKey(dict);
                     thiskey = dictGetKey(de);
                     thisval = (long) dictGetVal(de);
+                    thisquota = tableOverQuota(thiskey);
 
-                    /* Expire sooner (minor expire unix timestamp) is better
-                     * candidate for deletion */
-                    if (bestkey == NULL || thisval < bestval) {
+                    /* Keys of tables over quota first, then expire sooner
+                     * (minor expire unix timestamp) is better candidate for
+                     * deletion */
+                    if (bestkey == NULL || thisquota > bestquota ||
+                        (thisquota == bestquota && thisval < bestval)) {
                         bestkey = thiskey;
                         bestval = thisval;
+                        bestquota = thisquota;
                     }
                 }
             }
 
             /* Finally remove the selected key. */
-            int now = (int)time(NULL);
-            if (bestkey && (now - getLastSaveTime(&server.db[j], bestkey) > server.persistenceTolerateTime * 2)) {
+            if (bestkey) {
                 long long delta;
 
                 robj* keyobj = createStringObject(bestkey, sdslen(bestkey));
@@ -2780,13 +3174,25 @@ int freeMemoryIfNeeded(void)
                  * AOF and Output buffer memory will be freed eventually so
                  * we only care about memory used by the key space. */
                 delta = (long long) zmalloc_used_memory();
-                dbDelete(db, keyobj);
+                if (server.lazyfree_lazy_eviction) {
+                    dbAsyncDelete(db, keyobj);
+                } else {
+                    dbSyncDelete(db, keyobj);
+                }
                 delta -= (long long) zmalloc_used_memory();
                 mem_freed += delta;
                 server.stat_evictedkeys++;
                 decrRefCount(keyobj);
                 keys_freed++;
 
+                /* Values freed by the lazyfree thread are not part of the
+                 * delta above, so from time to time check if the memory
+                 * actually used is already under the limit. */
+                if (server.lazyfree_lazy_eviction && !(keys_freed % 16) &&
+                    freeMemoryGetUsedMemory() <= server.maxmemory) {
+                    mem_freed = mem_tofree;
+                }
+
                 /* When the memory to free starts to be big enough, we may
                  * start spending so much time here that is impossible to
                  * deliver data to the slaves fast enough, so we force the
@@ -2797,12 +3203,66 @@ int freeMemoryIfNeeded(void)
             }
         }
         if (!keys_freed) {
+            /* Nothing left to evict. The values still being released by
+             * the lazyfree thread will lower the used memory later, but
+             * the command is refused instead of blocking the event loop. */
             return REDIS_ERR;    /* nothing to free... */
         }
     }
     return REDIS_OK;
 }
 
+/* Evict keys of the tables over their hard quota, regardless of maxmemory.
+ * Only strings, lists and sorted sets are evicted: they are stored in MySQL
+ * and read back on the next access, while the other types would be lost.
+ * The number of keys to evict is derived from the sampled average key size,
+ * and at most REDIS_TABLE_EVICT_PER_CALL keys are sampled per call so that
+ * a big table is brought back under quota incrementally by serverCron(). */
+void evictOverQuotaTables(void)
+{
+    int j, k, slaves = listLength(server.slaves);
+
+    if (server.tablesOverHard == 0) {
+        return;
+    }
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb* db = server.db + j;
+
+        for (k = 0; k < REDIS_TABLE_EVICT_PER_CALL && dictSize(db->dict); k++) {
+            dictEntry* de = dictGetRandomKey(db->dict);
+            sds key = dictGetKey(de);
+            tableStats* ts = lookupTableStats(key, 0);
+            robj* val = dictGetVal(de);
+            robj* keyobj;
+
+            if (ts == NULL || ts->overquota != REDIS_TABLE_OVER_HARD ||
+                (val->type != REDIS_STRING && val->type != REDIS_LIST &&
+                 val->type != REDIS_ZSET)) {
+                continue;
+            }
+            keyobj = createStringObject(key, sdslen(key));
+            propagateExpire(db, keyobj);
+            if (server.lazyfree_lazy_eviction) {
+                dbAsyncDelete(db, keyobj);
+            } else {
+                dbSyncDelete(db, keyobj);
+            }
+            server.stat_evictedkeys++;
+            decrRefCount(keyobj);
+            updateTableQuota(ts);
+            if (server.tablesOverHard == 0) {
+                break;
+            }
+        }
+        if (slaves) {
+            flushSlavesOutputBuffers();
+        }
+        if (server.tablesOverHard == 0) {
+            return;
+        }
+    }
+}
+
 /* =================================== Main! ================================ */
 
 #ifdef __linux__
@@ -3002,6 +3462,11 @@ int main(int argc, char** argv)
     server.sentinel_mode = checkForSentinelMode(argc, argv);
     initServerConfig();
 
+    /* redis-mysql-dump builds an RDB file from the MySQL tables and exits. */
+    if (checkForMysqlDumpMode(argc, argv)) {
+        mysqlDumpMain(argc, argv);
+    }
+
     /* We need to init sentinel right now as parsing the configuration file
      * in sentinel mode will have the effect of populating the sentinel
      * data structures with master nodes to monitor. */
@@ -3112,8 +3577,148 @@ int checkPersistenceDone(void)
     int lockSleepSum = 0;
     unsigned long long lockWsize = 0;
     unsigned long long lockRsize = 0;
-    persistenceInfo(&untreatedSize, &sleepSum, &wsize, &rsize, pmgr);
-    persistenceInfo(&lockUntreatedSize, &lockSleepSum, &lockWsize, &lockRsize, lockPmgr);
+    persistenceTotalInfo(0, &untreatedSize, &sleepSum, &wsize, &rsize);
+    persistenceTotalInfo(1, &lockUntreatedSize, &lockSleepSum, &lockWsize, &lockRsize);
     return untreatedSize == 0 && lockUntreatedSize == 0;
 }
+
+/* ======================= MySQL persistence backpressure ===================
+ *
+ * When MySQL is slower than the incoming writes the persistence queues grow
+ * without bound. Every MySQL shard is checked on its own: a shard enters
+ * throttling when its queued bytes reach persistence_high_watermark, or the
+ * job being dispatched is older than half of persistence_tolerate_time, and
+ * leaves it only once its queues drained below persistence_low_watermark, so
+ * we don't flap around a single value. server.persistenceThrottled is the
+ * number of throttled shards. persistenceBackpressureCommand() applies the
+ * configured policy to the commands writing keys of a throttled shard. */
+
+static char* persistenceBackpressureNames[] = {"alert", "delay", "reject"};
+
+char* persistenceBackpressureName(int policy)
+{
+    return persistenceBackpressureNames[policy];
+}
+
+int persistenceBackpressureByName(char* name)
+{
+    int j;
+
+    for (j = 0; j < 3; j++) {
+        if (!strcasecmp(name, persistenceBackpressureNames[j])) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+void persistenceBackpressureCron(void)
+{
+    int shard, age, resume = 0;
+    long long queued;
+
+    if (pmgr == NULL) {
+        return;
+    }
+    for (shard = 0; shard < dbShardNum(); shard++) {
+        queued = persistenceShardQueued(shard);
+        age = persistenceShardHeadJobAge(shard);
+
+        if (!persistenceShardThrottled(shard)) {
+            if (queued >= server.persistenceHighWatermark ||
+                (server.persistenceTolerateTime > 0 &&
+                 age >= server.persistenceTolerateTime / 2)) {
+                setPersistenceShardThrottled(shard, 1);
+                if (server.persistenceThrottled++ == 0) {
+                    server.persistenceThrottledSince = server.unixtime;
+                }
+                server.stat_persistence_throttled++;
+                redisLog(REDIS_WARNING,
+                         "MySQL persistence of shard %d is behind (%lld bytes queued, oldest job %d seconds), %s policy in effect.",
+                         shard, queued, age,
+                         persistenceBackpressureName(server.persistenceBackpressure));
+            }
+        } else if (queued <= server.persistenceLowWatermark &&
+                   (server.persistenceTolerateTime <= 0 ||
+                    age < server.persistenceTolerateTime / 4)) {
+            setPersistenceShardThrottled(shard, 0);
+            server.persistenceThrottled--;
+            resume = 1;
+            redisLog(REDIS_WARNING,
+                     "MySQL persistence of shard %d caught up (%lld bytes queued).",
+                     shard, queued);
+            if (server.persistenceThrottled == 0) {
+                redisLog(REDIS_WARNING,
+                         "MySQL persistence caught up after %ld seconds.",
+                         (long)(server.unixtime - server.persistenceThrottledSince));
+            }
+        }
+    }
+
+    /* Resume delayed writers when a shard caught up, or if the policy was
+     * changed with CONFIG SET while they were waiting. The writers of the
+     * shards still throttled are delayed again, at the tail of the list,
+     * so only the clients paused so far are visited. */
+    if (resume || !server.persistenceThrottled ||
+        server.persistenceBackpressure != REDIS_PERSIST_BACKPRESSURE_DELAY) {
+        unsigned long paused = listLength(server.persistencePausedClients);
+
+        while (paused-- && listLength(server.persistencePausedClients)) {
+            listNode* ln = listFirst(server.persistencePausedClients);
+            resumePersistencePausedClient(ln->value);
+        }
+    }
+}
+
+/* Called by processCommand() while a shard is throttled. Returns 1 if the
+ * command writes a key of a throttled shard and was handled by the
+ * backpressure policy, so it must not be executed now. Commands from our
+ * master, Lua and the AOF loader are never throttled. */
+int persistenceBackpressureCommand(redisClient* c)
+{
+    if (server.persistenceBackpressure == REDIS_PERSIST_BACKPRESSURE_ALERT ||
+        c->fd == -1 || (c->flags & (REDIS_MASTER | REDIS_LUA_CLIENT)) ||
+        !isPersistenceCmd(c) || !persistenceCmdThrottled(c)) {
+        return 0;
+    }
+
+    if (server.persistenceBackpressure == REDIS_PERSIST_BACKPRESSURE_REJECT) {
+        server.stat_persistence_rejected++;
+        addReply(c, shared.persistbehinderr);
+        return 1;
+    }
+
+    /* DELAY: keep the parsed command in argv and stop reading from the
+     * client, it will be executed when the throttling ends. */
+    aeDeleteFileEvent(server.el, c->fd, AE_READABLE);
+    c->flags |= REDIS_PERSIST_PAUSED;
+    listAddNodeTail(server.persistencePausedClients, c);
+    server.stat_persistence_delayed++;
+    return 1;
+}
+
+void resumePersistencePausedClient(redisClient* c)
+{
+    listNode* ln = listSearchKey(server.persistencePausedClients, c);
+
+    redisAssert(ln != NULL);
+    listDelNode(server.persistencePausedClients, ln);
+    c->flags &= ~REDIS_PERSIST_PAUSED;
+    if (aeCreateFileEvent(server.el, c->fd, AE_READABLE,
+                          readQueryFromClient, c) == AE_ERR) {
+        freeClientAsync(c);
+        return;
+    }
+
+    /* Run the delayed command, then whatever was pipelined after it. */
+    server.current_client = c;
+    if (processCommand(c) == REDIS_OK) {
+        resetClient(c);
+    }
+    if (!(c->flags & REDIS_PERSIST_PAUSED) && c->querybuf &&
+        (sdslen(c->querybuf) > 0 || c->pcmds_len > 0)) {
+        processInputBuffer(c);
+    }
+    server.current_client = NULL;
+}
 /* The End */
@@ -58,6 +58,7 @@
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "anet.h"    /* Networking the easy way */
 #include "ziplist.h" /* Compact list data structure */
+#include "quicklist.h" /* Linked list of ziplists */
 #include "intset.h"  /* Compact integer set structure */
 #include "version.h" /* Version macro */
 #include "util.h"    /* Misc functions useful in many places */
@@ -76,6 +77,8 @@
 #define REDIS_CONFIGLINE_MAX    1024
 #define REDIS_DBCRON_DBS_PER_CALL 16
 #define REDIS_MAX_WRITE_PER_EVENT (1024*64)
+#define REDIS_DEFAULT_IO_THREADS 1      /* Only the main thread does I/O. */
+#define REDIS_IO_THREADS_MAX_NUM 128
 #define REDIS_SHARED_SELECT_CMDS 10
 #define REDIS_SHARED_INTEGERS 10000
 #define REDIS_SHARED_BULKHDR_LEN 32
@@ -104,13 +107,22 @@
 #define REDIS_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define REDIS_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define REDIS_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define REDIS_REPLY_SHARE_BYTES (4*1024) /* Bigger replies are not copied */
 #define REDIS_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define REDIS_MBULK_BIG_ARG     (1024*32)
+#define REDIS_MBULK_FAST_MAX_ARGS 512   /* Bigger requests use the generic parser */
+#define REDIS_MBULK_FAST_BATCH 1024     /* Max commands parsed in one batch */
+#define REDIS_ARGPOOL_SIZE 16          /* Argument objects recycled per client */
+#define REDIS_ARGPOOL_MAX_ALLOC 64     /* Bigger argument strings are not recycled */
 #define REDIS_AOF_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
 /* Hash table parameters */
 #define REDIS_HT_MINFILL        10      /* Minimal hash table fill 10% */
 
+/* emptyDb() flags */
+#define REDIS_EMPTYDB_NO_FLAGS  0       /* No flags. */
+#define REDIS_EMPTYDB_ASYNC     (1<<0)  /* Free the values in background. */
+
 /* Command flags. Please check the command table defined in the redis.c file
  * for more information about the meaning of every flag. */
 #define REDIS_CMD_WRITE 1                   /* "w" flag */
@@ -144,6 +156,7 @@
 #define REDIS_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
 #define REDIS_ENCODING_INTSET 6  /* Encoded as intset */
 #define REDIS_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
+#define REDIS_ENCODING_QUICKLIST 8 /* Encoded as linked list of ziplists */
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -192,6 +205,9 @@ server.unblocked_clients */
 #define REDIS_CLOSE_ASAP (1<<10)/* Close this client ASAP */
 #define REDIS_UNIX_SOCKET (1<<11) /* Client connected via Unix domain socket */
 #define REDIS_DIRTY_EXEC (1<<12)  /* EXEC will fail for errors while queueing */
+#define REDIS_PERSIST_PAUSED (1<<13) /* Write delayed until MySQL catches up */
+#define REDIS_PENDING_READ (1<<14)   /* Read queued for the I/O threads */
+#define REDIS_PENDING_WRITE (1<<15)  /* Reply queued for the I/O threads */
 
 /* Client request types */
 #define REDIS_REQ_INLINE 1
@@ -257,6 +273,8 @@ server.unblocked_clients */
 #define REDIS_HASH_MAX_ZIPLIST_VALUE 64
 #define REDIS_LIST_MAX_ZIPLIST_ENTRIES 512
 #define REDIS_LIST_MAX_ZIPLIST_VALUE 64
+#define REDIS_LIST_MAX_ZIPLIST_SIZE -2
+#define REDIS_LIST_COMPRESS_DEPTH 0
 #define REDIS_SET_MAX_INTSET_ENTRIES 512
 #define REDIS_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define REDIS_ZSET_MAX_ZIPLIST_VALUE 64
@@ -277,6 +295,13 @@ server.unblocked_clients */
 /* Scripting */
 #define REDIS_LUA_TIME_LIMIT 5000 /* milliseconds */
 
+/* What to do with writes while the MySQL persistence queue is behind */
+#define REDIS_PERSIST_BACKPRESSURE_ALERT 0  /* Keep accepting, just log */
+#define REDIS_PERSIST_BACKPRESSURE_DELAY 1  /* Stop reading from writers */
+#define REDIS_PERSIST_BACKPRESSURE_REJECT 2 /* Reply with -PERSISTBEHIND */
+#define REDIS_PERSIST_HIGH_WATERMARK (1024*1024*16)
+#define REDIS_PERSIST_LOW_WATERMARK (1024*1024*8)
+
 /* Units */
 #define UNIT_SECONDS 0
 #define UNIT_MILLISECONDS 1
@@ -347,6 +372,27 @@ typedef struct redisDb {
     long long avg_ttl;          /* Average TTL, just for stats */
 } redisDb;
 
+/* Per table accounting. The table is the key prefix before the first '_',
+ * as in the MySQL persistence. Tables beyond REDIS_TABLE_STATS_MAX are all
+ * accounted in the REDIS_TABLE_STATS_OTHER entry. */
+#define REDIS_TABLE_STATS_MAX 1024
+#define REDIS_TABLE_STATS_OTHER "*"
+#define REDIS_TABLE_STATS_SAMPLES 16    /* Keys sampled per DB per cron call */
+#define REDIS_TABLE_EVICT_PER_CALL 64   /* Max keys evicted per cron call */
+#define REDIS_TABLE_UNDER_QUOTA 0
+#define REDIS_TABLE_OVER_SOFT 1
+#define REDIS_TABLE_OVER_HARD 2
+
+typedef struct tableStats {
+    long long keys;
+    size_t avgsize;                 /* Sampled memory per key */
+    long long hits;
+    long long misses;
+    unsigned long long softquota;   /* Evicted first under maxmemory, 0 = none */
+    unsigned long long hardquota;   /* Evicted even under maxmemory, 0 = none */
+    int overquota;                  /* REDIS_TABLE_* state, updated by cron */
+} tableStats;
+
 /* Client MULTI/EXEC state */
 typedef struct multiCmd {
     robj** argv;
@@ -384,6 +430,21 @@ typedef struct readyList {
     robj* key;
 } readyList;
 
+/* A command an I/O thread parsed out of the query buffer, waiting for the
+ * main thread to execute it. */
+typedef struct parsedCommand {
+    int argc;
+    robj** argv;
+} parsedCommand;
+
+/* Where the output buffers of a client ended before a command ran, see
+ * markClientReply(). */
+typedef struct replyMark {
+    int bufpos;
+    unsigned long listlen;
+    size_t taillen;
+} replyMark;
+
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a liked list. */
 typedef struct redisClient {
@@ -421,6 +482,23 @@ typedef struct redisClient {
     dict* pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list* pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
 
+    /* Threaded I/O state */
+    parsedCommand* pcmds;   /* Commands parsed ahead by an I/O thread */
+    int pcmds_pos;          /* Next command of pcmds to execute */
+    int pcmds_len;          /* Number of used entries of pcmds */
+    int pcmds_size;         /* Number of allocated entries of pcmds */
+    sds protoerr;           /* Protocol error found by an I/O thread */
+    int io_nread;           /* Result of the last threaded read */
+    int io_errno;           /* errno of the last threaded read or write */
+    int io_sentobjs;        /* Reply objects fully written by an I/O thread */
+    robj* argpool[REDIS_ARGPOOL_SIZE]; /* Released argument objects to reuse */
+    int argpool_len;        /* Number of objects in argpool */
+
+    /* MySQL key of the current command, see clientDBKey() */
+    struct _DBKey* dbkey;   /* argv[1] parsed as "table_ID", allocated lazily */
+    robj* dbkey_arg;        /* argv[1] dbkey was parsed from, NULL if none */
+    int dbkey_valid;        /* argv[1] maps to a MySQL row */
+
     /* Response buffer */
     int bufpos;
     char buf[REDIS_REPLY_CHUNK_BYTES];
@@ -436,10 +514,10 @@ struct sharedObjectsStruct {
           *colon, *nullbulk, *nullmultibulk, *queued,
           *emptymultibulk, *wrongtypeerr, *nokeyerr, *syntaxerr, *sameobjecterr,
           *outofrangeerr, *noscripterr, *loadingerr, *slowscripterr, *bgsaveerr,
-          *masterdownerr, *roslaveerr, *execaborterr,
+          *masterdownerr, *roslaveerr, *execaborterr, *persistbehinderr,
           *oomerr, *plus, *messagebulk, *pmessagebulk, *subscribebulk,
           *unsubscribebulk, *psubscribebulk, *punsubscribebulk, *del, *rpop, *lpop,
-          *lpush,
+          *lpush, *emptyscan,
           *select[REDIS_SHARED_SELECT_CMDS],
           *integers[REDIS_SHARED_INTEGERS],
           *mbulkhdr[REDIS_SHARED_BULKHDR_LEN], /* "*<value>\r\n" */
@@ -513,6 +591,10 @@ struct redisServer {
     unsigned lruclock_padding: 10;
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int keyspace_open_addressing; /* Open addressing tables for the keyspace */
+    int lazyfree_lazy_eviction; /* Free evicted values in background */
+    int lazyfree_lazy_server_del; /* Free overwritten / implicitly deleted
+                                     values in background */
     char* requirepass;          /* Pass for AUTH command, or NULL */
     char* pidfile;              /* PID file path */
     int arch_bits;              /* 32 or 64 depending on sizeof(long) */
@@ -528,6 +610,8 @@ struct redisServer {
     int sofd;                   /* Unix socket file descriptor */
     list* clients;              /* List of active clients */
     list* clients_to_close;     /* Clients to close asynchronously */
+    list* clients_pending_read; /* Clients to read from in the I/O threads */
+    list* clients_pending_write; /* Clients with replies not yet written */
     list* slaves, *monitors;    /* List of slaves and MONITORs */
     redisClient* current_client; /* Current client, only used on crash report */
     char neterr[ANET_ERR_LEN];  /* Error buffer for anet.c */
@@ -550,6 +634,8 @@ struct redisServer {
     size_t stat_peak_memory;        /* Max used memory record */
     long long stat_fork_time;       /* Time needed to perform latest fork() */
     long long stat_rejected_conn;   /* Clients rejected because of maxclients */
+    long long stat_io_reads_processed; /* Reads done by the I/O threads */
+    long long stat_io_writes_processed; /* Writes done by the I/O threads */
     list* slowlog;                  /* SLOWLOG list of commands */
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
@@ -564,8 +650,12 @@ struct redisServer {
     int verbosity;                  /* Loglevel in redis.conf */
     int maxidletime;                /* Client timeout in seconds */
     int tcpkeepalive;               /* Set SO_KEEPALIVE if non-zero. */
+    int tcp_reuseport;              /* Share the port with other instances */
     int active_expire_enabled;      /* Can be disabled for testing purposes. */
     size_t client_max_querybuf_len; /* Limit for client query buffer length */
+    int io_threads_num;             /* Threads doing client I/O, main included */
+    int io_threads_do_reads;        /* Also read and parse in the I/O threads */
+    int io_threads_active;          /* The I/O threads are spinning for work */
     int dbnum;                      /* Total number of configured DBs */
     int daemonize;                  /* True if running as a daemon */
     clientBufferLimitsConfig client_obuf_limits[REDIS_CLIENT_LIMIT_NUM_CLASSES];
@@ -653,6 +743,8 @@ struct redisServer {
     size_t hash_max_ziplist_value;
     size_t list_max_ziplist_entries;
     size_t list_max_ziplist_value;
+    int list_max_ziplist_size;
+    int list_compress_depth;
     size_t set_max_intset_entries;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
@@ -690,7 +782,42 @@ struct redisServer {
     int mysqlPort;
     char* persistenceMmapFile;
     char* lockPersistenceMmapFile;
-    int writeThreadNum;
+    int writeThreadNum;             /* Write workers started per queue */
+    int writeThreadMin;             /* Never retire below this many workers */
+    int writeThreadMax;             /* Never grow above this many workers */
+    int writeThreadScaleDepth;      /* Grow when this many bytes are queued */
+    int writeThreadScaleAge;        /* Grow when a job waited this many secs */
+    int writeThreadIdleTime;        /* Retire workers idle this many secs */
+    int persistenceTolerateTime;
+    int dynamicCreateTable;
+    int persistenceBackpressure;    /* REDIS_PERSIST_BACKPRESSURE_* */
+    long long persistenceHighWatermark; /* Throttle above this queued size */
+    long long persistenceLowWatermark;  /* Stop throttling below this size */
+    int persistenceThrottled;       /* Shards over the high watermark */
+    time_t persistenceThrottledSince; /* When throttling started */
+    list* persistencePausedClients; /* Writers delayed by the DELAY policy */
+    long long stat_persistence_throttled; /* Times throttling was entered */
+    long long stat_persistence_rejected;  /* Writes refused by REJECT */
+    long long stat_persistence_delayed;   /* Writes delayed by DELAY */
+    dict* tableStats;                 /* table -> tableStats */
+    int tablesOverSoft;               /* Tables over their soft quota */
+    int tablesOverHard;               /* Tables over their hard quota */
+    int persistenceRetryMaxAttempts;  /* Dead-letter a job after N failures */
+    int persistenceRetryMaxJobs;      /* Max jobs waiting for a retry */
+    char* persistenceDeadLetterFile;  /* Failed jobs in protocol format */
+    dict* tablePolicies;              /* table -> persistence policy */
+    dict* readPrefetch;               /* table -> ReadPrefetch policy */
+    dict* readPrefetched;             /* "db:key" prefetched, not yet accessed */
+    dict* shardMaps;                  /* table -> ShardMap */
+    pid_t mysqlFlushChildPid;         /* PID of the BGMYSQLSAVE child or -1 */
+    time_t mysqlFlushTimeStart;       /* Start of the current BGMYSQLSAVE */
+    time_t mysqlFlushTimeLast;        /* Duration of the last BGMYSQLSAVE */
+    int lastMysqlFlushStatus;         /* REDIS_OK or REDIS_ERR */
+    int mysqlFlushRate;               /* BGMYSQLSAVE rows per sec, 0 = no limit */
+    int mysqlFlushMaxHold;            /* Abort BGMYSQLSAVE after N secs, 0 = no limit */
+    int binlogInvalidation;           /* Invalidate keys from the MySQL binlog */
+    int binlogServerId;               /* server_id used to read the binlog */
+    int binlogRefresh;                /* Reload invalidated strings at once */
 };
 
 typedef struct pubsubPattern {
@@ -739,14 +866,14 @@ typedef struct {
     unsigned char encoding;
     unsigned char direction; /* Iteration direction */
     unsigned char* zi;
-    listNode* ln;
+    quicklistIter* iter;
 } listTypeIterator;
 
 /* Structure for an entry while iterating over a list. */
 typedef struct {
     listTypeIterator* li;
     unsigned char* zi;  /* Entry in ziplist */
-    listNode* ln;       /* Entry in linked list */
+    quicklistEntry entry; /* Entry in quicklist */
 } listTypeEntry;
 
 /* Structure to hold set iteration abstraction. */
@@ -783,9 +910,15 @@ extern struct sharedObjectsStruct shared;
 extern dictType setDictType;
 extern dictType zsetDictType;
 extern dictType dbDictType;
+extern dictType keyptrDictType;
 extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
+extern dictType pendingWriteDictType;
+extern dictType readPrefetchDictType;
+extern dictType shardMapDictType;
+extern dictType tablePolicyDictType;
+extern dictType tableStatsDictType;
 
 /*-----------------------------------------------------------------------------
  * Functions prototypes
@@ -809,6 +942,7 @@ void* addDeferredMultiBulkLength(redisClient* c);
 void setDeferredMultiBulkLength(redisClient* c, void* node, long length);
 void addReplySds(redisClient* c, sds s);
 void processInputBuffer(redisClient* c);
+void prefetchParsedCommands(redisClient* c);
 void acceptTcpHandler(aeEventLoop* el, int fd, void* privdata, int mask);
 void acceptUnixHandler(aeEventLoop* el, int fd, void* privdata, int mask);
 void readQueryFromClient(aeEventLoop* el, int fd, void* privdata, int mask);
@@ -825,6 +959,8 @@ void addReplyDouble(redisClient* c, double d);
 void addReplyLongLong(redisClient* c, long long ll);
 void addReplyMultiBulkLen(redisClient* c, long length);
 void copyClientOutputBuffer(redisClient* dst, redisClient* src);
+void markClientReply(redisClient* c, replyMark* mark);
+void discardClientReply(redisClient* c, replyMark* mark);
 void* dupClientReplyValue(void* o);
 void getClientsMaxBuffers(unsigned long* longest_output_list,
                           unsigned long* biggest_input_buffer);
@@ -834,6 +970,11 @@ void rewriteClientCommandVector(redisClient* c, int argc, ...);
 void rewriteClientCommandArgument(redisClient* c, int i, robj* newval);
 unsigned long getClientOutputBufferMemoryUsage(redisClient* c);
 void freeClientsInAsyncFreeQueue(void);
+void initThreadedIO(void);
+void handleClientsWithPendingReads(void);
+void handleClientsWithPendingWrites(void);
+void processEventsWhileBlocked(void);
+void freeClientAsync(redisClient* c);
 void asyncCloseClientOnOutputBufferLimitReached(redisClient* c);
 int getClientLimitClassByName(char* name);
 char* getClientLimitClassName(int class);
@@ -895,7 +1036,7 @@ robj* getDecodedObject(robj* o);
 size_t stringObjectLen(robj* o);
 robj* createStringObjectFromLongLong(long long value);
 robj* createStringObjectFromLongDouble(long double value);
-robj* createListObject(void);
+robj* createQuicklistObject(void);
 robj* createZiplistObject(void);
 robj* createSetObject(void);
 robj* createIntsetObject(void);
@@ -913,6 +1054,7 @@ char* strEncoding(int encoding);
 int compareStringObjects(robj* a, robj* b);
 int equalStringObjects(robj* a, robj* b);
 unsigned long estimateObjectIdleTime(robj* o);
+size_t estimateObjectMemory(robj* o);
 
 /* Synchronous I/O with timeout */
 ssize_t syncWrite(int fd, char* ptr, ssize_t size, long long timeout);
@@ -967,10 +1109,22 @@ void zsetConvert(robj* zobj, int encoding);
 
 /* Core functions */
 int freeMemoryIfNeeded(void);
+void evictOverQuotaTables(void);
+void mysqlFlushCron(void);
+void mysqlFlushDoneHandler(int exitcode, int bysignal);
+void setMysqlFlushRate(int rate);
+sds catMysqlFlushInfo(sds info);
+int checkPersistenceDone(void);
+void persistenceBackpressureCron(void);
+int persistenceBackpressureCommand(redisClient* c);
+void resumePersistencePausedClient(redisClient* c);
+char* persistenceBackpressureName(int policy);
+int persistenceBackpressureByName(char* name);
 int processCommand(redisClient* c);
 void setupSignalHandlers(void);
 struct redisCommand* lookupCommand(sds name);
 struct redisCommand* lookupCommandByCString(char* s);
+struct redisCommand* lookupCommandByProc(redisCommandProc* proc);
 struct redisCommand* lookupCommandOrOriginal(sds name);
 void call(redisClient* c, int flags);
 void propagate(struct redisCommand* cmd, int dbid, robj** argv, int argc, int flags);
@@ -985,6 +1139,7 @@ int htNeedsResize(dict* dict);
 void oom(const char* msg);
 void populateCommandTable(void);
 void resetCommandTableStats(void);
+void createSharedObjects(void);
 
 /* Set data type */
 robj* setTypeCreate(robj* value);
@@ -1048,11 +1203,31 @@ void setKey(redisDb* db, robj* key, robj* val);
 int dbExists(redisDb* db, robj* key);
 robj* dbRandomKey(redisDb* db);
 int dbDelete(redisDb* db, robj* key);
-long long emptyDb();
+int dbSyncDelete(redisDb* db, robj* key);
+long long emptyDb(int flags);
+tableStats* lookupTableStats(const char* key, int create);
+int tableOverQuota(const char* key);
+void updateTableQuota(tableStats* ts);
+void rebuildTableStats(void);
+void tableStatsCron(void);
+int setTableQuota(const char* table, unsigned long long softquota, unsigned long long hardquota);
+sds catTableQuotaConfig(sds s);
+sds catTableStatsInfo(sds info);
 int selectDb(redisClient* c, int id);
 void signalModifiedKey(redisDb* db, robj* key);
 void signalFlushedDb(int dbid);
 unsigned int GetKeysInSlot(unsigned int hashslot, robj** keys, unsigned int count);
+int parseScanCursorOrReply(redisClient* c, robj* o, unsigned long* cursor);
+void scanGenericCommand(redisClient* c, robj* o, unsigned long cursor);
+
+/* Lazy free */
+int dbAsyncDelete(redisDb* db, robj* key);
+void freeObjAsync(robj* o);
+void emptyDbAsync(redisDb* db);
+size_t lazyfreeGetPendingObjectsCount(void);
+void lazyfreeReleaseShared(void);
+void lazyfreeFreeObjectFromBioThread(robj* o);
+void lazyfreeFreeDatabaseFromBioThread(dict* ht1, dict* ht2);
 
 /* API to get key arguments from commands */
 #define REDIS_GETKEYS_ALL 0
@@ -1086,6 +1261,7 @@ void setexCommand(redisClient* c);
 void psetexCommand(redisClient* c);
 void getCommand(redisClient* c);
 void delCommand(redisClient* c);
+void unlinkCommand(redisClient* c);
 void existsCommand(redisClient* c);
 void setbitCommand(redisClient* c);
 void getbitCommand(redisClient* c);
@@ -1099,10 +1275,12 @@ void incrbyfloatCommand(redisClient* c);
 void selectCommand(redisClient* c);
 void randomkeyCommand(redisClient* c);
 void keysCommand(redisClient* c);
+void scanCommand(redisClient* c);
 void dbsizeCommand(redisClient* c);
 void lastsaveCommand(redisClient* c);
 void saveCommand(redisClient* c);
 void bgsaveCommand(redisClient* c);
+void bgmysqlsaveCommand(redisClient* c);
 void bgrewriteaofCommand(redisClient* c);
 void shutdownCommand(redisClient* c);
 void moveCommand(redisClient* c);
@@ -1126,6 +1304,7 @@ void sremCommand(redisClient* c);
 void smoveCommand(redisClient* c);
 void sismemberCommand(redisClient* c);
 void scardCommand(redisClient* c);
+void sscanCommand(redisClient* c);
 void spopCommand(redisClient* c);
 void srandmemberCommand(redisClient* c);
 void sinterCommand(redisClient* c);
@@ -1165,6 +1344,7 @@ void zrevrangeCommand(redisClient* c);
 void zcardCommand(redisClient* c);
 void zremCommand(redisClient* c);
 void zscoreCommand(redisClient* c);
+void zscanCommand(redisClient* c);
 void zremrangebyscoreCommand(redisClient* c);
 void multiCommand(redisClient* c);
 void execCommand(redisClient* c);
@@ -1183,6 +1363,7 @@ void hmsetCommand(redisClient* c);
 void hmgetCommand(redisClient* c);
 void hdelCommand(redisClient* c);
 void hlenCommand(redisClient* c);
+void hscanCommand(redisClient* c);
 void zremrangebyrankCommand(redisClient* c);
 void zunionstoreCommand(redisClient* c);
 void zinterstoreCommand(redisClient* c);
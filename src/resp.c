@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2009-2013, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Fast path for the multi bulk request protocol.
+ *
+ * processMultibulkBuffer() in networking.c parses one argument at a time
+ * keeping its state in the client, so that a request can arrive in any
+ * number of reads: it searches every length header with strchr(), converts
+ * it with string2ll() and trims the query buffer after every command.
+ *
+ * With pipelining the query buffer usually holds many whole commands, and
+ * respScanCommand() handles exactly this case: it parses the digits of the
+ * length headers while looking for the CR that ends them, jumps over the
+ * arguments using their length, and only reports offsets into the buffer so
+ * that the caller can parse a whole batch of commands and trim the buffer
+ * once. Everything else (partial commands, protocol errors, empty requests,
+ * big arguments that get the zero copy treatment) is left to the generic
+ * parser, respParseMultibulk(), that remains the reference for the protocol.
+ * It lives here rather than in networking.c so that the test at the end of
+ * this file compares the fast path with the very parser the server uses. */
+
+#include "resp.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Scan the non negative decimal number and the CRLF at *pp, advancing *pp
+ * past them. Returns 1 on success, 0 if the buffer ends before the CRLF, and
+ * -1 if this is not a number string2ll() would accept the same way. */
+static int respScanLength(const char** pp, const char* end, unsigned long* value)
+{
+    const char* p = *pp;
+    unsigned long v = 0;
+    int digits = 0;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (++digits > RESP_MAX_DIGITS) {
+            return -1;
+        }
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    if (p == end) {
+        return 0;
+    }
+    if (digits == 0 || *p != '\r' || (digits > 1 && **pp == '0')) {
+        return -1;
+    }
+    if (p + 1 == end) {
+        return 0;
+    }
+    if (p[1] != '\n') {
+        return -1;
+    }
+    *pp = p + 2;
+    *value = v;
+    return 1;
+}
+
+/* Scan the multi bulk command at the start of 'buf'. On success the number
+ * of arguments is stored in *argc, their offsets in 'args', and the length
+ * of the command in the buffer is returned.
+ *
+ * RESP_INCOMPLETE is returned if more data is needed, RESP_UNSUPPORTED if
+ * the command is not one of the plain ones handled here: more than 'maxargs'
+ * arguments, an argument of 'maxarglen' bytes or more, or anything
+ * processMultibulkBuffer() may reply with an error to. */
+long respScanCommand(const char* buf, size_t len, size_t maxarglen,
+                     respArg* args, int maxargs, int* argc)
+{
+    const char* p = buf, *end = buf + len;
+    unsigned long count, arglen, j;
+    int ret;
+
+    if (p == end) {
+        return RESP_INCOMPLETE;
+    }
+    if (*p++ != '*') {
+        return RESP_UNSUPPORTED;
+    }
+    if ((ret = respScanLength(&p, end, &count)) != 1) {
+        return ret == 0 ? RESP_INCOMPLETE : RESP_UNSUPPORTED;
+    }
+    if (count == 0 || count > (unsigned long)maxargs) {
+        return RESP_UNSUPPORTED;
+    }
+
+    for (j = 0; j < count; j++) {
+        if (p == end) {
+            return RESP_INCOMPLETE;
+        }
+        if (*p++ != '$') {
+            return RESP_UNSUPPORTED;
+        }
+        if ((ret = respScanLength(&p, end, &arglen)) != 1) {
+            return ret == 0 ? RESP_INCOMPLETE : RESP_UNSUPPORTED;
+        }
+        if (arglen >= maxarglen) {
+            return RESP_UNSUPPORTED;
+        }
+        if ((size_t)(end - p) < arglen + 2) {
+            return RESP_INCOMPLETE;
+        }
+        if (p[arglen] != '\r' || p[arglen + 1] != '\n') {
+            return RESP_UNSUPPORTED;
+        }
+        args[j].offset = p - buf;
+        args[j].len = arglen;
+        p += arglen + 2;
+    }
+    *argc = count;
+    return p - buf;
+}
+
+/* One step of the generic multi bulk parser. The state is kept by the caller
+ * in *multibulklen (arguments still to read, 0 at a command boundary) and
+ * *bulklen (length of the next argument, -1 if unknown), so a request can
+ * arrive in any number of reads. *pos is the offset in 'buf', that must be
+ * null terminated, where parsing continues, and is advanced past what was
+ * consumed. The caller trims the buffer at *pos once it stops calling.
+ *
+ * Returns RESP_PARSE_COUNT once the number of arguments is known, so that
+ * they can be allocated, RESP_PARSE_BULKLEN once the length of an argument
+ * is known, before waiting for its data, and RESP_PARSE_ARG with the offset
+ * and length of a whole argument in 'arg'. RESP_PARSE_EMPTY is returned for
+ * requests with no arguments, RESP_PARSE_MORE if more data is needed, and
+ * RESP_PARSE_ERROR with a message in 'err' on protocol errors. */
+int respParseMultibulk(const char* buf, size_t len, size_t* pos,
+                       int* multibulklen, long* bulklen, size_t maxinline,
+                       respArg* arg, char* err, size_t errlen)
+{
+    const char* newline;
+    long long ll;
+    int ok;
+
+    if (*multibulklen == 0) {
+        /* Multi bulk length cannot be read without a \r\n */
+        newline = strchr(buf + *pos, '\r');
+        if (newline == NULL) {
+            if (len > maxinline) {
+                snprintf(err, errlen, "Protocol error: too big mbulk count string");
+                return RESP_PARSE_ERROR;
+            }
+            return RESP_PARSE_MORE;
+        }
+
+        /* Buffer should also contain \n */
+        if (newline - buf > (long)len - 2) {
+            return RESP_PARSE_MORE;
+        }
+
+        /* We know for sure there is a whole line since newline != NULL,
+         * so go ahead and find out the multi bulk length. */
+        ok = string2ll(buf + *pos + 1, newline - (buf + *pos + 1), &ll);
+        if (!ok || ll > RESP_MAX_MULTIBULK_LEN) {
+            snprintf(err, errlen, "Protocol error: invalid multibulk length");
+            return RESP_PARSE_ERROR;
+        }
+        *pos = (newline - buf) + 2;
+        if (ll <= 0) {
+            return RESP_PARSE_EMPTY;
+        }
+        *multibulklen = ll;
+        return RESP_PARSE_COUNT;
+    }
+
+    /* Read bulk length if unknown */
+    if (*bulklen == -1) {
+        newline = strchr(buf + *pos, '\r');
+        if (newline == NULL) {
+            if (len > maxinline) {
+                snprintf(err, errlen, "Protocol error: too big bulk count string");
+                return RESP_PARSE_ERROR;
+            }
+            return RESP_PARSE_MORE;
+        }
+
+        /* Buffer should also contain \n */
+        if (newline - buf > (long)len - 2) {
+            return RESP_PARSE_MORE;
+        }
+
+        if (buf[*pos] != '$') {
+            snprintf(err, errlen, "Protocol error: expected '$', got '%c'", buf[*pos]);
+            return RESP_PARSE_ERROR;
+        }
+
+        ok = string2ll(buf + *pos + 1, newline - (buf + *pos + 1), &ll);
+        if (!ok || ll < 0 || ll > RESP_MAX_BULK_LEN) {
+            snprintf(err, errlen, "Protocol error: invalid bulk length");
+            return RESP_PARSE_ERROR;
+        }
+        *pos = (newline - buf) + 2;
+        *bulklen = ll;
+        return RESP_PARSE_BULKLEN;
+    }
+
+    /* Read bulk argument, +2 == trailing \r\n */
+    if (len - *pos < (size_t)*bulklen + 2) {
+        return RESP_PARSE_MORE;
+    }
+    arg->offset = *pos;
+    arg->len = *bulklen;
+    *pos += *bulklen + 2;
+    *bulklen = -1;
+    (*multibulklen)--;
+    return RESP_PARSE_ARG;
+}
+
+#ifdef RESP_TEST_MAIN
+/* Equivalence test against respParseMultibulk(), driven the same way
+ * processMultibulkBuffer() drives it, with the client state reduced to what
+ * the parser uses. Build and run with "make test-resp". */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "util.h"
+
+#define TEST_INLINE_MAX_SIZE (1024*64)
+#define TEST_MBULK_BIG_ARG (1024*32)
+#define TEST_MAX_ARGS 512
+#define TEST_BUF_SIZE (1024*1024)
+
+typedef struct testClient {
+    char* buf;              /* Query buffer, always null terminated. */
+    size_t len;
+    int multibulklen;
+    long bulklen;
+    int argc;
+    int error;
+    char* log;              /* Commands parsed so far, serialized. */
+    size_t loglen;
+} testClient;
+
+static void testConsume(testClient* c, size_t pos)
+{
+    memmove(c->buf, c->buf + pos, c->len - pos + 1);
+    c->len -= pos;
+}
+
+static void testLog(testClient* c, const void* p, size_t len)
+{
+    c->log = realloc(c->log, c->loglen + len);
+    memcpy(c->log + c->loglen, p, len);
+    c->loglen += len;
+}
+
+static void testLogArg(testClient* c, const char* p, size_t len)
+{
+    testLog(c, &len, sizeof(len));
+    testLog(c, p, len);
+}
+
+/* processMultibulkBuffer() with the arguments appended to the log: the same
+ * calls to respParseMultibulk(), trimming the buffer where it does. Big
+ * arguments are always copied, the zero copy case leaves the same state. */
+static int testMultibulk(testClient* c)
+{
+    size_t pos = 0;
+    respArg arg;
+    char err[128];
+    int ret;
+
+    assert(c->multibulklen || c->buf[0] == '*');
+    do {
+        ret = respParseMultibulk(c->buf, c->len, &pos, &c->multibulklen,
+                                 &c->bulklen, TEST_INLINE_MAX_SIZE, &arg,
+                                 err, sizeof(err));
+        if (ret == RESP_PARSE_MORE) {
+            if (pos) {
+                testConsume(c, pos);
+            }
+            return 0;
+        } else if (ret == RESP_PARSE_ERROR) {
+            testConsume(c, pos);
+            c->error = 1;
+            return 0;
+        } else if (ret == RESP_PARSE_EMPTY) {
+            testConsume(c, pos);
+            return 1;
+        } else if (ret == RESP_PARSE_COUNT) {
+            testLog(c, "*", 1);
+        } else if (ret == RESP_PARSE_BULKLEN) {
+            if (c->bulklen >= TEST_MBULK_BIG_ARG) {
+                testConsume(c, pos);
+                pos = 0;
+            }
+        } else {
+            testLogArg(c, c->buf + arg.offset, arg.len);
+            c->argc++;
+        }
+    } while (c->multibulklen);
+
+    if (pos) {
+        testConsume(c, pos);
+    }
+    c->argc = 0;
+    return 1;
+}
+
+/* Parse the buffer as processInputBuffer() would, using respScanCommand()
+ * at command boundaries when 'fast' is true. */
+static void testParse(testClient* c, int fast)
+{
+    respArg args[TEST_MAX_ARGS];
+    int argc, j;
+    long used;
+
+    while (c->len && !c->error) {
+        if (c->multibulklen == 0) {
+            size_t pos = 0;
+
+            /* Inline requests are not part of the test. */
+            if (c->buf[0] != '*') {
+                break;
+            }
+            while (fast && (used = respScanCommand(c->buf + pos, c->len - pos,
+                                                   TEST_MBULK_BIG_ARG, args,
+                                                   TEST_MAX_ARGS, &argc)) > 0) {
+                testLog(c, "*", 1);
+                for (j = 0; j < argc; j++) {
+                    testLogArg(c, c->buf + pos + args[j].offset, args[j].len);
+                }
+                pos += used;
+            }
+            if (pos) {
+                testConsume(c, pos);
+                continue;
+            }
+        }
+        if (!testMultibulk(c)) {
+            break;
+        }
+    }
+}
+
+static char testRandomByte(const char* set)
+{
+    return set[rand() % strlen(set)];
+}
+
+/* A pipeline of mostly valid commands, possibly corrupted and truncated. */
+static size_t testPipeline(char* buf)
+{
+    size_t len = 0, arglen;
+    int commands = 1 + rand() % 50, argc, i, j;
+
+    while (commands-- && len < TEST_BUF_SIZE / 2) {
+        switch (rand() % 20) {
+        case 0: argc = rand() % 3 - 1; break;
+        case 1: argc = TEST_MAX_ARGS - 2 + rand() % 5; break;
+        default: argc = 1 + rand() % 6; break;
+        }
+        len += sprintf(buf + len, "*%d\r\n", argc);
+        for (i = 0; i < argc; i++) {
+            arglen = rand() % 1000 ? rand() % 24 : TEST_MBULK_BIG_ARG - 2 + rand() % 5;
+            len += sprintf(buf + len, "$%zu\r\n", arglen);
+            for (j = 0; j < (int)arglen; j++) {
+                buf[len++] = testRandomByte("abcxyz019*$\r\n");
+            }
+            buf[len++] = '\r';
+            buf[len++] = '\n';
+        }
+    }
+    if (rand() % 3 == 0) {
+        for (i = rand() % 3; i >= 0; i--) {
+            size_t pos = rand() % len;
+
+            if (rand() % 2) {
+                memmove(buf + pos + 1, buf + pos, len - pos);
+                len++;
+            }
+            buf[pos] = testRandomByte("0123456789*$\r\n-+ a");
+        }
+    }
+    if (rand() % 2 == 0) {
+        len = rand() % (len + 1);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static void testInit(testClient* c, const char* buf, size_t len)
+{
+    memset(c, 0, sizeof(*c));
+    c->buf = malloc(len + 1);
+    memcpy(c->buf, buf, len + 1);
+    c->len = len;
+    c->bulklen = -1;
+}
+
+static void testFree(testClient* c)
+{
+    free(c->buf);
+    free(c->log);
+}
+
+int main(int argc, char** argv)
+{
+    char* buf = malloc(TEST_BUF_SIZE);
+    respArg args[4];
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000, i, n;
+    long used;
+
+    /* Directed cases. */
+    used = respScanCommand("*2\r\n$3\r\nGET\r\n$1\r\nk\r\n*1", 22, 16, args, 4, &n);
+    assert(used == 20 && n == 2);
+    assert(args[0].offset == 8 && args[0].len == 3);
+    assert(args[1].offset == 17 && args[1].len == 1);
+    assert(respScanCommand("*1\r\n$0\r\n\r\n", 10, 16, args, 4, &n) == 10 && n == 1);
+    assert(respScanCommand("*2\r\n$3\r\nGET\r\n$1\r\nk\r", 19, 16, args, 4, &n) == RESP_INCOMPLETE);
+    assert(respScanCommand("*1\r", 3, 16, args, 4, &n) == RESP_INCOMPLETE);
+    assert(respScanCommand("*0\r\n", 4, 16, args, 4, &n) == RESP_UNSUPPORTED);
+    assert(respScanCommand("*-1\r\n", 5, 16, args, 4, &n) == RESP_UNSUPPORTED);
+    assert(respScanCommand("*01\r\n", 5, 16, args, 4, &n) == RESP_UNSUPPORTED);
+    assert(respScanCommand("*5\r\n", 4, 16, args, 4, &n) == RESP_UNSUPPORTED);
+    assert(respScanCommand("*1\r\n$16\r\n", 9, 16, args, 4, &n) == RESP_UNSUPPORTED);
+    assert(respScanCommand("*1\r\n$1\r\nab\r\n", 12, 16, args, 4, &n) == RESP_UNSUPPORTED);
+    assert(respScanCommand("GET k\r\n", 7, 16, args, 4, &n) == RESP_UNSUPPORTED);
+
+    /* Random pipelines parsed with and without the fast path must give the
+     * same commands and leave the same state behind. */
+    srand(argc > 2 ? atoi(argv[2]) : 1234);
+    for (i = 0; i < iterations; i++) {
+        testClient ref, fast;
+        size_t len = testPipeline(buf);
+
+        testInit(&ref, buf, len);
+        testInit(&fast, buf, len);
+        testParse(&ref, 0);
+        testParse(&fast, 1);
+        if (ref.loglen != fast.loglen ||
+            (ref.loglen && memcmp(ref.log, fast.log, ref.loglen)) ||
+            ref.len != fast.len || ref.error != fast.error ||
+            ref.multibulklen != fast.multibulklen || ref.bulklen != fast.bulklen ||
+            ref.argc != fast.argc) {
+            printf("Mismatch at iteration %d\n", i);
+            return 1;
+        }
+        testFree(&ref);
+        testFree(&fast);
+    }
+    printf("%d pipelines parsed the same way\n", iterations);
+    free(buf);
+    return 0;
+}
+#endif
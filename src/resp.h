@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2009-2013, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RESP_H
+#define __RESP_H
+
+#include <stddef.h>
+
+/* Return values of respScanCommand() when no command was scanned. */
+#define RESP_INCOMPLETE 0
+#define RESP_UNSUPPORTED -1
+
+/* Longest length header respScanCommand() accepts, in digits. */
+#define RESP_MAX_DIGITS 9
+
+/* Limits of the generic parser, respParseMultibulk(). */
+#define RESP_MAX_MULTIBULK_LEN (1024*1024)
+#define RESP_MAX_BULK_LEN (512*1024*1024)
+
+/* Return values of respParseMultibulk(). */
+#define RESP_PARSE_ERROR -1     /* Protocol error, the message is in 'err'. */
+#define RESP_PARSE_MORE 0       /* More data is needed. */
+#define RESP_PARSE_EMPTY 1      /* Request with no arguments, skip it. */
+#define RESP_PARSE_COUNT 2      /* Number of arguments read. */
+#define RESP_PARSE_BULKLEN 3    /* Length of the next argument read. */
+#define RESP_PARSE_ARG 4        /* Argument read. */
+
+typedef struct respArg {
+    size_t offset;      /* Of the first byte of the argument in the buffer. */
+    size_t len;
+} respArg;
+
+long respScanCommand(const char* buf, size_t len, size_t maxarglen,
+                     respArg* args, int maxargs, int* argc);
+int respParseMultibulk(const char* buf, size_t len, size_t* pos,
+                       int* multibulklen, long* bulklen, size_t maxinline,
+                       respArg* arg, char* err, size_t errlen);
+
+#endif
@@ -467,7 +467,7 @@ void luaMaskCountHook(lua_State* lua, lua_Debug* ar)
         aeDeleteFileEvent(server.el, server.lua_caller->fd, AE_READABLE);
     }
     if (server.lua_timedout) {
-        aeProcessEvents(server.el, AE_FILE_EVENTS | AE_DONT_WAIT);
+        processEventsWhileBlocked();
     }
     if (server.lua_kill) {
         redisLog(REDIS_WARNING, "Lua script killed by user with SCRIPT KILL.");
@@ -223,7 +223,7 @@ void sortCommand(redisClient* c)
     if (sortval) {
         incrRefCount(sortval);
     } else {
-        sortval = createListObject();
+        sortval = createQuicklistObject();
     }
 
     /* The SORT command has an SQL-alike syntax, parse it */
@@ -742,6 +742,21 @@ void hlenCommand(redisClient* c)
     addReplyLongLong(c, hashTypeLength(o));
 }
 
+void hscanCommand(redisClient* c)
+{
+    robj* o;
+    unsigned long cursor;
+
+    if (parseScanCursorOrReply(c, c->argv[2], &cursor) == REDIS_ERR) {
+        return;
+    }
+    if ((o = lookupKeyReadOrReply(c, c->argv[1], shared.emptyscan)) == NULL ||
+        checkType(c, o, REDIS_HASH)) {
+        return;
+    }
+    scanGenericCommand(c, o, cursor);
+}
+
 static void addHashIteratorCursorToReply(redisClient* c, hashTypeIterator* hi, int what)
 {
     if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
@@ -37,7 +37,7 @@ void signalListAsReady(redisClient* c, robj* key);
  *----------------------------------------------------------------------------*/
 
 /* Check the argument length to see if it requires us to convert the ziplist
- * to a real list. Only check raw-encoded objects because integer encoded
+ * to a quicklist. Only check raw-encoded objects because integer encoded
  * objects are never too long. */
 void listTypeTryConversion(robj* subject, robj* value)
 {
@@ -46,7 +46,7 @@ void listTypeTryConversion(robj* subject, robj* value)
     }
     if (value->encoding == REDIS_ENCODING_RAW &&
         sdslen(value->ptr) > server.list_max_ziplist_value) {
-        listTypeConvert(subject, REDIS_ENCODING_LINKEDLIST);
+        listTypeConvert(subject, REDIS_ENCODING_QUICKLIST);
     }
 }
 
@@ -61,7 +61,7 @@ void listTypePush(robj* subject, robj* value, int where)
     listTypeTryConversion(subject, value);
     if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
         ziplistLen(subject->ptr) >= server.list_max_ziplist_entries) {
-        listTypeConvert(subject, REDIS_ENCODING_LINKEDLIST);
+        listTypeConvert(subject, REDIS_ENCODING_QUICKLIST);
     }
 
     if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
@@ -69,18 +69,21 @@ void listTypePush(robj* subject, robj* value, int where)
         value = getDecodedObject(value);
         subject->ptr = ziplistPush(subject->ptr, value->ptr, sdslen(value->ptr), pos);
         decrRefCount(value);
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        if (where == REDIS_HEAD) {
-            listAddNodeHead(subject->ptr, value);
-        } else {
-            listAddNodeTail(subject->ptr, value);
-        }
-        incrRefCount(value);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        value = getDecodedObject(value);
+        quicklistPush(subject->ptr, value->ptr, sdslen(value->ptr), pos);
+        decrRefCount(value);
     } else {
         redisPanic("Unknown list encoding");
     }
 }
 
+static void* listPopSaver(unsigned char* data, unsigned int sz)
+{
+    return createStringObject((char*)data, sz);
+}
+
 robj* listTypePop(robj* subject, int where)
 {
     robj* value = NULL;
@@ -100,18 +103,14 @@ robj* listTypePop(robj* subject, int where)
             /* We only need to delete an element when it exists */
             subject->ptr = ziplistDelete(subject->ptr, &p);
         }
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list* list = subject->ptr;
-        listNode* ln;
-        if (where == REDIS_HEAD) {
-            ln = listFirst(list);
-        } else {
-            ln = listLast(list);
-        }
-        if (ln != NULL) {
-            value = listNodeValue(ln);
-            incrRefCount(value);
-            listDelNode(list, ln);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        long long vlong;
+        if (quicklistPopCustom(subject->ptr, pos, (unsigned char**)&value,
+                               NULL, &vlong, listPopSaver)) {
+            if (!value) {
+                value = createStringObjectFromLongLong(vlong);
+            }
         }
     } else {
         redisPanic("Unknown list encoding");
@@ -123,8 +122,8 @@ unsigned long listTypeLength(robj* subject)
 {
     if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
         return ziplistLen(subject->ptr);
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        return listLength((list*)subject->ptr);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistCount(subject->ptr);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -137,10 +136,16 @@ listTypeIterator* listTypeInitIterator(robj* subject, long index, unsigned char
     li->subject = subject;
     li->encoding = subject->encoding;
     li->direction = direction;
+    li->zi = NULL;
+    li->iter = NULL;
     if (li->encoding == REDIS_ENCODING_ZIPLIST) {
         li->zi = ziplistIndex(subject->ptr, index);
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        li->ln = listIndex(subject->ptr, index);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        /* A NULL iterator (index out of range) returns no entries. */
+        li->iter = quicklistGetIteratorAtIdx(subject->ptr,
+                                             direction == REDIS_TAIL ?
+                                             QUICKLIST_START_HEAD : QUICKLIST_START_TAIL,
+                                             index);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -150,6 +155,7 @@ listTypeIterator* listTypeInitIterator(robj* subject, long index, unsigned char
 /* Clean up the iterator. */
 void listTypeReleaseIterator(listTypeIterator* li)
 {
+    quicklistReleaseIterator(li->iter);
     zfree(li);
 }
 
@@ -172,16 +178,8 @@ int listTypeNext(listTypeIterator* li, listTypeEntry* entry)
             }
             return 1;
         }
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        entry->ln = li->ln;
-        if (entry->ln != NULL) {
-            if (li->direction == REDIS_TAIL) {
-                li->ln = li->ln->next;
-            } else {
-                li->ln = li->ln->prev;
-            }
-            return 1;
-        }
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistNext(li->iter, &entry->entry);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -205,10 +203,12 @@ robj* listTypeGet(listTypeEntry* entry)
                 value = createStringObjectFromLongLong(vlong);
             }
         }
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        redisAssert(entry->ln != NULL);
-        value = listNodeValue(entry->ln);
-        incrRefCount(value);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        if (entry->entry.value) {
+            value = createStringObject((char*)entry->entry.value, entry->entry.sz);
+        } else {
+            value = createStringObjectFromLongLong(entry->entry.longval);
+        }
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -234,13 +234,14 @@ void listTypeInsert(listTypeEntry* entry, robj* value, int where)
             subject->ptr = ziplistInsert(subject->ptr, entry->zi, value->ptr, sdslen(value->ptr));
         }
         decrRefCount(value);
-    } else if (entry->li->encoding == REDIS_ENCODING_LINKEDLIST) {
+    } else if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
+        value = getDecodedObject(value);
         if (where == REDIS_TAIL) {
-            listInsertNode(subject->ptr, entry->ln, value, AL_START_TAIL);
+            quicklistInsertAfter(subject->ptr, &entry->entry, value->ptr, sdslen(value->ptr));
         } else {
-            listInsertNode(subject->ptr, entry->ln, value, AL_START_HEAD);
+            quicklistInsertBefore(subject->ptr, &entry->entry, value->ptr, sdslen(value->ptr));
         }
-        incrRefCount(value);
+        decrRefCount(value);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -253,8 +254,9 @@ int listTypeEqual(listTypeEntry* entry, robj* o)
     if (li->encoding == REDIS_ENCODING_ZIPLIST) {
         redisAssertWithInfo(NULL, o, o->encoding == REDIS_ENCODING_RAW);
         return ziplistCompare(entry->zi, o->ptr, sdslen(o->ptr));
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        return equalStringObjects(o, listNodeValue(entry->ln));
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        redisAssertWithInfo(NULL, o, o->encoding == REDIS_ENCODING_RAW);
+        return quicklistCompare(entry->entry.zi, o->ptr, sdslen(o->ptr));
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -274,40 +276,25 @@ void listTypeDelete(listTypeEntry* entry)
         } else {
             li->zi = ziplistPrev(li->subject->ptr, p);
         }
-    } else if (entry->li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode* next;
-        if (li->direction == REDIS_TAIL) {
-            next = entry->ln->next;
-        } else {
-            next = entry->ln->prev;
-        }
-        listDelNode(li->subject->ptr, entry->ln);
-        li->ln = next;
+    } else if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistDelEntry(li->iter, &entry->entry);
     } else {
         redisPanic("Unknown list encoding");
     }
 }
 
+/* Convert a ziplist encoded list to a quicklist, splitting the entries in
+ * nodes according to list-max-ziplist-size. */
 void listTypeConvert(robj* subject, int enc)
 {
-    listTypeIterator* li;
-    listTypeEntry entry;
     redisAssertWithInfo(NULL, subject, subject->type == REDIS_LIST);
+    redisAssertWithInfo(NULL, subject, subject->encoding == REDIS_ENCODING_ZIPLIST);
 
-    if (enc == REDIS_ENCODING_LINKEDLIST) {
-        list* l = listCreate();
-        listSetFreeMethod(l, decrRefCount);
-
-        /* listTypeGet returns a robj with incremented refcount */
-        li = listTypeInitIterator(subject, 0, REDIS_TAIL);
-        while (listTypeNext(li, &entry)) {
-            listAddNodeTail(l, listTypeGet(&entry));
-        }
-        listTypeReleaseIterator(li);
-
-        subject->encoding = REDIS_ENCODING_LINKEDLIST;
-        zfree(subject->ptr);
-        subject->ptr = l;
+    if (enc == REDIS_ENCODING_QUICKLIST) {
+        subject->ptr = quicklistCreateFromZiplist(server.list_max_ziplist_size,
+                                                  server.list_compress_depth,
+                                                  subject->ptr);
+        subject->encoding = REDIS_ENCODING_QUICKLIST;
     } else {
         redisPanic("Unsupported list conversion");
     }
@@ -350,7 +337,6 @@ void pushGenericCommand(redisClient* c, int where)
         listTypePush(lobj, c->argv[j], where);
         pushed++;
     }
-    setLastSaveTime(c->db, c->argv[1]->ptr);
     addReplyLongLong(c, waiting + (lobj ? listTypeLength(lobj) : 0));
     if (pushed) {
         signalModifiedKey(c->db, c->argv[1]);
@@ -407,7 +393,7 @@ void pushxGenericCommand(redisClient* c, robj* refval, robj* val, int where)
             /* Check if the length exceeds the ziplist length threshold. */
             if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
                 ziplistLen(subject->ptr) > server.list_max_ziplist_entries) {
-                listTypeConvert(subject, REDIS_ENCODING_LINKEDLIST);
+                listTypeConvert(subject, REDIS_ENCODING_QUICKLIST);
             }
             signalModifiedKey(c->db, c->argv[1]);
             server.dirty++;
@@ -488,11 +474,15 @@ void lindexCommand(redisClient* c)
         } else {
             addReply(c, shared.nullbulk);
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode* ln = listIndex(o->ptr, index);
-        if (ln != NULL) {
-            value = listNodeValue(ln);
-            addReplyBulk(c, value);
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistEntry entry;
+        if (quicklistIndex(o->ptr, index, &entry)) {
+            if (entry.value) {
+                addReplyBulkCBuffer(c, entry.value, entry.sz);
+            } else {
+                addReplyBulkLongLong(c, entry.longval);
+            }
+            quicklistRecompressOnly(o->ptr, entry.node);
         } else {
             addReply(c, shared.nullbulk);
         }
@@ -529,14 +519,14 @@ void lsetCommand(redisClient* c)
             signalModifiedKey(c->db, c->argv[1]);
             server.dirty++;
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode* ln = listIndex(o->ptr, index);
-        if (ln == NULL) {
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        int replaced;
+        value = getDecodedObject(value);
+        replaced = quicklistReplaceAtIndex(o->ptr, index, value->ptr, sdslen(value->ptr));
+        decrRefCount(value);
+        if (!replaced) {
             addReply(c, shared.outofrangeerr);
         } else {
-            decrRefCount((robj*)listNodeValue(ln));
-            listNodeValue(ln) = value;
-            incrRefCount(value);
             addReply(c, shared.ok);
             signalModifiedKey(c->db, c->argv[1]);
             server.dirty++;
@@ -554,7 +544,6 @@ void popGenericCommand(redisClient* c, int where)
     }
 
     robj* value = listTypePop(o, where);
-    setLastSaveTime(c->db, c->argv[1]->ptr);
     if (value == NULL) {
         addReply(c, shared.nullbulk);
     } else {
@@ -633,31 +622,34 @@ void lrangeCommand(redisClient* c)
             }
             p = ziplistNext(o->ptr, p);
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode* ln;
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistIter* iter;
+        quicklistEntry entry;
 
         /* If we are nearest to the end of the list, reach the element
          * starting from tail and going backward, as it is faster. */
         if (start > llen / 2) {
             start -= llen;
         }
-        ln = listIndex(o->ptr, start);
+        iter = quicklistGetIteratorAtIdx(o->ptr, QUICKLIST_START_HEAD, start);
 
-        while (rangelen--) {
-            addReplyBulk(c, ln->value);
-            ln = ln->next;
+        while (rangelen-- && quicklistNext(iter, &entry)) {
+            if (entry.value) {
+                addReplyBulkCBuffer(c, entry.value, entry.sz);
+            } else {
+                addReplyBulkLongLong(c, entry.longval);
+            }
         }
+        quicklistReleaseIterator(iter);
     } else {
-        redisPanic("List encoding is not LINKEDLIST nor ZIPLIST!");
+        redisPanic("List encoding is not QUICKLIST nor ZIPLIST!");
     }
 }
 
 void ltrimCommand(redisClient* c)
 {
     robj* o;
-    long start, end, llen, j, ltrim, rtrim;
-    list* list;
-    listNode* ln;
+    long start, end, llen, ltrim, rtrim;
 
     if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != REDIS_OK) ||
         (getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != REDIS_OK)) {
@@ -699,16 +691,9 @@ void ltrimCommand(redisClient* c)
     if (o->encoding == REDIS_ENCODING_ZIPLIST) {
         o->ptr = ziplistDeleteRange(o->ptr, 0, ltrim);
         o->ptr = ziplistDeleteRange(o->ptr, -rtrim, rtrim);
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list = o->ptr;
-        for (j = 0; j < ltrim; j++) {
-            ln = listFirst(list);
-            listDelNode(list, ln);
-        }
-        for (j = 0; j < rtrim; j++) {
-            ln = listLast(list);
-            listDelNode(list, ln);
-        }
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistDelRange(o->ptr, 0, ltrim);
+        quicklistDelRange(o->ptr, -rtrim, rtrim);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -737,10 +722,9 @@ void lremCommand(redisClient* c)
         return;
     }
 
-    /* Make sure obj is raw when we're dealing with a ziplist */
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-        obj = getDecodedObject(obj);
-    }
+    /* Make sure obj is raw, both encodings compare against the ziplist
+     * entries */
+    obj = getDecodedObject(obj);
 
     listTypeIterator* li;
     if (toremove < 0) {
@@ -763,9 +747,7 @@ void lremCommand(redisClient* c)
     listTypeReleaseIterator(li);
 
     /* Clean up raw encoded object */
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-        decrRefCount(obj);
-    }
+    decrRefCount(obj);
 
     if (listTypeLength(subject) == 0) {
         dbDelete(c->db, c->argv[1]);
@@ -406,6 +406,21 @@ void scardCommand(redisClient* c)
     addReplyLongLong(c, setTypeSize(o));
 }
 
+void sscanCommand(redisClient* c)
+{
+    robj* set;
+    unsigned long cursor;
+
+    if (parseScanCursorOrReply(c, c->argv[2], &cursor) == REDIS_ERR) {
+        return;
+    }
+    if ((set = lookupKeyReadOrReply(c, c->argv[1], shared.emptyscan)) == NULL ||
+        checkType(c, set, REDIS_SET)) {
+        return;
+    }
+    scanGenericCommand(c, set, cursor);
+}
+
 void spopCommand(redisClient* c)
 {
     robj* set, *ele, *aux;
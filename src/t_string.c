@@ -98,7 +98,6 @@ void setGenericCommand(redisClient* c, int flags, robj* key, robj* val, robj* ex
         return;
     }
     setKey(c->db, key, val);
-    setLastSaveTime(c->db, key->ptr);
     server.dirty++;
     if (expire) {
         setExpire(c->db, key, mstime() + milliseconds);
@@ -318,6 +317,7 @@ void mgetCommand(redisClient* c)
 {
     int j;
 
+    readStrKeysFromDB(c->db, c->argv + 1, c->argc - 1, 1);
     addReplyMultiBulkLen(c, c->argc - 1);
     for (j = 1; j < c->argc; j++) {
         robj* o = lookupKeyRead(c->db, c->argv[j]);
@@ -344,6 +344,7 @@ void msetGenericCommand(redisClient* c, int nx)
     /* Handle the NX flag. The MSETNX semantic is to return zero and don't
      * set nothing at all if at least one already key exists. */
     if (nx) {
+        readStrKeysFromDB(c->db, c->argv + 1, c->argc - 1, 2);
         for (j = 1; j < c->argc; j += 2) {
             if (lookupKeyWrite(c->db, c->argv[j]) != NULL) {
                 busykeys++;
@@ -409,7 +410,6 @@ void incrDecrCommand(redisClient* c, long long incr)
     } else {
         dbAdd(c->db, c->argv[1], new);
     }
-    setLastSaveTime(c->db, c->argv[1]->ptr);
     signalModifiedKey(c->db, c->argv[1]);
     server.dirty++;
     addReply(c, shared.colon);
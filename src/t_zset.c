@@ -1079,7 +1079,6 @@ void zaddGenericCommand(redisClient* c, int incr)
             redisPanic("Unknown sorted set encoding");
         }
     }
-    setLastSaveTime(c->db, key->ptr);
     zfree(scores);
     if (incr) { /* ZINCRBY */
         addReplyDouble(c, score);
@@ -1155,7 +1154,6 @@ void zremCommand(redisClient* c)
         signalModifiedKey(c->db, key);
         server.dirty += deleted;
     }
-    setLastSaveTime(c->db, key->ptr);
     addReplyLongLong(c, deleted);
 }
 
@@ -1199,7 +1197,6 @@ void zremrangebyscoreCommand(redisClient* c)
         signalModifiedKey(c->db, key);
     }
     server.dirty += deleted;
-    setLastSaveTime(c->db, key->ptr);
     addReplyLongLong(c, deleted);
 }
 
@@ -1269,7 +1266,6 @@ void zremrangebyrankCommand(redisClient* c)
         signalModifiedKey(c->db, key);
     }
     server.dirty += deleted;
-    setLastSaveTime(c->db, key->ptr);
     addReplyLongLong(c, deleted);
 }
 
@@ -2318,6 +2314,21 @@ void zcardCommand(redisClient* c)
     addReplyLongLong(c, zsetLength(zobj));
 }
 
+void zscanCommand(redisClient* c)
+{
+    robj* o;
+    unsigned long cursor;
+
+    if (parseScanCursorOrReply(c, c->argv[2], &cursor) == REDIS_ERR) {
+        return;
+    }
+    if ((o = lookupKeyReadOrReply(c, c->argv[1], shared.emptyscan)) == NULL ||
+        checkType(c, o, REDIS_ZSET)) {
+        return;
+    }
+    scanGenericCommand(c, o, cursor);
+}
+
 void zscoreCommand(redisClient* c)
 {
     robj* key = c->argv[1];